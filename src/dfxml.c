@@ -60,6 +60,7 @@
 #include "ntfs_dir.h"
 #include "misc.h"
 #include "dfxml.h"
+#include "hash.h"
 
 static FILE *xml_handle = NULL;
 static int xml_stack_depth = 0;
@@ -302,10 +303,21 @@ static const char *relative_name(const char *fname)
   return fname;
 }
 
+static void xml_log_digests(const file_recovery_t *file_recovery)
+{
+  char hex[2*SHA256_DIGEST_SIZE+1];
+  if(file_recovery->digest_ok==0)
+    return ;
+  hash_to_hex(hex, file_recovery->md5, MD5_DIGEST_SIZE);
+  xml_printf("<hashdigest type='md5'>%s</hashdigest>\n", hex);
+  hash_to_hex(hex, file_recovery->sha256, SHA256_DIGEST_SIZE);
+  xml_printf("<hashdigest type='sha256'>%s</hashdigest>\n", hex);
+}
+
 /* See filegen.h for the definition of file_recovery_struct */
 void xml_log_file_recovered(const file_recovery_t *file_recovery)
 {
-  struct td_list_head *tmp;
+  unsigned int i;
   uint64_t file_size=0;
   if(xml_handle==NULL)
     return;
@@ -314,10 +326,13 @@ void xml_log_file_recovered(const file_recovery_t *file_recovery)
   xml_push("fileobject", "");
   xml_out2s("filename", relative_name(file_recovery->filename));
   xml_out2i("filesize", file_recovery->file_size);
+  xml_log_digests(file_recovery);
+  if(file_recovery->duplicate_of!=NULL)
+    xml_out2s("duplicate_of", relative_name(file_recovery->duplicate_of));
   xml_push("byte_runs", "");
-  td_list_for_each(tmp, &file_recovery->location.list)
+  for(i=0; i<file_recovery->location.nbr; i++)
   {
-    const alloc_list_t *element=td_list_entry(tmp, alloc_list_t, list);
+    const alloc_extent_t *element=&file_recovery->location.extents[i];
     if(element->data>0)
     {
       const uint64_t len=element->end - element->start + 1;
@@ -373,6 +388,9 @@ void xml_log_file_recovered2(const alloc_data_t *space, const file_recovery_t *f
   xml_push("fileobject", "");
   xml_out2s("filename", relative_name(file_recovery->filename));
   xml_out2i("filesize", file_recovery->file_size);
+  xml_log_digests(file_recovery);
+  if(file_recovery->duplicate_of!=NULL)
+    xml_out2s("duplicate_of", relative_name(file_recovery->duplicate_of));
   xml_push("byte_runs", "");
   xml_log_file_recovered2_aux(space, file_recovery->loc, file_recovery->file_size);
   xml_pop("byte_runs");
@@ -574,59 +574,175 @@ int dir_partition_aff(disk_t *disk, const partition_t *partition, dir_data_t *di
   return dir_partition_aux(disk, partition, dir_data, inode, 0, current_cmd);
 }
 
+/* Set of the directory inodes already copied, used to avoid loops */
+typedef struct
+{
+  unsigned long int *table;	/* inode+1, 0 is an empty slot */
+  unsigned int size;		/* power of 2 */
+  unsigned int nbr;
+} inode_set_t;
+
+static inline unsigned int inode_set_hash(const unsigned long int inode, const unsigned int size)
+{
+  return (unsigned int)(inode * 2654435761UL) & (size-1);
+}
+
+static void inode_set_init(inode_set_t *inode_set)
+{
+  inode_set->size=256;
+  inode_set->nbr=0;
+  inode_set->table=(unsigned long int *)MALLOC(inode_set->size * sizeof(*inode_set->table));
+}
+
+static void inode_set_free(inode_set_t *inode_set)
+{
+  free(inode_set->table);
+  inode_set->table=NULL;
+  inode_set->size=0;
+  inode_set->nbr=0;
+}
+
+static void inode_set_grow(inode_set_t *inode_set)
+{
+  unsigned long int *old_table=inode_set->table;
+  const unsigned int old_size=inode_set->size;
+  unsigned int i;
+  inode_set->size*=2;
+  inode_set->table=(unsigned long int *)MALLOC(inode_set->size * sizeof(*inode_set->table));
+  for(i=0; i<old_size; i++)
+  {
+    if(old_table[i]!=0)
+    {
+      unsigned int j;
+      for(j=inode_set_hash(old_table[i]-1, inode_set->size);
+	  inode_set->table[j]!=0;
+	  j=(j+1)&(inode_set->size-1));
+      inode_set->table[j]=old_table[i];
+    }
+  }
+  free(old_table);
+}
+
+/*
+Returns
+0: inode was already known
+1: inode has been added
+*/
+static int inode_set_add(inode_set_t *inode_set, const unsigned long int inode)
+{
+  unsigned int i;
+  if(2*(inode_set->nbr+1) > inode_set->size)
+    inode_set_grow(inode_set);
+  for(i=inode_set_hash(inode, inode_set->size);
+      inode_set->table[i]!=0;
+      i=(i+1)&(inode_set->size-1))
+  {
+    if(inode_set->table[i]==inode+1)
+      return 0;
+  }
+  inode_set->table[i]=inode+1;
+  inode_set->nbr++;
+  return 1;
+}
+
+/* Sort by inode: first cluster for FAT/exFAT, MFT record for NTFS,
+ * inode (so block group) for ext2/ext3/ext4.
+ * It's the best approximation of the location on disk we have. */
+static int file_data_ino_cmp(const void *p1, const void *p2)
+{
+  const file_data_t *f1=*(const file_data_t * const *)p1;
+  const file_data_t *f2=*(const file_data_t * const *)p2;
+  if(f1->st_ino < f2->st_ino)
+    return -1;
+  if(f1->st_ino > f2->st_ino)
+    return 1;
+  return 0;
+}
+
+static int copy_dir_aux(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const file_data_t *dir, inode_set_t *inode_known);
+
 /*
 Returns
 -2: no file copied
 -1: failed to copy some files
 0: all files has been copied
 */
-#define MAX_DIR_NBR 256
 static int copy_dir(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const file_data_t *dir)
 {
-  static unsigned int dir_nbr=0;
-  static unsigned long int inode_known[MAX_DIR_NBR];
+  inode_set_t inode_known;
+  int res;
+  if(dir_data->get_dir==NULL || dir_data->copy_file==NULL)
+    return -2;
+  inode_set_init(&inode_known);
+  inode_set_add(&inode_known, dir->st_ino);
+  res=copy_dir_aux(disk, partition, dir_data, dir, &inode_known);
+  inode_set_free(&inode_known);
+  return res;
+}
+
+/* The directory is listed first, regular files are copied in on-disk
+ * order to limit the seeks, then the subdirectories are processed. */
+static int copy_dir_aux(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const file_data_t *dir, inode_set_t *inode_known)
+{
   file_data_t *dir_list;
   const unsigned int current_directory_namelength=strlen(dir_data->current_directory);
   file_data_t *current_file;
+  file_data_t **files=NULL;
   char *dir_name;
+  unsigned int nbr_files=0;
+  unsigned int nbr_dirs=0;
+  unsigned int i;
   int copy_bad=0;
   int copy_ok=0;
-  if(dir_data->get_dir==NULL || dir_data->copy_file==NULL)
-    return -2;
-  inode_known[dir_nbr++]=dir->st_ino;
   dir_name=mkdir_local(dir_data->local_dir, dir_data->current_directory);
   dir_list=dir_data->get_dir(disk, partition, dir_data, (const unsigned long int)dir->st_ino);
   for(current_file=dir_list;current_file!=NULL;current_file=current_file->next)
   {
+    if(LINUX_S_ISREG(current_file->st_mode)!=0)
+      nbr_files++;
+    else if(LINUX_S_ISDIR(current_file->st_mode)!=0 &&
+	current_file->st_ino>=2 &&
+	strcmp(current_file->name,"..")!=0 && strcmp(current_file->name,".")!=0)
+      nbr_dirs++;
+  }
+  if(nbr_files+nbr_dirs>0)
+  {
+    unsigned int nbr=0;
+    files=(file_data_t **)MALLOC((nbr_files+nbr_dirs)*sizeof(*files));
+    for(current_file=dir_list;current_file!=NULL;current_file=current_file->next)
+      if(LINUX_S_ISREG(current_file->st_mode)!=0)
+	files[nbr++]=current_file;
+    for(current_file=dir_list;current_file!=NULL;current_file=current_file->next)
+      if(LINUX_S_ISDIR(current_file->st_mode)!=0 &&
+	  current_file->st_ino>=2 &&
+	  strcmp(current_file->name,"..")!=0 && strcmp(current_file->name,".")!=0)
+	files[nbr++]=current_file;
+    qsort(files, nbr_files, sizeof(*files), file_data_ino_cmp);
+    qsort(&files[nbr_files], nbr_dirs, sizeof(*files), file_data_ino_cmp);
+  }
+  for(i=0; i<nbr_files+nbr_dirs; i++)
+  {
+    current_file=files[i];
     dir_data->current_directory[current_directory_namelength]='\0';
     if(current_directory_namelength+1+strlen(current_file->name)<sizeof(dir_data->current_directory)-1)
     {
       if(strcmp(dir_data->current_directory,"/"))
 	strcat(dir_data->current_directory,"/");
       strcat(dir_data->current_directory,current_file->name);
-      if(LINUX_S_ISDIR(current_file->st_mode)!=0)
+      if(i>=nbr_files)
       {
-	const unsigned long int new_inode=current_file->st_ino;
-	unsigned int new_inode_ok=1;
-	unsigned int i;
-	if(new_inode<2)
-	  new_inode_ok=0;
-	if(strcmp(current_file->name,"..")==0 || strcmp(current_file->name,".")==0)
-	  new_inode_ok=0;
-	for(i=0;i<dir_nbr && new_inode_ok!=0;i++)
-	  if(new_inode==inode_known[i]) /* Avoid loop */
-	    new_inode_ok=0;
-	if(new_inode_ok>0)
+	/* Avoid loop */
+	if(inode_set_add(inode_known, current_file->st_ino)>0)
 	{
 	  int tmp;
-	  tmp=copy_dir(disk, partition, dir_data, current_file);
+	  tmp=copy_dir_aux(disk, partition, dir_data, current_file, inode_known);
 	  if(tmp>=-1)
 	    copy_ok=1;
 	  if(tmp<0)
 	    copy_bad=1;
 	}
       }
-      else if(LINUX_S_ISREG(current_file->st_mode)!=0)
+      else
       {
 //	log_trace("copy_file %s\n",dir_data->current_directory);
 	int tmp;
@@ -639,10 +755,10 @@ static int copy_dir(disk_t *disk, const partition_t *partition, dir_data_t *dir_
     }
   }
   dir_data->current_directory[current_directory_namelength]='\0';
+  free(files);
   delete_list_file(dir_list);
   set_date(dir_name, dir->td_atime, dir->td_mtime);
   free(dir_name);
-  dir_nbr--;
   return (copy_bad>0?(copy_ok>0?-1:-2):0);
 }
 
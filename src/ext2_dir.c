@@ -54,6 +54,7 @@
  */
 
 #define LONG_OPT	0x0001
+#define EXT2_COPY_BUFFER_SIZE	(256*1024)
 
 /*
  * I/O Manager routine prototypes
@@ -292,7 +293,7 @@ static int ext2_copy(disk_t *disk_car, const partition_t *partition, dir_data_t
   {
     errcode_t retval;
     struct ext2_inode       inode;
-    char            buffer[8192];
+    char            *buffer;
     ext2_file_t     e2_file;
 
     if (ext2fs_read_inode(ls->current_fs, file->st_ino, &inode)!=0)
@@ -309,11 +310,12 @@ static int ext2_copy(disk_t *disk_car, const partition_t *partition, dir_data_t
       fclose(f_out);
       return -2;
     }
+    buffer=(char *)MALLOC(EXT2_COPY_BUFFER_SIZE);
     while (1)
     {
       int             nbytes; 
       unsigned int    got;
-      retval = ext2fs_file_read(e2_file, buffer, sizeof(buffer), &got);
+      retval = ext2fs_file_read(e2_file, buffer, EXT2_COPY_BUFFER_SIZE, &got);
       if (retval)
       {
 	log_error("Error while reading ext2 file %s\n", dir_data->current_directory);
@@ -328,6 +330,7 @@ static int ext2_copy(disk_t *disk_car, const partition_t *partition, dir_data_t
       error = -5;
       }
     }
+    free(buffer);
     retval = ext2fs_file_close(e2_file);
     if (retval)
     {
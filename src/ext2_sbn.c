@@ -37,34 +37,109 @@
 #include "ext2.h"
 #include "ext2_sbn.h"
 
-static const  uint64_t group_size[3]={
-    (EXT2_MIN_BLOCK_SIZE<<0)*8*(EXT2_MIN_BLOCK_SIZE<<0),
-    (EXT2_MIN_BLOCK_SIZE<<1)*8*(EXT2_MIN_BLOCK_SIZE<<1),
-    (EXT2_MIN_BLOCK_SIZE<<2)*8*(EXT2_MIN_BLOCK_SIZE<<2),
-  };
+#define EXT2_SB_MAX_GEOMETRY 16
+
+/* Layout of the block groups holding a superblock */
+typedef struct
+{
+  uint64_t origin;		/* filesystem start, relative to the partition */
+  uint64_t first;		/* offset of the first data block */
+  uint64_t group_size;
+  unsigned int blocksize;
+  int sparse;			/* backups only in groups 1 and powers of 3, 5, 7 */
+  int from_sb;			/* 0 for the default geometry of mke2fs */
+} ext2_sb_geometry_t;
+
 static const  uint64_t factors[3]={3,5,7};
 
-static uint64_t next_sb(const uint64_t hd_offset_old)
+static unsigned int ext2_sb_geometry_default(ext2_sb_geometry_t *geometry)
+{
+  unsigned int j;
+  for(j=0; j<3; j++)
+  {
+    const unsigned int blocksize=EXT2_MIN_BLOCK_SIZE<<j;
+    geometry[j].origin=0;
+    geometry[j].first=(j==0?2*512:0);
+    geometry[j].group_size=(uint64_t)blocksize*8*blocksize;
+    geometry[j].blocksize=blocksize;
+    geometry[j].sparse=1;
+    geometry[j].from_sb=0;
+  }
+  return 3;
+}
+
+/* Once a valid superblock has been found, its block size and group size
+ * are known: stop testing the default layouts for other block sizes and
+ * test the real layout, even when mke2fs has been run with -g or without
+ * sparse_super. */
+static unsigned int ext2_sb_geometry_add(ext2_sb_geometry_t *geometry, unsigned int nbr_geometry, const struct ext2_super_block *sb, const uint64_t hd_offset, const uint64_t sb_offset)
+{
+  const unsigned int blocksize=EXT2_MIN_BLOCK_SIZE<<le32(sb->s_log_block_size);
+  ext2_sb_geometry_t new_geometry;
+  unsigned int i;
+  unsigned int j;
+  if(le32(sb->s_blocks_per_group)==0 || hd_offset < sb_offset)
+    return nbr_geometry;
+  new_geometry.origin=hd_offset - sb_offset;
+  new_geometry.first=(uint64_t)le32(sb->s_first_data_block)*blocksize;
+  new_geometry.group_size=(uint64_t)le32(sb->s_blocks_per_group)*blocksize;
+  new_geometry.blocksize=blocksize;
+  new_geometry.sparse=(EXT2_HAS_RO_COMPAT_FEATURE(sb,EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER)!=0);
+  new_geometry.from_sb=1;
+  for(i=0, j=0; i<nbr_geometry; i++)
+  {
+    if(geometry[i].from_sb!=0 || geometry[i].blocksize==blocksize)
+      geometry[j++]=geometry[i];
+  }
+  nbr_geometry=j;
+  for(i=0; i<nbr_geometry; i++)
+  {
+    if(geometry[i].origin==new_geometry.origin &&
+	geometry[i].first==new_geometry.first &&
+	geometry[i].group_size==new_geometry.group_size &&
+	geometry[i].sparse==new_geometry.sparse)
+      return nbr_geometry;
+  }
+  if(nbr_geometry < EXT2_SB_MAX_GEOMETRY)
+    geometry[nbr_geometry++]=new_geometry;
+  return nbr_geometry;
+}
+
+/* Return the smallest offset after hd_offset_old where a superblock
+ * may be found */
+static uint64_t next_sb(const uint64_t hd_offset_old, const ext2_sb_geometry_t *geometry, const unsigned int nbr_geometry)
 {
   uint64_t hd_offset=0;
-  int j;
+  unsigned int j;
   if(hd_offset_old < EXT2_MIN_BLOCK_SIZE<<0)
     hd_offset=EXT2_MIN_BLOCK_SIZE<<0;
   else if(hd_offset_old < EXT2_MIN_BLOCK_SIZE<<1)
     hd_offset=EXT2_MIN_BLOCK_SIZE<<1;
   else if(hd_offset_old < EXT2_MIN_BLOCK_SIZE<<2)
     hd_offset=EXT2_MIN_BLOCK_SIZE<<2;
-  for(j=0; j<3; j++)
+  for(j=0; j<nbr_geometry; j++)
   {
-    int i;
-    const uint64_t offset=(j==0?2*512:0);
-    for(i=0; i<3; i++)
+    const uint64_t offset=geometry[j].origin + geometry[j].first;
+    const uint64_t group_size=geometry[j].group_size;
+    if(geometry[j].sparse==0)
+    {
+      /* Every group has a superblock backup */
+      const uint64_t val=(hd_offset_old < offset + group_size ? 1 :
+	  (hd_offset_old - offset) / group_size + 1);
+      if(hd_offset==0 || val * group_size + offset < hd_offset)
+	hd_offset=val * group_size + offset;
+    }
+    else
     {
-      uint64_t val;
-      for(val=1; val * group_size[j] + offset <= hd_offset_old; val*=factors[i])
-	;
-      if(hd_offset==0 || val * group_size[j] + offset < hd_offset)
-	hd_offset=val* group_size[j] + offset;
+      int i;
+      for(i=0; i<3; i++)
+      {
+	uint64_t val;
+	for(val=1; val * group_size + offset <= hd_offset_old; val*=factors[i])
+	  ;
+	if(hd_offset==0 || val * group_size + offset < hd_offset)
+	  hd_offset=val * group_size + offset;
+      }
     }
   }
   return hd_offset;
@@ -80,9 +155,12 @@ list_part_t *search_superblock(disk_t *disk_car, partition_t *partition, const i
 #ifdef HAVE_NCURSES
   unsigned long int old_percent=0;
 #endif
+  ext2_sb_geometry_t geometry[EXT2_SB_MAX_GEOMETRY];
+  unsigned int nbr_geometry;
   struct ext2_super_block *sb=(struct ext2_super_block *)buffer;
   partition_t *new_partition=partition_new(disk_car->arch);
   log_trace("search_superblock\n");
+  nbr_geometry=ext2_sb_geometry_default(geometry);
 #ifdef HAVE_NCURSES
   if(interface>0)
   {
@@ -98,7 +176,7 @@ list_part_t *search_superblock(disk_t *disk_car, partition_t *partition, const i
     wattroff(stdscr, A_REVERSE);
   }
 #endif
-  for(hd_offset=0;hd_offset<partition->part_size && nbr_sb<10 && ind_stop==0;hd_offset=next_sb(hd_offset))
+  for(hd_offset=0;hd_offset<partition->part_size && nbr_sb<10 && ind_stop==0;hd_offset=next_sb(hd_offset, geometry, nbr_geometry))
   {
 #ifdef HAVE_NCURSES
     unsigned long int percent;
@@ -124,6 +202,8 @@ list_part_t *search_superblock(disk_t *disk_car, partition_t *partition, const i
 	if(recover_EXT2(disk_car,sb,new_partition,verbose,dump_ind)==0)
 	{
 	  int insert_error=0;
+	  nbr_geometry=ext2_sb_geometry_add(geometry, nbr_geometry, sb, hd_offset,
+	      (le16(sb->s_block_group_nr)==0 ? EXT2_SUPERBLOCK_SIZE : new_partition->sb_offset));
 	  if(hd_offset<=(EXT2_MIN_BLOCK_SIZE<<2))
 	    new_partition->part_offset-=hd_offset;
 	  if(partition->blocksize==0)
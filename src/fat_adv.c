@@ -61,6 +61,7 @@
 #define INTER_FAT_ASK_Y	23
 #define INTER_FATBS_X		0
 #define INTER_FATBS_Y		22
+#define FAT_SEARCH_READ_SIZE (4*1024*1024)
 extern const char *monstr[];
 
 typedef struct info_offset_struct info_offset_t;
@@ -321,9 +322,14 @@ static unsigned int fat32_find_root_cluster(disk_t *disk_car,const partition_t *
 #ifdef HAVE_NCURSES
     int interactive=1;
 #endif
-    unsigned char *buffer;
+    unsigned char *buffer_batch;
+    /* Clusters are read FAT_SEARCH_READ_SIZE bytes at a time */
+    const unsigned int batch_max=(cluster_size < FAT_SEARCH_READ_SIZE ? FAT_SEARCH_READ_SIZE / cluster_size : 1);
+    unsigned long int batch_first=0;
+    unsigned int batch_nbr=0;
+    int batch_ok=0;
     int ind_stop=0;
-    buffer=(unsigned char *)MALLOC(cluster_size);
+    buffer_batch=(unsigned char *)MALLOC(batch_max * cluster_size);
 #ifdef HAVE_NCURSES
     if(interface)
     {
@@ -335,6 +341,7 @@ static unsigned int fat32_find_root_cluster(disk_t *disk_car,const partition_t *
 #endif
     for(root_cluster=2;(root_cluster<2+no_of_cluster)&&(ind_stop==0);root_cluster++)
     {
+      unsigned char *buffer;
 #ifdef HAVE_NCURSES
       const unsigned long int percent=root_cluster*100/(2+no_of_cluster);
       if(interface>0 && (root_cluster&0xfff)==0)
@@ -346,7 +353,18 @@ static unsigned int fat32_find_root_cluster(disk_t *disk_car,const partition_t *
         ind_stop|=check_enter_key_or_s(stdscr);
       }
 #endif
-      if((unsigned)disk_car->pread(disk_car, buffer, cluster_size,
+      if(root_cluster >= batch_first + batch_nbr)
+      {
+	batch_first=root_cluster;
+	batch_nbr=(2 + no_of_cluster - root_cluster < batch_max ? 2 + no_of_cluster - root_cluster : batch_max);
+	batch_ok=((unsigned)disk_car->pread(disk_car, buffer_batch, batch_nbr * cluster_size,
+	      partition->part_offset + (start_data + (uint64_t)(batch_first - 2) * sectors_per_cluster) *
+	      disk_car->sector_size) == batch_nbr * cluster_size);
+      }
+      buffer=&buffer_batch[(root_cluster - batch_first) * cluster_size];
+      /* If the large read has failed, read the cluster alone */
+      if(batch_ok ||
+	  (unsigned)disk_car->pread(disk_car, buffer, cluster_size,
 	    partition->part_offset + (start_data + (uint64_t)(root_cluster - 2) * sectors_per_cluster) *
 	    disk_car->sector_size) == cluster_size)
       {
@@ -463,7 +481,7 @@ static unsigned int fat32_find_root_cluster(disk_t *disk_car,const partition_t *
                   if((tmp<2) || (tmp>=2+no_of_cluster))
                   {
                     log_error("bad cluster number\n");
-                    free(buffer);
+                    free(buffer_batch);
                     return new_root_cluster;
                   }
                   /* Read the cluster */
@@ -471,7 +489,7 @@ static unsigned int fat32_find_root_cluster(disk_t *disk_car,const partition_t *
 			partition->part_offset + (start_data + (uint64_t)(tmp - 2) * sectors_per_cluster) * disk_car->sector_size) != cluster_size)
                   {
                     log_critical("cluster can't be read\n");
-                    free(buffer);
+                    free(buffer_batch);
                     return new_root_cluster;
                   }
                   /* Check if this cluster is a directory structure. FAT can be damaged */
@@ -480,13 +498,13 @@ static unsigned int fat32_find_root_cluster(disk_t *disk_car,const partition_t *
                     if(check_FAT_dir_entry(&buffer[i*0x20],i)!=1)
                     {
                       log_error("cluster data is not a directory structure\n");
-                      free(buffer);
+                      free(buffer_batch);
                       return new_root_cluster;
                     }
                   }
                 }
               } while(tmp && (++back<10));
-              free(buffer);
+              free(buffer_batch);
               return new_root_cluster;
             }
             else
@@ -515,14 +533,14 @@ static unsigned int fat32_find_root_cluster(disk_t *disk_car,const partition_t *
                   {
                     case c_YES:
                       delete_list_file(dir_list);
-                      free(buffer);
+                      free(buffer_batch);
                       return root_cluster;
                     case 'A':
                       interactive=0;
                       break;
 		    case 'Q':
                       delete_list_file(dir_list);
-                      free(buffer);
+                      free(buffer_batch);
                       return 0;
                     default:
                       break;
@@ -561,7 +579,7 @@ static unsigned int fat32_find_root_cluster(disk_t *disk_car,const partition_t *
 #endif
       delete_list_file(rootdir_list);
     }
-    free(buffer);
+    free(buffer_batch);
   }
   return root_cluster;
 }
@@ -1282,13 +1300,33 @@ static int calcul_sectors_per_cluster(const upart_type_t upart_type, const unsig
   }
 }
 
+/* Open addressing hash set of cluster numbers, 0 is used for empty slots.
+ * Returns 1 if cluster was already present, otherwise adds it. */
+static int fat_cluster_seen(uint32_t *hash_table, const unsigned int hash_mask, const uint32_t cluster)
+{
+  unsigned int pos=(cluster * 0x9E3779B1U) & hash_mask;
+  while(hash_table[pos]!=0)
+  {
+    if(hash_table[pos]==cluster)
+      return 1;
+    pos=(pos+1) & hash_mask;
+  }
+  hash_table[pos]=cluster;
+  return 0;
+}
+
 static unsigned int fat_find_fat_start(const unsigned char *buffer,const int p_fat12, const int p_fat16, const int p_fat32,unsigned long int*fat_offset, const unsigned int sector_size)
 {
   /* TODO: handle limited size of info_offset */
   info_offset_t *info_offset;
   unsigned int nbr_offset=0;
   int have_fat_signature=0;
+  uint32_t *hash_table;
+  unsigned int hash_size;
+  /* At least twice the number of FAT16 entries in a sector */
+  for(hash_size=1; hash_size<sector_size; hash_size<<=1);
   info_offset=(info_offset_t *)MALLOC(sector_size*sizeof(info_offset_t));
+  hash_table=(uint32_t *)MALLOC(hash_size*sizeof(uint32_t));
   if(p_fat12!=0)
   {
     unsigned int i;
@@ -1421,6 +1459,7 @@ static unsigned int fat_find_fat_start(const unsigned char *buffer,const int p_f
     unsigned int i,j;
     const uint16_t *p16=(const uint16_t*)buffer;
     unsigned int err=0;
+    memset(hash_table, 0, hash_size*sizeof(uint32_t));
     for(i=0; (i<sector_size/2)&&(err==0); i++)
     {
       unsigned long int cluster=le16(p16[i]);
@@ -1428,15 +1467,11 @@ static unsigned int fat_find_fat_start(const unsigned char *buffer,const int p_f
       {
 	err=1;
       }
-      if((cluster!=0) && ((cluster&0x0fff8)!=(unsigned)0x0fff8))
+      /* A cluster can't be referenced twice */
+      if((cluster!=0) && ((cluster&0x0fff8)!=(unsigned)0x0fff8) &&
+	  fat_cluster_seen(hash_table, hash_size-1, cluster))
       {
-	for(j=i+1; (j<sector_size/2)&&(err==0); j++)
-	{
-	  if(cluster==le16(p16[j]))
-	  {
-	    err=1;
-	  }
-	}
+	err=1;
       }
     }
     if(err==0)
@@ -1481,6 +1516,7 @@ static unsigned int fat_find_fat_start(const unsigned char *buffer,const int p_f
     unsigned int i,j;
     const uint32_t *p32=(const uint32_t*)buffer;
     unsigned int err=0;
+    memset(hash_table, 0, hash_size*sizeof(uint32_t));
     for(i=0; (i<sector_size/4)&&(err==0); i++)
     {
       unsigned long int cluster=le32(p32[i])&0x0FFFFFFF;
@@ -1488,15 +1524,10 @@ static unsigned int fat_find_fat_start(const unsigned char *buffer,const int p_f
       {
 	err=1;
       }
-      if((cluster!=0) && ((cluster&0x0ffffff8)!=(unsigned)0x0ffffff8))
+      if((cluster!=0) && ((cluster&0x0ffffff8)!=(unsigned)0x0ffffff8) &&
+	  fat_cluster_seen(hash_table, hash_size-1, cluster))
       {
-	for(j=i+1; (j<sector_size/4)&&(err==0); j++)
-	{
-	  if(cluster==(le32(p32[j])&0x0FFFFFFF))
-	  {
-	    err=1;
-	  }
-	}
+	err=1;
       }
     }
     if(err==0)
@@ -1551,10 +1582,12 @@ static unsigned int fat_find_fat_start(const unsigned char *buffer,const int p_f
       unsigned int res;
       *fat_offset=info_offset[best_j].offset;
       res=info_offset[best_j].fat_type;
+      free(hash_table);
       free(info_offset);
       return res;
     }
   }
+  free(hash_table);
   free(info_offset);
   return 0;
 }
@@ -1566,7 +1599,12 @@ static int fat_find_type(disk_t *disk_car,const partition_t *partition,const uin
   unsigned long int old_percent=0;
 #endif
   int ind_stop=0;
-  unsigned char *buffer=(unsigned char *)MALLOC(disk_car->sector_size);
+  /* Sectors are read FAT_SEARCH_READ_SIZE bytes at a time */
+  const unsigned int batch_size=(disk_car->sector_size < FAT_SEARCH_READ_SIZE ? FAT_SEARCH_READ_SIZE / disk_car->sector_size * disk_car->sector_size : disk_car->sector_size);
+  uint64_t batch_offset=0;
+  unsigned int batch_len=0;
+  int batch_ok=0;
+  unsigned char *buffer_batch=(unsigned char *)MALLOC(batch_size);
   if(verbose>0)
   {
     log_trace("fat_find_type(max_offset=%lu, p_fat12=%d, p_fat16=%d, p_fat32=%d, debug=%d, dump_ind=%d)\n",
@@ -1587,6 +1625,7 @@ static int fat_find_type(disk_t *disk_car,const partition_t *partition,const uin
       offset<max_offset && !ind_stop;
       offset+=disk_car->sector_size)
   {
+    unsigned char *buffer;
 #ifdef HAVE_NCURSES
     unsigned long int percent=offset*100/max_offset;
     if(interface && (percent!=old_percent))
@@ -1599,7 +1638,16 @@ static int fat_find_type(disk_t *disk_car,const partition_t *partition,const uin
       ind_stop|=check_enter_key_or_s(stdscr);
     }
 #endif
-    if((unsigned)disk_car->pread(disk_car, buffer, disk_car->sector_size, partition->part_offset + offset) == disk_car->sector_size)
+    if(offset >= batch_offset + batch_len)
+    {
+      batch_offset=offset;
+      batch_len=(max_offset - offset < batch_size ? (max_offset - offset + disk_car->sector_size - 1) / disk_car->sector_size * disk_car->sector_size : batch_size);
+      batch_ok=((unsigned)disk_car->pread(disk_car, buffer_batch, batch_len, partition->part_offset + batch_offset) == batch_len);
+    }
+    buffer=&buffer_batch[offset - batch_offset];
+    /* If the large read has failed, read the sector alone */
+    if(batch_ok ||
+	(unsigned)disk_car->pread(disk_car, buffer, disk_car->sector_size, partition->part_offset + offset) == disk_car->sector_size)
     {
       unsigned long int fat_offset=0;
       unsigned int fat_type;
@@ -1648,7 +1696,7 @@ static int fat_find_type(disk_t *disk_car,const partition_t *partition,const uin
     wrefresh(stdscr);
   }
 #endif
-  free(buffer);
+  free(buffer_batch);
   return 0;
 }
 
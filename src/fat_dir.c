@@ -48,6 +48,7 @@
 #include "log.h"
 #include "setdate.h"
 
+#define FAT_COPY_BUFFER_SIZE	(1024*1024)
 #define MSDOS_MKMODE(a,m) ((m & (a & ATTR_RO ? LINUX_S_IRUGO|LINUX_S_IXUGO : LINUX_S_IRWXUGO)) | (a & ATTR_DIR ? LINUX_S_IFDIR : LINUX_S_IFREG))
 struct fat_dir_struct
 {
@@ -494,9 +495,13 @@ static int fat_copy(disk_t *disk_car, const partition_t *partition, dir_data_t *
   const struct fat_boot_sector *fat_header=ls->boot_sector;
   const unsigned int sectors_per_cluster=fat_header->sectors_per_cluster;
   const unsigned int block_size=fat_sector_size(fat_header)*sectors_per_cluster;
-  unsigned char *buffer_file=(unsigned char *)MALLOC(block_size);
-  unsigned int cluster;
   unsigned int file_size=file->st_size;
+  /* Contiguous clusters are read at once */
+  const unsigned int file_clusters=(file_size>0 ? (file_size+block_size-1)/block_size : 1);
+  const unsigned int max_clusters=td_min(file_clusters,
+      (block_size < FAT_COPY_BUFFER_SIZE ? FAT_COPY_BUFFER_SIZE/block_size : 1U));
+  unsigned char *buffer_file=(unsigned char *)MALLOC(max_clusters*block_size);
+  unsigned int cluster;
   unsigned int fat_meth=FAT_FOLLOW_CLUSTER;
   uint64_t start_fat1,start_data,part_size;
   unsigned long int no_of_cluster,fat_length;
@@ -522,12 +527,40 @@ static int fat_copy(disk_t *disk_car, const partition_t *partition, dir_data_t *
   while(cluster>=2 && cluster<=no_of_cluster+2 && file_size>0)
   {
     const uint64_t start=partition->part_offset+(uint64_t)(start_data+(cluster-2)*sectors_per_cluster)*fat_sector_size(fat_header);
-    unsigned int toread = block_size;
-    if (toread > file_size)
-      toread = file_size;
+    const unsigned int first_cluster=cluster;
+    unsigned int prev_cluster;
+    unsigned int toread=0;
+    do
+    {
+      const unsigned int cluster_size=(block_size < file_size ? block_size : file_size);
+      toread+=cluster_size;
+      file_size-=cluster_size;
+      prev_cluster=cluster;
+      if(file_size>0)
+      {
+	if(fat_meth==FAT_FOLLOW_CLUSTER)
+	{
+	  const unsigned int next_cluster=get_next_cluster(disk_car, partition, partition->upart_type, start_fat1, cluster);
+	  if(next_cluster>=2 && next_cluster<=no_of_cluster+2)
+	    cluster=next_cluster;
+	  else if(cluster==file->st_ino && next_cluster==0)
+	    fat_meth=FAT_NEXT_FREE_CLUSTER;	/* Recovery of a deleted file */
+	  else
+	    fat_meth=FAT_NEXT_CLUSTER;		/* FAT is corrupted, don't trust it */
+	}
+	if(fat_meth==FAT_NEXT_CLUSTER)
+	  cluster++;
+	else if(fat_meth==FAT_NEXT_FREE_CLUSTER)
+	{	/* Deleted file are composed of "free" clusters */
+	  while(++cluster<no_of_cluster+2 &&
+	      get_next_cluster(disk_car, partition, partition->upart_type, start_fat1, cluster)!=0);
+	}
+      }
+    } while(file_size>0 && cluster==prev_cluster+1 &&
+	cluster<=no_of_cluster+2 && cluster-first_cluster<max_clusters);
     if((unsigned)disk_car->pread(disk_car, buffer_file, toread, start) != toread)
     {
-      log_error("fat_copy: Can't read cluster %u.\n", cluster);
+      log_error("fat_copy: Can't read cluster %u.\n", first_cluster);
     }
     if(fwrite(buffer_file, 1, toread, f_out) != toread)
     {
@@ -538,27 +571,6 @@ static int fat_copy(disk_t *disk_car, const partition_t *partition, dir_data_t *
       free(buffer_file);
       return -1;
     }
-    file_size -= toread;
-    if(file_size>0)
-    {
-      if(fat_meth==FAT_FOLLOW_CLUSTER)
-      {
-	const unsigned int next_cluster=get_next_cluster(disk_car, partition, partition->upart_type, start_fat1, cluster);
-	if(next_cluster>=2 && next_cluster<=no_of_cluster+2)
-	  cluster=next_cluster;
-	else if(cluster==file->st_ino && next_cluster==0)
-	  fat_meth=FAT_NEXT_FREE_CLUSTER;	/* Recovery of a deleted file */
-	else
-	  fat_meth=FAT_NEXT_CLUSTER;		/* FAT is corrupted, don't trust it */
-      }
-      if(fat_meth==FAT_NEXT_CLUSTER)
-	cluster++;
-      else if(fat_meth==FAT_NEXT_FREE_CLUSTER)
-      {	/* Deleted file are composed of "free" clusters */
-	while(++cluster<no_of_cluster+2 &&
-	    get_next_cluster(disk_car, partition, partition->upart_type, start_fat1, cluster)!=0);
-      }
-    }
   }
   fclose(f_out);
   set_date(new_file, file->td_atime, file->td_mtime);
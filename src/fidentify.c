@@ -93,7 +93,7 @@ static int file_identify(const char *filename, const unsigned int check)
       {
 	const file_check_t *file_check=td_list_entry(tmp, file_check_t, list);
 	if((file_check->length==0 || memcmp(buffer + file_check->offset, file_check->value, file_check->length)==0) &&
-	    file_check->header_check(buffer, read_size, 0, &file_recovery, &file_recovery_new)!=0)
+	    file_check_header(file_check, buffer, read_size, 0, &file_recovery, &file_recovery_new)!=0)
 	{
 	  file_recovery_new.file_stat=file_check->file_stat;
 	  break;
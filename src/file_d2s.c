@@ -31,7 +31,7 @@
 
 static void register_header_check_d2s(file_stat_t *file_stat);
 static int header_check_d2s(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new);
-static void file_rename_d2s(const char *old_filename);
+static void file_rename_d2s(file_recovery_t *file_recovery);
 
 const file_hint_t file_hint_d2s= {
   .extension="d2s",
@@ -67,14 +67,14 @@ static int header_check_d2s(const unsigned char *buffer, const unsigned int buff
   return 0;
 }
 
-static void file_rename_d2s(const char *old_filename)
+static void file_rename_d2s(file_recovery_t *file_recovery)
 {
   unsigned char buffer[512];
   FILE *file;
   int buffer_size;
-  if((file=fopen(old_filename, "rb"))==NULL)
+  if((file=fopen(file_recovery->filename, "rb"))==NULL)
     return;
   buffer_size=fread(buffer, 1, sizeof(buffer), file);
   fclose(file);
-  file_rename(old_filename, buffer, buffer_size, 0x14, NULL, 1);
+  file_rename(file_recovery, buffer, buffer_size, 0x14, NULL, 1);
 }
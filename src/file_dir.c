@@ -50,14 +50,14 @@ const file_hint_t file_hint_dir= {
   .register_header_check=&register_header_check_dir
 };
 
-static void file_rename_fatdir(const char *old_filename)
+static void file_rename_fatdir(file_recovery_t *file_recovery)
 {
   unsigned char buffer[512];
   char buffer_cluster[32];
   FILE *file;
   int buffer_size;
   unsigned int cluster;
-  if((file=fopen(old_filename, "rb"))==NULL)
+  if((file=fopen(file_recovery->filename, "rb"))==NULL)
     return;
   buffer_size=fread(buffer, 1, sizeof(buffer), file);
   fclose(file);
@@ -65,7 +65,7 @@ static void file_rename_fatdir(const char *old_filename)
     return;
   cluster=(buffer[0x15]<<24)|(buffer[0x14]<<16)|(buffer[0x1B]<<8)|buffer[0x1A];
   sprintf(buffer_cluster, "cluster_%u", cluster);
-  file_rename(old_filename, buffer_cluster, strlen(buffer_cluster), 0, NULL, 1);
+  file_rename(file_recovery, buffer_cluster, strlen(buffer_cluster), 0, NULL, 1);
 }
 
 static int data_check_fatdir(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
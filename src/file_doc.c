@@ -30,6 +30,9 @@
 #include <string.h>
 #endif
 #include <stdio.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include "types.h"
 #include "common.h"
 #include "filegen.h"
@@ -41,9 +44,42 @@
 static void register_header_check_doc(file_stat_t *file_stat);
 static void file_check_doc(file_recovery_t *file_recovery);
 static int header_check_doc(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new);
-static void file_rename_doc(const char *old_filename);
-static uint32_t *OLE_load_FAT(FILE *IN, const struct OLE_HDR *header);
-static uint32_t *OLE_load_MiniFAT(FILE *IN, const struct OLE_HDR *header, const uint32_t *fat, const unsigned int fat_entries);
+static void file_rename_doc(file_recovery_t *file_recovery);
+
+/* Largest file read at once in memory */
+#define OLE_MAX_READ_SIZE (16*1024*1024)
+
+/* OLE2 compound file being parsed */
+typedef struct
+{
+  unsigned char buffer_header[512];
+  FILE *handle;
+  const unsigned char *data;	/* whole file when it's in memory, NULL otherwise */
+  unsigned char *data_alloc;
+  uint64_t size;
+  uint64_t max_offset;		/* end of the furthest sector read */
+  uint32_t *fat;
+  unsigned int fat_entries;
+  uint32_t *minifat;
+  unsigned int uSectorShift;
+} ole_file_t;
+
+static int OLE_open(ole_file_t *ole, FILE *handle, const unsigned char *data, const uint64_t size);
+static void OLE_close(ole_file_t *ole);
+static int OLE_load_FAT(ole_file_t *ole);
+static int OLE_read_sector(ole_file_t *ole, const uint64_t block, void *buffer);
+static unsigned char *OLE_chain_new(const ole_file_t *ole);
+static int OLE_chain_seen(unsigned char *chain, const unsigned int block);
+
+/* FAT of the last file accepted by file_check_doc(),
+ * file_rename_doc() is called next for the same file */
+static char ole_cache_filename[2048];
+static unsigned char ole_cache_header[512];
+static uint32_t *ole_cache_fat=NULL;
+static uint64_t ole_cache_size=0;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t ole_cache_mutex=PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 const file_hint_t file_hint_doc= {
   .extension="doc",
@@ -75,35 +111,35 @@ const char WilcomDesignInformationDDD[56]=
 
 static void file_check_doc(file_recovery_t *file_recovery)
 {
-  unsigned char buffer_header[512];
+  ole_file_t ole;
   uint64_t doc_file_size;
   uint32_t *fat;
   unsigned long int i;
   unsigned int freesect_count=0;  
-  struct OLE_HDR *header=(struct OLE_HDR*)&buffer_header;
+  const struct OLE_HDR *header=(const struct OLE_HDR*)&ole.buffer_header;
   const uint64_t doc_file_size_org=file_recovery->file_size;
   file_recovery->file_size=0;
-  /*reads first sector including OLE header */
-  if(fseek(file_recovery->handle, 0, SEEK_SET) < 0 ||
-      fread(&buffer_header, sizeof(buffer_header), 1, file_recovery->handle) != 1)
+  if(OLE_open(&ole, file_recovery->handle,
+	file_content_get(file_recovery, 0, doc_file_size_org),
+	doc_file_size_org) < 0)
+  {
+    OLE_close(&ole);
     return ;
+  }
 #ifdef DEBUG_OLE
   log_info("file_check_doc %s\n", file_recovery->filename);
   log_trace("num_FAT_blocks       %u\n",le32(header->num_FAT_blocks));
   log_trace("num_extra_FAT_blocks %u\n",le32(header->num_extra_FAT_blocks));
 #endif
-  /* Sanity check */
-  if(le32(header->num_FAT_blocks)==0 ||
-      le32(header->num_extra_FAT_blocks)>50 ||
-      le32(header->num_FAT_blocks)>109+le32(header->num_extra_FAT_blocks)*((1<<le16(header->uSectorShift))-1))
-    return ;
-  if((fat=OLE_load_FAT(file_recovery->handle, header))==NULL)
+  if(OLE_load_FAT(&ole) < 0)
   {
 #ifdef DEBUG_OLE
     log_info("OLE_load_FAT failed\n");
 #endif
+    OLE_close(&ole);
     return ;
   }
+  fat=ole.fat;
   /* Search how many entries are not used at the end of the FAT */
   for(i=(le32(header->num_FAT_blocks)<<le16(header->uSectorShift))/4-1;
       i>((le32(header->num_FAT_blocks)-1)<<le16(header->uSectorShift))/4 && le32(fat[i])==0xFFFFFFFF;
@@ -116,7 +152,7 @@ static void file_check_doc(file_recovery_t *file_recovery)
     log_info("doc_file_size %llu > doc_file_size_org %llu\n",
     (unsigned long long)doc_file_size, (unsigned long long)doc_file_size_org);
 #endif
-    free(fat);
+    OLE_close(&ole);
     return ;
   }
 #ifdef DEBUG_OLE
@@ -124,48 +160,43 @@ static void file_check_doc(file_recovery_t *file_recovery)
 #endif
   {
     unsigned int block;
-    const unsigned int fat_entries=(le32(header->num_FAT_blocks)==0 ?
-	109:
-	(le32(header->num_FAT_blocks)<<le16(header->uSectorShift))/4);
+    const unsigned int fat_entries=ole.fat_entries;
+    unsigned char *chain=OLE_chain_new(&ole);
+    struct OLE_DIR *dir_entries=(struct OLE_DIR *)MALLOC(1<<le16(header->uSectorShift));
 #ifdef DEBUG_OLE
     log_info("root_start_block=%u, fat_entries=%u\n", le32(header->root_start_block), fat_entries);
 #endif
     /* FFFFFFFE = ENDOFCHAIN
-     * Use a loop count i to avoid endless loop */
-    for(block=le32(header->root_start_block), i=0;
-	block!=0xFFFFFFFE && i<fat_entries;
-	block=le32(fat[block]), i++)
+     * Stop when a block is used twice to avoid endless loop */
+    for(block=le32(header->root_start_block);
+	block!=0xFFFFFFFE;
+	block=le32(fat[block]))
     {
-      struct OLE_DIR *dir_entries;
 #ifdef DEBUG_OLE
       log_info("read block %u\n", block);
 #endif
       if(!(block < fat_entries))
       {
-	free(fat);
-	return ;
-      }
-      if(fseek(file_recovery->handle, 512+(block<<le16(header->uSectorShift)), SEEK_SET)<0)
-      {
-#ifdef DEBUG_OLE
-	log_info("fseek failed\n");
-#endif
-	free(fat);
+	free(dir_entries);
+	free(chain);
+	OLE_close(&ole);
 	return ;
       }
-      dir_entries=(struct OLE_DIR *)MALLOC(1<<le16(header->uSectorShift));
-      if(fread(dir_entries, (1<<le16(header->uSectorShift)), 1, file_recovery->handle)!=1)
+      if(OLE_chain_seen(chain, block))
+	break;
+      if(OLE_read_sector(&ole, block, dir_entries) < 0)
       {
 #ifdef DEBUG_OLE
-	log_info("fread failed\n");
+	log_info("OLE_read_sector failed\n");
 #endif
 	free(dir_entries);
-	free(fat);
+	free(chain);
+	OLE_close(&ole);
 	return ;
       }
       {
 	unsigned int sid;
-	struct OLE_DIR *dir_entry;
+	const struct OLE_DIR *dir_entry;
 	for(sid=0, dir_entry=dir_entries;
 	    sid<(1<<le16(header->uSectorShift))/sizeof(struct OLE_DIR) && dir_entry->type!=NO_ENTRY;
 	    sid++,dir_entry++)
@@ -179,16 +210,35 @@ static void file_check_doc(file_recovery_t *file_recovery)
 	    log_info("error at sid %u\n", sid);
 #endif
 	    free(dir_entries);
-	    free(fat);
+	    free(chain);
+	    OLE_close(&ole);
 	    return ;
 	  }
 	}
       }
-      free(dir_entries);
     }
+    free(dir_entries);
+    free(chain);
   }
-  free(fat);
   file_recovery->file_size=doc_file_size;
+  /* Keep the FAT for file_rename_doc() if it only depends on data kept in the file */
+  if(ole.max_offset <= doc_file_size)
+  {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&ole_cache_mutex);
+#endif
+    free(ole_cache_fat);
+    ole_cache_fat=ole.fat;
+    ole.fat=NULL;
+    strncpy(ole_cache_filename, file_recovery->filename, sizeof(ole_cache_filename)-1);
+    ole_cache_filename[sizeof(ole_cache_filename)-1]='\0';
+    memcpy(ole_cache_header, ole.buffer_header, sizeof(ole_cache_header));
+    ole_cache_size=doc_file_size;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&ole_cache_mutex);
+#endif
+  }
+  OLE_close(&ole);
 }
 
 static const char *ole_get_file_extension(const unsigned char *buffer, const unsigned int buffer_size)
@@ -473,11 +523,104 @@ static int header_check_doc(const unsigned char *buffer, const unsigned int buff
   return 0;
 }
 
-static uint32_t *OLE_load_FAT(FILE *IN, const struct OLE_HDR *header)
+/* Read and check the header.
+ * Small files are read at once in memory unless they are already there */
+static int OLE_open(ole_file_t *ole, FILE *handle, const unsigned char *data, const uint64_t size)
 {
+  const struct OLE_HDR *header=(const struct OLE_HDR*)&ole->buffer_header;
+  ole->handle=handle;
+  ole->data=data;
+  ole->data_alloc=NULL;
+  ole->size=size;
+  ole->max_offset=0;
+  ole->fat=NULL;
+  ole->fat_entries=0;
+  ole->minifat=NULL;
+  ole->uSectorShift=0;
+  if(size < sizeof(ole->buffer_header))
+    return -1;
+  if(data==NULL && size <= OLE_MAX_READ_SIZE)
+  {
+    ole->data_alloc=(unsigned char *)MALLOC(size);
+    if(fseek(handle, 0, SEEK_SET) < 0 ||
+	fread(ole->data_alloc, size, 1, handle) != 1)
+    {
+      free(ole->data_alloc);
+      ole->data_alloc=NULL;
+    }
+    ole->data=ole->data_alloc;
+  }
+  /*reads first sector including OLE header */
+  if(ole->data!=NULL)
+    memcpy(&ole->buffer_header, ole->data, sizeof(ole->buffer_header));
+  else if(fseek(handle, 0, SEEK_SET) < 0 ||
+      fread(&ole->buffer_header, sizeof(ole->buffer_header), 1, handle) != 1)
+    return -1;
+  ole->uSectorShift=le16(header->uSectorShift);
+  /* Sanity check */
+  if(le32(header->num_FAT_blocks)==0 ||
+      le32(header->num_extra_FAT_blocks)>50 ||
+      le32(header->num_FAT_blocks)>109+le32(header->num_extra_FAT_blocks)*((1<<ole->uSectorShift)-1))
+    return -1;
+  return 0;
+}
+
+static void OLE_close(ole_file_t *ole)
+{
+  free(ole->data_alloc);
+  free(ole->fat);
+  free(ole->minifat);
+  ole->data_alloc=NULL;
+  ole->data=NULL;
+  ole->fat=NULL;
+  ole->minifat=NULL;
+}
+
+static int OLE_read_sectors(ole_file_t *ole, const uint64_t block, const unsigned int count, void *buffer)
+{
+  const uint64_t offset=512+(block<<ole->uSectorShift);
+  const uint64_t size=(uint64_t)count<<ole->uSectorShift;
+  if(offset + size > ole->size)
+    return -1;
+  if(ole->data!=NULL)
+    memcpy(buffer, &ole->data[offset], size);
+  else if(fseek(ole->handle, offset, SEEK_SET) < 0 ||
+      fread(buffer, size, 1, ole->handle) != 1)
+    return -1;
+  if(ole->max_offset < offset + size)
+    ole->max_offset=offset + size;
+  return 0;
+}
+
+static int OLE_read_sector(ole_file_t *ole, const uint64_t block, void *buffer)
+{
+  return OLE_read_sectors(ole, block, 1, buffer);
+}
+
+/* Bitmap of the blocks already used by the chain being walked */
+static unsigned char *OLE_chain_new(const ole_file_t *ole)
+{
+  unsigned char *chain=(unsigned char *)MALLOC((ole->fat_entries+7)/8);
+  memset(chain, 0, (ole->fat_entries+7)/8);
+  return chain;
+}
+
+/* block must be lower than fat_entries */
+static int OLE_chain_seen(unsigned char *chain, const unsigned int block)
+{
+  const unsigned char mask=1<<(block&7);
+  if((chain[block/8]&mask)!=0)
+    return 1;
+  chain[block/8]|=mask;
+  return 0;
+}
+
+static int OLE_load_FAT(ole_file_t *ole)
+{
+  const struct OLE_HDR *header=(const struct OLE_HDR*)&ole->buffer_header;
   uint32_t *fat;
   uint32_t *dif;
-  dif=(uint32_t*)MALLOC(109*4+(le32(header->num_extra_FAT_blocks)<<le16(header->uSectorShift)));
+  dif=(uint32_t*)MALLOC(109*4+(le32(header->num_extra_FAT_blocks)<<ole->uSectorShift));
   memcpy(dif,(header+1),109*4);
   if(le32(header->num_extra_FAT_blocks)>0)
   { /* Load DIF*/
@@ -486,105 +629,98 @@ static uint32_t *OLE_load_FAT(FILE *IN, const struct OLE_HDR *header)
     unsigned char *data=(unsigned char*)&dif[109];
     for(i=0, block=le32(header->FAT_next_block);
 	i<le32(header->num_extra_FAT_blocks) && block!=0xFFFFFFFF && block!=0xFFFFFFFE;
-	i++, block=le32(dif[109+i*(((1<<le16(header->uSectorShift))/4)-1)]))
+	i++, block=le32(dif[109+i*(((1<<ole->uSectorShift)/4)-1)]))
     {
-      if(fseek(IN, 512+(block<<le16(header->uSectorShift)), SEEK_SET) < 0)
+      if(OLE_read_sector(ole, block, data) < 0)
       {
 	free(dif);
-	return NULL;
+	return -1;
       }
-      if(fread(data, 1<<le16(header->uSectorShift), 1, IN)!=1)
-      {
-	free(dif);
-	return NULL;
-      }
-      data+=(1<<le16(header->uSectorShift))-4;
+      data+=(1<<ole->uSectorShift)-4;
     }
   }
-  fat=(uint32_t*)MALLOC(le32(header->num_FAT_blocks)<<le16(header->uSectorShift));
-  { /* Load FAT */
+  fat=(uint32_t*)MALLOC(le32(header->num_FAT_blocks)<<ole->uSectorShift);
+  { /* Load FAT, consecutive sectors are read at once */
     unsigned long int j;
-    unsigned char *data;
-    for(j=0, data=(unsigned char*)fat;
-	j<le32(header->num_FAT_blocks);
-	j++, data+=(1<<le16(header->uSectorShift)))
+    unsigned int count;
+    for(j=0; j<le32(header->num_FAT_blocks); j+=count)
     {
-      if(fseek(IN,512+(le32(dif[j])<<le16(header->uSectorShift)),SEEK_SET)<0)
-      {
-	free(dif);
-	free(fat);
-	return NULL;
-      }
-      if(fread(data, (1<<le16(header->uSectorShift)), 1, IN)!=1)
+      for(count=1;
+	  j+count<le32(header->num_FAT_blocks) &&
+	  le32(dif[j+count])==le32(dif[j])+count;
+	  count++);
+      if(OLE_read_sectors(ole, le32(dif[j]), count,
+	    (unsigned char*)fat + (j<<ole->uSectorShift)) < 0)
       {
 	free(dif);
 	free(fat);
-	return NULL;
+	return -1;
       }
     }
   }
   free(dif);
-  return fat;
+  ole->fat=fat;
+  ole->fat_entries=(le32(header->num_FAT_blocks)<<ole->uSectorShift)/4;
+  return 0;
 }
 
-static void *OLE_read_stream(FILE *IN,
-    const uint32_t *fat, const unsigned int fat_entries, const unsigned int uSectorShift,
+static void *OLE_read_stream(ole_file_t *ole,
     const unsigned int block_start, const unsigned int len)
 {
   unsigned char *dataPt;
+  unsigned char *chain;
   unsigned int block;
   unsigned int size_read;
+  const unsigned int uSectorShift=ole->uSectorShift;
   dataPt=(unsigned char *)MALLOC((len+(1<<uSectorShift)-1) / (1<<uSectorShift) * (1<<uSectorShift));
+  chain=OLE_chain_new(ole);
   for(block=block_start, size_read=0;
       size_read < len;
-      block=le32(fat[block]), size_read+=(1<<uSectorShift))
+      block=le32(ole->fat[block]), size_read+=(1<<uSectorShift))
   {
-    if(!(block < fat_entries))
-    {
-      free(dataPt);
-      return NULL;
-    }
-    if(fseek(IN, 512+(block<<uSectorShift), SEEK_SET)<0)
-    {
-      free(dataPt);
-      return NULL;
-    }
-    if(fread(&dataPt[size_read], (1<<uSectorShift), 1, IN)!=1)
+    if(!(block < ole->fat_entries) ||
+	OLE_chain_seen(chain, block) ||
+	OLE_read_sector(ole, block, &dataPt[size_read]) < 0)
     {
+      free(chain);
       free(dataPt);
       return NULL;
     }
   }
+  free(chain);
   return dataPt;
 }
 
-static uint32_t *OLE_load_MiniFAT(FILE *IN, const struct OLE_HDR *header, const uint32_t *fat, const unsigned int fat_entries)
+static const uint32_t *OLE_load_MiniFAT(ole_file_t *ole)
 {
+  const struct OLE_HDR *header=(const struct OLE_HDR*)&ole->buffer_header;
   unsigned char*minifat_pos;
-  uint32_t *minifat;
+  unsigned char *chain;
   unsigned int block;
   unsigned int i;
+  if(ole->minifat!=NULL)
+    return ole->minifat;
   if(le32(header->csectMiniFat)==0)
     return NULL;
-  minifat=(uint32_t*)MALLOC(le32(header->csectMiniFat) << le16(header->uSectorShift));
-  minifat_pos=(unsigned char*)minifat;
+  ole->minifat=(uint32_t*)MALLOC(le32(header->csectMiniFat) << ole->uSectorShift);
+  minifat_pos=(unsigned char*)ole->minifat;
+  chain=OLE_chain_new(ole);
   block=le32(header->MiniFat_block);
-  for(i=0; i < le32(header->csectMiniFat) && block < fat_entries; i++)
+  for(i=0; i < le32(header->csectMiniFat) && block < ole->fat_entries; i++)
   {
-    if(fseek(IN, ((uint64_t)block << le16(header->uSectorShift)) + 512, SEEK_SET) < 0)
+    if(OLE_chain_seen(chain, block) ||
+	OLE_read_sector(ole, block, minifat_pos) < 0)
     {
-      free(minifat);
+      free(chain);
+      free(ole->minifat);
+      ole->minifat=NULL;
       return NULL;
     }
-    if(fread(minifat_pos, 1 << le16(header->uSectorShift), 1, IN) != 1)
-    {
-      free(minifat);
-      return NULL;
-    }
-    minifat_pos+=1 << le16(header->uSectorShift);
-    block=le32(fat[block]);
+    minifat_pos+=1 << ole->uSectorShift;
+    block=le32(ole->fat[block]);
   }
-  return minifat;
+  free(chain);
+  return ole->minifat;
 }
 
 static uint32_t get32u(const void *buffer, const unsigned int offset)
@@ -749,10 +885,10 @@ static void *OLE_read_ministream(unsigned char *ministream,
   return dataPt;
 }
 
-static void OLE_parse_summary(FILE *file, const uint32_t *fat, const unsigned int fat_entries,
-    const struct OLE_HDR *header, const unsigned int ministream_block, const unsigned int ministream_size,
+static void OLE_parse_summary(ole_file_t *ole, const unsigned int ministream_block, const unsigned int ministream_size,
     const unsigned int block, const unsigned int len, const char **ext, char **title, time_t *file_time)
 {
+  const struct OLE_HDR *header=(const struct OLE_HDR*)&ole->buffer_header;
   unsigned char *summary=NULL;
   if(len < 48 || len>1024*1024)
     return ;
@@ -760,13 +896,12 @@ static void OLE_parse_summary(FILE *file, const uint32_t *fat, const unsigned in
   {
     if(le32(header->csectMiniFat)!=0 && ministream_size > 0 && ministream_size < 1024*1024)
     {
-      const unsigned int mini_fat_entries=(le32(header->csectMiniFat) << le16(header->uSectorShift)) / 4;
-      uint32_t *minifat;
+      const unsigned int mini_fat_entries=(le32(header->csectMiniFat) << ole->uSectorShift) / 4;
+      const uint32_t *minifat;
       unsigned char *ministream;
-      if((minifat=OLE_load_MiniFAT(file, header, fat, fat_entries))==NULL)
+      if((minifat=OLE_load_MiniFAT(ole))==NULL)
 	return ;
-      ministream=(unsigned char *)OLE_read_stream(file,
-	  fat, fat_entries, le16(header->uSectorShift),
+      ministream=(unsigned char *)OLE_read_stream(ole,
 	  ministream_block, ministream_size);
       if(ministream != NULL)
       {
@@ -775,13 +910,10 @@ static void OLE_parse_summary(FILE *file, const uint32_t *fat, const unsigned in
 	    block, len, ministream_size);
 	free(ministream);
       }
-      free(minifat);
     }
   }
   else
-    summary=(unsigned char *)OLE_read_stream(file,
-	fat, fat_entries, le16(header->uSectorShift),
-	block, len);
+    summary=(unsigned char *)OLE_read_stream(ole, block, len);
   if(summary!=NULL)
   {
     OLE_parse_summary_aux(summary, len, ext, title, file_time);
@@ -789,79 +921,88 @@ static void OLE_parse_summary(FILE *file, const uint32_t *fat, const unsigned in
   }
 }
 
-static void file_rename_doc(const char *old_filename)
+static void file_rename_doc(file_recovery_t *file_recovery)
 {
   const char *ext=NULL;
   char *title=NULL;
   FILE *file;
-  unsigned char buffer_header[512];
-  uint32_t *fat;
-  struct OLE_HDR *header=(struct OLE_HDR*)&buffer_header;
+  ole_file_t ole;
+  long int file_size;
+  const uint32_t *fat;
+  const struct OLE_HDR *header=(const struct OLE_HDR*)&ole.buffer_header;
   time_t file_time=0;
   unsigned int fat_entries;
-  if((file=fopen(old_filename, "rb"))==NULL)
+  if((file=fopen(file_recovery->filename, "rb"))==NULL)
     return;
 #ifdef DEBUG_OLE
-  log_info("file_rename_doc(%s)\n", old_filename);
+  log_info("file_rename_doc(%s)\n", file_recovery->filename);
 #endif
-  /*reads first sector including OLE header */
-  if(fseek(file, 0, SEEK_SET) < 0 ||
-      fread(&buffer_header, sizeof(buffer_header), 1, file) != 1)
+  if(fseek(file, 0, SEEK_END) < 0 || (file_size=ftell(file)) < 0)
   {
     fclose(file);
     return ;
   }
-  /* Sanity check */
-  if(le32(header->num_FAT_blocks)==0 ||
-      le32(header->num_extra_FAT_blocks)>50 ||
-      le32(header->num_FAT_blocks)>109+le32(header->num_extra_FAT_blocks)*((1<<le16(header->uSectorShift))-1))
+  if(OLE_open(&ole, file, NULL, file_size) < 0)
   {
+    OLE_close(&ole);
     fclose(file);
     return ;
   }
   if(le16(header->uSectorShift)==12)
   {
+    OLE_close(&ole);
     fclose(file);
     if(le32(header->csectDir)==1)
-      file_rename(old_filename, NULL, 0, 0, "max", 1);
+      file_rename(file_recovery, NULL, 0, 0, "max", 1);
     else
-      file_rename(old_filename, NULL, 0, 0, "qbb", 1);
+      file_rename(file_recovery, NULL, 0, 0, "qbb", 1);
     return ;
   }
-  if((fat=OLE_load_FAT(file, header))==NULL)
+  /* Reuse the FAT loaded by file_check_doc() */
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&ole_cache_mutex);
+#endif
+  if(ole_cache_fat!=NULL &&
+      ole_cache_size==(uint64_t)file_size &&
+      strcmp(ole_cache_filename, file_recovery->filename)==0 &&
+      memcmp(ole_cache_header, ole.buffer_header, sizeof(ole_cache_header))==0)
+  {
+    ole.fat=ole_cache_fat;
+    ole.fat_entries=(le32(header->num_FAT_blocks)<<ole.uSectorShift)/4;
+    ole_cache_fat=NULL;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&ole_cache_mutex);
+#endif
+  if(ole.fat==NULL && OLE_load_FAT(&ole) < 0)
   {
+    OLE_close(&ole);
     fclose(file);
     return ;
   }
-  fat_entries=(le32(header->num_FAT_blocks)==0 ?
-      109:
-      (le32(header->num_FAT_blocks)<<le16(header->uSectorShift))/4);
+  fat=ole.fat;
+  fat_entries=ole.fat_entries;
   {
     unsigned int ministream_block=0;
     unsigned int ministream_size=0;
     unsigned int block;
     unsigned int i;
+    unsigned char *chain=OLE_chain_new(&ole);
+    struct OLE_DIR *dir_entries=(struct OLE_DIR *)MALLOC(1<<ole.uSectorShift);
     /* FFFFFFFE = ENDOFCHAIN
-     * Use a loop count i to avoid endless loop */
+     * Stop when a block is used twice to avoid endless loop */
 #ifdef DEBUG_OLE
     log_info("root_start_block=%u, fat_entries=%u\n", le32(header->root_start_block), fat_entries);
 #endif
     for(block=le32(header->root_start_block), i=0;
-	block<fat_entries && block!=0xFFFFFFFE && i<fat_entries;
+	block<fat_entries && block!=0xFFFFFFFE && !OLE_chain_seen(chain, block);
 	block=le32(fat[block]), i++)
     {
-      struct OLE_DIR *dir_entries;
-      if(fseek(file, 512+(block<<le16(header->uSectorShift)), SEEK_SET)<0)
+      if(OLE_read_sector(&ole, block, dir_entries) < 0)
       {
-	free(fat);
-	fclose(file);
-	return ;
-      }
-      dir_entries=(struct OLE_DIR *)MALLOC(1<<le16(header->uSectorShift));
-      if(fread(dir_entries, (1<<le16(header->uSectorShift)), 1, file)!=1)
-      {
-	free(fat);
 	free(dir_entries);
+	free(chain);
+	OLE_close(&ole);
 	fclose(file);
 	return ;
       }
@@ -981,7 +1122,7 @@ static void file_rename_doc(const char *old_filename)
 	      case 40:
 		if(memcmp(dir_entry->name, SummaryInformation, 40)==0)
 		{
-		  OLE_parse_summary(file, fat, fat_entries, header,
+		  OLE_parse_summary(&ole,
 		      ministream_block, ministream_size,
 		      le32(dir_entry->start_block), le32(dir_entry->size),
 		      &ext, &title, &file_time);
@@ -1019,18 +1160,19 @@ static void file_rename_doc(const char *old_filename)
 	  }
 	}
       }
-      free(dir_entries);
     }
+    free(dir_entries);
+    free(chain);
   }
-  free(fat);
+  OLE_close(&ole);
   fclose(file);
   if(file_time!=0 && file_time!=(time_t)-1)
-    set_date(old_filename, file_time, file_time);
+    set_date(file_recovery->filename, file_time, file_time);
   if(title!=NULL)
   {
-    file_rename(old_filename, (const unsigned char*)title, strlen(title), 0, ext, 1);
+    file_rename(file_recovery, (const unsigned char*)title, strlen(title), 0, ext, 1);
     free(title);
   }
   else
-    file_rename(old_filename, NULL, 0, 0, ext, 1);
+    file_rename(file_recovery, NULL, 0, 0, ext, 1);
 }
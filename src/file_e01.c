@@ -98,17 +98,17 @@ static int header_check_e01(const unsigned char *buffer, const unsigned int buff
 
 static void file_check_e01(file_recovery_t *file_recovery)
 {
-  const unsigned char sig_done[16]={
+  static const unsigned char sig_done[16]={
     'd', 'o', 'n', 'e', 0x00, 0x00, 0x00, 0x00,
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
     };
-  const unsigned char sig_next[16]={
+  static const unsigned char sig_next[16]={
     'n', 'e', 'x', 't', 0x00, 0x00, 0x00, 0x00,
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
     };
-  file_search_footer(file_recovery, sig_next, sizeof(sig_next), 60);
-  if(file_recovery->file_size!=0)
-    return ;
-  file_recovery->file_size=file_recovery->file_size;
-  file_search_footer(file_recovery, sig_done, sizeof(sig_done), 60);
+  const file_footer_t footers[2]={
+    { sig_next, sizeof(sig_next) },
+    { sig_done, sizeof(sig_done) }
+  };
+  file_search_footers(file_recovery, footers, 2, 60);
 }
@@ -42,16 +42,16 @@ const file_hint_t file_hint_exs= {
   .register_header_check=&register_header_check_exs
 };
 
-static void file_rename_exs(const char *old_filename)
+static void file_rename_exs(file_recovery_t *file_recovery)
 {
   unsigned char buffer[512];
   FILE *file;
   int buffer_size;
-  if((file=fopen(old_filename, "rb"))==NULL)
+  if((file=fopen(file_recovery->filename, "rb"))==NULL)
     return;
   buffer_size=fread(buffer, 1, sizeof(buffer), file);
   fclose(file);
-  file_rename(old_filename, buffer, buffer_size, 0x14, "exs", 0);
+  file_rename(file_recovery, buffer, buffer_size, 0x14, "exs", 0);
 }
 
 static const unsigned char exs_header[8]=  {
@@ -56,7 +56,7 @@ alloc_data_t *file_found(alloc_data_t *current_search_space, const uint64_t offs
   if(current_search_space->start < offset && offset <= current_search_space->end)
   {
     alloc_data_t *next_search_space;
-    next_search_space=(alloc_data_t*)MALLOC(sizeof(*next_search_space));
+    next_search_space=(alloc_data_t*)pool_alloc(&alloc_data_pool);
     memcpy(next_search_space, current_search_space, sizeof(*next_search_space));
     current_search_space->end=offset-1;
     next_search_space->start=offset;
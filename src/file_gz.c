@@ -35,7 +35,7 @@
 
 static void register_header_check_gz(file_stat_t *file_stat);
 static int header_check_gz(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new);
-static void file_rename_gz(const char *old_filename);
+static void file_rename_gz(file_recovery_t *file_recovery);
 
 const file_hint_t file_hint_gz= {
   .extension="gz",
@@ -64,6 +64,256 @@ static const unsigned char gz_header_magic[3]= {0x1F, 0x8B, 0x08};
 #define GZ_FNAME	8
 #define GZ_FCOMMENT     0x10
 
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+/* Minimal deflate (RFC 1951) reader used to reject random data before
+ * calling zlib: it checks the first block header and, for Huffman coded
+ * blocks, the code tables and the first symbol. Nothing is allocated. */
+#define DEFLATE_MAXBITS	15
+#define DEFLATE_MAXLCODES	286
+#define DEFLATE_MAXDCODES	30
+#define DEFLATE_FIXLCODES	288
+
+typedef struct
+{
+  const unsigned char *buffer;
+  unsigned int size;
+  unsigned int bitpos;
+} deflate_bits_t;
+
+typedef struct
+{
+  uint16_t count[DEFLATE_MAXBITS+1];
+  uint16_t symbol[DEFLATE_FIXLCODES];
+} deflate_huffman_t;
+
+/* Returns the next nbr bits, -1 if the buffer is exhausted */
+static int deflate_getbits(deflate_bits_t *s, const unsigned int nbr)
+{
+  int val=0;
+  unsigned int i;
+  if(s->bitpos + nbr > 8 * s->size)
+    return -1;
+  for(i=0; i<nbr; i++, s->bitpos++)
+    val|=((s->buffer[s->bitpos>>3] >> (s->bitpos&7)) & 1) << i;
+  return val;
+}
+
+/* Returns 0 for a complete code, >0 if incomplete, <0 if over-subscribed */
+static int deflate_huffman_build(deflate_huffman_t *h, const unsigned char *length, const unsigned int n)
+{
+  uint16_t offs[DEFLATE_MAXBITS+1];
+  unsigned int len;
+  unsigned int symbol;
+  int left=1;
+  for(len=0; len<=DEFLATE_MAXBITS; len++)
+    h->count[len]=0;
+  for(symbol=0; symbol<n; symbol++)
+    h->count[length[symbol]]++;
+  if(h->count[0]==n)
+    return left;
+  for(len=1; len<=DEFLATE_MAXBITS; len++)
+  {
+    left<<=1;
+    left-=h->count[len];
+    if(left<0)
+      return left;
+  }
+  offs[1]=0;
+  for(len=1; len<DEFLATE_MAXBITS; len++)
+    offs[len+1]=offs[len]+h->count[len];
+  for(symbol=0; symbol<n; symbol++)
+    if(length[symbol]!=0)
+      h->symbol[offs[length[symbol]]++]=symbol;
+  return left;
+}
+
+/* Returns the decoded symbol, -1 if the buffer is exhausted, -2 for an invalid code */
+static int deflate_decode(deflate_bits_t *s, const deflate_huffman_t *h)
+{
+  int code=0;
+  int first=0;
+  int index=0;
+  unsigned int len;
+  for(len=1; len<=DEFLATE_MAXBITS; len++)
+  {
+    const int bit=deflate_getbits(s, 1);
+    const int count=h->count[len];
+    if(bit<0)
+      return -1;
+    code|=bit;
+    if(code - count < first)
+      return h->symbol[index + (code - first)];
+    index+=count;
+    first+=count;
+    first<<=1;
+    code<<=1;
+  }
+  return -2;
+}
+
+/* Returns 0 if the data can't be the start of a deflate stream */
+static int deflate_check_first_block(const unsigned char *buffer, const unsigned int size)
+{
+  static const unsigned char order[19]=
+  { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+  deflate_bits_t s;
+  deflate_huffman_t lencode;
+  unsigned char lengths[DEFLATE_FIXLCODES+DEFLATE_MAXDCODES];
+  int btype;
+  int symbol;
+  s.buffer=buffer;
+  s.size=size;
+  s.bitpos=0;
+  if(deflate_getbits(&s, 1) < 0)
+    return 1;
+  btype=deflate_getbits(&s, 2);
+  if(btype==0)
+  {
+    /* Stored block: LEN followed by its one's complement */
+    const unsigned int pos=(s.bitpos+7)>>3;
+    if(pos+4 > size)
+      return 1;
+    return ((buffer[pos] ^ buffer[pos+2])==0xff && (buffer[pos+1] ^ buffer[pos+3])==0xff);
+  }
+  if(btype==1)
+  {
+    unsigned int i;
+    for(i=0; i<144; i++)
+      lengths[i]=8;
+    for(; i<256; i++)
+      lengths[i]=9;
+    for(; i<280; i++)
+      lengths[i]=7;
+    for(; i<DEFLATE_FIXLCODES; i++)
+      lengths[i]=8;
+    deflate_huffman_build(&lencode, lengths, DEFLATE_FIXLCODES);
+  }
+  else if(btype==2)
+  {
+    deflate_huffman_t distcode;
+    const int nlen=deflate_getbits(&s, 5) + 257;
+    const int ndist=deflate_getbits(&s, 5) + 1;
+    const int ncode=deflate_getbits(&s, 4) + 4;
+    int index;
+    int err;
+    if(ncode<4)
+      return 1;
+    if(nlen > DEFLATE_MAXLCODES || ndist > DEFLATE_MAXDCODES)
+      return 0;
+    for(index=0; index<ncode; index++)
+    {
+      const int len=deflate_getbits(&s, 3);
+      if(len<0)
+	return 1;
+      lengths[order[index]]=len;
+    }
+    for(; index<19; index++)
+      lengths[order[index]]=0;
+    /* The code length code must be complete */
+    if(deflate_huffman_build(&lencode, lengths, 19)!=0)
+      return 0;
+    index=0;
+    while(index < nlen + ndist)
+    {
+      int len=0;
+      int rep;
+      symbol=deflate_decode(&s, &lencode);
+      if(symbol==-1)
+	return 1;
+      if(symbol<0)
+	return 0;
+      if(symbol<16)
+      {
+	lengths[index++]=symbol;
+	continue;
+      }
+      if(symbol==16)
+      {
+	if(index==0)
+	  return 0;
+	len=lengths[index-1];
+	rep=deflate_getbits(&s, 2);
+	rep=(rep<0 ? rep : 3 + rep);
+      }
+      else if(symbol==17)
+      {
+	rep=deflate_getbits(&s, 3);
+	rep=(rep<0 ? rep : 3 + rep);
+      }
+      else
+      {
+	rep=deflate_getbits(&s, 7);
+	rep=(rep<0 ? rep : 11 + rep);
+      }
+      if(rep<0)
+	return 1;
+      if(index + rep > nlen + ndist)
+	return 0;
+      while(rep-- > 0)
+	lengths[index++]=len;
+    }
+    /* End-of-block code is mandatory */
+    if(lengths[256]==0)
+      return 0;
+    /* Incomplete codes are only allowed for a single length-1 code */
+    err=deflate_huffman_build(&lencode, lengths, nlen);
+    if(err!=0 && (err<0 || nlen != lencode.count[0] + lencode.count[1]))
+      return 0;
+    err=deflate_huffman_build(&distcode, lengths + nlen, ndist);
+    if(err!=0 && (err<0 || ndist != distcode.count[0] + distcode.count[1]))
+      return 0;
+  }
+  else
+    return 0;
+  symbol=deflate_decode(&s, &lencode);
+  if(symbol==-1)
+    return 1;
+  /* There is nothing to copy from before the first literal */
+  if(symbol<0 || symbol>256)
+    return 0;
+  return 1;
+}
+
+/* Each thread has its own stream, it is allocated once and reset for
+ * each candidate. */
+typedef struct
+{
+  z_stream stream;
+  int init;
+} gz_context_t;
+
+static void gz_context_free(void *context)
+{
+  gz_context_t *ctx=(gz_context_t *)context;
+  if(ctx->init!=0)
+    inflateEnd(&ctx->stream);
+}
+
+static z_stream *gz_stream_reset(const unsigned char *buffer, const unsigned int size, unsigned char *out, const unsigned int out_size)
+{
+  gz_context_t *ctx=(gz_context_t *)file_handler_context(&file_hint_gz, sizeof(gz_context_t), &gz_context_free);
+  z_stream *gz_stream=&ctx->stream;
+  if(ctx->init==0)
+  {
+    gz_stream->zalloc = (alloc_func)0;
+    gz_stream->zfree = (free_func)0;
+    gz_stream->opaque = (voidpf)0;
+    gz_stream->next_in  = Z_NULL;
+    gz_stream->avail_in = 0;
+    if(inflateInit2(gz_stream, -MAX_WBITS)!=Z_OK)
+      return NULL;
+    ctx->init=1;
+  }
+  else if(inflateReset(gz_stream)!=Z_OK)
+    return NULL;
+  gz_stream->next_in  = (Bytef*)buffer;
+  gz_stream->avail_in = size;
+  gz_stream->next_out = out;
+  gz_stream->avail_out = out_size;
+  return gz_stream;
+}
+#endif
+
 static void register_header_check_gz(file_stat_t *file_stat)
 {
   register_header_check(0, gz_header_magic,sizeof(gz_header_magic), &header_check_gz, file_stat);
@@ -121,37 +371,21 @@ static int header_check_gz(const unsigned char *buffer, const unsigned int buffe
     unsigned char buffer_uncompr[512];
     const unsigned int comprLen=(buffer_size<512?buffer_size:512)-off;
     const unsigned int uncomprLen=512-1;
+    unsigned int total_out;
     int err;
-    z_stream d_stream; /* decompression stream */
-    d_stream.zalloc = (alloc_func)0;
-    d_stream.zfree = (free_func)0;
-    d_stream.opaque = (voidpf)0;
-
-    d_stream.next_in  = (Bytef*)buffer_compr;
-    d_stream.avail_in = 0;
-    d_stream.next_out = buffer_uncompr;
-
-    err = inflateInit2(&d_stream, -MAX_WBITS);
-    if(err!=Z_OK)
+    z_stream *gz_stream;
+    if(deflate_check_first_block(buffer_compr, comprLen)==0)
       return 0;
-    while (d_stream.total_out < uncomprLen && d_stream.total_in < comprLen) {
-      d_stream.avail_in = d_stream.avail_out = 1; /* force small buffers */
-      err = inflate(&d_stream, Z_NO_FLUSH);
-      if (err == Z_STREAM_END) break;
-      if(err!=Z_OK)
-      {
-	/* Decompression has failed, free ressources */
-	inflateEnd(&d_stream);
-	return 0;
-      }
-    }
-    err = inflateEnd(&d_stream);
-    if(err!=Z_OK)
+    if((gz_stream=gz_stream_reset(buffer_compr, comprLen, buffer_uncompr, uncomprLen))==NULL)
+      return 0;
+    err = inflate(gz_stream, Z_NO_FLUSH);
+    if(err!=Z_OK && err!=Z_STREAM_END)
       return 0;
+    total_out=gz_stream->total_out;
     /* Probably too small to be a file */
-    if(d_stream.total_out < 16)
+    if(total_out < 16)
       return 0;
-    buffer_uncompr[d_stream.total_out]='\0';
+    buffer_uncompr[total_out]='\0';
     reset_file_recovery(file_recovery_new);
     file_recovery_new->min_filesize=22;
     file_recovery_new->time=buffer[4]|(buffer[5]<<8)|(buffer[6]<<16)|(buffer[7]<<24);
@@ -193,7 +427,7 @@ static int header_check_gz(const unsigned char *buffer, const unsigned int buffe
     }
     {
       unsigned int i;
-      for(i=0; i<d_stream.total_out && i< 256; i++)
+      for(i=0; i<total_out && i< 256; i++)
       {
 	if(buffer_uncompr[i]=='<')
 	{
@@ -206,7 +440,7 @@ static int header_check_gz(const unsigned char *buffer, const unsigned int buffe
       }
     }
 #endif
-    if(d_stream.total_out>0x110 &&
+    if(total_out>0x110 &&
 	memcmp(&buffer_uncompr[0x101],tar_header_posix,sizeof(tar_header_posix))==0)
     {
 #ifdef DJGPP
@@ -227,12 +461,12 @@ static int header_check_gz(const unsigned char *buffer, const unsigned int buffe
   return 1;
 }
 
-static void file_rename_gz(const char *old_filename)
+static void file_rename_gz(file_recovery_t *file_recovery)
 {
   unsigned char buffer[512];
   FILE *file;
   int buffer_size;
-  if((file=fopen(old_filename, "rb"))==NULL)
+  if((file=fopen(file_recovery->filename, "rb"))==NULL)
     return;
   buffer_size=fread(buffer, 1, sizeof(buffer), file);
   fclose(file);
@@ -250,7 +484,7 @@ static void file_rename_gz(const char *old_filename)
     }
     if((flags&GZ_FNAME)!=0)
     {
-      file_rename(old_filename, buffer, buffer_size, off, NULL, 1);
+      file_rename(file_recovery, buffer, buffer_size, off, NULL, 1);
     }
   }
 }
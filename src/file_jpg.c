@@ -218,8 +218,7 @@ static void file_check_mpo(file_recovery_t *fr)
   do
   {
     offset+=2+size;
-    fseek(fr->handle, offset, SEEK_SET);
-    nbytes=fread(&buffer, 1, sizeof(buffer), fr->handle);
+    nbytes=file_content_read(fr, &buffer, sizeof(buffer), offset);
 //    log_info("file_check_mpo offset=%llu => nbytes=%d, buffer=%02x %02x\n",
 //    (long long unsigned)offset, nbytes, buffer[0], buffer[1]);
     /* 0xda SOS Start Of Scan */
@@ -661,8 +660,22 @@ struct jpeg_session_struct
   FILE *handle;
   unsigned int flags;
   unsigned int blocksize;
+  unsigned int scale_denom;	/* 1 or JPG_DC_SCALE */
+  jpeg_pool_t *pool;		/* kept between sessions */
 };
 
+/* At 1/8 scale, libjpeg only uses the DC coefficient of each 8x8 block:
+ * the entropy coded data is still fully decoded, so errors are detected
+ * as at full scale, but there is no IDCT and each block gives one pixel.
+ * The checks work on the blocks, jpg_block_size() is the number of
+ * pixels per block in the output. */
+#define JPG_DC_SCALE	8
+
+static inline unsigned int jpg_block_size(const struct jpeg_session_struct *jpeg_session)
+{
+  return 8 / jpeg_session->scale_denom;
+}
+
 static void jpeg_init_session(struct jpeg_session_struct *jpeg_session)
 {
   jpeg_session->frame=NULL;
@@ -673,6 +686,7 @@ static void jpeg_init_session(struct jpeg_session_struct *jpeg_session)
   jpeg_session->offset=0;
   jpeg_session->handle=NULL;
   jpeg_session->flags=0;
+  jpeg_session->scale_denom=1;
 }
 
 static void jpeg_session_delete(struct jpeg_session_struct *jpeg_session)
@@ -704,6 +718,11 @@ static inline void jpeg_session_suspend(struct jpeg_session_struct *jpeg_session
 static void jpeg_session_start(struct jpeg_session_struct *jpeg_session)
 {
   fseek(jpeg_session->handle, jpeg_session->offset, SEEK_SET);
+  if(jpeg_session->pool==NULL)
+    jpeg_session->pool=jpeg_pool_new();
+  /* jpeg_create_decompress() keeps client_data, the memory manager gets
+   * its pool from it */
+  jpeg_session->cinfo.client_data=jpeg_session->pool;
   jpeg_create_decompress(&jpeg_session->cinfo);
   jpeg_testdisk_src(&jpeg_session->cinfo, jpeg_session->handle, jpeg_session->offset, jpeg_session->blocksize);
   (void) jpeg_read_header(&jpeg_session->cinfo, TRUE);
@@ -712,6 +731,8 @@ static void jpeg_session_start(struct jpeg_session_struct *jpeg_session)
   jpeg_session->cinfo.dct_method = JDCT_FASTEST;
   jpeg_session->cinfo.do_block_smoothing = FALSE;
   jpeg_session->cinfo.do_fancy_upsampling = FALSE;
+  jpeg_session->cinfo.scale_num = 1;
+  jpeg_session->cinfo.scale_denom = jpeg_session->scale_denom;
   (void) jpeg_start_decompress(&jpeg_session->cinfo);
   jpeg_session->output_width=jpeg_session->cinfo.output_width;
   jpeg_session->output_height=jpeg_session->cinfo.output_height;
@@ -720,115 +741,157 @@ static void jpeg_session_start(struct jpeg_session_struct *jpeg_session)
   jpeg_session->frame=NULL;
 }
 
+#define JPG_MAX_OFFSETS	10240
+
+/* libjpeg objects of each thread, they must keep their value after a
+ * longjmp() and jpg_check_picture() resumes its session on checkpoint */
+typedef struct
+{
+  struct my_error_mgr xy_jerr;
+  struct jpeg_session_struct xy_session;
+  uint64_t xy_file_size_max;
+  struct my_error_mgr thumb_jerr;
+  unsigned int thumb_offsets[JPG_MAX_OFFSETS];
+  struct jpeg_session_struct thumb_session;
+  struct my_error_mgr picture_jerr;
+  unsigned int picture_offsets[JPG_MAX_OFFSETS];
+  struct jpeg_session_struct picture_session;
+  int picture_session_initialised;
+  /* The picture session can be resumed for this file at this offset */
+  const file_recovery_t *picture_checkpoint_recovery;
+  uint64_t picture_checkpoint_offset;
+  uint64_t picture_checkpoint_distance;
+  uint64_t thumb_error;
+} jpg_context_t;
+
+static void jpg_context_free(void *context)
+{
+  jpg_context_t *ctx=(jpg_context_t *)context;
+  if(ctx->picture_session_initialised!=0)
+    jpeg_session_delete(&ctx->picture_session);
+  jpeg_pool_free(ctx->xy_session.pool);
+  jpeg_pool_free(ctx->thumb_session.pool);
+  jpeg_pool_free(ctx->picture_session.pool);
+}
+
+static jpg_context_t *jpg_context(void)
+{
+  return (jpg_context_t *)file_handler_context(&file_hint_jpg, sizeof(jpg_context_t), &jpg_context_free);
+}
+
 static uint64_t jpg_xy_to_offset(FILE *infile, const unsigned int x, const unsigned y,
-    const uint64_t offset_rel1, const uint64_t offset_rel2, const uint64_t offset, const unsigned int blocksize)
+    const uint64_t offset_rel1, const uint64_t offset_rel2, const uint64_t offset, const unsigned int blocksize, const unsigned int scale_denom)
 {
-  static struct my_error_mgr jerr;
-  static uint64_t file_size_max;
-  static struct jpeg_session_struct jpeg_session;
+  jpg_context_t *ctx=jpg_context();
+  struct my_error_mgr *jerr=&ctx->xy_jerr;
+  uint64_t *file_size_max=&ctx->xy_file_size_max;
+  struct jpeg_session_struct *jpeg_session=&ctx->xy_session;
   unsigned int checkpoint_status=0;
   int avoid_leak=0;
-  jpeg_init_session(&jpeg_session);
-  jpeg_session.handle=infile;
-  jpeg_session.offset=offset;
-  jpeg_session.blocksize=blocksize;
-  file_size_max=(offset_rel1 + blocksize - (offset % blocksize) -1) / blocksize * blocksize;
+  jpeg_init_session(jpeg_session);
+  jpeg_session->handle=infile;
+  jpeg_session->offset=offset;
+  jpeg_session->blocksize=blocksize;
+  jpeg_session->scale_denom=scale_denom;
+  *file_size_max=(offset_rel1 + blocksize - (offset % blocksize) -1) / blocksize * blocksize;
 #ifdef DEBUG_JPEG
   log_info("jpg_xy_to_offset(infile, x=%u, y=%u, offset_rel1=%lu, offset_rel2=%lu)\n",
       x, y, (long unsigned)offset_rel1, (long unsigned)offset_rel2);
 #endif
-  jpeg_session.cinfo.err = jpeg_std_error(&jerr.pub);
-  jerr.pub.output_message = my_output_message;
-  jerr.pub.error_exit = my_error_exit;
+  jpeg_session->cinfo.err = jpeg_std_error(&jerr->pub);
+  jerr->pub.output_message = my_output_message;
+  jerr->pub.error_exit = my_error_exit;
   /* Establish the setjmp return context for my_error_exit to use. */
-  if (setjmp(jerr.setjmp_buffer)) 
+  if (setjmp(jerr->setjmp_buffer)) 
   {
-    if(jpeg_session.frame!=NULL && jpeg_session.cinfo.output_scanline >= y)
+    if(jpeg_session->frame!=NULL && jpeg_session->cinfo.output_scanline >= y)
     {
       int data=0;
       unsigned int i;
-      for(i=0; i< (jpeg_session.output_width-x) * jpeg_session.output_components; i++)
+      for(i=0; i< (jpeg_session->output_width-x) * jpeg_session->output_components; i++)
       {
-	if(jpeg_session.frame[x*jpeg_session.output_components+i]!=0x80)
+	if(jpeg_session->frame[x*jpeg_session->output_components+i]!=0x80)
 	  data=1;
       }
       if(data==1)
       {
-	jpeg_session_delete(&jpeg_session);
-	return offset + file_size_max;
+	jpeg_session_delete(jpeg_session);
+	return offset + *file_size_max;
       }
     }
-    file_size_max+=blocksize;
+    *file_size_max+=blocksize;
   }
-  while(file_size_max<offset_rel2)
+  while(*file_size_max<offset_rel2)
   {
-    if(checkpoint_status==0 || jpeg_session_resume(&jpeg_session)<0)
+    if(checkpoint_status==0 || jpeg_session_resume(jpeg_session)<0)
     {
       if(avoid_leak)
-	jpeg_session_delete(&jpeg_session);
-      jpeg_session_start(&jpeg_session);
-      jpeg_session.frame = (unsigned char *)MALLOC(jpeg_session.row_stride);
+	jpeg_session_delete(jpeg_session);
+      jpeg_session_start(jpeg_session);
+      jpeg_session->frame = (unsigned char *)MALLOC(jpeg_session->row_stride);
       avoid_leak=1;
     }
     {
       my_source_mgr * src;
-      src = (my_source_mgr *) jpeg_session.cinfo.src;
-      src->file_size_max=file_size_max;
+      src = (my_source_mgr *) jpeg_session->cinfo.src;
+      src->file_size_max=*file_size_max;
     }
     {
       my_source_mgr * src;
-      src = (my_source_mgr *) jpeg_session.cinfo.src;
-      while (jpeg_session.cinfo.output_scanline < jpeg_session.cinfo.output_height &&
-	  jpeg_session.cinfo.output_scanline < y)
+      src = (my_source_mgr *) jpeg_session->cinfo.src;
+      while (jpeg_session->cinfo.output_scanline < jpeg_session->cinfo.output_height &&
+	  jpeg_session->cinfo.output_scanline < y)
       {
 	JSAMPROW row_pointer[1];
-	row_pointer[0] = (unsigned char *)jpeg_session.frame;
-	(void)jpeg_read_scanlines(&jpeg_session.cinfo, row_pointer, 1);
+	row_pointer[0] = (unsigned char *)jpeg_session->frame;
+	(void)jpeg_read_scanlines(&jpeg_session->cinfo, row_pointer, 1);
       }
       if(src->file_size < src->file_size_max)
       {
-	jpeg_session_suspend(&jpeg_session);
+	jpeg_session_suspend(jpeg_session);
 	checkpoint_status=1;
       }
-      if(jpeg_session.cinfo.output_scanline < jpeg_session.cinfo.output_height)
+      if(jpeg_session->cinfo.output_scanline < jpeg_session->cinfo.output_height)
       {
 	JSAMPROW row_pointer[1];
 	unsigned int i;
-	row_pointer[0] = (unsigned char *)jpeg_session.frame;
+	row_pointer[0] = (unsigned char *)jpeg_session->frame;
 	/* 0x100/2=0x80, medium value */
-	memset(jpeg_session.frame, 0x80, jpeg_session.row_stride);
-	(void)jpeg_read_scanlines(&jpeg_session.cinfo, row_pointer, 1);
-	for(i=(x+1)*jpeg_session.output_components; i < jpeg_session.output_width * jpeg_session.output_components; i++)
+	memset(jpeg_session->frame, 0x80, jpeg_session->row_stride);
+	(void)jpeg_read_scanlines(&jpeg_session->cinfo, row_pointer, 1);
+	for(i=(x+1)*jpeg_session->output_components; i < jpeg_session->output_width * jpeg_session->output_components; i++)
 	{
-	  if(jpeg_session.frame[i]!=0x80)
+	  if(jpeg_session->frame[i]!=0x80)
 	  {
-	    (void) jpeg_finish_decompress(&jpeg_session.cinfo);
-	    jpeg_session_delete(&jpeg_session);
-	    return offset + file_size_max;
+	    (void) jpeg_finish_decompress(&jpeg_session->cinfo);
+	    jpeg_session_delete(jpeg_session);
+	    return offset + *file_size_max;
 	  }
 	}
       }
     }
-    file_size_max+=blocksize;
+    *file_size_max+=blocksize;
   }
 /*  Do not call jpeg_finish_decompress(&cinfo); to avoid an endless loop */
-  jpeg_session_delete(&jpeg_session);
+  jpeg_session_delete(jpeg_session);
   return offset + offset_rel2;
 }
 
-static unsigned int is_line_cut(const unsigned int output_scanline, const unsigned int output_width, const unsigned int output_components, const unsigned char *frame, const unsigned int y)
+static unsigned int is_line_cut(const unsigned int output_scanline, const unsigned int output_width, const unsigned int output_components, const unsigned char *frame, const unsigned int y, const unsigned int block)
 {
+  /* The last column of a block is compared with its neighbours */
+  const unsigned int x_start=(block > 1 ? block - 1 : 1);
   unsigned int result_x=0;
-  if(y+8 < output_scanline)
+  if(y+block < output_scanline)
   {
     unsigned int result_max=0;
     unsigned int x;
-    for(x=8 - 1; x < output_width; x+=8)
+    for(x=x_start; x < output_width; x+=block)
     {
       unsigned int result=0;
       unsigned int j;
       for(j=0;
-	  j<8 && y+j < output_scanline;
+	  j<block && y+j < output_scanline;
 	  j++)
       {
 	unsigned int c;
@@ -853,12 +916,12 @@ static unsigned int is_line_cut(const unsigned int output_scanline, const unsign
     const unsigned int end = output_width * output_components * output_scanline;
     unsigned int result_max=0;
     unsigned int x;
-    for(x=8 - 1; x < output_width; x+=8)
+    for(x=x_start; x < output_width; x+=block)
     {
       unsigned int result=0;
       unsigned int j;
       for(j=0;
-	  j<8 && y+j < output_scanline;
+	  j<block && y+j < output_scanline;
 	  j++)
       {
 	unsigned int c;
@@ -887,7 +950,7 @@ static unsigned int is_line_cut(const unsigned int output_scanline, const unsign
   return (output_width - result_x - 1);
 }
 
-static unsigned int jpg_find_border(const unsigned int output_scanline, const unsigned int output_width, const unsigned int output_components, const unsigned char *frame)
+static unsigned int jpg_find_border(const unsigned int output_scanline, const unsigned int output_width, const unsigned int output_components, const unsigned char *frame, const unsigned int block)
 {
   unsigned int y;
   unsigned int val=0;
@@ -895,16 +958,16 @@ static unsigned int jpg_find_border(const unsigned int output_scanline, const un
   log_info("jpg_find_border output_scanline=%u output_width=%u output_components=%u\n",
       output_scanline, output_width, output_components);
 #endif
-  /* TODO handle output_width%8!=0 */
-  if(output_width%8!=0)
+  /* TODO handle output_width%8!=0 at full scale */
+  if(output_width%block!=0 || output_scanline < 2*block)
     return output_scanline;
-  for(y=output_scanline-8; y>=8; y-=8)
+  for(y=output_scanline-block; y>=block; y-=block)
   {
     const unsigned int old_val=val;
-    val=is_line_cut(output_scanline, output_width, output_components, frame, y);
+    val=is_line_cut(output_scanline, output_width, output_components, frame, y, block);
     if(val==0)
     {
-      return y+8;
+      return y+block;
     }
     if(old_val!=0 && val!=old_val)
     {
@@ -914,11 +977,10 @@ static unsigned int jpg_find_border(const unsigned int output_scanline, const un
   return output_scanline;
 }
 
-#define JPG_MAX_OFFSETS	10240
-
 /* FIXME: it doesn handle correctly when there is a few extra sectors */
-static uint64_t jpg_find_error(FILE *handle, const unsigned int output_scanline, const unsigned int output_width, const unsigned int output_components, const unsigned char *frame, const unsigned int *offsets, const uint64_t offset, const unsigned int blocksize, const uint64_t checkpoint_offset)
+static uint64_t jpg_find_error(FILE *handle, const unsigned int output_scanline, const unsigned int output_width, const unsigned int output_components, const unsigned char *frame, const unsigned int *offsets, const uint64_t offset, const unsigned int blocksize, const uint64_t checkpoint_offset, const unsigned int scale_denom)
 {
+  const unsigned int block = 8 / scale_denom;
   const unsigned int row_stride = output_width * output_components;
   unsigned int result=0;
   unsigned int result_max=0;
@@ -928,29 +990,29 @@ static uint64_t jpg_find_error(FILE *handle, const unsigned int output_scanline,
   unsigned int i;
   unsigned int pos_new;
   unsigned int output_scanline_max;
-  if(output_scanline/8 >= JPG_MAX_OFFSETS)
+  if(output_scanline/block >= JPG_MAX_OFFSETS || output_scanline <= block)
     return 0;
-  output_scanline_max=jpg_find_border(output_scanline, output_width, output_components, frame);
-  for(i = 0, pos_new= 8 * row_stride;
+  output_scanline_max=jpg_find_border(output_scanline, output_width, output_components, frame, block);
+  for(i = 0, pos_new= block * row_stride;
       i < row_stride;
       i++, pos_new++)
   {
     result += abs(2 * frame[pos_new] - frame[pos_new - row_stride] - frame[pos_new + row_stride]);
   }
   result_x=0;
-  result_y=8;
+  result_y=block;
   result_max=result;
 
-  for(y=8; y+8 < output_scanline; y+=8)
+  for(y=block; y+block < output_scanline; y+=block)
   {
     unsigned int pos;
     for(i = 0,
 	pos = y * row_stride,
-	pos_new = (y + 8) * row_stride;
+	pos_new = (y + block) * row_stride;
 	i < row_stride;
 	i++, pos++, pos_new++)
     {
-      if(i % (8 * output_components)==0)
+      if(i % (block * output_components)==0)
       {
 	int stop=0;
 //	log_info("x %4u, y %4u: %6u\n", i/output_components, y, result);
@@ -977,19 +1039,19 @@ static uint64_t jpg_find_error(FILE *handle, const unsigned int output_scanline,
 	}
 #endif
 	if(stop==1
-	    && is_line_cut(output_scanline, output_width, output_components, frame, y))
+	    && is_line_cut(output_scanline, output_width, output_components, frame, y, block))
 	{
 	  uint64_t offset_rel1,offset_rel2;
 #ifdef DEBUG_JPEG
 	  log_info("x %4u, y %4u: %6u, result=%u, output_scanline_max=%u\n",
 	      result_x, result_y, result_max, result, output_scanline_max);
 #endif
-	  offset_rel1=offsets[result_y / 8];
-	  offset_rel2=offsets[result_y / 8 + 1];
+	  offset_rel1=offsets[result_y / block];
+	  offset_rel2=offsets[result_y / block + 1];
 	  if(offset_rel1 < offset_rel2)
 	    return jpg_xy_to_offset(handle, result_x, result_y,
-//		offset_rel1, offset_rel2, offset, blocksize);
-		offset_rel1, offset_rel2, offset, 512);
+//		offset_rel1, offset_rel2, offset, blocksize, scale_denom);
+		offset_rel1, offset_rel2, offset, 512, scale_denom);
 	  return offset + offset_rel2;
 	}
       }
@@ -1002,96 +1064,108 @@ static uint64_t jpg_find_error(FILE *handle, const unsigned int output_scanline,
 
 static uint64_t jpg_check_thumb(FILE *infile, const uint64_t offset, const unsigned int blocksize, const uint64_t checkpoint_offset, const unsigned int flags)
 {
-  static struct my_error_mgr jerr;
-  static unsigned int offsets[JPG_MAX_OFFSETS];
-  static struct jpeg_session_struct jpeg_session;
-  jpeg_init_session(&jpeg_session);
-  jpeg_session.flags=flags;
-  jpeg_session.handle=infile;
-  jpeg_session.offset=offset;
-  jpeg_session.blocksize=blocksize;
-  jpeg_session.cinfo.err = jpeg_std_error(&jerr.pub);
-  jerr.pub.output_message = my_output_message;
-  jerr.pub.error_exit = my_error_exit;
-  jerr.pub.emit_message= my_emit_message;
+  jpg_context_t *ctx=jpg_context();
+  struct my_error_mgr *jerr=&ctx->thumb_jerr;
+  unsigned int *offsets=ctx->thumb_offsets;
+  struct jpeg_session_struct *jpeg_session=&ctx->thumb_session;
+  jpeg_init_session(jpeg_session);
+  jpeg_session->flags=flags;
+  jpeg_session->handle=infile;
+  jpeg_session->offset=offset;
+  jpeg_session->blocksize=blocksize;
+  jpeg_session->scale_denom=JPG_DC_SCALE;
+  jpeg_session->cinfo.err = jpeg_std_error(&jerr->pub);
+  jerr->pub.output_message = my_output_message;
+  jerr->pub.error_exit = my_error_exit;
+  jerr->pub.emit_message= my_emit_message;
 #ifdef DEBUG_JPEG
-  jerr.pub.trace_level= 3;
+  jerr->pub.trace_level= 3;
 #endif
   /* Establish the setjmp return context for my_error_exit to use. */
-  if (setjmp(jerr.setjmp_buffer)) 
+  if (setjmp(jerr->setjmp_buffer)) 
   {
     /* If we get here, the JPEG code has signaled an error.
      * We need to clean up the JPEG object and return.
      */
     uint64_t offset_error;
     my_source_mgr * src;
-    src = (my_source_mgr *) jpeg_session.cinfo.src;
-    offset_error=jpeg_session.offset + src->file_size - src->pub.bytes_in_buffer;
-    if(jpeg_session.frame!=NULL && jpeg_session.flags!=0)
+    src = (my_source_mgr *) jpeg_session->cinfo.src;
+    offset_error=jpeg_session->offset + src->file_size - src->pub.bytes_in_buffer;
+    if(jpeg_session->frame!=NULL && jpeg_session->flags!=0)
     {
-      const uint64_t tmp=jpg_find_error(jpeg_session.handle, jpeg_session.cinfo.output_scanline, jpeg_session.output_width, jpeg_session.output_components, jpeg_session.frame, &offsets[0], jpeg_session.offset, blocksize, checkpoint_offset);
+      const uint64_t tmp=jpg_find_error(jpeg_session->handle, jpeg_session->cinfo.output_scanline, jpeg_session->output_width, jpeg_session->output_components, jpeg_session->frame, &offsets[0], jpeg_session->offset, blocksize, checkpoint_offset, jpeg_session->scale_denom);
 //      log_info("jpg_check_thumb jpeg corrupted near   %llu\n", offset_error);
       if(tmp !=0 && offset_error > tmp)
 	offset_error=tmp;
 //      log_info("jpg_check_thumb find_error estimation %llu\n", (long long unsigned)offset_error);
     }
-    jpeg_session_delete(&jpeg_session);
+    jpeg_session_delete(jpeg_session);
     return offset_error;
   }
-  memset(offsets, 0, sizeof(offsets));
-  jpeg_session_start(&jpeg_session);
-  jpeg_session.frame = (unsigned char*)MALLOC(jpeg_session.output_height * jpeg_session.row_stride);
+  memset(offsets, 0, sizeof(ctx->thumb_offsets));
+  jpeg_session_start(jpeg_session);
+  jpeg_session->frame = (unsigned char*)MALLOC(jpeg_session->output_height * jpeg_session->row_stride);
   /* 0x100/2=0x80, medium value */
-  memset(jpeg_session.frame, 0x80, jpeg_session.row_stride * jpeg_session.cinfo.output_height);
-  while (jpeg_session.cinfo.output_scanline < jpeg_session.cinfo.output_height)
+  memset(jpeg_session->frame, 0x80, jpeg_session->row_stride * jpeg_session->cinfo.output_height);
+  while (jpeg_session->cinfo.output_scanline < jpeg_session->cinfo.output_height)
   {
+    const unsigned int block=jpg_block_size(jpeg_session);
     JSAMPROW row_pointer[1];
     my_source_mgr * src;
-    src = (my_source_mgr *) jpeg_session.cinfo.src;
+    src = (my_source_mgr *) jpeg_session->cinfo.src;
     src->offset_ok=src->file_size - src->pub.bytes_in_buffer;
-    if(jpeg_session.cinfo.output_scanline/8 < JPG_MAX_OFFSETS && offsets[jpeg_session.cinfo.output_scanline/8]==0)
-      offsets[jpeg_session.cinfo.output_scanline/8]=src->file_size - src->pub.bytes_in_buffer;
+    if(jpeg_session->cinfo.output_scanline/block < JPG_MAX_OFFSETS && offsets[jpeg_session->cinfo.output_scanline/block]==0)
+      offsets[jpeg_session->cinfo.output_scanline/block]=src->file_size - src->pub.bytes_in_buffer;
     // Calculate where this line needs to go.
-    row_pointer[0] = (unsigned char *)jpeg_session.frame + jpeg_session.cinfo.output_scanline * jpeg_session.row_stride;
-    (void)jpeg_read_scanlines(&jpeg_session.cinfo, row_pointer, 1);
+    row_pointer[0] = (unsigned char *)jpeg_session->frame + jpeg_session->cinfo.output_scanline * jpeg_session->row_stride;
+    (void)jpeg_read_scanlines(&jpeg_session->cinfo, row_pointer, 1);
   }
-  (void) jpeg_finish_decompress(&jpeg_session.cinfo);
-  jpeg_session_delete(&jpeg_session);
+  (void) jpeg_finish_decompress(&jpeg_session->cinfo);
+  jpeg_session_delete(jpeg_session);
   return 0;
 }
 
 static void jpg_check_picture(file_recovery_t *file_recovery)
 {
-  static struct my_error_mgr jerr;
-  static unsigned int offsets[JPG_MAX_OFFSETS];
+  jpg_context_t *ctx=jpg_context();
+  struct my_error_mgr *jerr=&ctx->picture_jerr;
+  unsigned int *offsets=ctx->picture_offsets;
   uint64_t jpeg_size=0;
-  static struct jpeg_session_struct jpeg_session;
-  static int jpeg_session_initialised=0;
-  if(file_recovery->checkpoint_status==0)
+  struct jpeg_session_struct *jpeg_session=&ctx->picture_session;
+  /* Only the session suspended for this file can be resumed, the file may
+   * have been checked by another thread */
+  const int resume=(file_recovery->checkpoint_status==1 &&
+      ctx->picture_session_initialised==1 &&
+      ctx->picture_checkpoint_recovery==file_recovery &&
+      ctx->picture_checkpoint_offset==file_recovery->checkpoint_offset &&
+      jpeg_session->handle==file_recovery->handle);
+  if(resume==0)
   {
-    if(jpeg_session_initialised==1)
-      jpeg_session_delete(&jpeg_session);
-    jpeg_init_session(&jpeg_session);
-    jpeg_session.flags=file_recovery->flags;
-    jpeg_session_initialised=1;
-    jpeg_session.blocksize=file_recovery->blocksize;
+    if(ctx->picture_session_initialised==1)
+      jpeg_session_delete(jpeg_session);
+    jpeg_init_session(jpeg_session);
+    jpeg_session->flags=file_recovery->flags;
+    ctx->picture_session_initialised=1;
+    jpeg_session->blocksize=file_recovery->blocksize;
+    jpeg_session->scale_denom=JPG_DC_SCALE;
+    file_recovery->checkpoint_status=0;
   }
-  jpeg_session.handle=file_recovery->handle;
-  jpeg_session.cinfo.err = jpeg_std_error(&jerr.pub);
-  jerr.pub.output_message = my_output_message;
-  jerr.pub.error_exit = my_error_exit;
-  jerr.pub.emit_message= my_emit_message;
+  jpeg_session->handle=file_recovery->handle;
+  jpeg_session->cinfo.err = jpeg_std_error(&jerr->pub);
+  jerr->pub.output_message = my_output_message;
+  jerr->pub.error_exit = my_error_exit;
+  jerr->pub.emit_message= my_emit_message;
 #ifdef DEBUG_JPEG
-  jerr.pub.trace_level= 3;
+  jerr->pub.trace_level= 3;
 #endif
   /* Establish the setjmp return context for my_error_exit to use. */
-  if (setjmp(jerr.setjmp_buffer)) 
+  if (setjmp(jerr->setjmp_buffer)) 
   {
     /* If we get here, the JPEG code has signaled an error.
      * We need to clean up the JPEG object and return.
      */
     my_source_mgr * src;
-    src = (my_source_mgr *) jpeg_session.cinfo.src;
+    src = (my_source_mgr *) jpeg_session->cinfo.src;
     jpeg_size=src->file_size;
     if(src->pub.bytes_in_buffer >= 4)
       jpeg_size-=src->pub.bytes_in_buffer;
@@ -1105,10 +1179,10 @@ static void jpg_check_picture(file_recovery_t *file_recovery)
 	(long long unsigned)file_recovery->offset_error);
 #endif
 #if 1
-    if(jpeg_session.frame!=NULL && jpeg_session.flags!=0)
+    if(jpeg_session->frame!=NULL && jpeg_session->flags!=0)
     {
       uint64_t offset_error;
-      offset_error=jpg_find_error(jpeg_session.handle, jpeg_session.cinfo.output_scanline, jpeg_session.output_width, jpeg_session.output_components, jpeg_session.frame, &offsets[0], jpeg_session.offset, jpeg_session.blocksize, file_recovery->checkpoint_offset);
+      offset_error=jpg_find_error(jpeg_session->handle, jpeg_session->cinfo.output_scanline, jpeg_session->output_width, jpeg_session->output_components, jpeg_session->frame, &offsets[0], jpeg_session->offset, jpeg_session->blocksize, file_recovery->checkpoint_offset, jpeg_session->scale_denom);
       if(offset_error !=0 && file_recovery->offset_error > offset_error)
 	file_recovery->offset_error=offset_error;
 #ifdef DEBUG_JPEG
@@ -1118,56 +1192,99 @@ static void jpg_check_picture(file_recovery_t *file_recovery)
 #endif
     }
 #endif
-    jpeg_session_delete(&jpeg_session);
+    if(file_recovery->checkpoint_status==1)
+    {
+      /* Keep the frame and the suspended session for the next check */
+      jpeg_destroy_decompress(&jpeg_session->cinfo);
+    }
+    else
+      jpeg_session_delete(jpeg_session);
     return;
   }
-  memset(offsets, 0, sizeof(offsets));
-  jpeg_session_start(&jpeg_session);
+  if(resume!=0 && jpeg_session_resume(jpeg_session)==0)
   {
-    my_source_mgr * src;
-    src = (my_source_mgr *) jpeg_session.cinfo.src;
-    src->file_size_max=file_recovery->file_size;
+    /* Forget the rows decoded after the checkpoint during the previous check */
+    const unsigned int scanline=jpeg_session->cinfo.output_scanline;
+    const unsigned int block_row=(scanline + jpg_block_size(jpeg_session) - 1) / jpg_block_size(jpeg_session);
+    if(jpeg_session->flags!=0)
+      memset(jpeg_session->frame + scanline * jpeg_session->row_stride, 0x80,
+	  (jpeg_session->output_height + 1 - scanline) * jpeg_session->row_stride);
+    if(block_row < JPG_MAX_OFFSETS)
+      memset(&offsets[block_row], 0, (JPG_MAX_OFFSETS - block_row) * sizeof(offsets[0]));
   }
-  /* Image is very big, skip some tests */
-  if(jpeg_session.output_height * jpeg_session.row_stride > 500 * 1024 * 1024)
-    jpeg_session.flags=0;
-  /* 0x100/2=0x80, medium value */
-  if(jpeg_session.flags==0)
+  else
   {
-    jpeg_session.frame = (unsigned char *)MALLOC(jpeg_session.row_stride);
-    memset(jpeg_session.frame, 0x80, jpeg_session.row_stride);
+    if(resume!=0)
+    {
+      free(jpeg_session->frame);
+      jpeg_session->frame=NULL;
+      file_recovery->checkpoint_status=0;
+    }
+    ctx->picture_checkpoint_recovery=NULL;
+    ctx->picture_checkpoint_distance=(uint64_t)-1;
+    memset(offsets, 0, sizeof(ctx->picture_offsets));
+    jpeg_session_start(jpeg_session);
+    /* Image is very big, skip some tests */
+    if(jpeg_session->output_height * jpeg_session->row_stride > 500 * 1024 * 1024)
+      jpeg_session->flags=0;
+    /* 0x100/2=0x80, medium value */
+    if(jpeg_session->flags==0)
+    {
+      jpeg_session->frame = (unsigned char *)MALLOC(jpeg_session->row_stride);
+      memset(jpeg_session->frame, 0x80, jpeg_session->row_stride);
+    }
+    else
+    {
+      /* FIXME out of bound read access in libjpeg-turbo */
+      jpeg_session->frame = (unsigned char *)MALLOC((jpeg_session->output_height+1) * jpeg_session->row_stride);
+      memset(jpeg_session->frame, 0x80, (jpeg_session->cinfo.output_height+1) * jpeg_session->row_stride);
+    }
   }
-  else
   {
-    /* FIXME out of bound read access in libjpeg-turbo */
-    jpeg_session.frame = (unsigned char *)MALLOC((jpeg_session.output_height+1) * jpeg_session.row_stride);
-    memset(jpeg_session.frame, 0x80, (jpeg_session.cinfo.output_height+1) * jpeg_session.row_stride);
+    my_source_mgr * src;
+    src = (my_source_mgr *) jpeg_session->cinfo.src;
+    src->file_size_max=file_recovery->file_size;
   }
-  while (jpeg_session.cinfo.output_scanline < jpeg_session.cinfo.output_height)
+  while (jpeg_session->cinfo.output_scanline < jpeg_session->cinfo.output_height)
   {
+    const unsigned int block=jpg_block_size(jpeg_session);
     JSAMPROW row_pointer[1];
     my_source_mgr * src;
-    src = (my_source_mgr *) jpeg_session.cinfo.src;
+    src = (my_source_mgr *) jpeg_session->cinfo.src;
     src->offset_ok=src->file_size - src->pub.bytes_in_buffer;
-    if(jpeg_session.cinfo.output_scanline/8 < JPG_MAX_OFFSETS && offsets[jpeg_session.cinfo.output_scanline/8]==0)
+    if(jpeg_session->cinfo.output_scanline/block < JPG_MAX_OFFSETS && offsets[jpeg_session->cinfo.output_scanline/block]==0)
     {
-      offsets[jpeg_session.cinfo.output_scanline/8]=src->file_size - src->pub.bytes_in_buffer;
+      offsets[jpeg_session->cinfo.output_scanline/block]=src->file_size - src->pub.bytes_in_buffer;
+    }
+    /* The data before checkpoint_offset doesn't change between the checks
+     * of the brute force, suspend the session when getting closer to it so
+     * the next check resumes from there instead of the beginning */
+    if(file_recovery->checkpoint_offset > 0 &&
+	src->file_size <= file_recovery->checkpoint_offset &&
+	2 * (file_recovery->checkpoint_offset - src->file_size) < ctx->picture_checkpoint_distance)
+    {
+      jpeg_session_suspend(jpeg_session);
+      ctx->picture_checkpoint_distance=file_recovery->checkpoint_offset - src->file_size;
+      ctx->picture_checkpoint_recovery=file_recovery;
+      ctx->picture_checkpoint_offset=file_recovery->checkpoint_offset;
+      file_recovery->checkpoint_status=1;
     }
   // Calculate where this line needs to go.
-    if(jpeg_session.flags==0)
-      row_pointer[0] = jpeg_session.frame;
+    if(jpeg_session->flags==0)
+      row_pointer[0] = jpeg_session->frame;
     else
-      row_pointer[0] = (unsigned char *)jpeg_session.frame + jpeg_session.cinfo.output_scanline * jpeg_session.row_stride;
-    (void)jpeg_read_scanlines(&jpeg_session.cinfo, row_pointer, 1);
+      row_pointer[0] = (unsigned char *)jpeg_session->frame + jpeg_session->cinfo.output_scanline * jpeg_session->row_stride;
+    (void)jpeg_read_scanlines(&jpeg_session->cinfo, row_pointer, 1);
   }
   {
     my_source_mgr * src;
-    src = (my_source_mgr *) jpeg_session.cinfo.src;
+    src = (my_source_mgr *) jpeg_session->cinfo.src;
     jpeg_size=src->file_size - src->pub.bytes_in_buffer;
   }
-  (void) jpeg_finish_decompress(&jpeg_session.cinfo);
-  jpeg_session_delete(&jpeg_session);
-  jpeg_session_initialised=0;
+  (void) jpeg_finish_decompress(&jpeg_session->cinfo);
+  jpeg_session_delete(jpeg_session);
+  ctx->picture_session_initialised=0;
+  ctx->picture_checkpoint_recovery=NULL;
   file_recovery->checkpoint_status=0;
   if(jpeg_size<=0)
     return;
@@ -1487,7 +1604,9 @@ static uint64_t jpg_check_structure(file_recovery_t *file_recovery, const unsign
 static void file_check_jpg(file_recovery_t *file_recovery)
 {
   uint64_t thumb_offset;
-  static uint64_t thumb_error=0;
+#if defined(HAVE_LIBJPEG) && defined(HAVE_JPEGLIB_H)
+  jpg_context_t *ctx=jpg_context();
+#endif
   /* FIXME REMOVE ME */
   file_recovery->flags=1;
   file_recovery->file_size=0;
@@ -1506,26 +1625,26 @@ static void file_check_jpg(file_recovery_t *file_recovery)
 #endif
 #if defined(HAVE_LIBJPEG) && defined(HAVE_JPEGLIB_H)
   if(thumb_offset!=0 &&
-      (file_recovery->checkpoint_status==0 || thumb_error!=0) &&
+      (file_recovery->checkpoint_status==0 || ctx->thumb_error!=0) &&
       (file_recovery->offset_error==0 || thumb_offset < file_recovery->offset_error))
   {
 #ifdef DEBUG_JPEG
     log_info("jpg_check_thumb\n");
 #endif
-    thumb_error=jpg_check_thumb(file_recovery->handle, thumb_offset, file_recovery->blocksize, file_recovery->checkpoint_offset, file_recovery->flags);
-    if(thumb_error!=0)
+    ctx->thumb_error=jpg_check_thumb(file_recovery->handle, thumb_offset, file_recovery->blocksize, file_recovery->checkpoint_offset, file_recovery->flags);
+    if(ctx->thumb_error!=0)
     {
 #ifdef DEBUG_JPEG
       log_info("%s thumb corrupted at %llu, previous error at %llu\n",
-	  file_recovery->filename, (long long unsigned)thumb_error,
+	  file_recovery->filename, (long long unsigned)ctx->thumb_error,
 	  (long long unsigned)file_recovery->offset_error);
 #endif
-      if(file_recovery->offset_error==0 || file_recovery->offset_error > thumb_error)
+      if(file_recovery->offset_error==0 || file_recovery->offset_error > ctx->thumb_error)
       {
 #ifdef DEBUG_JPEG
-	log_info("Thumb usefull, error at %llu\n", (long long unsigned)thumb_error);
+	log_info("Thumb usefull, error at %llu\n", (long long unsigned)ctx->thumb_error);
 #endif
-	file_recovery->offset_error = thumb_error;
+	file_recovery->offset_error = ctx->thumb_error;
       }
     }
   }
@@ -193,6 +193,7 @@ static int header_check_mkv(const unsigned char *buffer, const unsigned int buff
 #endif
       file_recovery_new->data_check=&data_check_size;
       file_recovery_new->file_check=&file_check_size;
+      file_recovery_new->trusted_size=file_recovery_new->calculated_file_size;
     }
   }
   return 1;
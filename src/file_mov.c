@@ -80,11 +80,11 @@ struct atom64_struct
   uint64_t size;
 } __attribute__ ((__packed__));
 
-static void file_rename_mov(const char *old_filename)
+static void file_rename_mov(file_recovery_t *file_recovery)
 {
   FILE *file;
   unsigned char buffer[512];
-  if((file=fopen(old_filename, "rb"))==NULL)
+  if((file=fopen(file_recovery->filename, "rb"))==NULL)
     return;
   if(fread(&buffer,sizeof(buffer),1,file)!=1)
   {
@@ -93,7 +93,7 @@ static void file_rename_mov(const char *old_filename)
   }
   fclose(file);
   buffer[8]='\0';
-  file_rename(old_filename, buffer, sizeof(buffer), 4, NULL, 1);
+  file_rename(file_recovery, buffer, sizeof(buffer), 4, NULL, 1);
 }
 
 static int header_check_mov(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new)
@@ -287,6 +287,9 @@ static int data_check_mov(const unsigned char *buffer, const unsigned int buffer
 	(buffer[i+4]=='w' && buffer[i+5]=='i' && buffer[i+6]=='d' && buffer[i+7]=='e') )
     {
       file_recovery->calculated_file_size+=atom_size;
+      /* mdat holds the media data, there is no need to look inside */
+      if(buffer[i+4]=='m' && buffer[i+5]=='d' && buffer[i+6]=='a' && buffer[i+7]=='t')
+	file_recovery->trusted_size=file_recovery->calculated_file_size;
     }
     else
     {
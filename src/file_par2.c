@@ -64,11 +64,11 @@ static int data_check_par2(const unsigned char *buffer, const unsigned int buffe
   return 1;
 }
 
-static void file_rename_par2(const char *old_filename)
+static void file_rename_par2(file_recovery_t *file_recovery)
 {
   FILE *file;
   uint64_t offset=0;
-  if((file=fopen(old_filename, "rb"))==NULL)
+  if((file=fopen(file_recovery->filename, "rb"))==NULL)
     return;
   while(1)
   {
@@ -95,7 +95,7 @@ static void file_rename_par2(const char *old_filename)
     }
     if(memcmp(&buffer[0x30], "PAR 2.0\0FileDesc", 16)==0)
     {
-      file_rename(old_filename, buffer,
+      file_rename(file_recovery, buffer,
 	  (length < buffer_size ? length : buffer_size),
 	  0x78, NULL, 1);
       fclose(file);
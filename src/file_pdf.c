@@ -73,7 +73,7 @@ static int hex(int c)
   return -1;
 }
 
-static void file_rename_pdf(const char *old_filename)
+static void file_rename_pdf(file_recovery_t *file_recovery)
 {
   char title[512];
   const unsigned char pattern[6]={ '/', 'T', 'i', 't', 'l', 'e' };
@@ -84,7 +84,7 @@ static void file_rename_pdf(const char *old_filename)
   unsigned int j;
   int bsize;
   const unsigned char utf16[3]= { 0xfe, 0xff, 0x00};
-  if((handle=fopen(old_filename, "rb"))==NULL)
+  if((handle=fopen(file_recovery->filename, "rb"))==NULL)
     return;
   if(fseek(handle, 0, SEEK_END)<0)
   {
@@ -182,7 +182,7 @@ static void file_rename_pdf(const char *old_filename)
       (memcmp(&title[j-5], ".docx", 5)==0 ||
        memcmp(&title[j-5], ".xlsx", 5)==0))
     j-=5;
-  file_rename(old_filename, title, j, 0, NULL, 1);
+  file_rename(file_recovery, title, j, 0, NULL, 1);
   free(buffer);
 }
 
@@ -239,12 +239,7 @@ static void file_check_pdf_and_size(file_recovery_t *file_recovery)
     int i;
     int taille;
     file_recovery->file_size=file_recovery->calculated_file_size;
-    if(fseek(file_recovery->handle,file_recovery->file_size-read_size,SEEK_SET)<0)
-    {
-      file_recovery->file_size=0;
-      return ;
-    }
-    taille=fread(buffer,1,read_size,file_recovery->handle);
+    taille=file_content_read(file_recovery, buffer, read_size, file_recovery->file_size-read_size);
     for(i=taille-4;i>=0;i--)
     {
       if(buffer[i]=='%' && buffer[i+1]=='E' && buffer[i+2]=='O' && buffer[i+3]=='F')
@@ -271,16 +266,11 @@ static void file_date_pdf(file_recovery_t *file_recovery)
   uint64_t offset=0;
   unsigned int j=0;
   unsigned char*buffer=(unsigned char*)MALLOC(4096);
-  if(fseek(file_recovery->handle, 0, SEEK_SET)<0)
-  {
-    free(buffer);
-    return ;
-  }
   while(offset < file_recovery->file_size)
   {
     int i;
     int bsize;
-    if((bsize=fread(buffer, 1, 4096, file_recovery->handle))<=0)
+    if((bsize=file_content_read(file_recovery, buffer, 4096, offset))<=0)
     {
       free(buffer);
       return ;
@@ -293,12 +283,7 @@ static void file_date_pdf(file_recovery_t *file_recovery)
 	{
 	  const unsigned char *date_asc;
 	  struct tm tm_time;
-	  if(fseek(file_recovery->handle, offset+i+1, SEEK_SET)<0)
-	  {
-	    free(buffer);
-	    return ;
-	  }
-	  if(fread(buffer, 1, 22, file_recovery->handle) < 22)
+	  if(file_content_read(file_recovery, buffer, 22, offset+i+1) < 22)
 	  {
 	    free(buffer);
 	    return ;
@@ -36,6 +36,7 @@
 #include <ctype.h>
 #include "types.h"
 #include "filegen.h"
+#include "crc.h"
 
 extern const file_hint_t file_hint_doc;
 
@@ -43,6 +44,7 @@ static void register_header_check_png(file_stat_t *file_stat);
 static int header_check_png(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new);
 static int data_check_png(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery);
 static int data_check_mng(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery);
+static void file_check_png(file_recovery_t *file_recovery);
 
 const file_hint_t file_hint_png= {
   .extension="png",
@@ -73,7 +75,7 @@ static int header_check_png(const unsigned char *buffer, const unsigned int buff
     file_recovery_new->extension="jng";
     file_recovery_new->calculated_file_size=8;
     file_recovery_new->data_check=&data_check_png;
-    file_recovery_new->file_check=&file_check_size;
+    file_recovery_new->file_check=&file_check_png;
     return 1;
   }
   if(memcmp(buffer,mng_header,sizeof(mng_header))==0)
@@ -82,7 +84,7 @@ static int header_check_png(const unsigned char *buffer, const unsigned int buff
     file_recovery_new->extension="mng";
     file_recovery_new->calculated_file_size=8;
     file_recovery_new->data_check=&data_check_mng;
-    file_recovery_new->file_check=&file_check_size;
+    file_recovery_new->file_check=&file_check_png;
     return 1;
   }
   /* SolidWorks files contains a png */
@@ -97,15 +99,65 @@ static int header_check_png(const unsigned char *buffer, const unsigned int buff
     file_recovery_new->extension=file_hint_png.extension;
     file_recovery_new->calculated_file_size=8;
     file_recovery_new->data_check=&data_check_png;
-    file_recovery_new->file_check=&file_check_size;
+    file_recovery_new->file_check=&file_check_png;
     return 1;
   }
   return 0;
 }
 
+/* Add the bytes of the current chunk available in the buffer to its CRC.
+   Returns 0 if the CRC doesn't match, 1 if more data is needed,
+   2 if the chunk has been verified or there is nothing to verify */
+static int png_check_crc(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
+{
+  const uint64_t buffer_end=file_recovery->file_size + buffer_size/2;
+  const uint64_t crc_offset=file_recovery->calculated_file_size - 4;
+  if(file_recovery->data_crc_offset==0 ||
+      file_recovery->data_crc_offset + buffer_size/2 < file_recovery->file_size)
+  {
+    file_recovery->data_crc_offset=0;
+    return 2;
+  }
+  if(file_recovery->data_crc_offset < crc_offset)
+  {
+    const uint64_t end=(crc_offset < buffer_end ? crc_offset : buffer_end);
+    const unsigned int i=file_recovery->data_crc_offset + buffer_size/2 - file_recovery->file_size;
+    file_recovery->data_crc=get_crc32(&buffer[i], end - file_recovery->data_crc_offset, file_recovery->data_crc);
+    file_recovery->data_crc_offset=end;
+  }
+  if(crc_offset + 4 > buffer_end)
+    return 1;
+  {
+    const unsigned int i=crc_offset + buffer_size/2 - file_recovery->file_size;
+    const uint32_t crc=((uint32_t)buffer[i]<<24)+(buffer[i+1]<<16)+(buffer[i+2]<<8)+buffer[i+3];
+    file_recovery->data_crc_offset=0;
+    if(crc != (file_recovery->data_crc ^ 0xFFFFFFFF))
+    {
+      file_recovery->offset_error=crc_offset;
+      return 0;
+    }
+  }
+  return 2;
+}
+
+/* Start the CRC of the chunk beginning at buffer[i], it covers the chunk
+   type and data */
+static int png_start_crc(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery, const unsigned int i)
+{
+  file_recovery->data_crc=0xFFFFFFFF;
+  file_recovery->data_crc_offset=file_recovery->file_size + i + 4 - buffer_size/2;
+  return png_check_crc(buffer, buffer_size, file_recovery);
+}
+
 static int data_check_mng(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
 {
   static const unsigned char mng_footer[4]= {'M','E','N','D'};
+  if(file_recovery->verify_crc>0)
+  {
+    const int res=png_check_crc(buffer, buffer_size, file_recovery);
+    if(res!=2)
+      return (res==0 ? 2 : 1);
+  }
   while(file_recovery->calculated_file_size + buffer_size/2  >= file_recovery->file_size &&
       file_recovery->calculated_file_size + 8 < file_recovery->file_size + buffer_size/2)
   {
@@ -115,12 +167,24 @@ static int data_check_mng(const unsigned char *buffer, const unsigned int buffer
     file_recovery->calculated_file_size+=12;
     if(memcmp(&buffer[i+4], mng_footer, sizeof(mng_footer))==0)
       return 2;
+    if(file_recovery->verify_crc>0)
+    {
+      const int res=png_start_crc(buffer, buffer_size, file_recovery, i);
+      if(res!=2)
+	return (res==0 ? 2 : 1);
+    }
   }
   return 1;
 }
 
 static int data_check_png(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
 {
+  if(file_recovery->verify_crc>0)
+  {
+    const int res=png_check_crc(buffer, buffer_size, file_recovery);
+    if(res!=2)
+      return (res==0 ? 2 : 1);
+  }
   while(file_recovery->calculated_file_size + buffer_size/2  >= file_recovery->file_size &&
       file_recovery->calculated_file_size + 8 < file_recovery->file_size + buffer_size/2)
   {
@@ -140,7 +204,24 @@ static int data_check_png(const unsigned char *buffer, const unsigned int buffer
     {
       return 2;
     }
+    if(file_recovery->verify_crc>0)
+    {
+      const int res=png_start_crc(buffer, buffer_size, file_recovery, i);
+      if(res!=2)
+	return (res==0 ? 2 : 1);
+    }
   }
   return 1;
 }
 
+static void file_check_png(file_recovery_t *file_recovery)
+{
+  /* A chunk CRC mismatch has been found by data_check */
+  if(file_recovery->offset_error > 0)
+  {
+    file_recovery->file_size=0;
+    return;
+  }
+  file_check_size(file_recovery);
+}
+
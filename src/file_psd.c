@@ -51,7 +51,6 @@ const file_hint_t file_hint_psd= {
 };
 
 static const unsigned char psd_header[6]={'8', 'B', 'P', 'S', 0x00, 0x01};
-static uint64_t psd_image_data_size_max=0;
 
 static void register_header_check_psd(file_stat_t *file_stat)
 {
@@ -126,13 +125,6 @@ static int psd_skip_image_resources(const unsigned char *buffer, const unsigned
 
 static int psd_skip_color_mode(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
 {
-  psd_image_data_size_max=(buffer[buffer_size/2+12]<<8 | buffer[buffer_size/2+13]) *
-    (buffer[buffer_size/2+14]<<24 | buffer[buffer_size/2+15] <<16 | buffer[buffer_size/2+16]<<8 | buffer[buffer_size/2+17]) *
-    (buffer[buffer_size/2+18]<<24 | buffer[buffer_size/2+19] <<16 | buffer[buffer_size/2+20]<<8 | buffer[buffer_size/2+21]) *
-    buffer[buffer_size/2+23] / 8;
-#ifdef DEBUG_PSD
-  log_info("psd_image_data_size_max %lu\n", (long unsigned)psd_image_data_size_max);
-#endif
   while(file_recovery->calculated_file_size + buffer_size/2  >= file_recovery->file_size &&
       file_recovery->calculated_file_size + 16 < file_recovery->file_size + buffer_size/2)
   {
@@ -152,8 +144,25 @@ static int psd_skip_color_mode(const unsigned char *buffer, const unsigned int b
 
 static void file_check_psd(file_recovery_t *file_recovery)
 {
+  unsigned char buffer[0x1a];
+  uint64_t psd_image_data_size_max;
   if(file_recovery->file_size < file_recovery->calculated_file_size)
+  {
     file_recovery->file_size=0;
-  else if(file_recovery->file_size > file_recovery->calculated_file_size + psd_image_data_size_max)
+    return ;
+  }
+  /* The header is read again from the file, file_check may be run
+   * after the header of another file has been found */
+  if(fseek(file_recovery->handle, 0, SEEK_SET) < 0 ||
+      fread(buffer, sizeof(buffer), 1, file_recovery->handle) != 1)
+    return ;
+  psd_image_data_size_max=(uint64_t)(buffer[12]<<8 | buffer[13]) *
+    (buffer[14]<<24 | buffer[15] <<16 | buffer[16]<<8 | buffer[17]) *
+    (buffer[18]<<24 | buffer[19] <<16 | buffer[20]<<8 | buffer[21]) *
+    buffer[23] / 8;
+#ifdef DEBUG_PSD
+  log_info("psd_image_data_size_max %lu\n", (long unsigned)psd_image_data_size_max);
+#endif
+  if(file_recovery->file_size > file_recovery->calculated_file_size + psd_image_data_size_max)
     file_recovery->file_size=file_recovery->calculated_file_size + psd_image_data_size_max;
 }
@@ -55,12 +55,12 @@ static void register_header_check_pzh(file_stat_t *file_stat)
   register_header_check(0x9c4, pzh_header, sizeof(pzh_header), &header_check_pzh, file_stat);
 }
 
-static void file_rename_pzh(const char *old_filename)
+static void file_rename_pzh(file_recovery_t *file_recovery)
 {
   unsigned char buffer[512];
   FILE *file;
   int buffer_size;
-  if((file=fopen(old_filename, "rb"))==NULL)
+  if((file=fopen(file_recovery->filename, "rb"))==NULL)
     return;
   if(fseek(file, 0x9ce, SEEK_SET)<0)
   {
@@ -70,7 +70,7 @@ static void file_rename_pzh(const char *old_filename)
   buffer_size=fread(buffer, 1, sizeof(buffer), file);
   fclose(file);
   if(buffer_size > 0)
-    file_rename(old_filename, buffer, buffer_size, 0, "pzh", 0);
+    file_rename(file_recovery, buffer, buffer_size, 0, "pzh", 0);
 }
 
 static int header_check_pzh(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new)
@@ -33,7 +33,7 @@
 
 static void register_header_check_r3d(file_stat_t *file_stat);
 static int header_check_r3d(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new);
-static void file_rename_r3d(const char *old_filename);
+static void file_rename_r3d(file_recovery_t *file_recovery);
 
 const file_hint_t file_hint_r3d= {
   .extension="r3d",
@@ -67,13 +67,13 @@ static int header_check_r3d(const unsigned char *buffer, const unsigned int buff
   return 0;
 }
 
-static void file_rename_r3d(const char *old_filename)
+static void file_rename_r3d(file_recovery_t *file_recovery)
 {
   unsigned char buffer[512];
   FILE *file;
   int buffer_size;
   unsigned int i;
-  if((file=fopen(old_filename, "rb"))==NULL)
+  if((file=fopen(file_recovery->filename, "rb"))==NULL)
     return;
   buffer_size=fread(buffer, 1, sizeof(buffer), file);
   fclose(file);
@@ -84,5 +84,5 @@ static void file_rename_r3d(const char *old_filename)
     if(!isalnum(buffer[i]) && buffer[i]!='_')
       return ;
   }
-  file_rename(old_filename, buffer, i, 0x43, NULL, 1);
+  file_rename(file_recovery, buffer, i, 0x43, NULL, 1);
 }
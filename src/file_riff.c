@@ -183,7 +183,10 @@ static int data_check_avi(const unsigned char *buffer, const unsigned int buffer
     unsigned int i=file_recovery->calculated_file_size - file_recovery->file_size + buffer_size/2;
     const riff_chunk_header *chunk_header=(const riff_chunk_header*)&buffer[i];
     if(memcmp(&buffer[i], "RIFF", 4)==0 && memcmp(&buffer[i+8], "AVIX", 4)==0)
+    {
       file_recovery->calculated_file_size += 8 + le32(chunk_header->dwSize);
+      file_recovery->trusted_size=file_recovery->calculated_file_size;
+    }
     else
       return 2;
   }
@@ -247,6 +250,8 @@ static int header_check_riff(const unsigned char *buffer, const unsigned int buf
       {
 	file_recovery_new->data_check=&data_check_avi;
 	file_recovery_new->file_check=&file_check_avi;
+	if(memcmp(&buffer[12],"LIST",4)==0 && memcmp(&buffer[20],"hdrl",4)==0)
+	  file_recovery_new->trusted_size=file_recovery_new->calculated_file_size;
       }
       return 1;
     }
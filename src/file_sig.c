@@ -42,7 +42,7 @@
 #include "log.h"
 
 static void register_header_check_sig(file_stat_t *file_stat);
-static int header_check_sig(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new);
+static int header_check_sig(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new, const file_check_t *file_check);
 
 const file_hint_t file_hint_sig= {
   .extension="custom",
@@ -58,35 +58,212 @@ const file_hint_t file_hint_sig= {
 #define DOT_PHOTOREC_SIG "/.photorec.sig"
 #define PHOTOREC_SIG "photorec.sig"
 
+/* Each line of photorec.sig is "extension offset signature":
+ * - offset is a number or a range min-max,
+ * - signature is made of 'c', "string" and 0x hexadecimal values,
+ *   ?? in hexadecimal values or ? alone matches any byte.
+ * Custom signatures are registered like the built-in formats with their
+ * longest run of fixed bytes, once per offset. header_check_sig() gets
+ * the offset where this run has matched and finds the signature through
+ * a hash of its first bytes, its cost depends neither on the number of
+ * signatures nor on the number of offsets. */
+#define SIG_MAX_OFFSETS	512
+#define SIG_KEY_SIZE	4
+#define SIG_HASH_SIZE	4096
+
 typedef struct signature_s signature_t;
 struct signature_s
 {
-  const char *extension;
+  char *extension;
   unsigned char *sig;
+  unsigned char *mask;		/* 0 for any byte, NULL if all bytes are fixed */
   unsigned int sig_size;
   unsigned int offset;
+  unsigned int offset_max;
+  unsigned int anchor;		/* Longest run of fixed bytes */
+  unsigned int anchor_size;
+  unsigned int fixed;		/* Number of fixed bytes */
+  unsigned int line;
   signature_t *next;
 };
 
+/* A signature at one of its offsets */
+typedef struct sig_placement_s sig_placement_t;
+struct sig_placement_s
+{
+  const signature_t *signature;
+  unsigned int offset;
+  sig_placement_t *next;
+};
+
 static signature_t *signatures=NULL;
-static void signature_insert(const char *extension, unsigned int offset, unsigned char *sig, unsigned int sig_size)
+static sig_placement_t *sig_hash[SIG_HASH_SIZE];
+
+static unsigned int sig_key_size(const signature_t *sig)
 {
-  /* FIXME: small memory leak */
-  signature_t *newsig=(signature_t*)MALLOC(sizeof(*newsig));
-  newsig->extension=extension;
-  newsig->sig=sig;
-  newsig->sig_size=sig_size;
-  newsig->offset=offset;
-  newsig->next=signatures;
-  signatures=newsig;
+  return (sig->anchor_size < SIG_KEY_SIZE ? sig->anchor_size : SIG_KEY_SIZE);
 }
 
-static int header_check_sig(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new)
+static unsigned int sig_hash_key(const unsigned int offset, const unsigned char *key, const unsigned int size)
 {
-  signature_t *sig;
-  for(sig=signatures; sig!=NULL; sig=sig->next)
+  unsigned int hash=offset*31+size;
+  unsigned int i;
+  for(i=0; i<size; i++)
+    hash=hash*257+key[i];
+  return hash%SIG_HASH_SIZE;
+}
+
+static int signature_match(const signature_t *sig, const unsigned char *buffer)
+{
+  unsigned int i;
+  if(sig->mask==NULL)
+    return (memcmp(buffer, sig->sig, sig->sig_size)==0);
+  for(i=0; i<sig->sig_size; i++)
+    if(sig->mask[i]!=0 && buffer[i]!=sig->sig[i])
+      return 0;
+  return 1;
+}
+
+/* signature_covers()
+ * @returns 1 if a matches every data matched by b */
+static int signature_covers(const signature_t *a, const unsigned int offset_a, const signature_t *b, const unsigned int offset_b)
+{
+  unsigned int i;
+  if(offset_a < offset_b || offset_a + a->sig_size > offset_b + b->sig_size)
+    return 0;
+  for(i=0; i<a->sig_size; i++)
+  {
+    const unsigned int j=offset_a - offset_b + i;
+    if(a->mask!=NULL && a->mask[i]==0)
+      continue;
+    if((b->mask!=NULL && b->mask[j]==0) || a->sig[i]!=b->sig[j])
+      return 0;
+  }
+  return 1;
+}
+
+/* signature_place()
+ * Add the signature at offset to the hash table
+ * @returns -1 if it's a duplicate, 0 if another signature has already
+ * registered the same bytes, 1 if it must be registered.
+ * *overlap is set to another signature matching the same data. */
+static int signature_place(const signature_t *sig, const unsigned int offset, const signature_t **overlap)
+{
+  const unsigned int key_offset=offset + sig->anchor;
+  const unsigned int key_size=sig_key_size(sig);
+  const unsigned int hash=sig_hash_key(key_offset, &sig->sig[sig->anchor], key_size);
+  sig_placement_t **prev=&sig_hash[hash];
+  sig_placement_t *new_placement;
+  sig_placement_t *placement;
+  int res=1;
+  for(placement=sig_hash[hash]; placement!=NULL; placement=placement->next)
+  {
+    const signature_t *other=placement->signature;
+    int covered;
+    int covers;
+    if(placement->offset + other->anchor != key_offset ||
+	sig_key_size(other) != key_size ||
+	memcmp(&other->sig[other->anchor], &sig->sig[sig->anchor], key_size)!=0)
+      continue;
+    covered=signature_covers(other, placement->offset, sig, offset);
+    covers=signature_covers(sig, offset, other, placement->offset);
+    if(covered && covers && placement->offset==offset &&
+	other->offset==sig->offset && other->offset_max==sig->offset_max)
+    {
+      *overlap=other;
+      return -1;
+    }
+    if((covered || covers) && *overlap==NULL)
+      *overlap=other;
+    if(other->anchor_size==sig->anchor_size &&
+	memcmp(&other->sig[other->anchor], &sig->sig[sig->anchor], sig->anchor_size)==0)
+      res=0;
+  }
+  /* The signatures with the most fixed bytes are tested first */
+  while(*prev!=NULL && (*prev)->signature->fixed >= sig->fixed)
+    prev=&(*prev)->next;
+  new_placement=(sig_placement_t *)MALLOC(sizeof(*new_placement));
+  new_placement->signature=sig;
+  new_placement->offset=offset;
+  new_placement->next=*prev;
+  *prev=new_placement;
+  return res;
+}
+
+static void signature_free(signature_t *sig)
+{
+  free(sig->extension);
+  free(sig->sig);
+  free(sig->mask);
+  free(sig);
+}
+
+static void signatures_free(void)
+{
+  unsigned int i;
+  while(signatures!=NULL)
+  {
+    signature_t *next=signatures->next;
+    signature_free(signatures);
+    signatures=next;
+  }
+  for(i=0; i<SIG_HASH_SIZE; i++)
   {
-    if(memcmp(&buffer[sig->offset], sig->sig, sig->sig_size)==0)
+    while(sig_hash[i]!=NULL)
+    {
+      sig_placement_t *next=sig_hash[i]->next;
+      free(sig_hash[i]);
+      sig_hash[i]=next;
+    }
+  }
+}
+
+/* signature_insert()
+ * @returns 0 if the signature has been added, -1 if it's a duplicate */
+static int signature_insert(file_stat_t *file_stat, signature_t *sig, unsigned int *nbr_overlaps)
+{
+  const signature_t *overlap=NULL;
+  unsigned int offset;
+  for(offset=sig->offset; offset<=sig->offset_max; offset++)
+  {
+    const int res=signature_place(sig, offset, &overlap);
+    if(res<0)
+    {
+      log_warning("photorec.sig line %u: %s signature is a duplicate of line %u, ignored\n",
+	  sig->line, sig->extension, overlap->line);
+      return -1;
+    }
+    if(res>0)
+      register_header_check_match(offset + sig->anchor, &sig->sig[sig->anchor], sig->anchor_size, &header_check_sig, file_stat);
+  }
+  if(overlap!=NULL)
+  {
+    log_info("photorec.sig line %u: %s signature overlaps %s signature line %u\n",
+	sig->line, sig->extension, overlap->extension, overlap->line);
+    (*nbr_overlaps)++;
+  }
+  sig->next=signatures;
+  signatures=sig;
+  return 0;
+}
+
+static int header_check_sig(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new, const file_check_t *file_check)
+{
+  /* The longest run of fixed bytes of a signature is at file_check->offset */
+  const unsigned int key_offset=file_check->offset;
+  const unsigned int key_size=(file_check->length < SIG_KEY_SIZE ? file_check->length : SIG_KEY_SIZE);
+  const sig_placement_t *placement;
+  if(key_offset + key_size > buffer_size)
+    return 0;
+  for(placement=sig_hash[sig_hash_key(key_offset, &buffer[key_offset], key_size)];
+      placement!=NULL;
+      placement=placement->next)
+  {
+    const signature_t *sig=placement->signature;
+    if(placement->offset + sig->anchor == key_offset &&
+	sig_key_size(sig) == key_size &&
+	placement->offset + sig->sig_size <= buffer_size &&
+	signature_match(sig, &buffer[placement->offset]))
     {
       reset_file_recovery(file_recovery_new);
       file_recovery_new->extension=sig->extension;
@@ -184,8 +361,104 @@ static char *str_uint(char *src, unsigned int *resptr)
 
 }
 
-static char *parse_signature_file(file_stat_t *file_stat, char *pos)
+typedef struct
+{
+  unsigned char *sig;
+  unsigned char *mask;
+  unsigned int size;
+  unsigned int max_size;
+  unsigned int wildcards;
+} sig_buffer_t;
+
+static int sig_buffer_add(sig_buffer_t *buf, const unsigned int val, const int wildcard)
+{
+  if(buf->size==buf->max_size)
+  {
+    unsigned char *tmp;
+    buf->max_size*=2;
+    tmp=(unsigned char *)realloc(buf->sig, buf->max_size);
+    if(tmp==NULL)
+      return -1;
+    buf->sig=tmp;
+    tmp=(unsigned char *)realloc(buf->mask, buf->max_size);
+    if(tmp==NULL)
+      return -1;
+    buf->mask=tmp;
+  }
+  buf->sig[buf->size]=(wildcard ? 0 : val);
+  buf->mask[buf->size]=(wildcard ? 0 : 1);
+  buf->size++;
+  if(wildcard)
+    buf->wildcards++;
+  return 0;
+}
+
+static unsigned int sig_escape(const char c)
+{
+  switch(c)
+  {
+    case 'b':	return '\b';
+    case 'n':	return '\n';
+    case 'r':	return '\r';
+    case 't':	return '\t';
+    case '0':	return '\0';
+    default:	return (unsigned char)c;
+  }
+}
+
+static unsigned int sig_hex(const char c)
+{
+  if(c>='0' && c<='9')
+    return c-'0';
+  if(c>='A' && c<='F')
+    return c-'A'+10;
+  return c-'a'+10;
+}
+
+static signature_t *signature_new(char *extension, const unsigned int offset, const unsigned int offset_max, sig_buffer_t *buf, const unsigned int line)
+{
+  signature_t *sig;
+  unsigned int i;
+  unsigned int run=0;
+  sig=(signature_t *)MALLOC(sizeof(*sig));
+  sig->extension=extension;
+  sig->sig=(unsigned char *)MALLOC(buf->size);
+  memcpy(sig->sig, buf->sig, buf->size);
+  if(buf->wildcards>0)
+  {
+    sig->mask=(unsigned char *)MALLOC(buf->size);
+    memcpy(sig->mask, buf->mask, buf->size);
+  }
+  else
+    sig->mask=NULL;
+  sig->sig_size=buf->size;
+  sig->offset=offset;
+  sig->offset_max=offset_max;
+  sig->anchor=0;
+  sig->anchor_size=0;
+  sig->fixed=buf->size - buf->wildcards;
+  sig->line=line;
+  sig->next=NULL;
+  for(i=0; i<buf->size; i++)
+  {
+    if(buf->mask[i]==0)
+      run=0;
+    else
+    {
+      run++;
+      if(run > sig->anchor_size)
+      {
+	sig->anchor=i+1-run;
+	sig->anchor_size=run;
+      }
+    }
+  }
+  return sig;
+}
+
+static char *parse_signature_file(file_stat_t *file_stat, char *pos, unsigned int *nbr_signatures, unsigned int *nbr_duplicates, unsigned int *nbr_overlaps)
 {
+  unsigned int line=1;
   while(*pos!='\0')
   {
     /* skip comments */
@@ -196,184 +469,161 @@ static char *parse_signature_file(file_stat_t *file_stat, char *pos)
       if(*pos=='\0')
 	return pos;
       pos++;
+      line++;
     }
     /* each line is composed of "extension offset signature" */
     {
       char *extension;
       unsigned int offset=0;
-      unsigned char *tmp=NULL;
-      unsigned int signature_max_size=512;
-      unsigned int signature_size=0;
+      unsigned int offset_max;
+      sig_buffer_t buf;
       {
 	const char *extension_start=pos;
 	while(*pos!='\0' && !isspace(*pos))
 	  pos++;
 	if(*pos=='\0')
 	  return pos;
+	if(*pos=='\n')
+	  line++;
 	*pos='\0';
 	extension=strdup(extension_start);
 	pos++;
       }
       /* skip space */
       while(isspace(*pos))
+      {
+	if(*pos=='\n')
+	  line++;
 	pos++;
-      /* read offset */
+      }
+      /* read offset or offset range */
       pos=str_uint(pos, &offset);
-      /* read signature */
-      tmp=(unsigned char *)MALLOC(signature_max_size);
-      while(*pos!='\n' && *pos!='\0')
+      offset_max=offset;
+      if(*pos=='-')
       {
-	if(signature_size==signature_max_size)
+	pos=str_uint(pos+1, &offset_max);
+	if(offset_max < offset || offset_max - offset >= SIG_MAX_OFFSETS)
 	{
-	  unsigned char *tmp_old=tmp;
-	  signature_max_size*=2;
-	  tmp=(unsigned char *)realloc(tmp, signature_max_size);
-	  if(tmp==NULL)
-	  {
-	    free(extension);
-	    free(tmp_old);
-	    return pos;
-	  }
+	  log_error("photorec.sig line %u: invalid offset range %u-%u for %s\n",
+	      line, offset, offset_max, extension);
+	  free(extension);
+	  return pos;
 	}
+      }
+      /* read signature */
+      buf.max_size=512;
+      buf.size=0;
+      buf.wildcards=0;
+      buf.sig=(unsigned char *)MALLOC(buf.max_size);
+      buf.mask=(unsigned char *)MALLOC(buf.max_size);
+      while(*pos!='\n' && *pos!='\0')
+      {
+	int err=0;
 	if(isspace(*pos) || *pos=='\r' || *pos==',')
 	  pos++;
+	else if(*pos=='?')
+	{
+	  err=sig_buffer_add(&buf, 0, 1);
+	  pos++;
+	}
 	else if(*pos== '\'')
 	{
 	  pos++;
 	  if(*pos=='\0')
-	  {
-	    free(extension);
-	    return pos;
-	  }
+	    err=-1;
 	  else if(*pos=='\\')
 	  {
 	    pos++;
 	    if(*pos=='\0')
+	      err=-1;
+	    else
 	    {
-	      free(extension);
-	      return pos;
+	      err=sig_buffer_add(&buf, sig_escape(*pos), 0);
+	      pos++;
 	    }
-	    else if(*pos=='b')
-	      tmp[signature_size++]='\b';
-	    else if(*pos=='n')
-	      tmp[signature_size++]='\n';
-	    else if(*pos=='t')
-	      tmp[signature_size++]='\t';
-	    else if(*pos=='r')
-	      tmp[signature_size++]='\r';
-	    else if(*pos=='0')
-	      tmp[signature_size++]='\0';
-	    else
-	      tmp[signature_size++]=*pos;
-	    pos++;
 	  }
 	  else
 	  {
-	    tmp[signature_size++]=*pos;
+	    err=sig_buffer_add(&buf, (unsigned char)*pos, 0);
 	    pos++;
 	  }
-	  if(*pos!='\'')
-	  {
-	    free(extension);
-	    return pos;
-	  }
-	  pos++;
+	  if(err==0 && *pos!='\'')
+	    err=-1;
+	  else if(err==0)
+	    pos++;
 	}
 	else if(*pos=='"')
 	{
 	  pos++;
-	  for(; *pos!='"' && *pos!='\0'; pos++)
+	  for(; err==0 && *pos!='"' && *pos!='\0'; pos++)
 	  {
-	    if(signature_size==signature_max_size)
-	    {
-	      unsigned char *tmp_old=tmp;
-	      signature_max_size*=2;
-	      tmp=(unsigned char *)realloc(tmp, signature_max_size);
-	      if(tmp==NULL)
-	      {
-		free(extension);
-		free(tmp_old);
-		return pos;
-	      }
-	    }
 	    if(*pos=='\\')
 	    {
 	      pos++;
 	      if(*pos=='\0')
-	      {
-		free(extension);
-		return pos;
-	      }
-	      else if(*pos=='b')
-		tmp[signature_size++]='\b';
-	      else if(*pos=='n')
-		tmp[signature_size++]='\n';
-	      else if(*pos=='r')
-		tmp[signature_size++]='\r';
-	      else if(*pos=='t')
-		tmp[signature_size++]='\t';
-	      else if(*pos=='0')
-		tmp[signature_size++]='\0';
+		err=-1;
 	      else
-		tmp[signature_size++]=*pos;
+		err=sig_buffer_add(&buf, sig_escape(*pos), 0);
 	    }
 	    else
-	      tmp[signature_size++]=*pos;;
+	      err=sig_buffer_add(&buf, (unsigned char)*pos, 0);
 	  }
-	  if(*pos!='"')
-	  {
-	    free(extension);
-	    return pos;
-	  }
-	  pos++;
+	  if(err==0 && *pos!='"')
+	    err=-1;
+	  else if(err==0)
+	    pos++;
 	}
 	else if(*pos=='0' && (*(pos+1)=='x' || *(pos+1)=='X'))
 	{
 	  pos+=2;
-	  while(isxdigit(*pos) && isxdigit(*(pos+1)))
+	  while(err==0 &&
+	      ((isxdigit(*pos) && isxdigit(*(pos+1))) || (*pos=='?' && *(pos+1)=='?')))
 	  {
-	    unsigned int val=(*pos);
-	    if(*pos>='0' && *pos<='9')
-	      val-='0';
-	    else if(*pos>='A' && *pos<='F')
-	      val=val-'A'+10;
-	    else if(*pos>='a' && *pos<='f')
-	      val=val-'a'+10;
-	    pos++;
-	    val*=16;
-	    val+=(*pos);
-	    if(*pos>='0' && *pos<='9')
-	      val-='0';
-	    else if(*pos>='A' && *pos<='F')
-	      val=val-'A'+10;
-	    else if(*pos>='a' && *pos<='f')
-	      val=val-'a'+10;
-	    pos++;
-	    tmp[signature_size++]=val;
+	    if(*pos=='?')
+	      err=sig_buffer_add(&buf, 0, 1);
+	    else
+	      err=sig_buffer_add(&buf, sig_hex(*pos)*16+sig_hex(*(pos+1)), 0);
+	    pos+=2;
 	  }
 	}
 	else
+	  err=-1;
+	if(err<0)
 	{
 	  free(extension);
+	  free(buf.sig);
+	  free(buf.mask);
 	  return pos;
 	}
       }
       if(*pos=='\n')
+      {
 	pos++;
-      if(signature_size>0)
+	line++;
+      }
+      if(buf.size>0 && buf.wildcards==buf.size)
+      {
+	log_error("photorec.sig line %u: %s signature has no fixed byte, ignored\n",
+	    line-1, extension);
+	free(extension);
+      }
+      else if(buf.size>0)
       {
-	/* FIXME: Small memory leak */
-	unsigned char *signature=(unsigned char *)MALLOC(signature_size);
-	log_info("register a signature for %s\n", extension);
-	memcpy(signature, tmp, signature_size);
-	register_header_check(offset, signature, signature_size, &header_check_sig, file_stat);
-	signature_insert(extension, offset, signature, signature_size);
+	signature_t *sig=signature_new(extension, offset, offset_max, &buf, line-1);
+	if(signature_insert(file_stat, sig, nbr_overlaps)<0)
+	{
+	  signature_free(sig);
+	  (*nbr_duplicates)++;
+	}
+	else
+	  (*nbr_signatures)++;
       }
       else
       {
 	free(extension);
       }
-      free(tmp);
+      free(buf.sig);
+      free(buf.mask);
     }
   }
   return pos;
@@ -386,6 +636,11 @@ static void register_header_check_sig(file_stat_t *file_stat)
   off_t buffer_size;
   struct stat stat_rec;
   FILE *handle;
+  unsigned int nbr_signatures=0;
+  unsigned int nbr_duplicates=0;
+  unsigned int nbr_overlaps=0;
+  /* Signatures from a previous recovery */
+  signatures_free();
   handle=open_signature_file();
   if(!handle)
     return;
@@ -404,12 +659,14 @@ static void register_header_check_sig(file_stat_t *file_stat)
   fclose(handle);
   buffer[buffer_size]='\0';
   pos=buffer;
-  pos=parse_signature_file(file_stat, pos);
+  pos=parse_signature_file(file_stat, pos, &nbr_signatures, &nbr_duplicates, &nbr_overlaps);
   if(*pos!='\0')
   {
     log_warning("Can't parse signature: %s\n", pos);
   }
   free(buffer);
+  log_info("%u custom signatures registered, %u duplicates ignored, %u overlaps\n",
+      nbr_signatures, nbr_duplicates, nbr_overlaps);
 }
 
 
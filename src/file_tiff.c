@@ -1077,10 +1077,9 @@ static uint64_t header_check_tiff_be(file_recovery_t *fr, const uint32_t tiff_di
 
 void file_check_tiff(file_recovery_t *fr)
 {
-  static uint64_t calculated_file_size=0;
+  uint64_t calculated_file_size=0;
   unsigned char *buffer=(unsigned char *)MALLOC(8192);
   int data_read;
-  calculated_file_size = 0;
   if(fseek(fr->handle, 0, SEEK_SET) < 0 ||
       (data_read=fread(buffer, 1, 8192, fr->handle)) < (int)sizeof(TIFFHeader))
   {
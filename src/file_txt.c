@@ -381,7 +381,7 @@ int UTF2Lat(unsigned char *buffer_lower, const unsigned char *buffer, const int
 static int data_check_html(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
 {
   unsigned int i;
-  char *buffer_lower=(char *)MALLOC(buffer_size+16);
+  char *buffer_lower=(char *)file_handler_scratch(&file_hint_txt, buffer_size+16);
   i=UTF2Lat((unsigned char*)buffer_lower, &buffer[buffer_size/2], buffer_size/2);
   if(i<buffer_size/2)
   {
@@ -394,10 +394,8 @@ static int data_check_html(const unsigned char *buffer, const unsigned int buffe
     }
     else if(i>=10)
       file_recovery->calculated_file_size=file_recovery->file_size+i;
-    free(buffer_lower);
     return 2;
   }
-  free(buffer_lower);
   file_recovery->calculated_file_size=file_recovery->file_size+(buffer_size/2);
   return 1;
 }
@@ -405,16 +403,14 @@ static int data_check_html(const unsigned char *buffer, const unsigned int buffe
 static int data_check_txt(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
 {
   unsigned int i;
-  char *buffer_lower=(char *)MALLOC(buffer_size+16);
+  char *buffer_lower=(char *)file_handler_scratch(&file_hint_txt, buffer_size+16);
   i=UTF2Lat((unsigned char*)buffer_lower, &buffer[buffer_size/2], buffer_size/2);
   if(i<buffer_size/2)
   {
     if(i>=10)
       file_recovery->calculated_file_size=file_recovery->file_size+i;
-    free(buffer_lower);
     return 2;
   }
-  free(buffer_lower);
   file_recovery->calculated_file_size=file_recovery->file_size+(buffer_size/2);
   return 1;
 }
@@ -472,7 +468,7 @@ static int header_check_ics(const unsigned char *buffer, const unsigned int buff
    * DTSTART:19970714T173000Z           ;UTC time
    * DTSTART;TZID=US-Eastern:19970714T133000    ;Local time and time
    */
-  buffer2=(char *)MALLOC(buffer_size+1);
+  buffer2=(char *)file_handler_scratch(&file_hint_txt, buffer_size+1);
   buffer2[buffer_size]='\0';
   memcpy(buffer2, buffer, buffer_size);
   date_asc=strstr(buffer2, "DTSTART");
@@ -493,13 +489,12 @@ static int header_check_ics(const unsigned char *buffer, const unsigned int buff
     tm_time.tm_isdst = -1;		/* unknown daylight saving time */
     file_recovery_new->time=mktime(&tm_time);
   }
-  free(buffer2);
   return 1;
 }
 
 static int header_check_perlm(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new)
 {
-  char *buffer_lower=(char *)MALLOC(2048);
+  char *buffer_lower=(char *)file_handler_scratch(&file_hint_txt, 2048);
   const unsigned int buffer_size_test=(buffer_size < 2048-16 ? buffer_size : 2048-16);
   UTF2Lat((unsigned char*)buffer_lower, buffer, buffer_size_test);
   reset_file_recovery(file_recovery_new);
@@ -521,7 +516,6 @@ static int header_check_perlm(const unsigned char *buffer, const unsigned int bu
     /* perl module */
     file_recovery_new->extension="pm";
   }
-  free(buffer_lower);
   return 1;
 }
 
@@ -570,7 +564,7 @@ static int header_check_xml(const unsigned char *buffer, const unsigned int buff
 {
   const char *tmp;
   /* buffer may not be null-terminated */
-  char *buf=(char *)MALLOC(buffer_size+1);
+  char *buf=(char *)file_handler_scratch(&file_hint_txt, buffer_size+1);
   memcpy(buf, buffer, buffer_size);
   buf[buffer_size]='\0';
   reset_file_recovery(file_recovery_new);
@@ -608,7 +602,6 @@ static int header_check_xml(const unsigned char *buffer, const unsigned int buff
       /* Scalable Vector Graphics */
       file_recovery_new->extension="svg";
       file_recovery_new->file_check=&file_check_svg;
-      free(buf);
       return 1;
     }
     else if(strncasecmp(tmp, "<!DOCTYPE plist ", 16)==0)
@@ -645,7 +638,6 @@ static int header_check_xml(const unsigned char *buffer, const unsigned int buff
     file_recovery_new->extension="xml";
   }
   file_recovery_new->file_check=&file_check_xml;
-  free(buf);
   return 1;
 }
 
@@ -778,8 +770,7 @@ static void file_check_emlx(file_recovery_t *file_recovery)
 
 static int header_check_txt(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new)
 {
-  static char *buffer_lower=NULL;
-  static unsigned int buffer_lower_size=0;
+  char *buffer_lower;
   unsigned int l=0;
   const unsigned int buffer_size_test=(buffer_size < 2048 ? buffer_size : 2048);
   {
@@ -887,17 +878,7 @@ static int header_check_txt(const unsigned char *buffer, const unsigned int buff
   {
     return 0;
   }
-  if(buffer_lower_size<buffer_size_test+16)
-  {
-    free(buffer_lower);
-    buffer_lower=NULL;
-  }
-  /* Don't malloc/free memory every time, small memory leak */
-  if(buffer_lower==NULL)
-  {
-    buffer_lower_size=buffer_size_test+16;
-    buffer_lower=(char *)MALLOC(buffer_lower_size);
-  }
+  buffer_lower=(char *)file_handler_scratch(&file_hint_txt, buffer_size_test+16);
   l=UTF2Lat((unsigned char*)buffer_lower, buffer, buffer_size_test);
   if(l<10)
     return 0;
@@ -77,7 +77,7 @@ static int header_check_win(const unsigned char *buffer, const unsigned int buff
 static int data_check_win(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
 {
   unsigned int i;
-  char *buffer_lower=(char *)MALLOC(buffer_size+16);
+  char *buffer_lower=(char *)file_handler_scratch(&file_hint_win, buffer_size+16);
   unsigned int offset=0;
   if(file_recovery->calculated_file_size==0)
     offset=3;
@@ -86,10 +86,8 @@ static int data_check_win(const unsigned char *buffer, const unsigned int buffer
   {
     if(i>=10)
       file_recovery->calculated_file_size=file_recovery->file_size+offset+i;
-    free(buffer_lower);
     return 2;
   }
-  free(buffer_lower);
   file_recovery->calculated_file_size=file_recovery->file_size+(buffer_size/2);
   return 1;
 }
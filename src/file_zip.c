@@ -46,8 +46,7 @@ static void register_header_check_zip(file_stat_t *file_stat);
 static int header_check_zip(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new);
 static void file_check_zip(file_recovery_t *file_recovery);
 static unsigned int pos_in_mem(const unsigned char *haystack, const unsigned int haystack_size, const unsigned char *needle, const unsigned int needle_size);
-static void file_rename_zip(const char *old_filename);
-static char first_filename[256];
+static void file_rename_zip(file_recovery_t *file_recovery);
 
 const file_hint_t file_hint_zip= {
   .extension="zip",
@@ -105,52 +104,106 @@ struct zip64_extra_entry
 } __attribute__ ((__packed__));
 typedef struct zip64_extra_entry zip64_extra_entry_t;
 
-static uint32_t expected_compressed_size=0;
+/* The archive is walked through a large buffer: headers are read from
+ * memory and the compressed data is skipped without any I/O. */
+#define ZIP_BUFFER_SIZE (1024*1024)
 
-static int64_t file_get_pos(FILE *f, const void* needle, const unsigned int size)
+typedef struct
 {
-  char     *buffer =(char *)MALLOC(4096);
-  int64_t  total   = 0;
+  FILE *handle;
+  unsigned char *buffer;
+  uint64_t buffer_offset;	/* Offset in the file of buffer[0] */
+  unsigned int buffer_size;	/* Number of valid bytes in buffer */
+  uint64_t offset;		/* Current position */
+  char first_filename[256];	/* Name of the first file in the archive */
+  uint32_t expected_compressed_size;
+  int msoffice;
+  int sh3d;
+} zip_reader_t;
+
+static void zip_reader_init(zip_reader_t *zr, FILE *handle)
+{
+  zr->handle=handle;
+  zr->buffer=(unsigned char *)file_handler_scratch(&file_hint_zip, ZIP_BUFFER_SIZE);
+  zr->buffer_offset=0;
+  zr->buffer_size=0;
+  zr->offset=0;
+  zr->first_filename[0]='\0';
+  zr->expected_compressed_size=0;
+  zr->msoffice=0;
+  zr->sh3d=0;
+}
+
+/* Make sure size bytes from the current position are in the buffer */
+static int zip_fill(zip_reader_t *zr, const unsigned int size)
+{
+  if(zr->offset >= zr->buffer_offset &&
+      zr->offset + size <= zr->buffer_offset + zr->buffer_size)
+    return 0;
+  zr->buffer_offset=zr->offset;
+  zr->buffer_size=0;
+  if(fseek(zr->handle, zr->offset, SEEK_SET) < 0)
+    return -1;
+  zr->buffer_size=fread(zr->buffer, 1, ZIP_BUFFER_SIZE, zr->handle);
+  return (zr->buffer_size >= size ? 0 : -1);
+}
+
+static int zip_peek(zip_reader_t *zr, void *data, const unsigned int size)
+{
+  if(zip_fill(zr, size) < 0)
+    return -1;
+  memcpy(data, &zr->buffer[zr->offset - zr->buffer_offset], size);
+  return 0;
+}
+
+static int zip_read(zip_reader_t *zr, void *data, const unsigned int size)
+{
+  if(zip_peek(zr, data, size) < 0)
+    return -1;
+  zr->offset+=size;
+  return 0;
+}
+
+static void zip_skip(zip_reader_t *zr, const uint64_t len)
+{
+  zr->offset+=len;
+}
+
+/* Returns the distance to the next occurrence of needle, the reader is
+ * positioned on it. Returns -1 if not found. */
+static int64_t zip_find(zip_reader_t *zr, const void* needle, const unsigned int size)
+{
+  const uint64_t start=zr->offset;
 #ifdef DEBUG_ZIP
-  log_trace("zip: file_get_pos(f, needle, %u)\n", size);
+  log_trace("zip: zip_find(zr, needle, %u)\n", size);
 #endif
-
-  while (!feof(f))
+  while(zip_fill(zr, size) >= 0)
   {
-    int      count = 0;
-    unsigned int left;
-    const unsigned int read_size= fread(buffer, 1, 4096, f);
-    left  = read_size;
-
-    while (left>=size)
-    {
-      if (buffer[count]==*(const char *)needle && memcmp(buffer+count, needle, size)==0)
-      {
-	free(buffer);
-        if(fseek(f, (long)count-read_size, SEEK_CUR)<0)
-          return -1;
-        return total;
-      }
-      count++;
-      total++;
-      left--;
-    }
-    if(feof(f) || fseek(f, (long)1-size, SEEK_CUR)<0)
+    const unsigned char *end=zr->buffer + zr->buffer_size;
+    const unsigned char *p=&zr->buffer[zr->offset - zr->buffer_offset];
+    while((p=(const unsigned char *)memchr(p, *(const unsigned char *)needle, end - p))!=NULL &&
+	(unsigned int)(end - p) >= size &&
+	memcmp(p, needle, size)!=0)
+      p++;
+    if(p==NULL)
+      zr->offset=zr->buffer_offset + zr->buffer_size;
+    else
     {
-      free(buffer);
-      return -1;
+      zr->offset=zr->buffer_offset + (p - zr->buffer);
+      /* Found, or a partial match at the end of the buffer: refill */
+      if((unsigned int)(end - p) >= size)
+	return zr->offset - start;
     }
   }
-  free(buffer);
   return -1;
 }
 
-static int zip_parse_file_entry(file_recovery_t *fr, const char **ext, const unsigned int file_nbr)
+static int zip_parse_file_entry(file_recovery_t *fr, zip_reader_t *zr, const char **ext, const unsigned int file_nbr)
 {
   zip_file_entry_t  file;
   zip64_extra_entry_t extra;
   uint64_t          len;
-  if (fread(&file, sizeof(file), 1, fr->handle) != 1)
+  if (zip_read(zr, &file, sizeof(file)) < 0)
   {
 #ifdef DEBUG_ZIP
     log_trace("zip: Unexpected EOF reading header of file_entry\n");
@@ -169,7 +222,7 @@ static int zip_parse_file_entry(file_recovery_t *fr, const char **ext, const uns
   if (len)
   {
     char *filename=(char *)MALLOC(len+1);
-    if (fread(filename, len, 1, fr->handle) != 1)
+    if (zip_read(zr, filename, len) < 0)
     {
 #ifdef DEBUG_ZIP
       log_trace("zip: Unexpected EOF in file_entry header: %lu bytes expected\n", len);
@@ -179,23 +232,21 @@ static int zip_parse_file_entry(file_recovery_t *fr, const char **ext, const uns
     }
     fr->file_size += len;
     filename[len]='\0';
-    if(first_filename[0]=='\0')
+    if(zr->first_filename[0]=='\0')
     {
       const unsigned int len_tmp=(len<255?len:255);
-      strncpy(first_filename, filename, len_tmp);
-      first_filename[len_tmp]='\0';
+      strncpy(zr->first_filename, filename, len_tmp);
+      zr->first_filename[len_tmp]='\0';
     }
 #ifdef DEBUG_ZIP
     log_info("%s\n", filename);
 #endif
     if(*ext==NULL)
     {
-      static int msoffice=0;
-      static int sh3d=0;
       if(file_nbr==0)
       {
-	msoffice=0;
-	sh3d=0;
+	zr->msoffice=0;
+	zr->sh3d=0;
 	if(len==8 && memcmp(filename, "mimetype", 8)==0 &&
 	    le16(file.extra_length)==0 &&
 	    le32(file.compressed_size)==le32(file.uncompressed_size) &&
@@ -203,7 +254,7 @@ static int zip_parse_file_entry(file_recovery_t *fr, const char **ext, const uns
 	{
 	  const int compressed_size=le32(file.uncompressed_size);
 	  unsigned char buffer[128];
-	  if( fread(buffer, compressed_size, 1, fr->handle)!=1)
+	  if(zip_peek(zr, buffer, compressed_size) < 0)
 	  {
 #ifdef DEBUG_ZIP
 	    log_trace("zip: Unexpected EOF in file_entry data: %u bytes expected\n",
@@ -211,11 +262,6 @@ static int zip_parse_file_entry(file_recovery_t *fr, const char **ext, const uns
 #endif
 	    return -1;
 	  }
-	  if (fseek(fr->handle, -compressed_size, SEEK_CUR) < 0)
-	  {
-	    log_info("fseek failed CGR\n");
-	    return -1;
-	  }
 	  if(compressed_size==28 && memcmp(buffer,"application/vnd.sun.xml.calc",28)==0)
 	    *ext="sxc";
 	  else if(compressed_size==28 && memcmp(buffer,"application/vnd.sun.xml.draw",28)==0)
@@ -238,18 +284,18 @@ static int zip_parse_file_entry(file_recovery_t *fr, const char **ext, const uns
 	  }
 	}
 	else if(len==19 && memcmp(filename, "[Content_Types].xml", 19)==0)
-	  msoffice=1;
+	  zr->msoffice=1;
 	else if(len==4 && memcmp(filename, "Home", 4)==0)
-	  sh3d=1;
+	  zr->sh3d=1;
 	else if(len==7 && memcmp(filename, "doc.kml", 7)==0)
 	  *ext="kmz";	/* Zipped Keyhole Markup Language (KML) used by Google Earth */
       }
-      else if(file_nbr==1 && sh3d==1)
+      else if(file_nbr==1 && zr->sh3d==1)
       {
 	if(len==1 && filename[0]=='0')
 	  *ext="sh3d";
       }
-      else if(file_nbr==2 && msoffice!=0)
+      else if(file_nbr==2 && zr->msoffice!=0)
       {
 	if(strncmp(filename, "word/", 5)==0)
 	  *ext="docx";
@@ -279,20 +325,13 @@ static int zip_parse_file_entry(file_recovery_t *fr, const char **ext, const uns
   memset(&extra, 0, sizeof(extra));
   if (len>0)
   {
-    if (fread(&extra, sizeof(extra), 1, fr->handle) != 1)
+    if (zip_peek(zr, &extra, sizeof(extra)) < 0)
     {
 #ifdef DEBUG_ZIP
       log_trace("zip: Unexpected EOF in file_entry header: %lu bytes expected\n", len);
 #endif
     }
-    if (fseek(fr->handle, fr->file_size, SEEK_SET) == -1 ||
-	fseek(fr->handle, len, SEEK_CUR) == -1)
-    {
-#ifdef DEBUG_ZIP
-      log_trace("zip: Unexpected EOF in file_entry header: %lu bytes expected\n", len);
-#endif
-      return -1;
-    }
+    zip_skip(zr, len);
     fr->file_size += len;
   }
   len = le32(file.compressed_size);
@@ -302,20 +341,14 @@ static int zip_parse_file_entry(file_recovery_t *fr, const char **ext, const uns
   }
   if (len>0)
   {
-    if (fseek(fr->handle, len, SEEK_CUR) == -1)
-    {
-#ifdef DEBUG_ZIP
-      log_trace("zip: Unexpected EOF in file_entry data: %lu bytes expected\n", len);
-#endif
-      return -1;
-    }
+    zip_skip(zr, len);
 #ifdef DEBUG_ZIP
     log_trace("zip: Data of length %lu\n", len);
 #endif
     fr->file_size += len;
   }
 
-  expected_compressed_size=0;
+  zr->expected_compressed_size=0;
   if (file.has_descriptor && (le16(file.compression)==8 || le16(file.compression)==9))
   {
     /* The fields crc-32, compressed size and uncompressed size
@@ -325,7 +358,7 @@ static int zip_parse_file_entry(file_recovery_t *fr, const char **ext, const uns
        Typically used in OOO documents
        Search ZIP_DATA_DESCRIPTOR */
     static const unsigned char zip_data_desc_header[4]= {0x50, 0x4B, 0x07, 0x08};
-    int64_t pos = file_get_pos(fr->handle, zip_data_desc_header, 4);
+    int64_t pos = zip_find(zr, zip_data_desc_header, 4);
 #ifdef DEBUG_ZIP
     log_trace("Searched footer, got length %lli\n", (long long int)pos);
 #endif
@@ -334,13 +367,13 @@ static int zip_parse_file_entry(file_recovery_t *fr, const char **ext, const uns
     if (pos > 0)
     {
       fr->file_size += pos;
-      expected_compressed_size=pos;
+      zr->expected_compressed_size=pos;
     }
   }
   return 0;
 }
 
-static int zip_parse_central_dir(file_recovery_t *fr)
+static int zip_parse_central_dir(file_recovery_t *fr, zip_reader_t *zr)
 {
   zip_file_entry_t  file;
   uint32_t          len;
@@ -353,16 +386,10 @@ static int zip_parse_central_dir(file_recovery_t *fr)
     uint32_t offset_header;           /** Relative offset of local header */
   } __attribute__ ((__packed__)) dir;
 
-  if (fseek(fr->handle, 2, SEEK_CUR) == -1)
-  {
-#ifdef DEBUG_ZIP
-    log_trace("Unexpected EOF skipping version from central_dir\n");
-#endif
-    return -1;
-  }
+  zip_skip(zr, 2);
   fr->file_size += 2;
 
-  if (fread(&file, sizeof(file), 1, fr->handle) != 1)
+  if (zip_read(zr, &file, sizeof(file)) < 0)
   {
 #ifdef DEBUG_ZIP
     log_trace("Unexpected EOF reading 1st part of central_dir\n");
@@ -374,7 +401,7 @@ static int zip_parse_central_dir(file_recovery_t *fr)
   log_trace("zip: Central dir with CRC 0x%08X\n", file.crc32);
 #endif
 
-  if (fread(&dir, sizeof(dir), 1, fr->handle) != 1)
+  if (zip_read(zr, &dir, sizeof(dir)) < 0)
   {
 #ifdef DEBUG_ZIP
     log_trace("zip: Unexpected EOF reading 2nd part of central_dir\n");
@@ -385,13 +412,7 @@ static int zip_parse_central_dir(file_recovery_t *fr)
 
   /* Rest of the block - could attempt CRC check */
   len = le16(file.extra_length) + le16(dir.comment_length) + le16(file.filename_length);
-  if (fseek(fr->handle, len, SEEK_CUR) == -1)
-  {
-#ifdef DEBUG_ZIP
-    log_trace("zip: Unexpected EOF in central_dir: %u bytes expected\n", len);
-#endif
-    return -1;
-  }
+  zip_skip(zr, len);
   fr->file_size += len;
 #ifdef DEBUG_ZIP
   log_trace("zip: Data of total length %u\n", len);
@@ -399,7 +420,7 @@ static int zip_parse_central_dir(file_recovery_t *fr)
   return 0;
 }
 
-static int zip64_parse_end_central_dir(file_recovery_t *fr)
+static int zip64_parse_end_central_dir(file_recovery_t *fr, zip_reader_t *zr)
 {
   struct {
     uint64_t end_size;                /** Size of zip64 end of central directory record */
@@ -413,7 +434,7 @@ static int zip64_parse_end_central_dir(file_recovery_t *fr)
     uint64_t offset;                  /** Offset of start of central directory */
   } __attribute__ ((__packed__)) dir;
 
-  if (fread(&dir, sizeof(dir), 1, fr->handle) != 1)
+  if (zip_read(zr, &dir, sizeof(dir)) < 0)
   {
 #ifdef DEBUG_ZIP
     log_trace("zip: Unexpected EOF reading end_central_dir_64\n");
@@ -425,13 +446,7 @@ static int zip64_parse_end_central_dir(file_recovery_t *fr)
   if (dir.end_size > 0)
   {
     uint64_t len = le64(dir.end_size);
-    if (fseek(fr->handle, len, SEEK_CUR) == -1)
-    {
-#ifdef DEBUG_ZIP
-      log_trace("zip: Unexpected EOF in end_central_dir_64: expected %llu bytes\n", (long long unsigned)len);
-#endif
-      return -1;
-    }
+    zip_skip(zr, len);
     fr->file_size += len;
 #ifdef DEBUG_ZIP
     log_trace("zip: End of 64b central dir of length %llu\n", (long long unsigned)len);
@@ -441,7 +456,7 @@ static int zip64_parse_end_central_dir(file_recovery_t *fr)
   return 0;
 }
 
-static int zip_parse_end_central_dir(file_recovery_t *fr)
+static int zip_parse_end_central_dir(file_recovery_t *fr, zip_reader_t *zr)
 {
   struct {
     uint16_t number_disk;             /** Number of this disk */
@@ -453,7 +468,7 @@ static int zip_parse_end_central_dir(file_recovery_t *fr)
     uint16_t comment_length;          /** Comment length */
   } __attribute__ ((__packed__)) dir;
 
-  if (fread(&dir, sizeof(dir), 1, fr->handle) != 1)
+  if (zip_read(zr, &dir, sizeof(dir)) < 0)
   {
 #ifdef DEBUG_ZIP
     log_trace("zip: Unexpected EOF reading header of zip_parse_end_central_dir\n");
@@ -465,13 +480,7 @@ static int zip_parse_end_central_dir(file_recovery_t *fr)
   if (dir.comment_length)
   {
     uint16_t len = le16(dir.comment_length);
-    if (fseek(fr->handle, len, SEEK_CUR) == -1)
-    {
-#ifdef DEBUG_ZIP
-      log_trace("zip: Unexpected EOF in end_central_dir: expected %u bytes\n", len);
-#endif
-      return -1;
-    }
+    zip_skip(zr, len);
     fr->file_size += len;
 #ifdef DEBUG_ZIP
     log_trace("zip: Comment of length %u\n", len);
@@ -480,7 +489,7 @@ static int zip_parse_end_central_dir(file_recovery_t *fr)
   return 0;
 }
 
-static int zip_parse_data_desc(file_recovery_t *fr)
+static int zip_parse_data_desc(file_recovery_t *fr, zip_reader_t *zr)
 {
   struct {
     uint32_t crc32;                  /** Checksum (CRC32) */
@@ -488,7 +497,7 @@ static int zip_parse_data_desc(file_recovery_t *fr)
     uint32_t uncompressed_size;      /** Uncompressed size (bytes) */
   } __attribute__ ((__packed__)) desc;
 
-  if (fread(&desc, sizeof(desc), 1, fr->handle) != 1)
+  if (zip_read(zr, &desc, sizeof(desc)) < 0)
   {
 #ifdef DEBUG_ZIP
     log_trace("zip: Unexpected EOF reading header of data_desc\n");
@@ -502,16 +511,16 @@ static int zip_parse_data_desc(file_recovery_t *fr)
       le32(desc.uncompressed_size),
       le32(desc.crc32));
 #endif
-  if(le32(desc.compressed_size)!=expected_compressed_size)
+  if(le32(desc.compressed_size)!=zr->expected_compressed_size)
     return -1;
   return 0;
 }
 
-static int zip_parse_signature(file_recovery_t *fr)
+static int zip_parse_signature(file_recovery_t *fr, zip_reader_t *zr)
 {
   uint16_t len;
 
-  if (fread(&len, 2, 1, fr->handle) != 1)
+  if (zip_read(zr, &len, 2) < 0)
   {
 #ifdef DEBUG_ZIP
     log_trace("zip: Unexpected EOF reading length of signature\n");
@@ -523,20 +532,14 @@ static int zip_parse_signature(file_recovery_t *fr)
   if (len)
   {
     len = le16(len);
-    if (fseek(fr->handle, len, SEEK_CUR) == -1)
-    {
-#ifdef DEBUG_ZIP
-      log_trace("zip: Unexpected EOF in zip_parse_signature: expected %u bytes\n", len);
-#endif
-      return -1;
-    }
+    zip_skip(zr, len);
     fr->file_size += len;
   }
 
   return 0;
 }
 
-static int zip64_parse_end_central_dir_locator(file_recovery_t *fr)
+static int zip64_parse_end_central_dir_locator(file_recovery_t *fr, zip_reader_t *zr)
 {
   struct {
     uint32_t disk_number;       /** Number of the disk with the start of the zip64 end of central directory */
@@ -544,7 +547,7 @@ static int zip64_parse_end_central_dir_locator(file_recovery_t *fr)
     uint32_t disk_total_number; /** Total number of disks */
   } __attribute__ ((__packed__)) loc;
 
-  if (fread(&loc, sizeof(loc), 1, fr->handle) != 1)
+  if (zip_read(zr, &loc, sizeof(loc)) < 0)
   {
 #ifdef DEBUG_ZIP
     log_trace("zip: Unexpected EOF reading 1st part of end_central_dir_locator\n");
@@ -555,23 +558,17 @@ static int zip64_parse_end_central_dir_locator(file_recovery_t *fr)
   return 0;
 }
 
-static void file_check_zip(file_recovery_t *fr)
+static void file_check_zip_aux(file_recovery_t *fr, zip_reader_t *zr)
 {
   const char *ext=NULL;
   unsigned int file_nbr=0;
-  fr->file_size = 0;
-  fr->offset_error=0;
-  fr->offset_ok=0;
-  first_filename[0]='\0';
-  if(fseek(fr->handle, 0, SEEK_SET) < 0)
-    return ;
   while (1)
   {
     uint64_t file_size_old;
     uint32_t header;
     int      status;
 
-    if (fread(&header, 4, 1, fr->handle)!=1)
+    if (zip_read(zr, &header, 4) < 0)
     {
 #ifdef DEBUG_ZIP
       log_trace("Failed to read block header\n");
@@ -592,26 +589,26 @@ static void file_check_zip(file_recovery_t *fr)
     switch (header)
     {
       case ZIP_CENTRAL_DIR: /* Central dir */
-        status = zip_parse_central_dir(fr);
+        status = zip_parse_central_dir(fr, zr);
         break;
       case ZIP_CENTRAL_DIR64: /* 64b end central dir */
-        status = zip64_parse_end_central_dir(fr);
+        status = zip64_parse_end_central_dir(fr, zr);
         break;
       case ZIP_END_CENTRAL_DIR: /* End central dir */
-        status = zip_parse_end_central_dir(fr);
+        status = zip_parse_end_central_dir(fr, zr);
         break;
       case ZIP_END_CENTRAL_DIR64: /* 64b end central dir locator */
-        status = zip64_parse_end_central_dir_locator(fr);
+        status = zip64_parse_end_central_dir_locator(fr, zr);
         break;
       case ZIP_DATA_DESCRIPTOR: /* Data descriptor */
-        status = zip_parse_data_desc(fr);
+        status = zip_parse_data_desc(fr, zr);
         break;
       case ZIP_FILE_ENTRY: /* File Entry */
-        status = zip_parse_file_entry(fr, &ext, file_nbr);
+        status = zip_parse_file_entry(fr, zr, &ext, file_nbr);
 	file_nbr++;
         break;
       case ZIP_SIGNATURE: /* Signature */
-        status = zip_parse_signature(fr);
+        status = zip_parse_signature(fr, zr);
         break;
       default:
 #ifdef DEBUG_ZIP
@@ -638,72 +635,70 @@ static void file_check_zip(file_recovery_t *fr)
   }
 }
 
-static void file_rename_zip(const char *old_filename)
+static void file_check_zip(file_recovery_t *fr)
+{
+  zip_reader_t zr;
+  fr->file_size = 0;
+  fr->offset_error=0;
+  fr->offset_ok=0;
+  zip_reader_init(&zr, fr->handle);
+  file_check_zip_aux(fr, &zr);
+}
+
+static void file_rename_zip_aux(file_recovery_t *file_recovery, file_recovery_t *fr, zip_reader_t *zr)
 {
   const char *ext=NULL;
   unsigned int file_nbr=0;
-  file_recovery_t fr;
-  reset_file_recovery(&fr);
-  if((fr.handle=fopen(old_filename, "rb"))==NULL)
-    return;
-  fr.file_size = 0;
-  fr.offset_error=0;
-  first_filename[0]='\0';
-  if(fseek(fr.handle, 0, SEEK_SET) < 0)
-  {
-    fclose(fr.handle);
-    return ;
-  }
   while (1)
   {
     uint32_t header;
     int      status;
 
-    if (fread(&header, 4, 1, fr.handle)!=1)
+    if (zip_read(zr, &header, 4) < 0)
     {
 #ifdef DEBUG_ZIP
       log_trace("Failed to read block header\n");
 #endif
-      fclose(fr.handle);
       return;
     }
 
     header = le32(header);
 #ifdef DEBUG_ZIP
-    log_trace("Header 0x%08X at 0x%llx\n", header, (long long unsigned int)fr.file_size);
+    log_trace("Header 0x%08X at 0x%llx\n", header, (long long unsigned int)fr->file_size);
     log_flush();
 #endif
-    fr.file_size += 4;
+    fr->file_size += 4;
 
     switch (header)
     {
       case ZIP_CENTRAL_DIR: /* Central dir */
-        status = zip_parse_central_dir(&fr);
+        status = zip_parse_central_dir(fr, zr);
         break;
       case ZIP_CENTRAL_DIR64: /* 64b end central dir */
-        status = zip64_parse_end_central_dir(&fr);
+        status = zip64_parse_end_central_dir(fr, zr);
         break;
       case ZIP_END_CENTRAL_DIR: /* End central dir */
-        status = zip_parse_end_central_dir(&fr);
+        status = zip_parse_end_central_dir(fr, zr);
         break;
       case ZIP_END_CENTRAL_DIR64: /* 64b end central dir locator */
-        status = zip64_parse_end_central_dir_locator(&fr);
+        status = zip64_parse_end_central_dir_locator(fr, zr);
         break;
       case ZIP_DATA_DESCRIPTOR: /* Data descriptor */
-        status = zip_parse_data_desc(&fr);
+        status = zip_parse_data_desc(fr, zr);
         break;
       case ZIP_FILE_ENTRY: /* File Entry */
-        status = zip_parse_file_entry(&fr, &ext, file_nbr);
+        status = zip_parse_file_entry(fr, zr, &ext, file_nbr);
 	file_nbr++;
 	if(ext!=NULL)
 	{
-	  fclose(fr.handle);
-	  file_rename(old_filename, NULL, 0, 0, ext, 1);
+	  fclose(fr->handle);
+	  fr->handle=NULL;
+	  file_rename(file_recovery, NULL, 0, 0, ext, 1);
 	  return;
 	}
         break;
       case ZIP_SIGNATURE: /* Signature */
-        status = zip_parse_signature(&fr);
+        status = zip_parse_signature(fr, zr);
         break;
       default:
 #ifdef DEBUG_ZIP
@@ -718,27 +713,40 @@ static void file_rename_zip(const char *old_filename)
 
     /* Verify status */
     if (status<0)
-    {
-      fclose(fr.handle);
       return;
-    }
     /* Only end of central dir is end of archive, 64b version of it is before */
     if (header==ZIP_END_CENTRAL_DIR)
     {
       unsigned int len;
-      fclose(fr.handle);
+      fclose(fr->handle);
+      fr->handle=NULL;
       for(len=0; len<32 &&
-	  first_filename[len]!='\0' &&
-	  first_filename[len]!='.' &&
-	  first_filename[len]!='/' &&
-	  first_filename[len]!='\\';
+	  zr->first_filename[len]!='\0' &&
+	  zr->first_filename[len]!='.' &&
+	  zr->first_filename[len]!='/' &&
+	  zr->first_filename[len]!='\\';
 	  len++);
-      file_rename(old_filename, first_filename, len, 0, "zip", 0);
+      file_rename(file_recovery, zr->first_filename, len, 0, "zip", 0);
       return;
     }
   }
 }
 
+static void file_rename_zip(file_recovery_t *file_recovery)
+{
+  file_recovery_t fr;
+  zip_reader_t zr;
+  reset_file_recovery(&fr);
+  if((fr.handle=fopen(file_recovery->filename, "rb"))==NULL)
+    return;
+  fr.file_size = 0;
+  fr.offset_error=0;
+  zip_reader_init(&zr, fr.handle);
+  file_rename_zip_aux(file_recovery, &fr, &zr);
+  if(fr.handle!=NULL)
+    fclose(fr.handle);
+}
+
 static void register_header_check_zip(file_stat_t *file_stat)
 {
   register_header_check(0, zip_header,sizeof(zip_header), &header_check_zip, file_stat);
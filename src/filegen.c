@@ -31,10 +31,14 @@
 #endif
 #include <stdio.h>
 #include <ctype.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include "types.h"
 #include "common.h"
 #include "filegen.h"
 #include "log.h"
+#include "hash.h"
 
 static  file_check_t file_check_plist={
   .list = TD_LIST_HEAD_INIT(file_check_plist.list)
@@ -44,6 +48,9 @@ file_check_list_t file_check_list={
     .list = TD_LIST_HEAD_INIT(file_check_list.list)
 };
 
+/* End of the furthest registered signature */
+static unsigned int header_check_end=0;
+
 static unsigned int index_header_check(void);
 
 static int file_check_cmp(const struct td_list_head *a, const struct td_list_head *b)
@@ -87,8 +94,41 @@ void register_header_check(const unsigned int offset, const void *value, const u
   file_check_new->length=length;
   file_check_new->offset=offset;
   file_check_new->header_check=header_check;
+  file_check_new->header_check_match=NULL;
   file_check_new->file_stat=file_stat;
   td_list_add_sorted(&file_check_new->list, &file_check_plist.list, file_check_cmp);
+  if(header_check_end < offset + length)
+    header_check_end=offset + length;
+}
+
+void register_header_check_match(const unsigned int offset, const void *value, const unsigned int length, int (*header_check_match)(const unsigned char *buffer, const unsigned int buffer_size,
+      const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new,
+      const file_check_t *file_check),
+  file_stat_t *file_stat)
+{
+  file_check_t *file_check_new=(file_check_t *)MALLOC(sizeof(*file_check_new));
+  file_check_new->value=value;
+  file_check_new->length=length;
+  file_check_new->offset=offset;
+  file_check_new->header_check=NULL;
+  file_check_new->header_check_match=header_check_match;
+  file_check_new->file_stat=file_stat;
+  td_list_add_sorted(&file_check_new->list, &file_check_plist.list, file_check_cmp);
+  if(header_check_end < offset + length)
+    header_check_end=offset + length;
+}
+
+int file_check_header(const file_check_t *file_check, const unsigned char *buffer, const unsigned int buffer_size,
+      const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new)
+{
+  if(file_check->header_check_match!=NULL)
+    return file_check->header_check_match(buffer, buffer_size, safe_header_only, file_recovery, file_recovery_new, file_check);
+  return file_check->header_check(buffer, buffer_size, safe_header_only, file_recovery, file_recovery_new);
+}
+
+unsigned int header_check_max_offset(void)
+{
+  return header_check_end;
 }
 
 static void index_header_check_aux(file_check_t *file_check_new)
@@ -171,6 +211,7 @@ void free_header_check(void)
     td_list_del(tmpl);
     free(pos);
   }
+  header_check_end=0;
 }
 
 void file_allow_nl(file_recovery_t *file_recovery, const unsigned int nl_mode)
@@ -188,44 +229,525 @@ void file_allow_nl(file_recovery_t *file_recovery, const unsigned int nl_mode)
     file_recovery->file_size++;
 }
 
-uint64_t file_rsearch(FILE *handle, uint64_t offset, const void*footer, const unsigned int footer_length)
+#define RSEARCH_CHUNK_SIZE (1024*1024)
+
+#ifdef HAVE_MEMRCHR
+#define td_memrchr memrchr
+#else
+static const void *td_memrchr(const void *s, const int c, size_t n)
+{
+  const unsigned char *p=(const unsigned char *)s + n;
+  while(n-- > 0)
+  {
+    if(*--p==(unsigned char)c)
+      return p;
+  }
+  return NULL;
+}
+#endif
+
+/* Returns the position of the last occurrence of footer starting before
+ * buffer+size. Up to tail bytes following buffer+size are valid. */
+static int rsearch_chunk(const unsigned char *buffer, const unsigned int size, const unsigned int tail, const file_footer_t *footer)
+{
+  const unsigned char first=*(const unsigned char *)footer->footer;
+  unsigned int len=size;
+  if(footer->footer_length > size + tail)
+    return -1;
+  if(len > size + tail - footer->footer_length + 1)
+    len=size + tail - footer->footer_length + 1;
+  while(len>0)
+  {
+    const unsigned char *p=(const unsigned char *)td_memrchr(buffer, first, len);
+    if(p==NULL)
+      return -1;
+    if(memcmp(p, footer->footer, footer->footer_length)==0)
+      return p - buffer;
+    len=p - buffer;
+  }
+  return -1;
+}
+
+uint64_t file_rsearch_footers(FILE *handle, uint64_t offset, const file_footer_t *footers, const unsigned int nbr_footers, unsigned int *footer_found)
 {
   unsigned char*buffer;
-  buffer=(unsigned char*)MALLOC(4096+footer_length-1);
-  memset(buffer+4096,0,footer_length-1);
-  do
+  unsigned int max_length=1;
+  unsigned int tail=0;
+  unsigned int i;
+  for(i=0; i<nbr_footers; i++)
+    if(max_length < footers[i].footer_length)
+      max_length=footers[i].footer_length;
+  buffer=(unsigned char*)MALLOC(RSEARCH_CHUNK_SIZE+max_length-1);
+  while(offset>0)
   {
-    int i;
-    int taille;
-    const unsigned int read_size=(offset%4096!=0 ? offset%4096 : 4096);
+    /* Read backward, chunks after the first one are aligned */
+    const unsigned int read_size=(offset%RSEARCH_CHUNK_SIZE!=0 ? offset%RSEARCH_CHUNK_SIZE : RSEARCH_CHUNK_SIZE);
+    unsigned int taille;
+    int best=-1;
     offset-=read_size;
     if(fseek(handle,offset,SEEK_SET)<0)
-    {
-      free(buffer);
-      return 0;
-    }
+      break;
     taille=fread(buffer, 1, read_size, handle);
-    for(i=taille-1;i>=0;i--)
+    if(taille < read_size)
+      tail=0;
+    for(i=0; i<nbr_footers; i++)
     {
-      if(buffer[i]==*(const unsigned char *)footer && memcmp(buffer+i,footer,footer_length)==0)
+      if(footers[i].footer_length>0)
       {
-        free(buffer);
-        return offset + i;
+	const int pos=rsearch_chunk(buffer, taille, tail, &footers[i]);
+	if(pos > best)
+	{
+	  best=pos;
+	  if(footer_found!=NULL)
+	    *footer_found=i;
+	}
       }
     }
-    memcpy(buffer+read_size,buffer,footer_length-1);
-  } while(offset>0);
+    if(best>=0)
+    {
+      free(buffer);
+      return offset + best;
+    }
+    /* Keep the beginning of this chunk for matches across the boundary */
+    tail=(taille < max_length-1 ? taille : max_length-1);
+    memmove(buffer+RSEARCH_CHUNK_SIZE, buffer, tail);
+  }
   free(buffer);
   return 0;
 }
 
-void file_search_footer(file_recovery_t *file_recovery, const void*footer, const unsigned int footer_length, const unsigned int extra_length)
+uint64_t file_rsearch(FILE *handle, uint64_t offset, const void*footer, const unsigned int footer_length)
+{
+  file_footer_t footers[1];
+  footers[0].footer=footer;
+  footers[0].footer_length=footer_length;
+  return file_rsearch_footers(handle, offset, footers, 1, NULL);
+}
+
+void file_search_footers(file_recovery_t *file_recovery, const file_footer_t *footers, const unsigned int nbr_footers, const unsigned int extra_length)
 {
-  if(footer_length==0 || file_recovery->file_size <= extra_length)
+  unsigned int footer_found=0;
+  const unsigned char *content;
+  if(nbr_footers==0 || file_recovery->file_size <= extra_length)
     return ;
-  file_recovery->file_size=file_rsearch(file_recovery->handle, file_recovery->file_size-extra_length, footer, footer_length);
+  content=file_content_get(file_recovery, 0, file_recovery->file_size-extra_length);
+  if(content!=NULL)
+  {
+    int best=-1;
+    unsigned int i;
+    for(i=0; i<nbr_footers; i++)
+    {
+      if(footers[i].footer_length>0)
+      {
+	const int pos=rsearch_chunk(content, file_recovery->file_size-extra_length, 0, &footers[i]);
+	if(pos > best)
+	{
+	  best=pos;
+	  footer_found=i;
+	}
+      }
+    }
+    file_recovery->file_size=(best>=0 ? best : 0);
+  }
+  else
+    file_recovery->file_size=file_rsearch_footers(file_recovery->handle, file_recovery->file_size-extra_length, footers, nbr_footers, &footer_found);
   if(file_recovery->file_size > 0)
-    file_recovery->file_size+= footer_length + extra_length;
+    file_recovery->file_size+= footers[footer_found].footer_length + extra_length;
+}
+
+void file_search_footer(file_recovery_t *file_recovery, const void*footer, const unsigned int footer_length, const unsigned int extra_length)
+{
+  file_footer_t footers[1];
+  if(footer_length==0)
+    return ;
+  footers[0].footer=footer;
+  footers[0].footer_length=footer_length;
+  file_search_footers(file_recovery, footers, 1, extra_length);
+}
+
+/* MD5 and SHA-256 of the recovered files.
+ * The last FILE_HASH_LAG bytes written are kept aside as file_check()
+ * may still truncate the file, the digests are only computed again
+ * from the beginning when the file is truncated before them. */
+#define FILE_HASH_LAG	(256*1024)
+
+struct file_hash_struct
+{
+  md5_ctx_t md5;
+  sha256_ctx_t sha256;
+  uint64_t size;		/* Bytes added to md5 and sha256 */
+  int valid;			/* The file has been written sequentially */
+  unsigned int pending_size;
+  unsigned char pending[2*FILE_HASH_LAG];
+};
+
+static int file_hash_enabled=0;
+
+void file_hash_enable(const int enable)
+{
+  file_hash_enabled=enable;
+}
+
+static void file_hash_update(struct file_hash_struct *hash, const unsigned char *buffer, const unsigned int size)
+{
+  md5_update(&hash->md5, buffer, size);
+  sha256_update(&hash->sha256, buffer, size);
+  hash->size+=size;
+}
+
+static struct file_hash_struct *file_hash_new(void)
+{
+  struct file_hash_struct *hash=(struct file_hash_struct *)MALLOC(sizeof(*hash));
+  md5_init(&hash->md5);
+  sha256_init(&hash->sha256);
+  hash->size=0;
+  hash->valid=1;
+  hash->pending_size=0;
+  return hash;
+}
+
+static void file_hash_add(file_recovery_t *file_recovery, const uint64_t offset, const unsigned char *buffer, const unsigned int size)
+{
+  struct file_hash_struct *hash=file_recovery->hash;
+  unsigned int done=0;
+  if(file_hash_enabled==0)
+    return ;
+  if(hash==NULL)
+  {
+    if(offset!=0)
+      return ;
+    hash=file_hash_new();
+    file_recovery->hash=hash;
+  }
+  if(hash->valid==0)
+    return ;
+  if(offset != hash->size + hash->pending_size)
+  {
+    /* Data has been overwritten, see photorec_bf() */
+    hash->valid=0;
+    return ;
+  }
+  while(done < size)
+  {
+    unsigned int len=sizeof(hash->pending) - hash->pending_size;
+    if(len > size - done)
+      len=size - done;
+    memcpy(&hash->pending[hash->pending_size], buffer + done, len);
+    hash->pending_size+=len;
+    done+=len;
+    if(hash->pending_size==sizeof(hash->pending))
+    {
+      file_hash_update(hash, hash->pending, FILE_HASH_LAG);
+      memmove(hash->pending, &hash->pending[FILE_HASH_LAG], FILE_HASH_LAG);
+      hash->pending_size=FILE_HASH_LAG;
+    }
+  }
+}
+
+/* Called with the data written at file_recovery->file_size */
+void file_hash_append(file_recovery_t *file_recovery, const unsigned char *buffer, const unsigned int size)
+{
+  file_hash_add(file_recovery, file_recovery->file_size, buffer, size);
+}
+
+/* file_hash_finish()
+ * Set the digests of the first file_size bytes of the file,
+ * the file must still be opened */
+void file_hash_finish(file_recovery_t *file_recovery)
+{
+  struct file_hash_struct *hash=file_recovery->hash;
+  const uint64_t file_size=file_recovery->file_size;
+  file_recovery->hash=NULL;
+  file_recovery->digest_ok=0;
+  if(file_hash_enabled==0 || file_size==0)
+  {
+    free(hash);
+    return ;
+  }
+  if(hash!=NULL && hash->valid>0 &&
+      hash->size <= file_size && file_size <= hash->size + hash->pending_size)
+  {
+    file_hash_update(hash, hash->pending, file_size - hash->size);
+  }
+  else
+  {
+    if(hash==NULL)
+      hash=file_hash_new();
+    else
+    {
+      md5_init(&hash->md5);
+      sha256_init(&hash->sha256);
+      hash->size=0;
+    }
+    if(file_recovery->content!=NULL && file_recovery->content_size >= file_size)
+      file_hash_update(hash, file_recovery->content, file_size);
+    while(hash->size < file_size)
+    {
+      unsigned int len=sizeof(hash->pending);
+      if(len > file_size - hash->size)
+	len=file_size - hash->size;
+      if(file_content_read(file_recovery, hash->pending, len, hash->size)!=len)
+      {
+	log_error("%s: cannot compute the digests\n", file_recovery->filename);
+	free(hash);
+	return ;
+      }
+      file_hash_update(hash, hash->pending, len);
+    }
+  }
+  md5_final(&hash->md5, file_recovery->md5);
+  sha256_final(&hash->sha256, file_recovery->sha256);
+  file_recovery->digest_ok=1;
+  free(hash);
+}
+
+void file_hash_free(file_recovery_t *file_recovery)
+{
+  free(file_recovery->hash);
+  file_recovery->hash=NULL;
+}
+
+/* Content of the recovered file kept in memory: file_check functions can
+ * read it without going through the file. Files bigger than
+ * FILE_CONTENT_MAX_SIZE or written out of order are only on disk.
+ * Buffers are recycled between files. */
+#define FILE_CONTENT_MAX_SIZE	(8*1024*1024)
+#define FILE_CONTENT_MIN_SIZE	(64*1024)
+#define FILE_CONTENT_POOL_SIZE	4
+
+static unsigned char *file_content_pool[FILE_CONTENT_POOL_SIZE];
+static uint64_t file_content_pool_max[FILE_CONTENT_POOL_SIZE];
+static unsigned int file_content_pool_nbr=0;
+#ifdef HAVE_PTHREAD
+/* Files may be checked by other threads, see file_finish_deferred() */
+static pthread_mutex_t file_content_mutex=PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void file_content_alloc(file_recovery_t *file_recovery)
+{
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&file_content_mutex);
+#endif
+  if(file_content_pool_nbr>0)
+  {
+    file_content_pool_nbr--;
+    file_recovery->content=file_content_pool[file_content_pool_nbr];
+    file_recovery->content_max=file_content_pool_max[file_content_pool_nbr];
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&file_content_mutex);
+#endif
+  if(file_recovery->content==NULL)
+  {
+    file_recovery->content=(unsigned char *)MALLOC(FILE_CONTENT_MIN_SIZE);
+    file_recovery->content_max=FILE_CONTENT_MIN_SIZE;
+  }
+  file_recovery->content_size=0;
+}
+
+void file_content_free(file_recovery_t *file_recovery)
+{
+  if(file_recovery->content==NULL)
+    return ;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&file_content_mutex);
+#endif
+  if(file_content_pool_nbr < FILE_CONTENT_POOL_SIZE)
+  {
+    file_content_pool[file_content_pool_nbr]=file_recovery->content;
+    file_content_pool_max[file_content_pool_nbr]=file_recovery->content_max;
+    file_content_pool_nbr++;
+    file_recovery->content=NULL;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&file_content_mutex);
+#endif
+  free(file_recovery->content);
+  file_recovery->content=NULL;
+  file_recovery->content_size=0;
+  file_recovery->content_max=0;
+}
+
+/* Must be called after writing buffer to file_recovery->handle at
+ * file_recovery->file_size */
+void file_content_append(file_recovery_t *file_recovery, const unsigned char *buffer, const unsigned int size)
+{
+  const uint64_t offset=file_recovery->file_size;
+  if(file_recovery->content==NULL)
+  {
+    if(offset!=0 || size > FILE_CONTENT_MAX_SIZE)
+    {
+      file_hash_append(file_recovery, buffer, size);
+      return ;
+    }
+    file_content_alloc(file_recovery);
+  }
+  else if(offset > file_recovery->content_size || offset + size > FILE_CONTENT_MAX_SIZE)
+  {
+    /* The digests of a file kept in memory are computed by file_hash_finish(),
+     * from now they are computed while the file is written */
+    if(offset == file_recovery->content_size)
+      file_hash_add(file_recovery, 0, file_recovery->content, file_recovery->content_size);
+    file_content_free(file_recovery);
+    file_hash_append(file_recovery, buffer, size);
+    return ;
+  }
+  if(offset + size > file_recovery->content_max)
+  {
+    uint64_t new_max=file_recovery->content_max;
+    unsigned char *content;
+    while(new_max < offset + size)
+      new_max*=2;
+    if(new_max > FILE_CONTENT_MAX_SIZE)
+      new_max=FILE_CONTENT_MAX_SIZE;
+    content=(unsigned char *)realloc(file_recovery->content, new_max);
+    if(content==NULL)
+    {
+      /* Keep going without the content in memory */
+      if(offset == file_recovery->content_size)
+	file_hash_add(file_recovery, 0, file_recovery->content, file_recovery->content_size);
+      file_content_free(file_recovery);
+      file_hash_append(file_recovery, buffer, size);
+      return ;
+    }
+    file_recovery->content=content;
+    file_recovery->content_max=new_max;
+  }
+  memcpy(file_recovery->content + offset, buffer, size);
+  file_recovery->content_size=offset + size;
+}
+
+/* Returns 1 if file_content_append() of size bytes keeps the whole file
+ * in memory */
+int file_content_fits(const file_recovery_t *file_recovery, const unsigned int size)
+{
+  const uint64_t offset=file_recovery->file_size;
+  if(file_recovery->content==NULL)
+    return (offset==0 && size <= FILE_CONTENT_MAX_SIZE);
+  return (offset <= file_recovery->content_size && offset + size <= FILE_CONTENT_MAX_SIZE);
+}
+
+/* Returns a pointer to size bytes of the file starting at offset,
+ * or NULL if they aren't in memory */
+const unsigned char *file_content_get(const file_recovery_t *file_recovery, const uint64_t offset, const unsigned int size)
+{
+  if(file_recovery->content==NULL || offset > file_recovery->content_size ||
+      size > file_recovery->content_size - offset)
+    return NULL;
+  return file_recovery->content + offset;
+}
+
+/* Read like fread() at offset, from memory if possible */
+size_t file_content_read(file_recovery_t *file_recovery, void *buffer, const unsigned int size, const uint64_t offset)
+{
+  const unsigned char *content=file_content_get(file_recovery, offset, size);
+  if(content!=NULL)
+  {
+    memcpy(buffer, content, size);
+    return size;
+  }
+  if(fseek(file_recovery->handle, offset, SEEK_SET) < 0)
+    return 0;
+  return fread(buffer, 1, size, file_recovery->handle);
+}
+
+/* Memory of the file handlers, owned by each thread: header_check,
+ * data_check and file_check functions use it instead of static
+ * variables or of an allocation for each call. */
+typedef struct
+{
+  struct td_list_head list;
+  const file_hint_t *file_hint;
+  int is_context;
+  void *data;
+  unsigned int size;
+  void (*free_context)(void *context);
+} file_handler_data_t;
+
+#ifdef HAVE_PTHREAD
+static pthread_key_t file_handler_key;
+static pthread_once_t file_handler_once=PTHREAD_ONCE_INIT;
+
+static void file_handler_data_free(void *arg)
+{
+  struct td_list_head *head=(struct td_list_head *)arg;
+  struct td_list_head *tmp;
+  struct td_list_head *next;
+  td_list_for_each_safe(tmp, next, head)
+  {
+    file_handler_data_t *hd=td_list_entry(tmp, file_handler_data_t, list);
+    if(hd->free_context!=NULL)
+      hd->free_context(hd->data);
+    td_list_del(tmp);
+    free(hd->data);
+    free(hd);
+  }
+  free(head);
+}
+
+static void file_handler_key_create(void)
+{
+  pthread_key_create(&file_handler_key, &file_handler_data_free);
+}
+#endif
+
+static file_handler_data_t *file_handler_data(const file_hint_t *file_hint, const int is_context)
+{
+  struct td_list_head *head;
+  struct td_list_head *tmp;
+  file_handler_data_t *hd;
+#ifdef HAVE_PTHREAD
+  pthread_once(&file_handler_once, &file_handler_key_create);
+  head=(struct td_list_head *)pthread_getspecific(file_handler_key);
+  if(head==NULL)
+  {
+    head=(struct td_list_head *)MALLOC(sizeof(*head));
+    TD_INIT_LIST_HEAD(head);
+    pthread_setspecific(file_handler_key, head);
+  }
+#else
+  static struct td_list_head file_handler_list=TD_LIST_HEAD_INIT(file_handler_list);
+  head=&file_handler_list;
+#endif
+  td_list_for_each(tmp, head)
+  {
+    hd=td_list_entry(tmp, file_handler_data_t, list);
+    if(hd->file_hint==file_hint && hd->is_context==is_context)
+      return hd;
+  }
+  hd=(file_handler_data_t *)MALLOC(sizeof(*hd));
+  hd->file_hint=file_hint;
+  hd->is_context=is_context;
+  hd->data=NULL;
+  hd->size=0;
+  hd->free_context=NULL;
+  td_list_add(&hd->list, head);
+  return hd;
+}
+
+void *file_handler_scratch(const file_hint_t *file_hint, const unsigned int size)
+{
+  file_handler_data_t *hd=file_handler_data(file_hint, 0);
+  if(hd->size < size)
+  {
+    free(hd->data);
+    hd->data=MALLOC(size);
+    hd->size=size;
+  }
+  return hd->data;
+}
+
+void *file_handler_context(const file_hint_t *file_hint, const unsigned int size, void (*free_context)(void *context))
+{
+  file_handler_data_t *hd=file_handler_data(file_hint, 1);
+  if(hd->data==NULL)
+  {
+    hd->data=MALLOC(size);
+    memset(hd->data, 0, size);
+    hd->size=size;
+    hd->free_context=free_context;
+  }
+  return hd->data;
 }
 
 #if 0
@@ -303,11 +825,10 @@ void reset_file_recovery(file_recovery_t *file_recovery)
   file_recovery->handle=NULL;
   file_recovery->file_size=0;
   file_recovery->file_size_on_disk=0;
-  file_recovery->location.list.prev=&file_recovery->location.list;
-  file_recovery->location.list.next=&file_recovery->location.list;
   file_recovery->location.start=0;
-  file_recovery->location.end=0;
-  file_recovery->location.data=0;
+  file_recovery->location.extents=NULL;
+  file_recovery->location.nbr=0;
+  file_recovery->location.max=0;
   file_recovery->extension=NULL;
   file_recovery->min_filesize=0;
   file_recovery->calculated_file_size=0;
@@ -321,6 +842,16 @@ void reset_file_recovery(file_recovery_t *file_recovery)
 //  file_recovery->blocksize=512;
   file_recovery->flags=0;
   file_recovery->extra=0;
+  file_recovery->verify_crc=0;
+  file_recovery->data_crc=0;
+  file_recovery->data_crc_offset=0;
+  file_recovery->content=NULL;
+  file_recovery->content_size=0;
+  file_recovery->content_max=0;
+  file_recovery->trusted_size=0;
+  file_recovery->hash=NULL;
+  file_recovery->digest_ok=0;
+  file_recovery->duplicate_of=NULL;
 }
 
 file_stat_t * init_file_stats(file_enable_t *files_enable)
@@ -357,17 +888,18 @@ file_stat_t * init_file_stats(file_enable_t *files_enable)
 }
 
 /* The original filename begins at offset in buffer and is null terminated */
-void file_rename(const char *old_filename, const void *buffer, const int buffer_size, const int offset, const char *new_ext, const int force_ext)
+int file_rename(file_recovery_t *file_recovery, const void *buffer, const int buffer_size, const int offset, const char *new_ext, const int force_ext)
 {
   /* new_filename is large enough to avoid a buffer overflow */
   char *new_filename;
+  const char *old_filename=file_recovery->filename;
   const char *src=old_filename;
   const char *ext=src;
   char *dst;
   char *directory_sep;
   int len=strlen(old_filename)+1;
   if(buffer_size<0)
-    return ;
+    return -1;
   if(offset < buffer_size && buffer!=NULL)
     len+=buffer_size-offset+1;
   if(new_ext!=NULL)
@@ -448,27 +980,33 @@ void file_rename(const char *old_filename, const void *buffer, const int buffer_
       *dst++ = *ext++;
   }
   *dst='\0';
-  if(rename(old_filename, new_filename)<0)
+  if(strlen(new_filename) >= sizeof(file_recovery->filename) ||
+      rename(old_filename, new_filename)<0)
   {
+    free(new_filename);
     /* Rename has failed, try without the original filename */
     if(buffer!=NULL)
-      file_rename(old_filename, NULL, 0, 0, new_ext, force_ext);
+      return file_rename(file_recovery, NULL, 0, 0, new_ext, force_ext);
+    return -1;
   }
+  strcpy(file_recovery->filename, new_filename);
   free(new_filename);
+  return 0;
 }
 
 /* The original filename begins at offset in buffer and is null terminated */
-void file_rename_unicode(const char *old_filename, const void *buffer, const int buffer_size, const int offset, const char *new_ext, const int force_ext)
+int file_rename_unicode(file_recovery_t *file_recovery, const void *buffer, const int buffer_size, const int offset, const char *new_ext, const int force_ext)
 {
   /* new_filename is large enough to avoid a buffer overflow */
   char *new_filename;
+  const char *old_filename=file_recovery->filename;
   const char *src=old_filename;
   const char *ext=src;
   char *dst;
   char *directory_sep;
   int len=strlen(old_filename)+1;
   if(buffer_size<0)
-    return ;
+    return -1;
   if(offset < buffer_size && buffer!=NULL)
     len+=buffer_size-offset;
   if(new_ext!=NULL)
@@ -545,11 +1083,16 @@ void file_rename_unicode(const char *old_filename, const void *buffer, const int
       *dst++ = *ext++;
   }
   *dst='\0';
-  if(rename(old_filename, new_filename)<0)
+  if(strlen(new_filename) >= sizeof(file_recovery->filename) ||
+      rename(old_filename, new_filename)<0)
   {
+    free(new_filename);
     /* Rename has failed, try without the original filename */
     if(buffer!=NULL)
-      file_rename_unicode(old_filename, NULL, 0, 0, new_ext, force_ext);
+      return file_rename_unicode(file_recovery, NULL, 0, 0, new_ext, force_ext);
+    return -1;
   }
+  strcpy(file_recovery->filename, new_filename);
   free(new_filename);
+  return 0;
 }
@@ -37,6 +37,7 @@ typedef struct file_hint_struct file_hint_t;
 typedef struct file_recovery_struct file_recovery_t;
 typedef struct file_enable_struct file_enable_t;
 typedef struct file_stat_struct file_stat_t;
+typedef struct file_check_struct file_check_t;
 typedef struct
 {
   struct td_list_head list;
@@ -80,11 +81,23 @@ struct file_recovery_struct
      It can modify file_recovery->calculated_file_size, not must not modify file_recovery->file_size
   */
   void (*file_check)(file_recovery_t *file_recovery);
-  void (*file_rename)(const char *old_filename);
+  void (*file_rename)(file_recovery_t *file_recovery);
   uint64_t checkpoint_offset;
   int checkpoint_status;	/* 0=suspend at offset_checkpoint if offset_checkpoint>0, 1=resume at offset_checkpoint */
   unsigned int blocksize;
   unsigned int flags;
+  unsigned int verify_crc;	/* data_check should verify the embedded CRC */
+  uint32_t data_crc;		/* CRC being computed by data_check */
+  uint64_t data_crc_offset;	/* Next byte to add to data_crc, 0 if none */
+  unsigned char *content;	/* Copy of the first content_size bytes written to handle, may be NULL */
+  uint64_t content_size;
+  uint64_t content_max;		/* Allocated size of content */
+  uint64_t trusted_size;	/* Data before this size has a validated declared length, it can be copied without header or data check */
+  struct file_hash_struct *hash;	/* Digests being computed, see file_hash_append() */
+  unsigned int digest_ok;	/* md5 and sha256 are set */
+  unsigned char md5[16];
+  unsigned char sha256[32];
+  const char *duplicate_of;	/* Identical file already recovered, this one hasn't been kept */
 };
 
 struct file_hint_struct
@@ -100,7 +113,7 @@ struct file_hint_struct
   void (*register_header_check)(file_stat_t *file_stat);
 };
 
-typedef struct
+struct file_check_struct
 {
   struct td_list_head list;
   const void *value;
@@ -108,8 +121,12 @@ typedef struct
   unsigned int offset;
   int (*header_check)(const unsigned char *buffer, const unsigned int buffer_size,
       const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new);
+  /* Used instead of header_check, gets the signature that has matched */
+  int (*header_check_match)(const unsigned char *buffer, const unsigned int buffer_size,
+      const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new,
+      const file_check_t *file_check);
   file_stat_t *file_stat;
-} file_check_t;
+};
 
 typedef struct
 {
@@ -122,10 +139,37 @@ typedef struct
 #define NL_CRLF         (1 << 1)
 #define NL_BARECR       (1 << 2)
 
+extern alloc_pool_t alloc_data_pool;
+
+typedef struct
+{
+  const void *footer;
+  unsigned int footer_length;
+} file_footer_t;
+
 void free_header_check(void);
 void file_allow_nl(file_recovery_t *file_recovery, const unsigned int nl_mode);
 uint64_t file_rsearch(FILE *handle, uint64_t offset, const void*footer, const unsigned int footer_length);
+uint64_t file_rsearch_footers(FILE *handle, uint64_t offset, const file_footer_t *footers, const unsigned int nbr_footers, unsigned int *footer_found);
 void file_search_footer(file_recovery_t *file_recovery, const void*footer, const unsigned int footer_length, const unsigned int extra_length);
+void file_content_append(file_recovery_t *file_recovery, const unsigned char *buffer, const unsigned int size);
+int file_content_fits(const file_recovery_t *file_recovery, const unsigned int size);
+const unsigned char *file_content_get(const file_recovery_t *file_recovery, const uint64_t offset, const unsigned int size);
+size_t file_content_read(file_recovery_t *file_recovery, void *buffer, const unsigned int size, const uint64_t offset);
+void file_content_free(file_recovery_t *file_recovery);
+void file_hash_enable(const int enable);
+void file_hash_append(file_recovery_t *file_recovery, const unsigned char *buffer, const unsigned int size);
+void file_hash_finish(file_recovery_t *file_recovery);
+void file_hash_free(file_recovery_t *file_recovery);
+/* Per-thread memory for the file handlers, so several threads can run them.
+ * file_handler_scratch() returns at least size bytes, the content isn't
+ * kept between calls.
+ * file_handler_context() returns a zeroed structure on the first call
+ * from a thread, then the same structure until the thread exits;
+ * free_context releases what the structure holds. */
+void *file_handler_scratch(const file_hint_t *file_hint, const unsigned int size);
+void *file_handler_context(const file_hint_t *file_hint, const unsigned int size, void (*free_context)(void *context));
+void file_search_footers(file_recovery_t *file_recovery, const file_footer_t *footers, const unsigned int nbr_footers, const unsigned int extra_length);
 void file_search_lc_footer(file_recovery_t *file_recovery, const unsigned char*footer, const unsigned int footer_length);
 void del_search_space(alloc_data_t *list_search_space, const uint64_t start, const uint64_t end);
 int data_check_size(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery);
@@ -135,9 +179,22 @@ void reset_file_recovery(file_recovery_t *file_recovery);
 void register_header_check(const unsigned int offset, const void *value, const unsigned int length, int (*header_check)(const unsigned char *buffer, const unsigned int buffer_size,
       const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new),
   file_stat_t *file_stat);
+void register_header_check_match(const unsigned int offset, const void *value, const unsigned int length, int (*header_check_match)(const unsigned char *buffer, const unsigned int buffer_size,
+      const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new,
+      const file_check_t *file_check),
+  file_stat_t *file_stat);
+/* file_check_header()
+ * Call the header_check of a signature found in buffer */
+int file_check_header(const file_check_t *file_check, const unsigned char *buffer, const unsigned int buffer_size,
+      const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new);
+/* Return the end of the furthest signature registered by register_header_check() */
+unsigned int header_check_max_offset(void);
 file_stat_t * init_file_stats(file_enable_t *files_enable);
-void file_rename(const char *old_filename, const void *buffer, const int buffer_size, const int offset, const char *new_ext, const int force_ext);
-void file_rename_unicode(const char *old_filename, const void *buffer, const int buffer_size, const int offset, const char *new_ext, const int force_ext);
+/* file_rename()
+ * On success, file_recovery->filename is updated with the new name
+ * @returns 0 on success, -1 if the file hasn't been renamed */
+int file_rename(file_recovery_t *file_recovery, const void *buffer, const int buffer_size, const int offset, const char *new_ext, const int force_ext);
+int file_rename_unicode(file_recovery_t *file_recovery, const void *buffer, const int buffer_size, const int offset, const char *new_ext, const int force_ext);
 
 #ifdef __cplusplus
 } /* closing brace for extern "C" */
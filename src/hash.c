@@ -0,0 +1,260 @@
+/*
+
+    File: hash.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#include <stdio.h>
+#include "types.h"
+#include "hash.h"
+
+/* MD5 (RFC 1321) and SHA-256 (FIPS 180-4), data is processed by blocks of
+ * 64 bytes, the state is kept between calls to *_update() */
+
+#define ROTL32(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t md5_k[64]=
+{
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const unsigned char md5_r[64]=
+{
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static void md5_block(md5_ctx_t *ctx, const unsigned char *block)
+{
+  uint32_t w[16];
+  uint32_t a=ctx->state[0];
+  uint32_t b=ctx->state[1];
+  uint32_t c=ctx->state[2];
+  uint32_t d=ctx->state[3];
+  unsigned int i;
+  for(i=0; i<16; i++)
+    w[i]=(uint32_t)block[4*i] | ((uint32_t)block[4*i+1]<<8) |
+      ((uint32_t)block[4*i+2]<<16) | ((uint32_t)block[4*i+3]<<24);
+  for(i=0; i<64; i++)
+  {
+    uint32_t f;
+    uint32_t tmp;
+    unsigned int g;
+    if(i<16)
+    {
+      f=(b & c) | (~b & d);
+      g=i;
+    }
+    else if(i<32)
+    {
+      f=(d & b) | (~d & c);
+      g=(5*i+1)%16;
+    }
+    else if(i<48)
+    {
+      f=b ^ c ^ d;
+      g=(3*i+5)%16;
+    }
+    else
+    {
+      f=c ^ (b | ~d);
+      g=(7*i)%16;
+    }
+    tmp=d;
+    d=c;
+    c=b;
+    b=b + ROTL32(a + f + md5_k[i] + w[g], md5_r[i]);
+    a=tmp;
+  }
+  ctx->state[0]+=a;
+  ctx->state[1]+=b;
+  ctx->state[2]+=c;
+  ctx->state[3]+=d;
+}
+
+void md5_init(md5_ctx_t *ctx)
+{
+  ctx->state[0]=0x67452301;
+  ctx->state[1]=0xefcdab89;
+  ctx->state[2]=0x98badcfe;
+  ctx->state[3]=0x10325476;
+  ctx->count=0;
+}
+
+void md5_update(md5_ctx_t *ctx, const void *data, size_t size)
+{
+  const unsigned char *p=(const unsigned char *)data;
+  unsigned int used=ctx->count % 64;
+  ctx->count+=size;
+  if(used>0)
+  {
+    const unsigned int len=(size < 64-used ? size : 64-used);
+    memcpy(&ctx->buffer[used], p, len);
+    p+=len;
+    size-=len;
+    if(used+len<64)
+      return ;
+    md5_block(ctx, ctx->buffer);
+  }
+  for(; size>=64; p+=64, size-=64)
+    md5_block(ctx, p);
+  if(size>0)
+    memcpy(ctx->buffer, p, size);
+}
+
+void md5_final(md5_ctx_t *ctx, unsigned char digest[MD5_DIGEST_SIZE])
+{
+  static const unsigned char padding[64]={ 0x80 };
+  unsigned char length[8];
+  const uint64_t bits=ctx->count*8;
+  const unsigned int used=ctx->count % 64;
+  unsigned int i;
+  for(i=0; i<8; i++)
+    length[i]=(bits >> (8*i)) & 0xff;
+  md5_update(ctx, padding, (used < 56 ? 56-used : 120-used));
+  md5_update(ctx, length, 8);
+  for(i=0; i<16; i++)
+    digest[i]=(ctx->state[i/4] >> (8*(i%4))) & 0xff;
+}
+
+static const uint32_t sha256_k[64]=
+{
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void sha256_block(sha256_ctx_t *ctx, const unsigned char *block)
+{
+  uint32_t w[64];
+  uint32_t s[8];
+  unsigned int i;
+  for(i=0; i<16; i++)
+    w[i]=((uint32_t)block[4*i]<<24) | ((uint32_t)block[4*i+1]<<16) |
+      ((uint32_t)block[4*i+2]<<8) | (uint32_t)block[4*i+3];
+  for(i=16; i<64; i++)
+  {
+    const uint32_t s0=ROTR32(w[i-15], 7) ^ ROTR32(w[i-15], 18) ^ (w[i-15] >> 3);
+    const uint32_t s1=ROTR32(w[i-2], 17) ^ ROTR32(w[i-2], 19) ^ (w[i-2] >> 10);
+    w[i]=w[i-16] + s0 + w[i-7] + s1;
+  }
+  memcpy(s, ctx->state, sizeof(s));
+  for(i=0; i<64; i++)
+  {
+    const uint32_t S1=ROTR32(s[4], 6) ^ ROTR32(s[4], 11) ^ ROTR32(s[4], 25);
+    const uint32_t ch=(s[4] & s[5]) ^ (~s[4] & s[6]);
+    const uint32_t t1=s[7] + S1 + ch + sha256_k[i] + w[i];
+    const uint32_t S0=ROTR32(s[0], 2) ^ ROTR32(s[0], 13) ^ ROTR32(s[0], 22);
+    const uint32_t maj=(s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]);
+    const uint32_t t2=S0 + maj;
+    s[7]=s[6];
+    s[6]=s[5];
+    s[5]=s[4];
+    s[4]=s[3] + t1;
+    s[3]=s[2];
+    s[2]=s[1];
+    s[1]=s[0];
+    s[0]=t1 + t2;
+  }
+  for(i=0; i<8; i++)
+    ctx->state[i]+=s[i];
+}
+
+void sha256_init(sha256_ctx_t *ctx)
+{
+  ctx->state[0]=0x6a09e667;
+  ctx->state[1]=0xbb67ae85;
+  ctx->state[2]=0x3c6ef372;
+  ctx->state[3]=0xa54ff53a;
+  ctx->state[4]=0x510e527f;
+  ctx->state[5]=0x9b05688c;
+  ctx->state[6]=0x1f83d9ab;
+  ctx->state[7]=0x5be0cd19;
+  ctx->count=0;
+}
+
+void sha256_update(sha256_ctx_t *ctx, const void *data, size_t size)
+{
+  const unsigned char *p=(const unsigned char *)data;
+  unsigned int used=ctx->count % 64;
+  ctx->count+=size;
+  if(used>0)
+  {
+    const unsigned int len=(size < 64-used ? size : 64-used);
+    memcpy(&ctx->buffer[used], p, len);
+    p+=len;
+    size-=len;
+    if(used+len<64)
+      return ;
+    sha256_block(ctx, ctx->buffer);
+  }
+  for(; size>=64; p+=64, size-=64)
+    sha256_block(ctx, p);
+  if(size>0)
+    memcpy(ctx->buffer, p, size);
+}
+
+void sha256_final(sha256_ctx_t *ctx, unsigned char digest[SHA256_DIGEST_SIZE])
+{
+  static const unsigned char padding[64]={ 0x80 };
+  unsigned char length[8];
+  const uint64_t bits=ctx->count*8;
+  const unsigned int used=ctx->count % 64;
+  unsigned int i;
+  for(i=0; i<8; i++)
+    length[i]=(bits >> (56-8*i)) & 0xff;
+  sha256_update(ctx, padding, (used < 56 ? 56-used : 120-used));
+  sha256_update(ctx, length, 8);
+  for(i=0; i<32; i++)
+    digest[i]=(ctx->state[i/4] >> (24-8*(i%4))) & 0xff;
+}
+
+void hash_to_hex(char *hex, const unsigned char *digest, const unsigned int size)
+{
+  static const char hexdigits[]="0123456789abcdef";
+  unsigned int i;
+  for(i=0; i<size; i++)
+  {
+    hex[2*i]=hexdigits[digest[i]>>4];
+    hex[2*i+1]=hexdigits[digest[i]&0x0f];
+  }
+  hex[2*size]='\0';
+}
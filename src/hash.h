@@ -0,0 +1,60 @@
+/*
+
+    File: hash.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _HASH_H
+#define _HASH_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MD5_DIGEST_SIZE		16
+#define SHA256_DIGEST_SIZE	32
+
+typedef struct
+{
+  uint32_t state[4];
+  uint64_t count;		/* number of bytes */
+  unsigned char buffer[64];
+} md5_ctx_t;
+
+typedef struct
+{
+  uint32_t state[8];
+  uint64_t count;		/* number of bytes */
+  unsigned char buffer[64];
+} sha256_ctx_t;
+
+void md5_init(md5_ctx_t *ctx);
+void md5_update(md5_ctx_t *ctx, const void *data, size_t size);
+void md5_final(md5_ctx_t *ctx, unsigned char digest[MD5_DIGEST_SIZE]);
+
+void sha256_init(sha256_ctx_t *ctx);
+void sha256_update(sha256_ctx_t *ctx, const void *data, size_t size);
+void sha256_final(sha256_ctx_t *ctx, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+/* hash_to_hex()
+ * hex must be able to hold 2*size+1 characters */
+void hash_to_hex(char *hex, const unsigned char *digest, const unsigned int size);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
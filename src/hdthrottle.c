@@ -0,0 +1,389 @@
+/*
+
+    File: hdthrottle.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>	/* usleep */
+#endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "hdthrottle.h"
+#include "log.h"
+
+/* Token buckets: the tokens are refilled at rate per second up to burst,
+ * a request may leave the bucket in debt, the next one then waits.
+ * The budgets are shared by all the disks of the process. */
+typedef struct
+{
+  uint64_t rate;
+  uint64_t burst;
+  double tokens;
+  uint64_t last;	/* us */
+} throttle_bucket_t;
+
+/* Adaptive backoff: when the read latency exceeds THROTTLE_SLOW times
+ * the usual latency, or on read error, the disk is left idle for
+ * (backoff-1) times the duration of each read. backoff is doubled at most
+ * every THROTTLE_HOLD reads, up to THROTTLE_BACKOFF_MAX, and decreases
+ * slowly once the latency is back to normal. backoff is in 1/16 units.
+ * Latencies below THROTTLE_LATENCY_MIN (us) are never considered slow. */
+#define THROTTLE_SLOW		4
+#define THROTTLE_LATENCY_MIN	2000
+#define THROTTLE_HOLD		8
+#define THROTTLE_BACKOFF_MAX	(16*16)
+
+struct throttle_struct
+{
+  disk_t *disk_car;
+  uint64_t latency;	/* us, moving average */
+  uint64_t latency_min;
+  uint64_t idle;	/* us to wait before the next read */
+  unsigned int backoff;
+  unsigned int backoff_max;
+  unsigned int hold;
+  uint64_t nbr_read;
+  uint64_t read_size;
+  uint64_t waited;	/* us */
+};
+
+static throttle_bucket_t throttle_read={ 0, 0, 0, 0 };
+static throttle_bucket_t throttle_read_iops={ 0, 0, 0, 0 };
+static throttle_bucket_t throttle_write_bucket={ 0, 0, 0, 0 };
+static unsigned int throttle_adaptive=0;
+
+static int throttle_pread(disk_t *disk_car, void *buffer, const unsigned int count, const uint64_t offset);
+static void *throttle_pread_fast(disk_t *disk_car, void *buffer, const unsigned int count, const uint64_t offset);
+static int throttle_pwrite(disk_t *disk_car, const void *buffer, const unsigned int count, const uint64_t offset);
+static int throttle_sync(disk_t *disk_car);
+static int throttle_clean(disk_t *disk_car);
+static const char *throttle_description(disk_t *disk_car);
+static const char *throttle_description_short(disk_t *disk_car);
+
+static uint64_t throttle_now(void)
+{
+#ifdef HAVE_SYS_TIME_H
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#else
+  return (uint64_t)time(NULL) * 1000000;
+#endif
+}
+
+static void throttle_sleep(uint64_t delay)
+{
+#ifdef HAVE_USLEEP
+  /* usleep() may not accept more than one second */
+  for(; delay >= 1000000; delay-=1000000)
+    usleep(999999);
+  if(delay > 0)
+    usleep(delay);
+#elif defined(HAVE_SLEEP)
+  sleep((delay + 999999) / 1000000);
+#endif
+}
+
+/* bucket_take()
+ * @returns the time in us to wait before using count tokens */
+static uint64_t bucket_take(throttle_bucket_t *bucket, const uint64_t count, const uint64_t now)
+{
+  if(bucket->rate==0)
+    return 0;
+  if(now > bucket->last)
+  {
+    bucket->tokens+=(double)(now - bucket->last) * bucket->rate / 1000000;
+    if(bucket->tokens > bucket->burst)
+      bucket->tokens=bucket->burst;
+  }
+  bucket->last=now;
+  bucket->tokens-=count;
+  if(bucket->tokens >= 0)
+    return 0;
+  return -bucket->tokens * 1000000 / bucket->rate;
+}
+
+static void bucket_set(throttle_bucket_t *bucket, const uint64_t rate, const uint64_t burst, const uint64_t burst_min)
+{
+  bucket->rate=rate;
+  bucket->burst=(burst > 0 ? burst : rate);
+  if(bucket->burst < burst_min)
+    bucket->burst=burst_min;
+  bucket->tokens=bucket->burst;
+  bucket->last=throttle_now();
+}
+
+static const char *throttle_parse_value(const char *cmd, const char *name, uint64_t *value)
+{
+  const unsigned int len=strlen(name);
+  char *end;
+  if(strncmp(cmd, name, len)!=0 || cmd[len]!='=')
+    return NULL;
+  cmd+=len+1;
+  if(*cmd<'0' || *cmd>'9')
+    return NULL;
+  *value=strtoull(cmd, &end, 10);
+  switch(*end)
+  {
+    case 'G': case 'g':	*value*=1024;
+    /*@fallthrough@*/
+    case 'M': case 'm':	*value*=1024;
+    /*@fallthrough@*/
+    case 'K': case 'k':	*value*=1024;
+      end++;
+      break;
+  }
+  if(*end!=',' && *end!='\0')
+    return NULL;
+  return end;
+}
+
+int throttle_set(const char *cmd)
+{
+  uint64_t read_rate=0;
+  uint64_t read_burst=0;
+  uint64_t read_iops=0;
+  uint64_t write_rate=0;
+  uint64_t write_burst=0;
+  unsigned int adaptive=0;
+  while(*cmd!='\0')
+  {
+    const char *next;
+    if(*cmd==',')
+      next=cmd+1;
+    /* Check read_burst and read_iops before read */
+    else if((next=throttle_parse_value(cmd, "read_burst", &read_burst))!=NULL ||
+	(next=throttle_parse_value(cmd, "read_iops", &read_iops))!=NULL ||
+	(next=throttle_parse_value(cmd, "read", &read_rate))!=NULL ||
+	(next=throttle_parse_value(cmd, "write_burst", &write_burst))!=NULL ||
+	(next=throttle_parse_value(cmd, "write", &write_rate))!=NULL)
+    {
+    }
+    else if(strncmp(cmd, "adaptive", 8)==0 && (cmd[8]==',' || cmd[8]=='\0'))
+    {
+      adaptive=1;
+      next=cmd+8;
+    }
+    else
+      return -1;
+    cmd=next;
+  }
+  bucket_set(&throttle_read, read_rate, read_burst, 64*1024);
+  bucket_set(&throttle_read_iops, read_iops, 0, 1);
+  bucket_set(&throttle_write_bucket, write_rate, write_burst, 64*1024);
+  throttle_adaptive=adaptive;
+  return 0;
+}
+
+void throttle_write(const unsigned int size)
+{
+  const uint64_t delay=bucket_take(&throttle_write_bucket, size, throttle_now());
+  if(delay > 0)
+    throttle_sleep(delay);
+}
+
+static void throttle_latency(struct throttle_struct *data, const uint64_t latency, const int error)
+{
+  uint64_t usual;
+  if(data->latency==0)
+    data->latency=latency;
+  else
+    data->latency=(7 * data->latency + latency) / 8;
+  /* Let the reference follow a disk becoming durably slower */
+  if(data->latency_min==0 || data->latency < data->latency_min)
+    data->latency_min=data->latency;
+  else
+    data->latency_min+=data->latency_min / 1024 + 1;
+  usual=(data->latency_min > THROTTLE_LATENCY_MIN ? data->latency_min : THROTTLE_LATENCY_MIN);
+  if(data->hold > 0)
+    data->hold--;
+  if(error || data->latency > THROTTLE_SLOW * usual)
+  {
+    if(data->backoff < THROTTLE_BACKOFF_MAX && data->hold==0)
+    {
+      data->hold=THROTTLE_HOLD;
+      data->backoff=(2 * data->backoff < THROTTLE_BACKOFF_MAX ? 2 * data->backoff : THROTTLE_BACKOFF_MAX);
+      if(data->backoff > data->backoff_max)
+      {
+	data->backoff_max=data->backoff;
+	if(error)
+	  log_info("%s: read error, slowing down x%u\n",
+	      data->disk_car->description_short(data->disk_car), data->backoff / 16);
+	else
+	  log_info("%s: read latency %lu us, usually %lu us, slowing down x%u\n",
+	      data->disk_car->description_short(data->disk_car),
+	      (long unsigned)data->latency, (long unsigned)data->latency_min,
+	      data->backoff / 16);
+      }
+    }
+  }
+  else if(data->backoff > 16 && data->latency < THROTTLE_SLOW / 2 * usual)
+    data->backoff--;
+}
+
+static int throttle_pread(disk_t *disk_car, void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct throttle_struct *data=(struct throttle_struct *)disk_car->data;
+  uint64_t start=throttle_now();
+  uint64_t delay=bucket_take(&throttle_read, count, start);
+  const uint64_t delay_iops=bucket_take(&throttle_read_iops, 1, start);
+  int res;
+  if(delay < delay_iops)
+    delay=delay_iops;
+  delay+=data->idle;
+  data->idle=0;
+  if(delay > 0)
+  {
+    throttle_sleep(delay);
+    data->waited+=delay;
+    start=throttle_now();
+  }
+  res=data->disk_car->pread(data->disk_car, buffer, count, offset);
+  data->nbr_read++;
+  data->read_size+=count;
+  if(throttle_adaptive > 0)
+  {
+    const uint64_t end=throttle_now();
+    const uint64_t latency=(end > start ? end - start : 0);
+    /* Reads after the end of the disk are not errors */
+    const int error=(res!=(int)count &&
+	offset + count <= data->disk_car->disk_size &&
+	offset + count <= data->disk_car->disk_real_size);
+    /* Compare the latencies of 64 KiB reads */
+    throttle_latency(data, (count > 65536 ? latency * 65536 / count : latency), error);
+    data->idle=latency * (data->backoff - 16) / 16;
+  }
+  return res;
+}
+
+static void *throttle_pread_fast(disk_t *disk_car, void *buffer, const unsigned int count, const uint64_t offset)
+{
+  if(throttle_pread(disk_car, buffer, count, offset) == (int)count)
+    return buffer;
+  return NULL;
+}
+
+static int throttle_pwrite(disk_t *disk_car, const void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct throttle_struct *data=(struct throttle_struct *)disk_car->data;
+  const uint64_t delay=bucket_take(&throttle_write_bucket, count, throttle_now());
+  if(delay > 0)
+  {
+    throttle_sleep(delay);
+    data->waited+=delay;
+  }
+  disk_car->write_used=1;
+  return data->disk_car->pwrite(data->disk_car, buffer, count, offset);
+}
+
+static int throttle_sync(disk_t *disk_car)
+{
+  struct throttle_struct *data=(struct throttle_struct *)disk_car->data;
+  return data->disk_car->sync(data->disk_car);
+}
+
+static int throttle_clean(disk_t *disk_car)
+{
+  if(disk_car->data)
+  {
+    struct throttle_struct *data=(struct throttle_struct *)disk_car->data;
+    log_info("%s: %llu reads, %llu MB, throttled %llus",
+	data->disk_car->description_short(data->disk_car),
+	(long long unsigned)data->nbr_read,
+	(long long unsigned)(data->read_size / 1000 / 1000),
+	(long long unsigned)(data->waited / 1000000));
+    if(data->backoff_max > 16)
+      log_info(", slowed down up to x%u", data->backoff_max / 16);
+    log_info("\n");
+    data->disk_car->clean(data->disk_car);
+    free(data->disk_car);
+    free(disk_car->data);
+    disk_car->data=NULL;
+  }
+  return 0;
+}
+
+static void throttle_update(disk_t *disk_car)
+{
+  struct throttle_struct *data=(struct throttle_struct *)disk_car->data;
+  data->disk_car->geom.cylinders=disk_car->geom.cylinders;
+  data->disk_car->geom.heads_per_cylinder=disk_car->geom.heads_per_cylinder;
+  data->disk_car->geom.sectors_per_head=disk_car->geom.sectors_per_head;
+  data->disk_car->disk_size=disk_car->disk_size;
+}
+
+static const char *throttle_description(disk_t *disk_car)
+{
+  struct throttle_struct *data=(struct throttle_struct *)disk_car->data;
+  throttle_update(disk_car);
+  return data->disk_car->description(data->disk_car);
+}
+
+static const char *throttle_description_short(disk_t *disk_car)
+{
+  struct throttle_struct *data=(struct throttle_struct *)disk_car->data;
+  throttle_update(disk_car);
+  return data->disk_car->description_short(data->disk_car);
+}
+
+disk_t *new_diskthrottle(disk_t *disk_car)
+{
+  struct throttle_struct *data;
+  disk_t *new_disk_car;
+  if(throttle_read.rate==0 && throttle_read_iops.rate==0 &&
+      throttle_write_bucket.rate==0 && throttle_adaptive==0)
+    return disk_car;
+  data=(struct throttle_struct *)MALLOC(sizeof(*data));
+  new_disk_car=(disk_t *)MALLOC(sizeof(*new_disk_car));
+  memcpy(new_disk_car, disk_car, sizeof(*new_disk_car));
+  memset(data, 0, sizeof(*data));
+  data->disk_car=disk_car;
+  data->backoff=16;
+  data->backoff_max=16;
+  new_disk_car->write_used=0;
+  new_disk_car->data=data;
+  new_disk_car->pread_fast=throttle_pread_fast;
+  new_disk_car->pread=throttle_pread;
+  new_disk_car->pwrite=throttle_pwrite;
+  new_disk_car->sync=throttle_sync;
+  new_disk_car->clean=throttle_clean;
+  new_disk_car->description=throttle_description;
+  new_disk_car->description_short=throttle_description_short;
+  new_disk_car->rbuffer=NULL;
+  new_disk_car->wbuffer=NULL;
+  new_disk_car->rbuffer_size=0;
+  new_disk_car->wbuffer_size=0;
+  return new_disk_car;
+}
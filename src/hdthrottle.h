@@ -0,0 +1,44 @@
+/*
+
+    File: hdthrottle.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* throttle_set()
+ * cmd: comma separated list of
+ * read=rate,read_burst=size,read_iops=nbr,write=rate,write_burst=size,adaptive
+ * rates are in bytes per second, sizes in bytes, K, M or G may be appended
+ * @returns 0 on success, -1 on syntax error */
+int throttle_set(const char *cmd);
+
+/* new_diskthrottle()
+ * @returns disk_car if throttling isn't enabled, otherwise a new disk
+ * limiting the reads and the writes of disk_car */
+disk_t *new_diskthrottle(disk_t *disk_car);
+
+/* throttle_write()
+ * Must be called after size bytes have been written to a recovered file */
+void throttle_write(const unsigned int size);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
@@ -23,31 +23,135 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
+#include <stdio.h>
 #ifdef HAVE_STDLIB_H
 #include <stdlib.h>
 #endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
 #include "types.h"
 #include "common.h"
 #include "list.h"
+#include "log.h"
 
-void list_truncate(alloc_list_t *list, const uint64_t file_size)
+#define ALLOC_POOL_SLAB_NODES	1024
+
+static void pool_grow(alloc_pool_t *pool)
+{
+  const unsigned int header_size=(sizeof(void *)+7)/8*8;
+  unsigned char *slab=(unsigned char *)MALLOC(header_size + ALLOC_POOL_SLAB_NODES * pool->node_size);
+  unsigned int i;
+  *(void **)slab=pool->slabs;
+  pool->slabs=slab;
+  for(i=0; i<ALLOC_POOL_SLAB_NODES; i++)
+  {
+    struct td_list_head *node=(struct td_list_head *)(slab + header_size + i * pool->node_size);
+    td_list_add_tail(node, &pool->free_nodes);
+  }
+  pool->capacity+=ALLOC_POOL_SLAB_NODES;
+}
+
+void *pool_alloc(alloc_pool_t *pool)
+{
+  struct td_list_head *node;
+  if(td_list_empty(&pool->free_nodes))
+    pool_grow(pool);
+  node=pool->free_nodes.next;
+  td_list_del(node);
+  if(++pool->live > pool->peak)
+    pool->peak=pool->live;
+  return node;
+}
+
+void pool_free(alloc_pool_t *pool, struct td_list_head *node)
+{
+  td_list_add(node, &pool->free_nodes);
+  pool->live--;
+}
+
+/* Give back all the nodes of a list at once, head is left empty */
+void pool_free_list(alloc_pool_t *pool, struct td_list_head *head)
 {
   struct td_list_head *tmp;
-  struct td_list_head *next;
-  uint64_t size=0;
-  td_list_for_each_safe(tmp, next, &list->list)
+  unsigned long int nbr=0;
+  td_list_for_each(tmp, head)
+    nbr++;
+  td_list_splice_init(head, &pool->free_nodes);
+  pool->live-=nbr;
+}
+
+void pool_log_stats(const alloc_pool_t *pool, const char *name)
+{
+  log_info("%s: %lu nodes in use, peak %lu, %lu allocated (%lu%% used)\n",
+      name, pool->live, pool->peak, pool->capacity,
+      (pool->capacity>0 ? pool->live*100/pool->capacity : 0));
+}
+
+void alloc_list_init(alloc_list_t *list)
+{
+  list->extents=NULL;
+  list->nbr=0;
+  list->max=0;
+}
+
+void alloc_list_free(alloc_list_t *list)
+{
+  free(list->extents);
+  alloc_list_init(list);
+}
+
+void list_append_block(alloc_list_t *list, const uint64_t offset, const uint64_t blocksize, const unsigned int data)
+{
+  alloc_extent_t *extent;
+  uint64_t file_offset=0;
+  if(list->nbr>0)
   {
-    alloc_list_t *element=td_list_entry(tmp, alloc_list_t, list);
-    if(size>=file_size)
+    alloc_extent_t *prev=&list->extents[list->nbr-1];
+    if(prev->end+1==offset && prev->data==data)
     {
-      td_list_del(tmp);
-      free(element);
-    }
-    else if(element->data>0)
-    {
-      size+=(element->end-element->start+1);
-      if(size>=file_size)
-	element->end-=(size-file_size);
+      prev->end=offset+blocksize-1;
+      return ;
     }
+    file_offset=prev->file_offset;
+    if(prev->data>0)
+      file_offset+=prev->end-prev->start+1;
+  }
+  if(list->nbr==list->max)
+  {
+    const unsigned int max=(list->max>0 ? 2*list->max : 16);
+    alloc_extent_t *extents=(alloc_extent_t *)MALLOC(max*sizeof(*extents));
+    if(list->nbr>0)
+      memcpy(extents, list->extents, list->nbr*sizeof(*extents));
+    free(list->extents);
+    list->extents=extents;
+    list->max=max;
+  }
+  extent=&list->extents[list->nbr++];
+  extent->start=offset;
+  extent->end=offset+blocksize-1;
+  extent->file_offset=file_offset;
+  extent->data=data;
+}
+
+void list_truncate(alloc_list_t *list, const uint64_t file_size)
+{
+  /* Keep the extents beginning before file_size */
+  unsigned int low=0;
+  unsigned int high=list->nbr;
+  while(low<high)
+  {
+    const unsigned int mid=low+(high-low)/2;
+    if(list->extents[mid].file_offset < file_size)
+      low=mid+1;
+    else
+      high=mid;
+  }
+  list->nbr=low;
+  if(low>0)
+  {
+    alloc_extent_t *extent=&list->extents[low-1];
+    if(extent->data>0 && extent->file_offset + (extent->end-extent->start+1) > file_size)
+      extent->end=extent->start + (file_size - extent->file_offset) - 1;
   }
 }
@@ -364,19 +364,52 @@ static inline int td_list_add_sorted_uniq(struct td_list_head *newe, struct td_l
   return 0;
 }
 
-typedef struct alloc_list_s alloc_list_t;
-struct alloc_list_s
+typedef struct
 {
-  struct td_list_head list;
   uint64_t start;
   uint64_t end;
+  uint64_t file_offset;	/* sum of the size of the previous data extents */
   unsigned int data;
+} alloc_extent_t;
+
+/* Location of a file: a growable array of extents, contiguous blocks
+ * with the same data flag are merged in a single extent. */
+typedef struct alloc_list_s alloc_list_t;
+struct alloc_list_s
+{
+  uint64_t start;	/* offset of the first block of the file */
+  alloc_extent_t *extents;
+  unsigned int nbr;
+  unsigned int max;
 };
 
+/* Pool of fixed-size nodes, every node must begin with a struct td_list_head.
+ * Nodes are carved from slabs that are kept until the end of the program,
+ * free nodes are linked together. Not thread safe. */
+typedef struct alloc_pool_s alloc_pool_t;
+struct alloc_pool_s
+{
+  struct td_list_head free_nodes;
+  void *slabs;
+  unsigned int node_size;
+  unsigned long int live;
+  unsigned long int peak;
+  unsigned long int capacity;
+};
+
+#define ALLOC_POOL_INIT(name, type) { TD_LIST_HEAD_INIT(name.free_nodes), NULL, sizeof(type), 0, 0, 0 }
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+void *pool_alloc(alloc_pool_t *pool);
+void pool_free(alloc_pool_t *pool, struct td_list_head *node);
+void pool_free_list(alloc_pool_t *pool, struct td_list_head *head);
+void pool_log_stats(const alloc_pool_t *pool, const char *name);
+void alloc_list_init(alloc_list_t *list);
+void alloc_list_free(alloc_list_t *list);
+void list_append_block(alloc_list_t *list, const uint64_t offset, const uint64_t blocksize, const unsigned int data);
 void list_truncate(alloc_list_t *list, const uint64_t file_size);
 
 #ifdef __cplusplus
@@ -42,13 +42,40 @@
 #ifdef HAVE_SYS_CYGWIN_H
 #include <sys/cygwin.h>
 #endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include "types.h"
 #include "common.h"
 #include "log.h"
 
+/* Messages are formatted by the caller, in its own stack, and queued in
+ * log_buffer[log_buffer_cur]. When this buffer is full, or after
+ * LOG_FLUSH_DELAY seconds, it's handed to the writer thread and the other
+ * buffer is used. Without the writer thread, the buffer is written
+ * synchronously every LOG_BUFFER_SYNC bytes like a stdio buffer. */
+#define LOG_BUFFER_SIZE (256*1024)
+#define LOG_BUFFER_SYNC	4096
+#define LOG_FLUSH_DELAY	1
+#define LOG_MSG_SIZE	1024
+
 static FILE *log_handle=NULL;
 static int f_status=0;
-static int log_handler(const char *_format, va_list ap) __attribute__((format(printf, 1, 0)));
+static char log_buffer[2][LOG_BUFFER_SIZE];
+static unsigned int log_buffer_len[2]={0, 0};
+static unsigned int log_buffer_cur=0;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t log_mutex=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond_pending=PTHREAD_COND_INITIALIZER;
+static pthread_cond_t log_cond_done=PTHREAD_COND_INITIALIZER;
+static pthread_t log_thread;
+static int log_thread_running=0;
+static int log_thread_stop=0;
+static int log_pending=-1;	/* buffer being written by the writer thread */
+#endif
+static void log_write_buffer(const unsigned int idx);
+static void log_queue(const char *msg, const unsigned int len);
+static void log_start(void);
 /* static unsigned int log_levels=LOG_LEVEL_DEBUG|LOG_LEVEL_TRACE|LOG_LEVEL_QUIET|LOG_LEVEL_INFO|LOG_LEVEL_VERBOSE|LOG_LEVEL_PROGRESS|LOG_LEVEL_WARNING|LOG_LEVEL_ERROR|LOG_LEVEL_PERROR|LOG_LEVEL_CRITICAL; */
 static unsigned int log_levels=LOG_LEVEL_TRACE|LOG_LEVEL_QUIET|LOG_LEVEL_INFO|LOG_LEVEL_VERBOSE|LOG_LEVEL_PROGRESS|LOG_LEVEL_WARNING|LOG_LEVEL_ERROR|LOG_LEVEL_PERROR|LOG_LEVEL_CRITICAL;
 
@@ -73,6 +100,8 @@ FILE *log_open(const char*default_filename, const int mode)
     }
   }
 #endif
+  if(log_handle!=NULL)
+    log_start();
   return log_handle;
 }
 
@@ -122,34 +151,201 @@ FILE *log_open_default(const char*default_filename, const int mode)
 }
 #endif
 
+static void log_write_buffer(const unsigned int idx)
+{
+  if(log_buffer_len[idx]==0)
+    return ;
+  /* Flush after each batch so nothing stay in stdio buffer */
+  if(fwrite(log_buffer[idx], log_buffer_len[idx], 1, log_handle)!=1 ||
+      fflush(log_handle)!=0)
+    f_status=1;
+  log_buffer_len[idx]=0;
+}
+
+#ifdef HAVE_PTHREAD
+static void *log_writer(void *arg)
+{
+  pthread_mutex_lock(&log_mutex);
+  while(1)
+  {
+    unsigned int idx;
+    if(log_pending<0 && log_thread_stop==0)
+    {
+      struct timespec deadline;
+      deadline.tv_sec=time(NULL)+LOG_FLUSH_DELAY;
+      deadline.tv_nsec=0;
+      pthread_cond_timedwait(&log_cond_pending, &log_mutex, &deadline);
+      if(log_pending<0 && log_thread_stop==0)
+      {
+	/* Don't keep the last messages in memory */
+	if(log_buffer_len[log_buffer_cur]==0)
+	  continue;
+	log_pending=log_buffer_cur;
+	log_buffer_cur^=1;
+      }
+    }
+    if(log_pending<0)
+      break;
+    idx=log_pending;
+    pthread_mutex_unlock(&log_mutex);
+    log_write_buffer(idx);
+    pthread_mutex_lock(&log_mutex);
+    log_pending=-1;
+    pthread_cond_broadcast(&log_cond_done);
+  }
+  pthread_mutex_unlock(&log_mutex);
+  return arg;
+}
+
+/* log_mutex must be held */
+static void log_wait_writer(void)
+{
+  while(log_pending>=0)
+    pthread_cond_wait(&log_cond_done, &log_mutex);
+}
+#endif
+
+#ifdef HAVE_ATEXIT
+static void log_close_atexit(void)
+{
+  log_close();
+}
+#endif
+
+#if defined(HAVE_SIGACTION) && defined(HAVE_UNISTD_H)
+static void log_write_fd(const int fd, const char *buffer, unsigned int len)
+{
+  while(len>0)
+  {
+    const ssize_t res=write(fd, buffer, len);
+    if(res<=0)
+      return ;
+    buffer+=res;
+    len-=res;
+  }
+}
+#endif
+
+static void log_start(void)
+{
+  static int log_initialized=0;
+  if(log_initialized==0)
+  {
+#ifdef HAVE_ATEXIT
+    atexit(log_close_atexit);
+#endif
+    log_initialized=1;
+  }
+#ifdef HAVE_PTHREAD
+  if(log_thread_running==0)
+  {
+    log_thread_stop=0;
+    if(pthread_create(&log_thread, NULL, log_writer, NULL)==0)
+      log_thread_running=1;
+  }
+#endif
+}
+
+static void log_queue(const char *msg, const unsigned int len)
+{
+  unsigned int max_len=LOG_BUFFER_SYNC;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&log_mutex);
+  if(log_thread_running)
+    max_len=LOG_BUFFER_SIZE;
+#endif
+  if(log_buffer_len[log_buffer_cur] + len > max_len)
+  {
+#ifdef HAVE_PTHREAD
+    if(log_thread_running)
+    {
+      log_wait_writer();
+      log_pending=log_buffer_cur;
+      log_buffer_cur^=1;
+      pthread_cond_signal(&log_cond_pending);
+    }
+    else
+#endif
+      log_write_buffer(log_buffer_cur);
+  }
+  if(len > max_len)
+  {
+    /* Too big to be queued, keep the messages in order */
+#ifdef HAVE_PTHREAD
+    log_wait_writer();
+#endif
+    if(fwrite(msg, len, 1, log_handle)!=1 || fflush(log_handle)!=0)
+      f_status=1;
+  }
+  else
+  {
+    memcpy(&log_buffer[log_buffer_cur][log_buffer_len[log_buffer_cur]], msg, len);
+    log_buffer_len[log_buffer_cur]+=len;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&log_mutex);
+#endif
+}
+
 int log_flush(void)
 {
+  if(log_handle==NULL)
+    return fflush(log_handle);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&log_mutex);
+  log_wait_writer();
+#endif
+  log_write_buffer(log_buffer_cur);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&log_mutex);
+#endif
   return fflush(log_handle);
 }
 
-static int log_handler(const char *_format, va_list ap)
+/* Can be called from a signal handler: the lock isn't taken, the queued
+ * messages and msg are written using write(). If the writer thread is
+ * busy, it owns the queued messages and only msg is written. */
+void log_emergency_flush(const char *msg)
 {
-  int res;
-  res=vfprintf(log_handle,_format,ap);
-  if(res<0)
+  if(log_handle==NULL)
+    return ;
+#if defined(HAVE_SIGACTION) && defined(HAVE_UNISTD_H)
   {
-    f_status=1;
+    const int fd=fileno(log_handle);
+#ifdef HAVE_PTHREAD
+    if(log_pending<0)
+#endif
+    {
+      log_write_fd(fd, log_buffer[log_buffer_cur], log_buffer_len[log_buffer_cur]);
+      log_buffer_len[log_buffer_cur]=0;
+    }
+    if(msg!=NULL)
+      log_write_fd(fd, msg, strlen(msg));
   }
-  /* flushing the outputs slow down the program, don't flush. Hope it's not a bad idea */
-  /*
-     fflush(stderr);
-     if(fflush(log_handle))
-     {
-     f_status=1;
-     }
-   */
-  return res;
+#else
+  log_write_buffer(log_buffer_cur);
+  if(msg!=NULL)
+    fputs(msg, log_handle);
+  fflush(log_handle);
+#endif
 }
 
 int log_close(void)
 {
   if(log_handle!=NULL)
   {
+#ifdef HAVE_PTHREAD
+    if(log_thread_running)
+    {
+      pthread_mutex_lock(&log_mutex);
+      log_thread_stop=1;
+      pthread_cond_signal(&log_cond_pending);
+      pthread_mutex_unlock(&log_mutex);
+      pthread_join(log_thread, NULL);
+      log_thread_running=0;
+    }
+#endif
+    log_write_buffer(log_buffer_cur);
     if(fclose(log_handle))
       f_status=1;
     log_handle=NULL;
@@ -164,11 +360,35 @@ int log_redirect(unsigned int level, const char *format, ...)
   if(log_handle==NULL)
     return 0;
   {
+    char msg[LOG_MSG_SIZE];
     int res;
     va_list ap;
     va_start(ap, format);
-    res=log_handler(format, ap);
+    res=vsnprintf(msg, sizeof(msg), format, ap);
     va_end(ap);
+    if(res<0)
+    {
+      f_status=1;
+      return res;
+    }
+    if((unsigned int)res < sizeof(msg))
+    {
+      log_queue(msg, res);
+      return res;
+    }
+    {
+      char *long_msg=(char *)malloc(res+1);
+      if(long_msg==NULL)
+      {
+	log_queue(msg, sizeof(msg)-1);
+	return res;
+      }
+      va_start(ap, format);
+      vsnprintf(long_msg, res+1, format, ap);
+      va_end(ap);
+      log_queue(long_msg, res);
+      free(long_msg);
+    }
     return res;
   }
 }
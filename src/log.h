@@ -29,6 +29,7 @@ int log_set_levels(const unsigned int levels);
 FILE *log_open(const char*default_filename, const int mode);
 FILE *log_open_default(const char*default_filename, const int mode);
 int log_flush(void);
+void log_emergency_flush(const char *msg);
 int log_close(void);
 int log_redirect(unsigned int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
 void dump_log(const void *nom_dump,unsigned int lng);
@@ -24,6 +24,9 @@
 #endif
  
 #include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
@@ -49,6 +52,7 @@
 
 #define MAX_INFO_MFT 10
 #define NTFS_SECTOR_SIZE 0x200
+#define NTFS_SEARCH_READ_SIZE (4*1024*1024)
 
 typedef struct s_info_mft info_mft_t;
 struct s_info_mft
@@ -58,11 +62,27 @@ struct s_info_mft
   uint64_t mftmirr_lcn;
 };
 
+/* The partition is read NTFS_SEARCH_READ_SIZE bytes at a time. Each read
+ * also gets the 2 sectors following the batch, so an MFT record can start
+ * in any sector of the batch. */
+typedef struct
+{
+  char *buffer;
+  unsigned int batch_max;
+  uint64_t first;
+  unsigned int nbr;
+  int ok;
+  char record[2*DEFAULT_SECTOR_SIZE];
+} ntfs_reader_t;
+
 #ifdef HAVE_NCURSES
 static int ncurses_ntfs2_info(const struct ntfs_boot_sector *nh1, const struct ntfs_boot_sector *nh2);
 static int ncurses_ntfs_info(const struct ntfs_boot_sector *ntfs_header);
 #endif
 static int testdisk_ffs(int x);
+static void ntfs_reader_init(ntfs_reader_t *reader, const disk_t *disk_car);
+static const char *ntfs_reader_get(ntfs_reader_t *reader, disk_t *disk_car, const partition_t *partition, const uint64_t sector, const uint64_t sector_max);
+static int ntfs_check_mft_record(disk_t *disk_car, partition_t *partition, const uint64_t sector, const char *record, const int in_use, const int verbose, const unsigned int expert, unsigned int *sectors_per_cluster, uint64_t *mft_lcn, uint64_t *mftmirr_lcn, unsigned int *mft_record_size, info_mft_t *info_mft, unsigned int *nbr_mft);
 static int read_mft_info(disk_t *disk_car, partition_t *partition, const uint64_t mft_sector, const int verbose, unsigned int *sectors_per_cluster, uint64_t *mft_lcn, uint64_t *mftmirr_lcn, unsigned int *mft_record_size);
 
 #ifdef HAVE_NCURSES
@@ -447,6 +467,72 @@ static int read_mft_info(disk_t *disk_car, partition_t *partition, const uint64_
   return 3;
 }
 
+static void ntfs_reader_init(ntfs_reader_t *reader, const disk_t *disk_car)
+{
+  reader->batch_max=(disk_car->sector_size < NTFS_SEARCH_READ_SIZE ? NTFS_SEARCH_READ_SIZE / disk_car->sector_size : 1);
+  reader->buffer=(char *)MALLOC(reader->batch_max * disk_car->sector_size + 2 * DEFAULT_SECTOR_SIZE);
+  reader->first=0;
+  reader->nbr=0;
+  reader->ok=0;
+}
+
+/* Return the 2*DEFAULT_SECTOR_SIZE bytes starting at sector,
+ * sectors up to sector_max are read in advance */
+static const char *ntfs_reader_get(ntfs_reader_t *reader, disk_t *disk_car, const partition_t *partition, const uint64_t sector, const uint64_t sector_max)
+{
+  if(sector < reader->first || sector >= reader->first + reader->nbr)
+  {
+    const unsigned int size=(sector_max - sector < reader->batch_max ? sector_max - sector : reader->batch_max) * disk_car->sector_size + 2 * DEFAULT_SECTOR_SIZE;
+    reader->first=sector;
+    reader->nbr=(size - 2 * DEFAULT_SECTOR_SIZE) / disk_car->sector_size;
+    reader->ok=((unsigned)disk_car->pread(disk_car, reader->buffer, size, partition->part_offset + sector * (uint64_t)disk_car->sector_size) == size);
+  }
+  if(reader->ok)
+    return &reader->buffer[(sector - reader->first) * disk_car->sector_size];
+  /* If the large read has failed, read the sector alone */
+  if(disk_car->pread(disk_car, reader->record, 2 * DEFAULT_SECTOR_SIZE, partition->part_offset + sector * (uint64_t)disk_car->sector_size) == 2 * DEFAULT_SECTOR_SIZE)
+    return reader->record;
+  return NULL;
+}
+
+/* Check if the record is the $MFT entry, return 1 when the search can stop */
+static int ntfs_check_mft_record(disk_t *disk_car, partition_t *partition, const uint64_t sector, const char *record, const int in_use, const int verbose, const unsigned int expert, unsigned int *sectors_per_cluster, uint64_t *mft_lcn, uint64_t *mftmirr_lcn, unsigned int *mft_record_size, info_mft_t *info_mft, unsigned int *nbr_mft)
+{
+  int res;
+  int tmp;
+  if(memcmp(record,"FILE",4)!=0 || (NTFS_GETU16(record+ 0x14)%8!=0) || (NTFS_GETU16(record+ 0x14)<42))
+    return 0;
+  if(in_use!=0 && NTFS_GETU16(record+22)!=1)	/* MFT_RECORD_IN_USE */
+    return 0;
+  res=ntfs_get_attr(record, 0x30, partition, record+2*DEFAULT_SECTOR_SIZE, verbose, "$MFT");
+  if(res!=1)
+    return 0;
+  log_info("mft at %lu, seq=%u, main=%u res=%d\n",(long unsigned)sector,NTFS_GETU8(record+0x10),(unsigned int)NTFS_GETU32(record+0x20),res);
+  tmp=read_mft_info(disk_car, partition, sector, verbose, sectors_per_cluster, mft_lcn, mftmirr_lcn, mft_record_size);
+  if(tmp==0)
+  {
+    log_info("ntfs_find_mft: mft_lcn             %lu\n",(long unsigned int)*mft_lcn);
+    log_info("ntfs_find_mft: mftmirr_lcn         %lu\n",(long unsigned int)*mftmirr_lcn);
+    if(expert==0
+#ifdef HAVE_NCURSES
+	|| ask_confirmation("Use MFT from %lu, confirm ? (Y/N)",(long unsigned int)*mft_lcn)!=0
+#endif
+      )
+      return 1;
+  }
+  else if(tmp==3)
+  {
+    if(*nbr_mft<MAX_INFO_MFT)
+    {
+      info_mft[*nbr_mft].sector=sector;
+      info_mft[*nbr_mft].mft_lcn=*mft_lcn;
+      info_mft[*nbr_mft].mftmirr_lcn=*mftmirr_lcn;
+      (*nbr_mft)++;
+    }
+  }
+  return 0;
+}
+
 int rebuild_NTFS_BS(disk_t *disk_car, partition_t *partition, const int verbose, const int interface, const unsigned int expert, char **current_cmd)
 {
   uint64_t sector;
@@ -458,6 +544,7 @@ int rebuild_NTFS_BS(disk_t *disk_car, partition_t *partition, const int verbose,
   unsigned int mft_record_size=1024;
   info_mft_t info_mft[MAX_INFO_MFT];
   unsigned int nbr_mft=0;
+  ntfs_reader_t reader;
   log_info("rebuild_NTFS_BS\n");
 #ifdef HAVE_NCURSES
   if(interface)
@@ -474,48 +561,19 @@ int rebuild_NTFS_BS(disk_t *disk_car, partition_t *partition, const int verbose,
     wattroff(stdscr, A_REVERSE);
   }
 #endif
+  ntfs_reader_init(&reader, disk_car);
   /* try to find MFT Backup first */
   for(sector=(partition->part_size/disk_car->sector_size/2-20>0?partition->part_size/disk_car->sector_size/2-20:1);(sector<partition->part_size/disk_car->sector_size)&&(sector<=partition->part_size/disk_car->sector_size/2+20)&&(ind_stop==0);sector++)
   {
-    if(disk_car->pread(disk_car, &buffer, 2 * DEFAULT_SECTOR_SIZE, partition->part_offset + sector * (uint64_t)disk_car->sector_size) == 2 * DEFAULT_SECTOR_SIZE)
-    {
-      if(memcmp(buffer,"FILE",4)==0 && (NTFS_GETU16(buffer+ 0x14)%8==0) && (NTFS_GETU16(buffer+ 0x14)>=42)
-	  &&(NTFS_GETU16(buffer+22)==1))	/* MFT_RECORD_IN_USE */
-      {
-	int res;
-	res=ntfs_get_attr(buffer, 0x30, partition, buffer+2*DEFAULT_SECTOR_SIZE, verbose, "$MFT");
-	if(res==1)
-	{
-	  int tmp;
-	  log_info("mft at %lu, seq=%u, main=%u res=%d\n",(long unsigned)sector,NTFS_GETU8(buffer+0x10),(unsigned int)NTFS_GETU32(buffer+0x20),res);
-	  tmp=read_mft_info(disk_car, partition, sector, verbose, &sectors_per_cluster, &mft_lcn, &mftmirr_lcn, &mft_record_size);
-	  if(tmp==0)
-	  {
-	    log_info("ntfs_find_mft: mft_lcn             %lu\n",(long unsigned int)mft_lcn);
-	    log_info("ntfs_find_mft: mftmirr_lcn         %lu\n",(long unsigned int)mftmirr_lcn);
-	    if(expert==0
-#ifdef HAVE_NCURSES
-		|| ask_confirmation("Use MFT from %lu, confirm ? (Y/N)",(long unsigned int)mft_lcn)!=0
-#endif
-	      )
-	      ind_stop=1;
-	  }
-	  else if(tmp==3)
-	  {
-	    if(nbr_mft<MAX_INFO_MFT)
-	    {
-	      info_mft[nbr_mft].sector=sector;
-	      info_mft[nbr_mft].mft_lcn=mft_lcn;
-	      info_mft[nbr_mft].mftmirr_lcn=mftmirr_lcn;
-	      nbr_mft++;
-	    }
-	  }
-	}
-      }
-    }
+    const char *record=ntfs_reader_get(&reader, disk_car, partition, sector, partition->part_size/disk_car->sector_size/2+20+1);
+    if(record!=NULL)
+      ind_stop=ntfs_check_mft_record(disk_car, partition, sector, record, 1, verbose, expert,
+	  &sectors_per_cluster, &mft_lcn, &mftmirr_lcn, &mft_record_size, info_mft, &nbr_mft);
   }
+  reader.nbr=0;
   for(sector=1;(sector<partition->part_size/disk_car->sector_size)&&(ind_stop==0);sector++)
   {
+    const char *record;
 #ifdef HAVE_NCURSES
     if((interface!=0) &&(sector&0xffff)==0)
     {
@@ -532,42 +590,12 @@ int rebuild_NTFS_BS(disk_t *disk_car, partition_t *partition, const int verbose,
       }
     }
 #endif
-    if(disk_car->pread(disk_car, &buffer, 2 * DEFAULT_SECTOR_SIZE, partition->part_offset + sector * (uint64_t)disk_car->sector_size) == 2 * DEFAULT_SECTOR_SIZE)
-    {
-      if(memcmp(buffer,"FILE",4)==0 && (NTFS_GETU16(buffer+ 0x14)%8==0) && (NTFS_GETU16(buffer+ 0x14)>=42))
-      {
-	int res;
-	res=ntfs_get_attr(buffer, 0x30, partition, buffer+2*DEFAULT_SECTOR_SIZE, verbose, "$MFT");
-	if(res==1)
-	{
-	  int tmp;
-	  log_info("mft at %lu, seq=%u, main=%u res=%d\n",(long unsigned)sector,NTFS_GETU8(buffer+0x10),(unsigned int)NTFS_GETU32(buffer+0x20),res);
-	  tmp=read_mft_info(disk_car, partition, sector, verbose, &sectors_per_cluster, &mft_lcn, &mftmirr_lcn, &mft_record_size);
-	  if(tmp==0)
-	  {
-	    log_info("ntfs_find_mft: mft_lcn             %lu\n",(long unsigned int)mft_lcn);
-	    log_info("ntfs_find_mft: mftmirr_lcn         %lu\n",(long unsigned int)mftmirr_lcn);
-	    if(expert==0
-#ifdef HAVE_NCURSES
-	      || ask_confirmation("Use MFT from %lu, confirm ? (Y/N)",(long unsigned int)mft_lcn)!=0
-#endif
-	      )
-	      ind_stop=1;
-	  }
-	  else if(tmp==3)
-	  {
-	    if(nbr_mft<MAX_INFO_MFT)
-	    {
-	      info_mft[nbr_mft].sector=sector;
-	      info_mft[nbr_mft].mft_lcn=mft_lcn;
-	      info_mft[nbr_mft].mftmirr_lcn=mftmirr_lcn;
-	      nbr_mft++;
-	    }
-	  }
-	}
-      }
-    }
+    record=ntfs_reader_get(&reader, disk_car, partition, sector, partition->part_size/disk_car->sector_size);
+    if(record!=NULL && ind_stop==0)
+      ind_stop=ntfs_check_mft_record(disk_car, partition, sector, record, 0, verbose, expert,
+	  &sectors_per_cluster, &mft_lcn, &mftmirr_lcn, &mft_record_size, info_mft, &nbr_mft);
   }
+  free(reader.buffer);
   /* Find partition location using MFT information */
   {
     unsigned int i,j;
@@ -67,10 +67,12 @@
 #include "pnext.h"
 #include "phbf.h"
 #include "phnc.h"
+#include "preadsize.h"
+#include "phindex.h"
+#include "phcontrol.h"
 
 //#define DEBUG_BF
 //#define DEBUG_BF2
-#define READ_SIZE 1024*512
 extern file_check_list_t file_check_list;
 extern uint64_t free_list_allocation_end;
 
@@ -80,14 +82,14 @@ static int photorec_bf_frag(struct ph_param *params, file_recovery_t *file_recov
 #ifdef DEBUG_BF
 static void list_space_used(const file_recovery_t *file_recovery, const unsigned int sector_size)
 {
-  struct td_list_head *tmp;
+  unsigned int i;
   uint64_t file_size=0;
   if(file_recovery->filename==NULL)
     return;
   log_info("%s\t",file_recovery->filename);
-  td_list_for_each(tmp, &file_recovery->location.list)
+  for(i=0; i<file_recovery->location.nbr; i++)
   {
-    const alloc_list_t *element=td_list_entry(tmp, alloc_list_t, list);
+    const alloc_extent_t *element=&file_recovery->location.extents[i];
     if(element->data>0)
     {
       log_info(" %lu-%lu", (unsigned long)(element->start/sector_size), (unsigned long)(element->end/sector_size));
@@ -105,28 +107,9 @@ static void list_space_used(const file_recovery_t *file_recovery, const unsigned
 static inline void file_recovery_cpy(file_recovery_t *dst, file_recovery_t *src)
 {
   memcpy(dst, src, sizeof(*dst));
-  dst->location.list.prev=&dst->location.list;
-  dst->location.list.next=&dst->location.list;
-}
-
-static inline void list_append_block(alloc_list_t *list, const uint64_t offset, const uint64_t blocksize, const unsigned int data)
-{
-  if(!td_list_empty(&list->list))
-  {
-    alloc_list_t *prev=td_list_entry(list->list.prev, alloc_list_t, list);
-    if(prev->end+1==offset && prev->data==data)
-    {
-      prev->end=offset+blocksize-1;
-      return ;
-    }
-  }
-  {
-    alloc_list_t *new_list=(alloc_list_t *)MALLOC(sizeof(*new_list));
-    new_list->start=offset;
-    new_list->end=offset+blocksize-1;
-    new_list->data=data;
-    td_list_add_tail(&new_list->list, &list->list);
-  }
+  dst->location.extents=NULL;
+  dst->location.nbr=0;
+  dst->location.max=0;
 }
 
 static struct td_list_head *next_file(struct td_list_head *search_walker, alloc_data_t *list_search_space)
@@ -150,12 +133,15 @@ int photorec_bf(struct ph_param *params, const struct ph_options *options, alloc
   struct td_list_head *p= NULL;
   unsigned char *buffer_start;
   const unsigned int blocksize=params->blocksize;
-  const unsigned int read_size=(blocksize>65536?blocksize:65536);
+  unsigned int read_size;
   unsigned int buffer_size;
+  read_window_t read_window;
   int ind_stop=0;
   int pass2=params->pass;
   int phase;
-  buffer_size=blocksize+READ_SIZE;
+  read_window_init(&read_window, params->disk, blocksize, params->recup_dir);
+  read_size=read_window.lookahead;
+  buffer_size=blocksize+read_window.max_size;
   buffer_start=(unsigned char *)MALLOC(buffer_size);
   for(phase=0; phase<2; phase++)
   {
@@ -167,6 +153,7 @@ int photorec_bf(struct ph_param *params, const struct ph_options *options, alloc
       alloc_data_t *current_search_space;
       unsigned char *buffer;
       unsigned char *buffer_olddata;
+      unsigned char *buffer_end;
       uint64_t offset;
       int need_to_check_file;
       int go_backward=1;
@@ -178,7 +165,8 @@ int photorec_bf(struct ph_param *params, const struct ph_options *options, alloc
       buffer_olddata=buffer_start;
       buffer=buffer_olddata + blocksize;
       memset(buffer_olddata, 0, blocksize);
-      params->disk->pread(params->disk, buffer, READ_SIZE, offset);
+      read_window_pread(&read_window, params->disk, buffer, offset, 0);
+      buffer_end=buffer+read_window.size;
       info_list_search_space(list_search_space, current_search_space, params->disk->sector_size, 0, options->verbose);
 #ifdef DEBUG_BF
 #endif
@@ -202,7 +190,7 @@ int photorec_bf(struct ph_param *params, const struct ph_options *options, alloc
 	    {
 	      const file_check_t *file_check=td_list_entry_const(tmp, const file_check_t, list);
 	      if((file_check->length==0 || memcmp(buffer + file_check->offset, file_check->value, file_check->length)==0) &&
-		  file_check->header_check(buffer, read_size, 0, &file_recovery, &file_recovery_new)!=0)
+		  file_check_header(file_check, buffer, read_size, 0, &file_recovery, &file_recovery_new)!=0)
 	      {
 		file_recovery_new.file_stat=file_check->file_stat;
 		break;
@@ -214,6 +202,7 @@ int photorec_bf(struct ph_param *params, const struct ph_options *options, alloc
 	  if(file_recovery_new.file_stat!=NULL)
 	  {
 	    file_recovery_new.location.start=offset;
+	    file_recovery_new.verify_crc=options->verify_crc;
 	    if(options->verbose>0)
 	    {
 	      log_info("%s header found at sector %lu\n",
@@ -240,7 +229,7 @@ int photorec_bf(struct ph_param *params, const struct ph_options *options, alloc
 	  set_filename(&file_recovery, params);
 	  if(file_recovery.file_stat->file_hint->recover==1)
 	  {
-	    if(!(file_recovery.handle=fopen(file_recovery.filename,"w+b")))
+	    if(!(file_recovery.handle=index_fopen(file_recovery.filename)))
 	    { 
 	      log_critical("Cannot create file %s: %s\n", file_recovery.filename, strerror(errno));
 	      ind_stop=2;
@@ -251,11 +240,13 @@ int photorec_bf(struct ph_param *params, const struct ph_options *options, alloc
 	{
 	  if(file_recovery.handle!=NULL)
 	  {
-	    if(fwrite(buffer,blocksize,1,file_recovery.handle)<1)
+	    if(file_fwrite(&file_recovery, buffer, blocksize)<1)
 	    { 
 	      log_critical("Cannot write to file %s: %s\n", file_recovery.filename, strerror(errno));
 	      ind_stop=3;
 	    }
+	    else
+	      file_content_append(&file_recovery, buffer, blocksize);
 	  }
 	  if(file_recovery.file_stat!=NULL)
 	  {
@@ -285,8 +276,9 @@ int photorec_bf(struct ph_param *params, const struct ph_options *options, alloc
 	{
 	  buffer_olddata+=blocksize;
 	  buffer+=blocksize;
-	  if(old_offset+blocksize!=offset || buffer+read_size>buffer_start+buffer_size)
+	  if(old_offset+blocksize!=offset || buffer+read_size>buffer_end)
 	  {
+	    const int sequential=(old_offset+blocksize==offset);
 	    memcpy(buffer_start, buffer_olddata, blocksize);
 	    buffer_olddata=buffer_start;
 	    buffer=buffer_olddata+blocksize;
@@ -296,7 +288,8 @@ int photorec_bf(struct ph_param *params, const struct ph_options *options, alloc
 		  (unsigned long long)((offset - params->partition->part_offset) / params->disk->sector_size),
 		  (unsigned long long)((params->partition->part_size-1) / params->disk->sector_size));
 	    }
-	    params->disk->pread(params->disk, buffer, READ_SIZE, offset);
+	    read_window_pread(&read_window, params->disk, buffer, offset, sequential);
+	    buffer_end=buffer+read_window.size;
 	  }
 	}
       } while(need_to_check_file==0);
@@ -344,6 +337,7 @@ int photorec_bf(struct ph_param *params, const struct ph_options *options, alloc
     log_info("phase=%d +%u\n", phase, params->file_nbr - file_nbr_phase_old);
   }
   free(buffer_start);
+  read_window_save(&read_window, params->disk);
 #ifdef HAVE_NCURSES
   photorec_info(stdscr, params->file_stats);
 #endif
@@ -384,13 +378,14 @@ static int photorec_bf_pad(struct ph_param *params, file_recovery_t *file_recove
 	    {
 	      stop=1;
 	    }
-	    if(fwrite(block_buffer, blocksize, 1, file_recovery->handle)<1)
+	    if(file_fwrite(file_recovery, block_buffer, blocksize)<1)
 	    {
 	      log_critical("Cannot write to file %s: %s\n", file_recovery->filename, strerror(errno));
 	      fclose(file_recovery->handle);
 	      file_recovery->handle=NULL;
 	      return BF_ERR_STOP;
 	    }
+	    file_content_append(file_recovery, block_buffer, blocksize);
 	    list_append_block(&file_recovery->location, *offset, blocksize, 1);
 	    file_recovery->file_size+=blocksize;
 	    file_recovery->file_size_on_disk+=blocksize;
@@ -411,13 +406,14 @@ static int photorec_bf_pad(struct ph_param *params, file_recovery_t *file_recove
 	      (*current_search_space)->file_stat->file_hint==NULL)
 	  {
 	    params->disk->pread(params->disk, block_buffer, blocksize, *offset);
-	    if(fwrite(block_buffer, blocksize, 1, file_recovery->handle)<1)
+	    if(file_fwrite(file_recovery, block_buffer, blocksize)<1)
 	    {
 	      log_critical("Cannot write to file %s: %s\n", file_recovery->filename, strerror(errno));
 	      fclose(file_recovery->handle);
 	      file_recovery->handle=NULL;
 	      return BF_ERR_STOP;
 	    }
+	    file_content_append(file_recovery, block_buffer, blocksize);
 	    list_append_block(&file_recovery->location, *offset, blocksize, 1);
 	    file_recovery->file_size+=blocksize;
 	    nbr++;
@@ -434,7 +430,7 @@ static int photorec_bf_pad(struct ph_param *params, file_recovery_t *file_recove
       file_recovery->offset_error=0;
       file_recovery->offset_ok=0;
       file_recovery->calculated_file_size=0;
-      file_recovery->file_check(file_recovery);
+      file_check_run(file_recovery);
       file_recovery->file_size=file_size_backup;
 #ifdef DEBUG_BF
       log_trace("offset_error=%llu offset_error_tmp=%llu nbr=%u blocksize=%u\n",
@@ -542,13 +538,14 @@ static int photorec_bf_frag_fast(struct ph_param *params, file_recovery_t *file_
       {
 	/* TODO handle this problem */
       }
-      if(fwrite(block_buffer, blocksize, 1, file_recovery->handle)<1)
+      if(file_fwrite(file_recovery, block_buffer, blocksize)<1)
       {
 	log_critical("Cannot write to file %s: %s\n", file_recovery->filename, strerror(errno));
 	fclose(file_recovery->handle);
 	file_recovery->handle=NULL;
 	return BF_ERR_STOP;
       }
+      file_content_append(file_recovery, block_buffer, blocksize);
       list_append_block(&file_recovery->location, *offset, blocksize, 1);
       file_recovery->file_size+=blocksize;
       file_recovery->file_size_on_disk+=blocksize;
@@ -642,9 +639,9 @@ static int photorec_bf_frag(struct ph_param *params, file_recovery_t *file_recov
 #endif
     /* Get the last block added to the file */
     extrablock_offset=0;
-    if(!td_list_empty(&file_recovery->location.list))
+    if(file_recovery->location.nbr>0)
     {
-      const alloc_list_t *element=td_list_entry(file_recovery->location.list.prev, alloc_list_t, list);
+      const alloc_extent_t *element=&file_recovery->location.extents[file_recovery->location.nbr-1];
       extrablock_offset=element->end/blocksize*blocksize;
     }
     /* Get the corresponding search_place */
@@ -672,7 +669,19 @@ static int photorec_bf_frag(struct ph_param *params, file_recovery_t *file_recov
 	  );
 	  blocs_to_skip++,testbf++)
       {
-	memcpy(file_recovery, &file_recovery_backup, sizeof(file_recovery_backup));
+	{
+	  /* Keep the current extent array, it's truncated below,
+	   and the current file content */
+	  const alloc_list_t location=file_recovery->location;
+	  unsigned char *content=file_recovery->content;
+	  const uint64_t content_size=file_recovery->content_size;
+	  const uint64_t content_max=file_recovery->content_max;
+	  memcpy(file_recovery, &file_recovery_backup, sizeof(file_recovery_backup));
+	  file_recovery->location=location;
+	  file_recovery->content=content;
+	  file_recovery->content_size=content_size;
+	  file_recovery->content_max=content_max;
+	}
 	*current_search_space=extractblock_search_space;
 	*offset=extrablock_offset;
 #ifdef DEBUG_BF
@@ -694,6 +703,8 @@ static int photorec_bf_frag(struct ph_param *params, file_recovery_t *file_recov
 	    ind_stop=photorec_progressbar(stdscr, testbf, params,
 		file_recovery->location.start, current_time);
 #endif
+	    if(ind_stop==0)
+	      ind_stop=control_poll(params, file_recovery->location.start, 0);
 	    if(ind_stop!=0)
 	    {
 	      file_recovery->flags=0;
@@ -782,7 +793,7 @@ static int photorec_bf_aux(struct ph_param *params, file_recovery_t *file_recove
   alloc_data_t *current_search_space;
   const unsigned int blocksize=params->blocksize;
   //Init. of the brute force
-  file_recovery->handle=fopen(file_recovery->filename, "w+b");
+  file_recovery->handle=index_fopen(file_recovery->filename);
   if(file_recovery->handle==NULL)
   {
     log_critical("Brute Force : Cannot create file %s: %s\n", file_recovery->filename, strerror(errno));
@@ -809,7 +820,7 @@ static int photorec_bf_aux(struct ph_param *params, file_recovery_t *file_recove
   {
     params->disk->pread(params->disk, block_buffer, blocksize, offset);
     /* FIXME: Handle ext2/ext3 */
-    if(fwrite(block_buffer, blocksize, 1, file_recovery->handle)<1)
+    if(file_fwrite(file_recovery, block_buffer, blocksize)<1)
     {
       log_critical("Cannot write to file %s: %s\n", file_recovery->filename, strerror(errno));
       fclose(file_recovery->handle);
@@ -817,6 +828,7 @@ static int photorec_bf_aux(struct ph_param *params, file_recovery_t *file_recove
       free(buffer);
       return BF_ERR_STOP;
     }
+    file_content_append(file_recovery, block_buffer, blocksize);
     list_append_block(&file_recovery->location, offset, blocksize, 1);
     get_next_sector(list_search_space, &current_search_space, &offset, blocksize);
   }
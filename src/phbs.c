@@ -74,17 +74,19 @@
 #include "phbf.h"
 #include "phnc.h"
 #include "phbs.h"
+#include "phcontrol.h"
 #include "file_found.h"
+#include "preadsize.h"
 
-#define READ_SIZE 1024*512
 extern const file_hint_t file_hint_tar;
 extern file_check_list_t file_check_list;
 
 static inline void file_recovery_cpy(file_recovery_t *dst, file_recovery_t *src)
 {
   memcpy(dst, src, sizeof(*dst));
-  dst->location.list.prev=&dst->location.list;
-  dst->location.list.next=&dst->location.list;
+  dst->location.extents=NULL;
+  dst->location.nbr=0;
+  dst->location.max=0;
 }
 
 int photorec_find_blocksize(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space)
@@ -93,18 +95,22 @@ int photorec_find_blocksize(struct ph_param *params, const struct ph_options *op
   unsigned char *buffer_start;
   unsigned char *buffer_olddata;
   unsigned char *buffer;
+  unsigned char *buffer_end;
   time_t start_time;
   time_t previous_time;
   unsigned int buffer_size;
   const unsigned int blocksize=params->blocksize;
-  const unsigned int read_size=(blocksize>65536?blocksize:65536);
+  unsigned int read_size;
+  read_window_t read_window;
   alloc_data_t *current_search_space;
   file_recovery_t file_recovery;
 
   params->file_nbr=0;
   reset_file_recovery(&file_recovery);
   file_recovery.blocksize=blocksize;
-  buffer_size=blocksize + READ_SIZE;
+  read_window_init(&read_window, params->disk, blocksize, params->recup_dir);
+  read_size=read_window.lookahead;
+  buffer_size=blocksize + read_window.max_size;
   buffer_start=(unsigned char *)MALLOC(buffer_size);
   buffer_olddata=buffer_start;
   buffer=buffer_olddata + blocksize;
@@ -116,7 +122,8 @@ int photorec_find_blocksize(struct ph_param *params, const struct ph_options *op
     offset=current_search_space->start;
   if(options->verbose>0)
     info_list_search_space(list_search_space, current_search_space, params->disk->sector_size, 0, options->verbose);
-  params->disk->pread(params->disk, buffer, READ_SIZE, offset);
+  read_window_pread(&read_window, params->disk, buffer, offset, 0);
+  buffer_end=buffer+read_window.size;
   while(current_search_space!=list_search_space)
   {
     uint64_t old_offset=offset;
@@ -143,7 +150,7 @@ int photorec_find_blocksize(struct ph_param *params, const struct ph_options *op
 	  {
 	    const file_check_t *file_check=td_list_entry_const(tmp, const file_check_t, list);
 	    if((file_check->length==0 || memcmp(buffer + file_check->offset, file_check->value, file_check->length)==0) &&
-		file_check->header_check(buffer, read_size, 1, &file_recovery, &file_recovery_new)!=0)
+		file_check_header(file_check, buffer, read_size, 1, &file_recovery, &file_recovery_new)!=0)
 	    {
 	      file_recovery_new.file_stat=file_check->file_stat;
 	      break;
@@ -195,8 +202,9 @@ int photorec_find_blocksize(struct ph_param *params, const struct ph_options *op
     buffer_olddata+=blocksize;
     buffer+=blocksize;
     if( old_offset+blocksize!=offset ||
-        buffer+read_size>buffer_start+buffer_size)
+        buffer+read_size>buffer_end)
     {
+      const int sequential=(old_offset+blocksize==offset);
       memcpy(buffer_start, buffer_olddata, blocksize);
       buffer_olddata=buffer_start;
       buffer=buffer_olddata+blocksize;
@@ -206,7 +214,7 @@ int photorec_find_blocksize(struct ph_param *params, const struct ph_options *op
 	    (unsigned long long)((offset - params->partition->part_offset) / params->disk->sector_size),
 	    (unsigned long long)((params->partition->part_size-1) / params->disk->sector_size));
       }
-      if(params->disk->pread(params->disk, buffer, READ_SIZE, offset) != READ_SIZE)
+      if(read_window_pread(&read_window, params->disk, buffer, offset, sequential) != (int)read_window.size)
       {
 #ifdef HAVE_NCURSES
 	wmove(stdscr,11,0);
@@ -215,23 +223,29 @@ int photorec_find_blocksize(struct ph_param *params, const struct ph_options *op
 	    (unsigned long)((offset - params->partition->part_offset) / params->disk->sector_size));
 #endif
       }
-#ifdef HAVE_NCURSES
+      buffer_end=buffer+read_window.size;
       {
         time_t current_time;
         current_time=time(NULL);
         if(current_time>previous_time)
         {
+          int ind_stop=0;
           previous_time=current_time;
-          if(photorec_progressbar(stdscr, 0, params, offset, current_time))
+#ifdef HAVE_NCURSES
+          ind_stop=photorec_progressbar(stdscr, 0, params, offset, current_time);
+#endif
+	  if(ind_stop==0)
+	    ind_stop=control_poll(params, offset, 0);
+          if(ind_stop!=0)
 	  {
 	    log_info("PhotoRec has been stopped\n");
 	    current_search_space=list_search_space;
 	  }
 	}
       }
-#endif
     }
   } /* end while(current_search_space!=list_search_space) */
   free(buffer_start);
+  read_window_save(&read_window, params->disk);
   return 0;
 }
@@ -0,0 +1,557 @@
+/*
+
+    File: phcontrol.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>	/* unlink, close */
+#endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef HAVE_SYS_SELECT_H
+#include <sys/select.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef HAVE_SYS_UN_H
+#include <sys/un.h>
+#endif
+#include <stdarg.h>
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "sessionp.h"
+#include "log.h"
+#include "phcontrol.h"
+
+#if defined(HAVE_SYS_SOCKET_H) && defined(HAVE_SYS_UN_H) && defined(HAVE_SYS_SELECT_H)
+/* An orchestrator can follow and drive unattended recoveries (/cmd).
+ * Each second, the clients receive
+ * {"event":"progress","pass":1,"status":"ext2_off","state":"running",
+ *  "offset":..,"size":..,"sector":..,"sectors":..,"elapsed":..,"rate":..,
+ *  "eta":..,"files":..,"formats":[{"extension":"jpg","recovered":..,
+ *  "not_recovered":..},...]}
+ * rate (bytes/s) and eta (s) are computed since the beginning of the pass,
+ * they are missing when unknown. */
+#define CONTROL_MAX_CLIENTS	8
+#define CONTROL_LINE_SIZE	256
+#ifdef MSG_NOSIGNAL
+#define CONTROL_SEND_FLAGS	MSG_NOSIGNAL
+#else
+#define CONTROL_SEND_FLAGS	0
+#endif
+
+typedef struct
+{
+  int fd;
+  unsigned int len;
+  char line[CONTROL_LINE_SIZE];
+} control_client_t;
+
+typedef struct
+{
+  char *data;
+  unsigned int len;
+  unsigned int size;
+} control_msg_t;
+
+static int control_fd=-1;
+static char *control_path=NULL;
+static control_client_t control_clients[CONTROL_MAX_CLIENTS];
+static control_msg_t control_msg={ NULL, 0, 0 };
+static unsigned int control_paused=0;
+static unsigned int control_stop=0;
+static unsigned int control_checkpoint=0;
+static alloc_data_t *control_list_search_space=NULL;
+static const struct ph_options *control_options=NULL;
+static unsigned int control_carve_free_space_only=0;
+/* Start of the current pass, to compute the rate */
+static unsigned int control_pass=0;
+static photorec_status_t control_status=STATUS_QUIT;
+static time_t control_pass_time=0;
+static uint64_t control_pass_offset=0;
+
+static const char *control_status_name(const photorec_status_t status)
+{
+  switch(status)
+  {
+    case STATUS_FIND_OFFSET:			return "find_offset";
+    case STATUS_UNFORMAT:			return "unformat";
+    case STATUS_EXT2_ON:			return "ext2_on";
+    case STATUS_EXT2_ON_BF:			return "ext2_on_bf";
+    case STATUS_EXT2_OFF:			return "ext2_off";
+    case STATUS_EXT2_OFF_BF:			return "ext2_off_bf";
+    case STATUS_EXT2_ON_SAVE_EVERYTHING:	return "ext2_on_save_everything";
+    case STATUS_EXT2_OFF_SAVE_EVERYTHING:	return "ext2_off_save_everything";
+    case STATUS_QUIT:				return "quit";
+  }
+  return "unknown";
+}
+
+static void control_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void control_printf(const char *fmt, ...)
+{
+  while(1)
+  {
+    va_list ap;
+    int res;
+    const unsigned int avail=control_msg.size - control_msg.len;
+    va_start(ap, fmt);
+    res=vsnprintf(&control_msg.data[control_msg.len], avail, fmt, ap);
+    va_end(ap);
+    if(res < 0)
+      return ;
+    if((unsigned int)res < avail)
+    {
+      control_msg.len+=res;
+      return ;
+    }
+    control_msg.size=2*control_msg.size + res;
+    control_msg.data=(char *)realloc(control_msg.data, control_msg.size);
+    if(control_msg.data==NULL)
+    {
+      log_critical("control_printf: not enough memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+static void control_client_close(control_client_t *client)
+{
+  close(client->fd);
+  client->fd=-1;
+  client->len=0;
+}
+
+/* Send the message to every client, a client too slow to read it
+ * is disconnected rather than blocking the recovery */
+static void control_send(void)
+{
+  unsigned int i;
+  control_printf("}\n");
+  for(i=0; i<CONTROL_MAX_CLIENTS; i++)
+  {
+    control_client_t *client=&control_clients[i];
+    if(client->fd>=0 &&
+	send(client->fd, control_msg.data, control_msg.len, CONTROL_SEND_FLAGS)!=(ssize_t)control_msg.len)
+      control_client_close(client);
+  }
+  control_msg.len=0;
+}
+
+static void control_event(const char *event)
+{
+  control_msg.len=0;
+  control_printf("{\"event\":\"%s\"", event);
+}
+
+static void control_progress(const struct ph_param *params, const uint64_t offset)
+{
+  const partition_t *partition=params->partition;
+  const unsigned int sector_size=params->disk->sector_size;
+  const time_t current_time=time(NULL);
+  const uint64_t pos=(offset > partition->part_offset ? offset - partition->part_offset : 0);
+  control_event("progress");
+  control_printf(",\"pass\":%u,\"status\":\"%s\",\"state\":\"%s\"",
+      params->pass, control_status_name(params->status),
+      (control_paused>0 ? "paused" : "running"));
+  control_printf(",\"offset\":%llu,\"size\":%llu,\"sector\":%llu,\"sectors\":%llu",
+      (long long unsigned)pos,
+      (long long unsigned)partition->part_size,
+      (long long unsigned)(pos/sector_size),
+      (long long unsigned)(partition->part_size/sector_size));
+  control_printf(",\"elapsed\":%lu",
+      (unsigned long)(current_time > params->real_start_time ? current_time - params->real_start_time : 0));
+  /* When brute-forcing, offset goes back and forth */
+  if(current_time > control_pass_time && offset > control_pass_offset &&
+      params->status!=STATUS_EXT2_ON_BF && params->status!=STATUS_EXT2_OFF_BF)
+  {
+    const uint64_t rate=(offset - control_pass_offset) / (current_time - control_pass_time);
+    control_printf(",\"rate\":%llu", (long long unsigned)rate);
+    if(rate > 0 && partition->part_size > pos)
+      control_printf(",\"eta\":%llu", (long long unsigned)((partition->part_size - pos) / rate));
+  }
+  control_printf(",\"files\":%u,\"formats\":[", params->file_nbr);
+  if(params->file_stats!=NULL)
+  {
+    const file_stat_t *file_stat;
+    unsigned int nbr=0;
+    for(file_stat=params->file_stats; file_stat->file_hint!=NULL; file_stat++)
+    {
+      if(file_stat->recovered + file_stat->not_recovered > 0)
+      {
+	control_printf("%s{\"extension\":\"%s\",\"recovered\":%u,\"not_recovered\":%u}",
+	    (nbr>0 ? "," : ""),
+	    (file_stat->file_hint->extension!=NULL ? file_stat->file_hint->extension : ""),
+	    file_stat->recovered, file_stat->not_recovered);
+	nbr++;
+      }
+    }
+  }
+  control_printf("]");
+  control_send();
+}
+
+static void control_checkpoint_save(struct ph_param *params, const int checkpoint_safe)
+{
+  int res;
+  if(control_checkpoint==0 || checkpoint_safe==0 || control_list_search_space==NULL)
+    return ;
+  control_checkpoint=0;
+  res=session_save(control_list_search_space, params, control_options, control_carve_free_space_only);
+  log_info("Checkpoint requested, session %s\n", (res<0 ? "not saved" : "saved"));
+  control_event("checkpoint");
+  control_printf(",\"saved\":%s", (res<0 ? "false" : "true"));
+  control_send();
+}
+
+static void control_command(control_client_t *client, const char *cmd, const struct ph_param *params, const uint64_t offset)
+{
+  if(cmd[0]=='\0')
+    return ;
+  if(strcmp(cmd, "pause")==0)
+  {
+    if(control_paused==0)
+      log_info("Recovery paused\n");
+    control_paused=1;
+  }
+  else if(strcmp(cmd, "resume")==0)
+  {
+    if(control_paused>0)
+      log_info("Recovery resumed\n");
+    control_paused=0;
+  }
+  else if(strcmp(cmd, "stop")==0)
+  {
+    if(control_stop==0)
+      log_info("Recovery stopped on request\n");
+    control_stop=1;
+  }
+  else if(strcmp(cmd, "checkpoint")==0)
+    control_checkpoint=1;
+  else if(strcmp(cmd, "status")==0)
+  {
+    control_progress(params, offset);
+    return ;
+  }
+  else
+  {
+    const char *msg="{\"event\":\"error\",\"message\":\"unknown command\"}\n";
+    if(send(client->fd, msg, strlen(msg), CONTROL_SEND_FLAGS)!=(ssize_t)strlen(msg))
+      control_client_close(client);
+    return ;
+  }
+  control_event("ack");
+  control_printf(",\"command\":\"%s\"", cmd);
+  control_send();
+}
+
+static void control_read(control_client_t *client, const struct ph_param *params, const uint64_t offset)
+{
+  const ssize_t res=recv(client->fd, &client->line[client->len], CONTROL_LINE_SIZE - client->len, 0);
+  unsigned int start=0;
+  unsigned int i;
+  if(res<=0)
+  {
+    if(res==0 || (errno!=EAGAIN && errno!=EINTR))
+      control_client_close(client);
+    return ;
+  }
+  client->len+=res;
+  for(i=0; i<client->len && client->fd>=0; i++)
+  {
+    if(client->line[i]=='\n')
+    {
+      unsigned int end=i;
+      while(end>start && (client->line[end-1]=='\r' || client->line[end-1]==' '))
+	end--;
+      client->line[end]='\0';
+      control_command(client, &client->line[start], params, offset);
+      start=i+1;
+    }
+  }
+  if(client->fd<0)
+    return ;
+  if(start>0)
+  {
+    memmove(client->line, &client->line[start], client->len - start);
+    client->len-=start;
+  }
+  else if(client->len==CONTROL_LINE_SIZE)
+  { /* Line too long, drop it */
+    client->len=0;
+  }
+}
+
+static void control_accept(void)
+{
+  unsigned int i;
+  const int fd=accept(control_fd, NULL, NULL);
+  if(fd<0)
+    return ;
+  for(i=0; i<CONTROL_MAX_CLIENTS && control_clients[i].fd>=0; i++);
+  if(i==CONTROL_MAX_CLIENTS || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0)
+  {
+    close(fd);
+    return ;
+  }
+  control_clients[i].fd=fd;
+  control_clients[i].len=0;
+}
+
+/* Wait up to timeout seconds for a new client or a command */
+static void control_wait(const struct ph_param *params, const uint64_t offset, const unsigned int timeout)
+{
+  fd_set readfds;
+  struct timeval tv;
+  unsigned int i;
+  int max_fd=control_fd;
+  FD_ZERO(&readfds);
+  FD_SET(control_fd, &readfds);
+  for(i=0; i<CONTROL_MAX_CLIENTS; i++)
+  {
+    if(control_clients[i].fd>=0)
+    {
+      FD_SET(control_clients[i].fd, &readfds);
+      if(control_clients[i].fd > max_fd)
+	max_fd=control_clients[i].fd;
+    }
+  }
+  tv.tv_sec=timeout;
+  tv.tv_usec=0;
+  if(select(max_fd+1, &readfds, NULL, NULL, &tv) <= 0)
+    return ;
+  for(i=0; i<CONTROL_MAX_CLIENTS; i++)
+  {
+    if(control_clients[i].fd>=0 && FD_ISSET(control_clients[i].fd, &readfds))
+      control_read(&control_clients[i], params, offset);
+  }
+  if(FD_ISSET(control_fd, &readfds))
+    control_accept();
+}
+
+int control_open(const char *path)
+{
+  struct sockaddr_un addr;
+  struct stat st;
+  mode_t old_mask;
+  int res;
+  unsigned int i;
+  if(strlen(path) >= sizeof(addr.sun_path))
+  {
+    errno=ENAMETOOLONG;
+    return -1;
+  }
+  /* Remove a socket left by a previous run, but nothing else */
+  if(lstat(path, &st)==0 && S_ISSOCK(st.st_mode))
+    unlink(path);
+  control_fd=socket(AF_UNIX, SOCK_STREAM, 0);
+  if(control_fd<0)
+    return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family=AF_UNIX;
+  strcpy(addr.sun_path, path);
+  /* Only the user running the recovery may connect to the socket */
+  old_mask=umask(077);
+  res=bind(control_fd, (const struct sockaddr *)&addr, sizeof(addr));
+  umask(old_mask);
+  if(res < 0 ||
+      listen(control_fd, CONTROL_MAX_CLIENTS) < 0 ||
+      fcntl(control_fd, F_SETFL, fcntl(control_fd, F_GETFL) | O_NONBLOCK) < 0)
+  {
+    const int err=errno;
+    close(control_fd);
+    control_fd=-1;
+    errno=err;
+    return -1;
+  }
+  for(i=0; i<CONTROL_MAX_CLIENTS; i++)
+  {
+    control_clients[i].fd=-1;
+    control_clients[i].len=0;
+  }
+  control_msg.size=4096;
+  control_msg.len=0;
+  control_msg.data=(char *)MALLOC(control_msg.size);
+  control_path=strdup(path);
+  return 0;
+}
+
+void control_close(void)
+{
+  unsigned int i;
+  if(control_fd<0)
+    return ;
+  for(i=0; i<CONTROL_MAX_CLIENTS; i++)
+  {
+    if(control_clients[i].fd>=0)
+      control_client_close(&control_clients[i]);
+  }
+  close(control_fd);
+  control_fd=-1;
+  unlink(control_path);
+  free(control_path);
+  control_path=NULL;
+  free(control_msg.data);
+  control_msg.data=NULL;
+  control_msg.size=0;
+}
+
+void control_session(alloc_data_t *list_search_space, const struct ph_options *options, const unsigned int carve_free_space_only)
+{
+  control_list_search_space=list_search_space;
+  control_options=options;
+  control_carve_free_space_only=carve_free_space_only;
+  control_status=STATUS_QUIT;
+  if(list_search_space!=NULL)
+  {
+    control_paused=0;
+    control_stop=0;
+    control_checkpoint=0;
+  }
+}
+
+int control_poll(struct ph_param *params, const uint64_t offset, const int checkpoint_safe)
+{
+  time_t current_time;
+  if(control_fd<0)
+    return 0;
+  current_time=time(NULL);
+  if(params->pass!=control_pass || params->status!=control_status)
+  {
+    control_pass=params->pass;
+    control_status=params->status;
+    control_pass_time=current_time;
+    control_pass_offset=offset;
+  }
+  control_wait(params, offset, 0);
+  if(control_paused>0 && control_stop==0)
+  {
+    time_t previous_time=0;
+    while(control_paused>0 && control_stop==0)
+    {
+      const time_t now=time(NULL);
+      control_checkpoint_save(params, checkpoint_safe);
+      if(now > previous_time)
+      {
+	previous_time=now;
+	control_progress(params, offset);
+      }
+      control_wait(params, offset, 1);
+    }
+    /* Don't count the pause in the rate */
+    control_pass_time+=time(NULL)-current_time;
+  }
+  control_checkpoint_save(params, checkpoint_safe);
+  control_progress(params, offset);
+  return control_stop;
+}
+
+int control_stop_requested(void)
+{
+  return control_stop;
+}
+
+void control_pass_end(const struct ph_param *params, const int session_saved)
+{
+  if(control_fd<0)
+    return ;
+  if(control_checkpoint>0)
+  {
+    control_checkpoint=0;
+    control_event("checkpoint");
+    control_printf(",\"saved\":%s", (session_saved<0 ? "false" : "true"));
+    control_send();
+  }
+  control_event("pass_end");
+  control_printf(",\"pass\":%u,\"status\":\"%s\",\"files\":%u",
+      params->pass, control_status_name(params->status), params->file_nbr);
+  control_send();
+}
+
+void control_finished(const struct ph_param *params, const int ind_stop)
+{
+  static const char *results[4]={ "completed", "stopped", "cannot_create_file", "no_space" };
+  if(control_fd<0)
+    return ;
+  control_event("finished");
+  control_printf(",\"result\":\"%s\",\"files\":%u",
+      (ind_stop>=0 && ind_stop<4 ? results[ind_stop] : "unknown"), params->file_nbr);
+  control_send();
+}
+#else
+int control_open(const char *path)
+{
+  errno=ENOSYS;
+  return -1;
+}
+
+void control_close(void)
+{
+}
+
+void control_session(alloc_data_t *list_search_space, const struct ph_options *options, const unsigned int carve_free_space_only)
+{
+}
+
+int control_poll(struct ph_param *params, const uint64_t offset, const int checkpoint_safe)
+{
+  return 0;
+}
+
+int control_stop_requested(void)
+{
+  return 0;
+}
+
+void control_pass_end(const struct ph_param *params, const int session_saved)
+{
+}
+
+void control_finished(const struct ph_param *params, const int ind_stop)
+{
+}
+#endif
@@ -0,0 +1,56 @@
+/*
+
+    File: phcontrol.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* control_open()
+ * Listen on a local socket, the clients receive the progress as JSON
+ * objects, one per line, and may send the commands
+ * pause, resume, stop, checkpoint and status, one per line.
+ * @returns 0 on success, -1 on error with errno set */
+int control_open(const char *path);
+void control_close(void);
+
+/* control_session()
+ * Register the search space saved on checkpoint requests,
+ * list_search_space is NULL when the recovery is over */
+void control_session(alloc_data_t *list_search_space, const struct ph_options *options, const unsigned int carve_free_space_only);
+
+/* control_poll()
+ * Must be called once per second: handles the commands and sends the
+ * progress. While the recovery is paused, it doesn't return until the
+ * recovery is resumed or stopped.
+ * checkpoint_safe: params->offset is up to date and the search space can
+ * be saved now, otherwise checkpoints are delayed to the end of the pass
+ * @returns 1 if a client has asked to stop the recovery */
+int control_poll(struct ph_param *params, const uint64_t offset, const int checkpoint_safe);
+int control_stop_requested(void);
+
+/* control_pass_end()
+ * session_saved is the result of session_save() at the end of the pass */
+void control_pass_end(const struct ph_param *params, const int session_saved);
+void control_finished(const struct ph_param *params, const int ind_stop);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
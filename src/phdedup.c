@@ -0,0 +1,248 @@
+/*
+
+    File: phdedup.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>	/* unlink */
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "log.h"
+#include "hash.h"
+#include "phdedup.h"
+
+/* Content fingerprints of the files already recovered, the files are
+ * compared by size first, then by SHA-256.
+ * The store is kept in recup_dir.dup next to recup_dir.1, one line per
+ * file: sha256 size name. Like photorec.ses, it survives an interrupted
+ * recovery, so a resumed one doesn't write the same files again, and it's
+ * removed once the recovery is complete.
+ * A file is only a duplicate of an entry if the file of this entry is
+ * still there with the same size. */
+#define DEDUP_BUCKETS	65536
+
+typedef struct dedup_entry_struct dedup_entry_t;
+struct dedup_entry_struct
+{
+  dedup_entry_t *next;
+  uint64_t size;
+  unsigned char sha256[SHA256_DIGEST_SIZE];
+  char *name;
+};
+
+static dedup_entry_t **dedup_table=NULL;
+static FILE *dedup_handle=NULL;
+static char dedup_filename[2048];
+static unsigned int dedup_nbr=0;
+static unsigned int dedup_duplicates=0;
+#ifdef HAVE_PTHREAD
+/* Files may be checked by other threads, see file_finish_deferred() */
+static pthread_mutex_t dedup_mutex=PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static unsigned int dedup_bucket(const uint64_t size, const unsigned char *sha256)
+{
+  return ((sha256[0] << 8) + sha256[1] + (unsigned int)size) % DEDUP_BUCKETS;
+}
+
+static int dedup_exists(const dedup_entry_t *entry)
+{
+  struct stat st;
+  return (stat(entry->name, &st)==0 && S_ISREG(st.st_mode) &&
+      (uint64_t)st.st_size==entry->size);
+}
+
+/* Returns the last entry with this content whose file is still there */
+static const dedup_entry_t *dedup_find(const uint64_t size, const unsigned char *sha256)
+{
+  const dedup_entry_t *entry;
+  for(entry=dedup_table[dedup_bucket(size, sha256)]; entry!=NULL; entry=entry->next)
+  {
+    if(entry->size==size && memcmp(entry->sha256, sha256, SHA256_DIGEST_SIZE)==0 &&
+	dedup_exists(entry))
+      return entry;
+  }
+  return NULL;
+}
+
+static void dedup_insert(const uint64_t size, const unsigned char *sha256, const char *name)
+{
+  const unsigned int bucket=dedup_bucket(size, sha256);
+  dedup_entry_t *entry=(dedup_entry_t *)MALLOC(sizeof(*entry));
+  entry->size=size;
+  memcpy(entry->sha256, sha256, SHA256_DIGEST_SIZE);
+  entry->name=strdup(name);
+  entry->next=dedup_table[bucket];
+  dedup_table[bucket]=entry;
+  dedup_nbr++;
+}
+
+static int hex_to_digest(unsigned char *digest, const char *hex, const unsigned int size)
+{
+  unsigned int i;
+  for(i=0; i<2*size; i++)
+  {
+    const char c=hex[i];
+    unsigned int v;
+    if(c>='0' && c<='9')
+      v=c-'0';
+    else if(c>='a' && c<='f')
+      v=c-'a'+10;
+    else
+      return -1;
+    if(i%2==0)
+      digest[i/2]=v<<4;
+    else
+      digest[i/2]|=v;
+  }
+  return 0;
+}
+
+static void dedup_load(FILE *handle)
+{
+  char line[4096];
+  while(fgets(line, sizeof(line), handle)!=NULL)
+  {
+    unsigned char sha256[SHA256_DIGEST_SIZE];
+    unsigned long long size;
+    int pos=0;
+    char *eol=strchr(line, '\n');
+    if(eol!=NULL)
+      *eol='\0';
+    if(strlen(line) <= 2*SHA256_DIGEST_SIZE ||
+	hex_to_digest(sha256, line, SHA256_DIGEST_SIZE) < 0 ||
+	sscanf(&line[2*SHA256_DIGEST_SIZE], " %llu %n", &size, &pos) < 1 || pos==0)
+      continue;
+    /* The last entries come first */
+    dedup_insert(size, sha256, &line[2*SHA256_DIGEST_SIZE+pos]);
+  }
+}
+
+int dedup_open(const char *recup_dir)
+{
+  dedup_table=(dedup_entry_t **)MALLOC(DEDUP_BUCKETS * sizeof(dedup_entry_t *));
+  dedup_nbr=0;
+  dedup_duplicates=0;
+  snprintf(dedup_filename, sizeof(dedup_filename), "%s.dup", recup_dir);
+  dedup_handle=fopen(dedup_filename, "a+");
+  if(dedup_handle==NULL)
+  {
+    log_error("Cannot open %s: %s\n", dedup_filename, strerror(errno));
+    free(dedup_table);
+    dedup_table=NULL;
+    return -1;
+  }
+  rewind(dedup_handle);
+  dedup_load(dedup_handle);
+  log_info("Duplicates: %u files already recovered listed in %s\n", dedup_nbr, dedup_filename);
+  return 0;
+}
+
+void dedup_close(const int recovery_done)
+{
+  unsigned int i;
+  if(dedup_table==NULL)
+    return ;
+  log_info("%u duplicate files not written\n", dedup_duplicates);
+  fclose(dedup_handle);
+  dedup_handle=NULL;
+  if(recovery_done>0)
+    unlink(dedup_filename);
+  for(i=0; i<DEDUP_BUCKETS; i++)
+  {
+    dedup_entry_t *entry=dedup_table[i];
+    while(entry!=NULL)
+    {
+      dedup_entry_t *next=entry->next;
+      free(entry->name);
+      free(entry);
+      entry=next;
+    }
+  }
+  free(dedup_table);
+  dedup_table=NULL;
+}
+
+int dedup_enabled(void)
+{
+  return (dedup_table!=NULL);
+}
+
+const char *dedup_lookup(const file_recovery_t *file_recovery)
+{
+  const dedup_entry_t *entry;
+  const char *res=NULL;
+  if(dedup_table==NULL || file_recovery->digest_ok==0 || file_recovery->file_size==0)
+    return NULL;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&dedup_mutex);
+#endif
+  entry=dedup_find(file_recovery->file_size, file_recovery->sha256);
+  if(entry!=NULL)
+  {
+    dedup_duplicates++;
+    res=entry->name;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&dedup_mutex);
+#endif
+  return res;
+}
+
+void dedup_add(const file_recovery_t *file_recovery)
+{
+  char hex[2*SHA256_DIGEST_SIZE+1];
+  if(dedup_table==NULL || file_recovery->digest_ok==0 || file_recovery->file_size==0)
+    return ;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&dedup_mutex);
+#endif
+  /* Comes before an entry whose file is gone, the names are never freed
+   * as they may be used as duplicate_of */
+  dedup_insert(file_recovery->file_size, file_recovery->sha256, file_recovery->filename);
+  hash_to_hex(hex, file_recovery->sha256, SHA256_DIGEST_SIZE);
+  fprintf(dedup_handle, "%s %llu %s\n", hex,
+      (long long unsigned)file_recovery->file_size, file_recovery->filename);
+  fflush(dedup_handle);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&dedup_mutex);
+#endif
+}
@@ -0,0 +1,44 @@
+/*
+
+    File: phdedup.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* dedup_open()
+ * The store of recup_dir is recup_dir.dup */
+int dedup_open(const char *recup_dir);
+/* dedup_close()
+ * The store is removed if the recovery is done */
+void dedup_close(const int recovery_done);
+int dedup_enabled(void);
+
+/* dedup_lookup()
+ * @returns the name of an identical file already recovered and still
+ * there, or NULL if the file is unique */
+const char *dedup_lookup(const file_recovery_t *file_recovery);
+/* dedup_add()
+ * Add a file kept under its final name to the store */
+void dedup_add(const file_recovery_t *file_recovery);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
@@ -0,0 +1,428 @@
+/*
+
+    File: phextract.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "filegen.h"
+#include "log.h"
+#include "setdate.h"
+#include "phindex.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* Size of the reads done on the source */
+#define EXTRACT_WINDOW	(8*1024*1024)
+
+typedef struct
+{
+  const phindex_entry_t *entry;
+  unsigned int entry_num;
+  uint64_t file_offset;
+  uint64_t offset;
+  uint64_t size;
+} extract_run_t;
+
+static int extract_run_cmp(const void *a, const void *b)
+{
+  const extract_run_t *run_a=(const extract_run_t *)a;
+  const extract_run_t *run_b=(const extract_run_t *)b;
+  if(run_a->offset < run_b->offset)
+    return -1;
+  if(run_a->offset > run_b->offset)
+    return 1;
+  return 0;
+}
+
+static int source_read(const int fd, void *buffer, const unsigned int size, const uint64_t offset)
+{
+#ifdef HAVE_PREAD
+  return pread(fd, buffer, size, offset);
+#else
+  if(lseek(fd, offset, SEEK_SET) < 0)
+    return -1;
+  return read(fd, buffer, size);
+#endif
+}
+
+static int entry_selected(const phindex_entry_t *entry, const char *formats, char **names, const int nbr_names)
+{
+  int i;
+  if((entry->flags & PHINDEX_REJECTED)!=0)
+    return 0;
+  if(formats!=NULL)
+  {
+    const size_t len=strlen(entry->format);
+    const char *pos=formats;
+    int found=0;
+    while(found==0 && pos!=NULL)
+    {
+      if(strncmp(pos, entry->format, len)==0 && (pos[len]==',' || pos[len]=='\0'))
+	found=1;
+      pos=strchr(pos, ',');
+      if(pos!=NULL)
+	pos++;
+    }
+    if(found==0)
+      return 0;
+  }
+  if(nbr_names==0)
+    return 1;
+  for(i=0; i<nbr_names; i++)
+  {
+    const char *basename=strrchr(entry->name, '/');
+    if(strcmp(entry->name, names[i])==0 ||
+	(basename!=NULL && strcmp(basename+1, names[i])==0))
+      return 1;
+  }
+  return 0;
+}
+
+/* Create the missing directories of filename */
+static void extract_mkdir(char *filename)
+{
+  char *sep;
+  for(sep=strchr(filename+1, '/'); sep!=NULL; sep=strchr(sep+1, '/'))
+  {
+    *sep='\0';
+#ifdef __MINGW32__
+    mkdir(filename);
+#else
+    mkdir(filename, 0775);
+#endif
+    *sep='/';
+  }
+}
+
+/* extract_filename()
+ * The names come from the index, an absolute name or a name with a ".."
+ * component would write outside of dest_dir.
+ * @returns dest_dir/name to be freed, or NULL if the name is rejected
+ */
+static char *extract_filename(const char *dest_dir, const phindex_entry_t *entry)
+{
+  const char *component=entry->name;
+  char *filename;
+  if(entry->name[0]=='/' || entry->name[0]=='\\' ||
+      (entry->name[0]!='\0' && entry->name[1]==':'))
+  {
+    fprintf(stderr, "Invalid file name %s, absolute name\n", entry->name);
+    return NULL;
+  }
+  while(1)
+  {
+    const size_t len=strcspn(component, "/\\");
+    if(len==2 && component[0]=='.' && component[1]=='.')
+    {
+      fprintf(stderr, "Invalid file name %s, outside of %s\n", entry->name, dest_dir);
+      return NULL;
+    }
+    if(component[len]=='\0')
+      break;
+    component+=len+1;
+  }
+  filename=(char *)MALLOC(strlen(dest_dir) + 1 + strlen(entry->name) + 1);
+  strcpy(filename, dest_dir);
+  strcat(filename, "/");
+  strcat(filename, entry->name);
+  return filename;
+}
+
+static FILE *extract_fopen(const char *dest_dir, const phindex_entry_t *entry, const int create)
+{
+  char *filename=extract_filename(dest_dir, entry);
+  FILE *handle;
+  if(filename==NULL)
+    return NULL;
+  if(create>0)
+  {
+    extract_mkdir(filename);
+    handle=fopen(filename, "w+b");
+  }
+  else
+    handle=fopen(filename, "r+b");
+  if(handle==NULL)
+    fprintf(stderr, "Cannot open %s: %s\n", filename, strerror(errno));
+  free(filename);
+  return handle;
+}
+
+static void extract_set_date(const char *dest_dir, const phindex_entry_t *entry)
+{
+  char *filename;
+  if(entry->time==0)
+    return ;
+  filename=extract_filename(dest_dir, entry);
+  if(filename==NULL)
+    return ;
+  set_date(filename, entry->time, entry->time);
+  free(filename);
+}
+
+/* Copy the runs sorted by offset in the source, so the source is read
+ * sequentially through a large window */
+static unsigned int extract_runs(const int fd, const char *dest_dir, extract_run_t *runs, const unsigned int nbr_runs, unsigned char *created)
+{
+  unsigned char *buffer=(unsigned char *)MALLOC(EXTRACT_WINDOW);
+  uint64_t window_offset=0;
+  unsigned int window_size=0;
+  FILE *handle=NULL;
+  const phindex_entry_t *handle_entry=NULL;
+  unsigned int nbr_errors=0;
+  unsigned int i;
+  for(i=0; i<nbr_runs; i++)
+  {
+    extract_run_t *run=&runs[i];
+    uint64_t done=0;
+    if(handle_entry!=run->entry)
+    {
+      if(handle!=NULL)
+	fclose(handle);
+      handle=extract_fopen(dest_dir, run->entry, (created[run->entry_num]==0));
+      handle_entry=run->entry;
+      created[run->entry_num]=1;
+    }
+    if(handle==NULL || fseek(handle, run->file_offset, SEEK_SET)<0)
+    {
+      nbr_errors++;
+      continue;
+    }
+    while(done < run->size)
+    {
+      const uint64_t offset=run->offset + done;
+      unsigned int size;
+      if(!(window_offset <= offset && offset < window_offset + window_size))
+      {
+	const int res=source_read(fd, buffer, EXTRACT_WINDOW, offset);
+	window_offset=offset;
+	window_size=(res > 0 ? res : 0);
+	if(window_size==0)
+	{
+	  fprintf(stderr, "Cannot read offset %llu: %s\n", (long long unsigned)offset, strerror(errno));
+	  nbr_errors++;
+	  break;
+	}
+      }
+      size=window_offset + window_size - offset;
+      if(size > run->size - done)
+	size=run->size - done;
+      if(fwrite(&buffer[offset - window_offset], size, 1, handle)!=1)
+      {
+	fprintf(stderr, "Cannot write %s: %s\n", run->entry->name, strerror(errno));
+	nbr_errors++;
+	break;
+      }
+      done+=size;
+    }
+  }
+  if(handle!=NULL)
+    fclose(handle);
+  free(buffer);
+  return nbr_errors;
+}
+
+static void display_help(void)
+{
+  printf("\nUsage: phextract [/list] [/d dest_dir] [/f ext[,ext]] [/s source] photorec.idx [file...]\n"\
+      "\n"\
+      "/list         : list the files of the index\n"\
+      "/d dest_dir   : extract the files in dest_dir, current directory by default\n"\
+      "/f ext[,ext]  : extract only these file formats\n"\
+      "/s source     : disk or image to read, default is the one scanned by PhotoRec\n"\
+      "file          : extract only these files\n");
+}
+
+int main(int argc, char **argv)
+{
+  int i;
+  int list=0;
+  const char *dest_dir=".";
+  const char *formats=NULL;
+  const char *source=NULL;
+  const char *index_filename=NULL;
+  char *device=NULL;
+  uint64_t disk_size=0;
+  FILE *index_handle;
+  phindex_entry_t *entries=NULL;
+  unsigned int nbr_entries=0;
+  unsigned int max_entries=0;
+  extract_run_t *runs=NULL;
+  unsigned int nbr_runs=0;
+  unsigned int nbr_files=0;
+  unsigned int nbr_errors=0;
+  int fd;
+  log_set_levels(LOG_LEVEL_ERROR|LOG_LEVEL_PERROR|LOG_LEVEL_CRITICAL);
+  for(i=1; i<argc && index_filename==NULL; i++)
+  {
+    if(strcmp(argv[i],"/list")==0 || strcmp(argv[i],"-list")==0)
+      list=1;
+    else if((strcmp(argv[i],"/d")==0 || strcmp(argv[i],"-d")==0) && i+1<argc)
+      dest_dir=argv[++i];
+    else if((strcmp(argv[i],"/f")==0 || strcmp(argv[i],"-f")==0) && i+1<argc)
+      formats=argv[++i];
+    else if((strcmp(argv[i],"/s")==0 || strcmp(argv[i],"-s")==0) && i+1<argc)
+      source=argv[++i];
+    else
+      index_filename=argv[i];
+  }
+  if(index_filename==NULL)
+  {
+    display_help();
+    return 1;
+  }
+  index_handle=index_read_open(index_filename, &device, &disk_size);
+  if(index_handle==NULL)
+  {
+    fprintf(stderr, "Cannot read index %s\n", index_filename);
+    return 1;
+  }
+  while(1)
+  {
+    int res;
+    if(nbr_entries==max_entries)
+    {
+      max_entries=(max_entries==0 ? 256 : 2*max_entries);
+      entries=(phindex_entry_t *)realloc(entries, max_entries * sizeof(phindex_entry_t));
+      if(entries==NULL)
+      {
+	fprintf(stderr, "Memory allocation failed\n");
+	return 1;
+      }
+    }
+    res=index_read_entry(index_handle, &entries[nbr_entries]);
+    if(res<0)
+      fprintf(stderr, "Index %s is truncated\n", index_filename);
+    if(res<=0)
+      break;
+    if(list>0)
+    {
+      const phindex_entry_t *entry=&entries[nbr_entries];
+      if((entry->flags & PHINDEX_REJECTED)!=0)
+	printf("-\t%s\t0\trejected\theader at %llu\n", entry->format,
+	    (long long unsigned)(entry->nbr_runs>0 ? entry->runs[0].offset : 0));
+      else
+	printf("%s\t%s\t%llu\t%s\t%u run%s\n", entry->name, entry->format,
+	    (long long unsigned)entry->file_size,
+	    ((entry->flags & PHINDEX_TRUNCATED)!=0 ? "truncated" :
+	     (entry->flags & PHINDEX_CHECKED)!=0 ? "checked" : "unchecked"),
+	    entry->nbr_runs, (entry->nbr_runs>1 ? "s" : ""));
+    }
+    nbr_entries++;
+  }
+  fclose(index_handle);
+  if(list>0)
+    return 0;
+  {
+    unsigned int j;
+    unsigned int max_runs=0;
+    for(j=0; j<nbr_entries; j++)
+      if(entry_selected(&entries[j], formats, &argv[i], argc-i))
+	max_runs+=entries[j].nbr_runs;
+    if(max_runs>0)
+      runs=(extract_run_t *)MALLOC(max_runs * sizeof(extract_run_t));
+    for(j=0; j<nbr_entries; j++)
+    {
+      const phindex_entry_t *entry=&entries[j];
+      if(entry_selected(entry, formats, &argv[i], argc-i))
+      {
+	uint64_t file_offset=0;
+	unsigned int k;
+	for(k=0; k<entry->nbr_runs; k++)
+	{
+	  runs[nbr_runs].entry=entry;
+	  runs[nbr_runs].entry_num=j;
+	  runs[nbr_runs].file_offset=file_offset;
+	  runs[nbr_runs].offset=entry->runs[k].offset;
+	  runs[nbr_runs].size=entry->runs[k].size;
+	  file_offset+=entry->runs[k].size;
+	  nbr_runs++;
+	}
+	nbr_files++;
+      }
+    }
+  }
+  if(nbr_runs==0)
+  {
+    printf("No file to extract\n");
+    return 0;
+  }
+  if(source==NULL)
+    source=device;
+  fd=open(source, O_RDONLY|O_BINARY);
+  if(fd<0)
+  {
+    fprintf(stderr, "Cannot open %s: %s\n", source, strerror(errno));
+    return 1;
+  }
+  qsort(runs, nbr_runs, sizeof(extract_run_t), extract_run_cmp);
+  {
+    unsigned char *created=(unsigned char *)MALLOC(nbr_entries);
+    unsigned int j;
+    nbr_errors=extract_runs(fd, dest_dir, runs, nbr_runs, created);
+    for(j=0; j<nbr_entries; j++)
+      if(created[j]>0)
+	extract_set_date(dest_dir, &entries[j]);
+    free(created);
+  }
+  close(fd);
+  printf("%u files extracted from %s", nbr_files, source);
+  if(nbr_errors>0)
+    printf(", %u errors", nbr_errors);
+  printf("\n");
+  {
+    unsigned int j;
+    for(j=0; j<nbr_entries; j++)
+      index_entry_free(&entries[j]);
+  }
+  free(entries);
+  free(runs);
+  free(device);
+  return (nbr_errors>0 ? 1 : 0);
+}
@@ -0,0 +1,378 @@
+/*
+
+    File: phindex.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#include <stdio.h>
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "log.h"
+#include "phindex.h"
+
+/* Index of the files found by PhotoRec, all values are little endian
+ * - header, followed by the name of the device
+ * - for each file: record, format, name and nbr_runs runs */
+#define PHINDEX_MAGIC	"PhRecIdx"
+#define PHINDEX_VERSION	1
+
+struct phindex_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t device_len;
+  uint64_t disk_size;
+} __attribute__ ((__packed__));
+
+struct phindex_record
+{
+  uint32_t flags;
+  uint32_t nbr_runs;
+  uint64_t file_size;
+  uint64_t time;
+  uint16_t format_len;
+  uint16_t name_len;
+} __attribute__ ((__packed__));
+
+struct phindex_run
+{
+  uint64_t offset;
+  uint64_t size;
+} __attribute__ ((__packed__));
+
+static FILE *index_handle=NULL;
+static char index_prefix[2048];
+
+static const char *relative_name(const char *fname)
+{
+  const size_t len=strlen(index_prefix);
+  if(strncmp(fname, index_prefix, len)==0)
+    return fname+len;
+  return fname;
+}
+
+FILE *index_open(const char *recup_dir, const unsigned int dir_num, const disk_t *disk)
+{
+  char filename[2048];
+  const char *sep;
+  struct phindex_header header;
+  snprintf(filename, sizeof(filename), "%s.%u/%s", recup_dir, dir_num, PHINDEX_FILENAME);
+  index_handle=fopen(filename, "wb");
+  if(index_handle==NULL)
+  {
+    log_error("Cannot create index %s: %s\n", filename, strerror(errno));
+    return NULL;
+  }
+  log_info("Index only, files are listed in %s\n", filename);
+  /* File names are relative to the directory holding recup_dir.N */
+  index_prefix[0]='\0';
+  sep=strrchr(recup_dir, '/');
+  if(sep!=NULL && (size_t)(sep - recup_dir + 1) < sizeof(index_prefix))
+  {
+    memcpy(index_prefix, recup_dir, sep - recup_dir + 1);
+    index_prefix[sep - recup_dir + 1]='\0';
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PHINDEX_MAGIC, sizeof(header.magic));
+  header.version=le32(PHINDEX_VERSION);
+  header.device_len=le32(strlen(disk->device));
+  header.disk_size=le64(disk->disk_size);
+  if(fwrite(&header, sizeof(header), 1, index_handle)!=1 ||
+      fwrite(disk->device, strlen(disk->device), 1, index_handle)!=1)
+  {
+    log_error("Cannot write index %s: %s\n", filename, strerror(errno));
+    fclose(index_handle);
+    index_handle=NULL;
+  }
+  return index_handle;
+}
+
+void index_close(void)
+{
+  if(index_handle==NULL)
+    return ;
+  fclose(index_handle);
+  index_handle=NULL;
+}
+
+int index_enabled(void)
+{
+  return (index_handle!=NULL);
+}
+
+/* In index only mode, the content of a file is only needed by file_check(),
+ * nothing is written to recup_dir: the data goes to a temporary file,
+ * and only when it can't be kept in memory (see file_fwrite()). */
+FILE *index_fopen(const char *filename)
+{
+  if(index_handle!=NULL)
+    return tmpfile();
+  return fopen(filename, "w+b");
+}
+
+static void index_run_add(phindex_run_t **runs, unsigned int *nbr_runs, unsigned int *max_runs, const uint64_t offset, const uint64_t size)
+{
+  if(*nbr_runs > 0 &&
+      (*runs)[*nbr_runs-1].offset + (*runs)[*nbr_runs-1].size == offset)
+  {
+    (*runs)[*nbr_runs-1].size+=size;
+    return ;
+  }
+  if(*nbr_runs == *max_runs)
+  {
+    *max_runs=(*max_runs==0 ? 16 : 2 * *max_runs);
+    *runs=(phindex_run_t *)realloc(*runs, *max_runs * sizeof(phindex_run_t));
+    if(*runs==NULL)
+    {
+      log_critical("index_run_add: memory allocation failed\n");
+      log_close();
+      exit(EXIT_FAILURE);
+    }
+  }
+  (*runs)[*nbr_runs].offset=offset;
+  (*runs)[*nbr_runs].size=size;
+  (*nbr_runs)++;
+}
+
+static void index_write(const char *format, const char *name, const unsigned int flags, const uint64_t file_size, const time_t time, const phindex_run_t *runs, const unsigned int nbr_runs)
+{
+  struct phindex_record record;
+  unsigned int i;
+  if(format==NULL)
+    format="";
+  record.flags=le32(flags);
+  record.nbr_runs=le32(nbr_runs);
+  record.file_size=le64(file_size);
+  record.time=le64((time==(time_t)-1 ? 0 : (uint64_t)time));
+  record.format_len=le16(strlen(format));
+  record.name_len=le16(strlen(name));
+  if(fwrite(&record, sizeof(record), 1, index_handle)!=1 ||
+      (format[0]!='\0' && fwrite(format, strlen(format), 1, index_handle)!=1) ||
+      (name[0]!='\0' && fwrite(name, strlen(name), 1, index_handle)!=1))
+  {
+    log_error("Cannot write index: %s\n", strerror(errno));
+    return ;
+  }
+  for(i=0; i<nbr_runs; i++)
+  {
+    struct phindex_run run;
+    run.offset=le64(runs[i].offset);
+    run.size=le64(runs[i].size);
+    if(fwrite(&run, sizeof(run), 1, index_handle)!=1)
+    {
+      log_error("Cannot write index: %s\n", strerror(errno));
+      return ;
+    }
+  }
+}
+
+/* See filegen.h for the definition of file_recovery_struct */
+void index_log_file_recovered(const file_recovery_t *file_recovery, const unsigned int flags)
+{
+  phindex_run_t *runs=NULL;
+  unsigned int nbr_runs=0;
+  unsigned int max_runs=0;
+  uint64_t size=0;
+  unsigned int i;
+  if(index_handle==NULL || file_recovery->file_stat==NULL)
+    return;
+  for(i=0; i<file_recovery->location.nbr && size < file_recovery->file_size; i++)
+  {
+    const alloc_extent_t *element=&file_recovery->location.extents[i];
+    if(element->data>0)
+    {
+      uint64_t len=element->end - element->start + 1;
+      if(size + len > file_recovery->file_size)
+	len=file_recovery->file_size - size;
+      index_run_add(&runs, &nbr_runs, &max_runs, element->start, len);
+      size+=len;
+    }
+  }
+  index_write(file_recovery->file_stat->file_hint->extension,
+      relative_name(file_recovery->filename), flags,
+      file_recovery->file_size, file_recovery->time, runs, nbr_runs);
+  free(runs);
+}
+
+void index_log_file_recovered2(const alloc_data_t *space, const file_recovery_t *file_recovery, const unsigned int flags)
+{
+  phindex_run_t *runs=NULL;
+  unsigned int nbr_runs=0;
+  unsigned int max_runs=0;
+  uint64_t size=0;
+  const struct td_list_head *tmp;
+  if(index_handle==NULL || file_recovery->file_stat==NULL)
+    return;
+  for(tmp=&file_recovery->loc->list;
+      tmp!=&space->list && size < file_recovery->file_size;
+      tmp=tmp->next)
+  {
+    const alloc_data_t *element=td_list_entry_const(tmp, const alloc_data_t, list);
+    if(element->data>0)
+    {
+      uint64_t len=element->end - element->start + 1;
+      if(size + len > file_recovery->file_size)
+	len=file_recovery->file_size - size;
+      index_run_add(&runs, &nbr_runs, &max_runs, element->start, len);
+      size+=len;
+    }
+  }
+  index_write(file_recovery->file_stat->file_hint->extension,
+      relative_name(file_recovery->filename), flags,
+      file_recovery->file_size, file_recovery->time, runs, nbr_runs);
+  free(runs);
+}
+
+/* Headers still in the search space belong to files that have been
+ * rejected, their only run has a null size and gives their location */
+void index_log_file_rejected(const alloc_data_t *list_search_space)
+{
+  struct td_list_head *search_walker = NULL;
+  if(index_handle==NULL)
+    return;
+  td_list_for_each(search_walker, &list_search_space->list)
+  {
+    const alloc_data_t *tmp=td_list_entry_const(search_walker, const alloc_data_t, list);
+    if(tmp->file_stat!=NULL && tmp->file_stat->file_hint!=NULL)
+    {
+      phindex_run_t run;
+      run.offset=tmp->start;
+      run.size=0;
+      index_write(tmp->file_stat->file_hint->extension, "",
+	  PHINDEX_CHECKED|PHINDEX_REJECTED, 0, (time_t)-1, &run, 1);
+    }
+  }
+}
+
+FILE *index_read_open(const char *filename, char **device, uint64_t *disk_size)
+{
+  struct phindex_header header;
+  unsigned int device_len;
+  FILE *handle=fopen(filename, "rb");
+  if(handle==NULL)
+    return NULL;
+  if(fread(&header, sizeof(header), 1, handle)!=1 ||
+      memcmp(header.magic, PHINDEX_MAGIC, sizeof(header.magic))!=0 ||
+      le32(header.version)!=PHINDEX_VERSION)
+  {
+    fclose(handle);
+    return NULL;
+  }
+  device_len=le32(header.device_len);
+  *device=(char *)MALLOC(device_len+1);
+  if(device_len>0 && fread(*device, device_len, 1, handle)!=1)
+  {
+    free(*device);
+    *device=NULL;
+    fclose(handle);
+    return NULL;
+  }
+  (*device)[device_len]='\0';
+  *disk_size=le64(header.disk_size);
+  return handle;
+}
+
+static char *index_read_string(FILE *handle, const unsigned int len)
+{
+  char *str=(char *)MALLOC(len+1);
+  if(len>0 && fread(str, len, 1, handle)!=1)
+  {
+    free(str);
+    return NULL;
+  }
+  str[len]='\0';
+  return str;
+}
+
+/* index_read_entry()
+ * @returns 1 if an entry has been read, 0 at the end of the index, -1 on error
+ */
+int index_read_entry(FILE *handle, phindex_entry_t *entry)
+{
+  struct phindex_record record;
+  unsigned int i;
+  memset(entry, 0, sizeof(*entry));
+  if(fread(&record, sizeof(record), 1, handle)!=1)
+    return (feof(handle) ? 0 : -1);
+  entry->flags=le32(record.flags);
+  entry->nbr_runs=le32(record.nbr_runs);
+  entry->file_size=le64(record.file_size);
+  entry->time=(time_t)le64(record.time);
+  entry->format=index_read_string(handle, le16(record.format_len));
+  entry->name=index_read_string(handle, le16(record.name_len));
+  if(entry->format==NULL || entry->name==NULL)
+  {
+    index_entry_free(entry);
+    return -1;
+  }
+  if(entry->nbr_runs==0)
+    return 1;
+  {
+    /* nbr_runs isn't trusted, the runs must fit in the rest of the index */
+    const long pos=ftell(handle);
+    long end;
+    if(pos < 0 || fseek(handle, 0, SEEK_END) < 0 || (end=ftell(handle)) < 0 ||
+	fseek(handle, pos, SEEK_SET) < 0 ||
+	entry->nbr_runs > (unsigned long)(end - pos) / sizeof(struct phindex_run))
+    {
+      index_entry_free(entry);
+      return -1;
+    }
+  }
+  entry->runs=(phindex_run_t *)MALLOC(entry->nbr_runs * sizeof(phindex_run_t));
+  for(i=0; i<entry->nbr_runs; i++)
+  {
+    struct phindex_run run;
+    if(fread(&run, sizeof(run), 1, handle)!=1)
+    {
+      index_entry_free(entry);
+      return -1;
+    }
+    entry->runs[i].offset=le64(run.offset);
+    entry->runs[i].size=le64(run.size);
+  }
+  return 1;
+}
+
+void index_entry_free(phindex_entry_t *entry)
+{
+  free(entry->format);
+  free(entry->name);
+  free(entry->runs);
+  entry->format=NULL;
+  entry->name=NULL;
+  entry->runs=NULL;
+  entry->nbr_runs=0;
+}
@@ -0,0 +1,66 @@
+/*
+
+    File: phindex.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PHINDEX_FILENAME	"photorec.idx"
+
+/* Validation result */
+#define PHINDEX_CHECKED		1	/* file_check() has been run */
+#define PHINDEX_TRUNCATED	2	/* file_check() has reduced the file size */
+#define PHINDEX_REJECTED	4	/* file is invalid, its run only gives its header */
+
+typedef struct
+{
+  uint64_t offset;	/* offset in the disk image */
+  uint64_t size;
+} phindex_run_t;
+
+typedef struct
+{
+  unsigned int flags;
+  uint64_t file_size;
+  time_t time;
+  char *format;		/* extension of the file format */
+  char *name;		/* file name relative to the parent of recup_dir, empty if rejected */
+  unsigned int nbr_runs;
+  phindex_run_t *runs;	/* contiguous in the file */
+} phindex_entry_t;
+
+/* Writer, used by PhotoRec in index only mode */
+FILE *index_open(const char *recup_dir, const unsigned int dir_num, const disk_t *disk);
+void index_close(void);
+int index_enabled(void);
+FILE *index_fopen(const char *filename);
+void index_log_file_recovered(const file_recovery_t *file_recovery, const unsigned int flags);
+void index_log_file_recovered2(const alloc_data_t *space, const file_recovery_t *file_recovery, const unsigned int flags);
+void index_log_file_rejected(const alloc_data_t *list_search_space);
+
+/* Reader */
+FILE *index_read_open(const char *filename, char **device, uint64_t *disk_size);
+int index_read_entry(FILE *handle, phindex_entry_t *entry);
+void index_entry_free(phindex_entry_t *entry);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
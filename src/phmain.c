@@ -66,6 +66,7 @@
 #include "filegen.h"
 #include "photorec.h"
 #include "hdcache.h"
+#include "hdthrottle.h"
 #include "ewf.h"
 #include "log.h"
 #include "hdaccess.h"
@@ -77,6 +78,7 @@
 #include "ntfs_dir.h"
 #include "pdisksel.h"
 #include "dfxml.h"
+#include "phcontrol.h"
 
 extern file_enable_t list_file_enable[];
 
@@ -87,10 +89,9 @@ static void sighup_hdlr(int sig);
 static void sighup_hdlr(int sig)
 {
   if(sig == SIGINT)
-    log_critical("SIGINT detected! PhotoRec has been killed.\n");
+    log_emergency_flush("SIGINT detected! PhotoRec has been killed.\n");
   else
-    log_critical("SIGHUP detected! PhotoRec has been killed.\n");
-  log_flush();
+    log_emergency_flush("SIGHUP detected! PhotoRec has been killed.\n");
   action.sa_handler=SIG_DFL;
   sigaction(sig,&action,NULL);
   kill(0, sig);
@@ -108,6 +109,7 @@ int main( int argc, char **argv )
   list_disk_t *list_disk=NULL;
   list_disk_t *element_disk;
   const char *logfile="photorec.log";
+  const char *control_name=NULL;
   FILE *log_handle=NULL;
   struct ph_options options={
     .paranoid=1,
@@ -115,6 +117,12 @@ int main( int argc, char **argv )
     .mode_ext2=0,
     .expert=0,
     .lowmem=0,
+    .deferred_check=0,
+    .verify_crc=0,
+    .fast_forward=0,
+    .index_only=0,
+    .hash=0,
+    .dedup=0,
     .verbose=0,
     .list_file_format=list_file_enable
   };
@@ -176,6 +184,16 @@ int main( int argc, char **argv )
         params.recup_dir=strdup(argv[i+1]);
       i++;
     }
+    else if(((strcmp(argv[i],"/control")==0)||(strcmp(argv[i],"-control")==0)) &&(i+1<argc))
+      control_name=argv[++i];
+    else if(((strcmp(argv[i],"/throttle")==0)||(strcmp(argv[i],"-throttle")==0)) &&(i+1<argc))
+    {
+      if(throttle_set(argv[++i])<0)
+      {
+	printf("\nInvalid throttle parameters %s\n", argv[i]);
+	help=1;
+      }
+    }
     else if((strcmp(argv[i],"/all")==0) || (strcmp(argv[i],"-all")==0))
       testdisk_mode|=TESTDISK_O_ALL;
     else if((strcmp(argv[i],"/direct")==0) || (strcmp(argv[i],"-direct")==0))
@@ -235,11 +253,16 @@ int main( int argc, char **argv )
   }
   if(help!=0)
   {
-    printf("\nUsage: photorec [/log] [/debug] [/d recup_dir] [file.dd|file.e01|device]\n"\
+    printf("\nUsage: photorec [/log] [/debug] [/d recup_dir] [/control socket] [/throttle limits] [file.dd|file.e01|device]\n"\
 	"       photorec /version\n" \
         "\n" \
         "/log          : create a photorec.log file\n" \
         "/debug        : add debug information\n" \
+        "/control      : report the progress in JSON on this local socket,\n" \
+        "                accept pause, resume, stop and checkpoint commands\n" \
+        "/throttle     : limit the disk reads and the file writes, ie\n" \
+        "                read=50M,read_burst=8M,read_iops=200,write=20M,write_burst=4M,adaptive\n" \
+        "                adaptive slows down the reads when the disk latency rises\n" \
         "\n" \
         "PhotoRec searches various file formats (JPEG, Office...), it stores them\n" \
         "in recup_dir directory.\n" \
@@ -248,6 +271,12 @@ int main( int argc, char **argv )
     free(params.recup_dir);
     return 0;
   }
+  if(control_name!=NULL && control_open(control_name)<0)
+  {
+    printf("\nUnable to create the control socket %s: %s\n", control_name, strerror(errno));
+    free(params.recup_dir);
+    return 1;
+  }
 #ifdef ENABLE_DFXML
   xml_set_command_line(argc, argv);
 #endif
@@ -311,6 +340,8 @@ int main( int argc, char **argv )
   log_info("Compilation date: %s\n", get_compilation_date());
   log_info("ext2fs lib: %s, ntfs lib: %s, ewf lib: %s, libjpeg: %s\n",
       td_ext2fs_version(), td_ntfs_version(), td_ewf_version(), td_jpeg_version());
+  if(control_name!=NULL)
+    log_info("Control socket: %s\n", control_name);
 #if defined(__CYGWIN__) || defined(__MINGW32__) || defined(DJGPP)
 #else
 #ifdef HAVE_GETEUID
@@ -328,7 +359,7 @@ int main( int argc, char **argv )
   /* Activate the cache, even if photorec has its own */
   for(element_disk=list_disk;element_disk!=NULL;element_disk=element_disk->next)
   {
-    element_disk->disk=new_diskcache(element_disk->disk, testdisk_mode);
+    element_disk->disk=new_diskcache(new_diskthrottle(element_disk->disk), testdisk_mode);
   }
   /* save disk parameters to rapport */
   log_info("Hard disk list\n");
@@ -352,6 +383,7 @@ int main( int argc, char **argv )
   end_ncurses();
 #endif
   delete_list_disk(list_disk);
+  control_close();
   log_info("PhotoRec exited normally.\n");
   if(log_close()!=0)
   {
@@ -35,6 +35,9 @@
 #include <string.h>
 #endif
 #include <errno.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include "types.h"
 #include "common.h"
 #include "fnctdsk.h"
@@ -48,6 +51,11 @@
 #include "log.h"
 #include "setdate.h"
 #include "dfxml.h"
+#include "phindex.h"
+#include "hash.h"
+#include "phdedup.h"
+
+alloc_pool_t alloc_data_pool=ALLOC_POOL_INIT(alloc_data_pool, alloc_data_t);
 
 /* #define DEBUG_FILE_FINISH */
 /* #define DEBUG_UPDATE_SEARCH_SPACE */
@@ -55,22 +63,22 @@
 
 static void update_search_space(const file_recovery_t *file_recovery, alloc_data_t *list_search_space, alloc_data_t **new_current_search_space, uint64_t *offset, const unsigned int blocksize);
 static void update_search_space_aux(alloc_data_t *list_search_space, uint64_t start, uint64_t end, alloc_data_t **new_current_search_space, uint64_t *offset);
-static alloc_data_t *file_truncate(alloc_data_t *space, file_recovery_t *file, const unsigned int sector_size, const unsigned int blocksize);
+static alloc_data_t *file_truncate(alloc_data_t *space, file_recovery_t *file, const unsigned int sector_size, const unsigned int blocksize, alloc_list_t *extents);
 static alloc_data_t *file_error(alloc_data_t *space, file_recovery_t *file, const unsigned int blocksize);
 static void list_free_add(const file_recovery_t *file_recovery, alloc_data_t *list_search_space);
 static void list_space_used(const file_recovery_t *file_recovery, const unsigned int sector_size);
 
 static void list_space_used(const file_recovery_t *file_recovery, const unsigned int sector_size)
 {
-  struct td_list_head *tmp;
+  unsigned int i;
   uint64_t file_size=0;
   uint64_t file_size_on_disk=0;
   if(file_recovery->filename==NULL)
     return;
   log_info("%s\t",file_recovery->filename);
-  td_list_for_each(tmp, &file_recovery->location.list)
+  for(i=0; i<file_recovery->location.nbr; i++)
   {
-    const alloc_list_t *element=td_list_entry(tmp, alloc_list_t, list);
+    const alloc_extent_t *element=&file_recovery->location.extents[i];
     file_size_on_disk+=(element->end-element->start+1);
     if(element->data>0)
     {
@@ -104,7 +112,7 @@ static void list_free_add(const file_recovery_t *file_recovery, alloc_data_t *li
     if(current_search_space->start < file_recovery->location.start && file_recovery->location.start < current_search_space->end)
     {
       alloc_data_t *new_free_space;
-      new_free_space=(alloc_data_t*)MALLOC(sizeof(*new_free_space));
+      new_free_space=(alloc_data_t*)pool_alloc(&alloc_data_pool);
       new_free_space->start=file_recovery->location.start;
       new_free_space->end=current_search_space->end;
       new_free_space->file_stat=NULL;
@@ -133,7 +141,7 @@ static void update_search_space(const file_recovery_t *file_recovery, alloc_data
 
   td_list_for_each(search_walker, &list_search_space->list)
   {
-    struct td_list_head *tmp;
+    unsigned int i;
     alloc_data_t *current_search_space;
     current_search_space=td_list_entry(search_walker, alloc_data_t, list);
     if(current_search_space->start <= file_recovery->location.start &&
@@ -141,9 +149,9 @@ static void update_search_space(const file_recovery_t *file_recovery, alloc_data
     {
       *offset=file_recovery->location.start;
       *new_current_search_space=current_search_space;
-      td_list_for_each(tmp, &file_recovery->location.list)
+      for(i=0; i<file_recovery->location.nbr; i++)
       {
-	const alloc_list_t *element=td_list_entry(tmp, alloc_list_t, list);
+	const alloc_extent_t *element=&file_recovery->location.extents[i];
         uint64_t end=(element->end-(element->start%blocksize)+blocksize-1+1)/blocksize*blocksize+(element->start%blocksize)-1;
         update_search_space_aux(list_search_space, element->start, end, new_current_search_space, offset);
       }
@@ -203,7 +211,7 @@ static void update_search_space_aux(alloc_data_t *list_search_space, const uint6
         *offset=(*new_current_search_space)->start;
       }
       td_list_del(search_walker);
-      free(current_search_space);
+      pool_free(&alloc_data_pool, search_walker);
       update_search_space_aux(list_search_space, pivot, end, new_current_search_space, offset);
       return ;
     }
@@ -232,7 +240,7 @@ static void update_search_space_aux(alloc_data_t *list_search_space, const uint6
         *offset=(*new_current_search_space)->start;
       }
       td_list_del(search_walker);
-      free(current_search_space);
+      pool_free(&alloc_data_pool, search_walker);
       update_search_space_aux(list_search_space, start, pivot, new_current_search_space, offset);
       return ;
     }
@@ -253,7 +261,7 @@ static void update_search_space_aux(alloc_data_t *list_search_space, const uint6
     if(current_search_space->start < start && end < current_search_space->end)
     {
       alloc_data_t *new_free_space;
-      new_free_space=(alloc_data_t*)MALLOC(sizeof(*new_free_space));
+      new_free_space=(alloc_data_t*)pool_alloc(&alloc_data_pool);
       new_free_space->start=start;
       new_free_space->end=current_search_space->end;
       new_free_space->file_stat=NULL;
@@ -273,7 +281,7 @@ static void update_search_space_aux(alloc_data_t *list_search_space, const uint6
 void init_search_space(alloc_data_t *list_search_space, const disk_t *disk_car, const partition_t *partition)
 {
   alloc_data_t *new_sp;
-  new_sp=(alloc_data_t*)MALLOC(sizeof(*new_sp));
+  new_sp=(alloc_data_t*)pool_alloc(&alloc_data_pool);
   new_sp->start=partition->part_offset;
   new_sp->end=partition->part_offset+partition->part_size-1;
   if(new_sp->end > disk_car->disk_size-1)
@@ -288,15 +296,7 @@ void init_search_space(alloc_data_t *list_search_space, const disk_t *disk_car,
 
 void free_list_search_space(alloc_data_t *list_search_space)
 {
-  struct td_list_head *search_walker = NULL;
-  struct td_list_head *search_walker_next = NULL;
-  td_list_for_each_safe(search_walker,search_walker_next,&list_search_space->list)
-  {
-    alloc_data_t *current_search_space;
-    current_search_space=td_list_entry(search_walker, alloc_data_t, list);
-    td_list_del(search_walker);
-    free(current_search_space);
-  }
+  pool_free_list(&alloc_data_pool, &list_search_space->list);
 }
 
 /** 
@@ -385,7 +385,7 @@ void forget(alloc_data_t *list_search_space, alloc_data_t *current_search_space)
       alloc_data_t *tmp;
       tmp=td_list_entry(search_walker, alloc_data_t, list);
       td_list_del(&tmp->list);
-      free(tmp);
+      pool_free(&alloc_data_pool, &tmp->list);
     }
     else
       nbr++;
@@ -554,7 +554,7 @@ void update_blocksize(unsigned int blocksize, alloc_data_t *list_search_space, c
     if(current_search_space->start>current_search_space->end)
     {
       td_list_del(search_walker);
-      free(current_search_space);
+      pool_free(&alloc_data_pool, search_walker);
     }
   }
 }
@@ -563,30 +563,90 @@ uint64_t free_list_allocation_end=0;
 
 static void free_list_allocation(alloc_list_t *list_allocation)
 {
-  struct td_list_head *tmp = NULL;
-  struct td_list_head *tmp_next = NULL;
-  td_list_for_each_safe(tmp,tmp_next,&list_allocation->list)
+  if(list_allocation->nbr>0)
+    free_list_allocation_end=list_allocation->extents[list_allocation->nbr-1].end;
+  alloc_list_free(list_allocation);
+}
+
+/* file_write_deferred()
+ * In index only mode, and to compare a file with the files already
+ * recovered before writing it, file_fwrite() keeps the file in memory as
+ * long as it fits. */
+static int file_write_deferred(void)
+{
+  return (index_enabled() || dedup_enabled());
+}
+
+/* Write the first size bytes of a file kept in memory */
+static int file_content_flush(file_recovery_t *file_recovery, const uint64_t size)
+{
+  if(fseek(file_recovery->handle, 0, SEEK_SET) < 0 ||
+      (size > 0 && fwrite(file_recovery->content, size, 1, file_recovery->handle)!=1))
+    return -1;
+  return 0;
+}
+
+/* file_fwrite()
+ * Replaces fwrite() of size bytes of the file at file_recovery->file_size,
+ * must be called before file_content_append().
+ * See file_write_deferred(), in index only mode a file without
+ * file_check() to read it is never written.
+ * @returns 1 on success, 0 on error like fwrite(buffer, size, 1, handle)
+ */
+size_t file_fwrite(file_recovery_t *file_recovery, const unsigned char *buffer, const unsigned int size)
+{
+  if(!file_write_deferred())
+    return fwrite(buffer, size, 1, file_recovery->handle);
+  if(file_content_fits(file_recovery, size))
+    return 1;
+  if(index_enabled() && file_recovery->file_check==NULL)
+    return 1;
+  /* The file no longer fits in memory, write what has been kept */
+  if(file_recovery->content!=NULL &&
+      file_content_flush(file_recovery, file_recovery->file_size) < 0)
+    return 0;
+  return fwrite(buffer, size, 1, file_recovery->handle);
+}
+
+void file_check_run(file_recovery_t *file_recovery)
+{
+  FILE *handle=file_recovery->handle;
+  if(!file_write_deferred() || file_recovery->content==NULL ||
+      file_recovery->content_size==0)
   {
-    alloc_list_t *allocated_space;
-    allocated_space=td_list_entry(tmp, alloc_list_t, list);
-    free_list_allocation_end=allocated_space->end;
-    td_list_del(tmp);
-    free(allocated_space);
+    file_recovery->file_check(file_recovery);
+    return ;
   }
+#ifdef HAVE_FMEMOPEN
+  file_recovery->handle=fmemopen(file_recovery->content, file_recovery->content_size, "rb");
+  if(file_recovery->handle!=NULL)
+  {
+    file_recovery->file_check(file_recovery);
+    fclose(file_recovery->handle);
+    file_recovery->handle=handle;
+    return ;
+  }
+  file_recovery->handle=handle;
+#endif
+  if(file_content_flush(file_recovery, file_recovery->content_size) < 0)
+    log_critical("Cannot write to file %s: %s\n", file_recovery->filename, strerror(errno));
+  file_recovery->file_check(file_recovery);
 }
-/* file_finish_aux()
+
+/* file_finish_check()
     @param file_recovery - handle!=NULL
-    @param struct ph_param *params
+    @param const struct ph_param *params
+    Check, truncate and close the recovered file, params is not modified
 */
 
-static void file_finish_aux(file_recovery_t *file_recovery, struct ph_param *params, const int paranoid)
+static void file_finish_check(file_recovery_t *file_recovery, const struct ph_param *params, const int paranoid)
 {
   if(params->status!=STATUS_EXT2_ON_SAVE_EVERYTHING &&
       params->status!=STATUS_EXT2_OFF_SAVE_EVERYTHING)
   {
     if(file_recovery->file_stat!=NULL && file_recovery->file_check!=NULL && paranoid>0)
     { /* Check if recovered file is valid */
-      file_recovery->file_check(file_recovery);
+      file_check_run(file_recovery);
     }
     /* FIXME: need to adapt read_size to volume size to avoid this */
     if(file_recovery->file_size > params->disk->disk_size)
@@ -603,15 +663,38 @@ static void file_finish_aux(file_recovery_t *file_recovery, struct ph_param *par
       file_recovery->file_size_on_disk=0;
     }
   }
+  file_hash_finish(file_recovery);
   if(file_recovery->file_size==0)
   {
     fclose(file_recovery->handle);
     file_recovery->handle=NULL;
     /* File is zero-length; erase it */
+    if(!index_enabled())
+      unlink(file_recovery->filename);
+  }
+  else if(index_enabled())
+  {
+    /* Index only, nothing has been written to recup_dir */
+    fclose(file_recovery->handle);
+    file_recovery->handle=NULL;
+  }
+  else if(dedup_enabled() && file_recovery->content!=NULL &&
+      (file_recovery->duplicate_of=dedup_lookup(file_recovery))!=NULL)
+  {
+    /* Same content as a file already recovered, the file kept in memory
+     * isn't written */
+    log_info("%s\tduplicate of %s\n", file_recovery->filename, file_recovery->duplicate_of);
+    fclose(file_recovery->handle);
+    file_recovery->handle=NULL;
     unlink(file_recovery->filename);
   }
   else
   {
+    const int in_memory=(file_write_deferred() && file_recovery->content!=NULL);
+    if(in_memory &&
+	file_content_flush(file_recovery, (file_recovery->file_size < file_recovery->content_size ?
+	    file_recovery->file_size : file_recovery->content_size)) < 0)
+      log_critical("Cannot write to file %s: %s\n", file_recovery->filename, strerror(errno));
 #ifdef HAVE_FTRUNCATE
     fflush(file_recovery->handle);
     if(ftruncate(fileno(file_recovery->handle), file_recovery->file_size)<0)
@@ -624,17 +707,426 @@ static void file_finish_aux(file_recovery_t *file_recovery, struct ph_param *par
     if(file_recovery->time!=0 && file_recovery->time!=(time_t)-1)
       set_date(file_recovery->filename, file_recovery->time, file_recovery->time);
     if(file_recovery->file_rename!=NULL)
-      file_recovery->file_rename(file_recovery->filename);
-    if((++params->file_nbr)%MAX_FILES_PER_DIR==0)
+      file_recovery->file_rename(file_recovery);
+    /* Once renamed, the store refers to the file under its final name */
+    if(in_memory==0 &&
+	(file_recovery->duplicate_of=dedup_lookup(file_recovery))!=NULL)
     {
-      params->dir_num=photorec_mkdir(params->recup_dir, params->dir_num+1);
+      /* Too big to be kept in memory, the duplicate has been written */
+      log_info("%s\tduplicate of %s\n", file_recovery->filename, file_recovery->duplicate_of);
+      unlink(file_recovery->filename);
     }
+    else
+      dedup_add(file_recovery);
+  }
+  file_content_free(file_recovery);
+}
+
+void photorec_dest_filename(char *filename, const unsigned int size, const char *recup_dir, const char *name)
+{
+  const char *sep=strrchr(recup_dir, '/');
+  if(sep==NULL)
+    snprintf(filename, size, "%s", name);
+  else
+    snprintf(filename, size, "%.*s%s", (int)(sep - recup_dir + 1), recup_dir, name);
+}
+
+/* Digests of the recovered files, in the format of md5sum and sha256sum.
+ * File names are relative to the directory holding recup_dir.N */
+static FILE *manifest_md5=NULL;
+static FILE *manifest_sha256=NULL;
+static unsigned int manifest_prefix_len=0;
+
+void manifest_open(const char *recup_dir, const unsigned int dir_num)
+{
+  char filename[2048];
+  const char *sep=strrchr(recup_dir, '/');
+  manifest_prefix_len=(sep==NULL ? 0 : sep - recup_dir + 1);
+  snprintf(filename, sizeof(filename), "%s.%u/photorec.md5", recup_dir, dir_num);
+  manifest_md5=fopen(filename, "w");
+  if(manifest_md5==NULL)
+    log_error("Cannot create %s: %s\n", filename, strerror(errno));
+  snprintf(filename, sizeof(filename), "%s.%u/photorec.sha256", recup_dir, dir_num);
+  manifest_sha256=fopen(filename, "w");
+  if(manifest_sha256==NULL)
+    log_error("Cannot create %s: %s\n", filename, strerror(errno));
+}
+
+void manifest_close(void)
+{
+  if(manifest_md5!=NULL)
+    fclose(manifest_md5);
+  if(manifest_sha256!=NULL)
+    fclose(manifest_sha256);
+  manifest_md5=NULL;
+  manifest_sha256=NULL;
+}
+
+static void manifest_log_file_recovered(const file_recovery_t *file_recovery)
+{
+  char hex[2*SHA256_DIGEST_SIZE+1];
+  const char *name=file_recovery->filename;
+  if(file_recovery->digest_ok==0 || file_recovery->duplicate_of!=NULL)
+    return ;
+  if(strlen(name) > manifest_prefix_len)
+    name+=manifest_prefix_len;
+  if(manifest_md5!=NULL)
+  {
+    hash_to_hex(hex, file_recovery->md5, MD5_DIGEST_SIZE);
+    fprintf(manifest_md5, "%s  %s\n", hex, name);
+  }
+  if(manifest_sha256!=NULL)
+  {
+    hash_to_hex(hex, file_recovery->sha256, SHA256_DIGEST_SIZE);
+    fprintf(manifest_sha256, "%s  %s\n", hex, name);
+  }
+}
+
+static unsigned int file_index_flags(const file_recovery_t *file_recovery, const struct ph_param *params, const int paranoid, const uint64_t file_size)
+{
+  unsigned int flags=0;
+  if(params->status!=STATUS_EXT2_ON_SAVE_EVERYTHING &&
+      params->status!=STATUS_EXT2_OFF_SAVE_EVERYTHING &&
+      file_recovery->file_check!=NULL && paranoid>0)
+    flags|=PHINDEX_CHECKED;
+  if(file_recovery->file_size < file_size)
+    flags|=PHINDEX_TRUNCATED;
+  return flags;
+}
+
+static void file_finish_count(struct ph_param *params)
+{
+  if((++params->file_nbr)%MAX_FILES_PER_DIR==0)
+  {
+    params->dir_num=photorec_mkdir(params->recup_dir, params->dir_num+1);
+  }
+}
+
+/* file_finish_aux()
+    @param file_recovery - handle!=NULL
+    @param struct ph_param *params
+*/
+
+static void file_finish_aux(file_recovery_t *file_recovery, struct ph_param *params, const int paranoid)
+{
+  file_finish_check(file_recovery, params, paranoid);
+  if(file_recovery->file_size>0)
+  {
+    file_finish_count(params);
     if(params->status!=STATUS_EXT2_ON_SAVE_EVERYTHING &&
 	params->status!=STATUS_EXT2_OFF_SAVE_EVERYTHING)
       file_recovery->file_stat->recovered++;
   }
 }
 
+/* search_space_add()
+   Give back [start-end] to the sorted search space, pos is a hint
+   where to start looking for the insertion point.
+*/
+static struct td_list_head *search_space_add(alloc_data_t *list_search_space, struct td_list_head *pos, const uint64_t start, const uint64_t end, file_stat_t *file_stat, const unsigned int data)
+{
+  alloc_data_t *new_space;
+  if(pos!=&list_search_space->list &&
+      td_list_entry(pos, alloc_data_t, list)->start > start)
+    pos=&list_search_space->list;
+  while(pos->next!=&list_search_space->list &&
+      td_list_entry(pos->next, alloc_data_t, list)->start < start)
+    pos=pos->next;
+  new_space=(alloc_data_t*)pool_alloc(&alloc_data_pool);
+  new_space->start=start;
+  new_space->end=end;
+  new_space->file_stat=file_stat;
+  new_space->data=data;
+  td_list_add(&new_space->list, pos);
+  return &new_space->list;
+}
+
+void search_space_merge(alloc_data_t *list_search_space, alloc_data_t *list_to_merge)
+{
+  struct td_list_head *pos=&list_search_space->list;
+  struct td_list_head *tmp;
+  struct td_list_head *next;
+  td_list_for_each_safe(tmp, next, &list_to_merge->list)
+  {
+    alloc_data_t *element=td_list_entry(tmp, alloc_data_t, list);
+    if(pos!=&list_search_space->list &&
+	td_list_entry(pos, alloc_data_t, list)->start > element->start)
+      pos=&list_search_space->list;
+    while(pos->next!=&list_search_space->list &&
+	td_list_entry(pos->next, alloc_data_t, list)->start < element->start)
+      pos=pos->next;
+    td_list_del(tmp);
+    td_list_add(tmp, pos);
+    pos=tmp;
+  }
+}
+
+#ifdef HAVE_PTHREAD
+/* Deferred file_check(): once the last block of a file has been written,
+ * the file is handed to a pool of threads that validate, truncate and
+ * close it while the disk is being read. The blocks used by the file
+ * are removed from the search space at once; they are given back,
+ * sorted by offset, when the pass ends. */
+#define DEFERRED_CHECK_MAX_THREADS	8
+
+typedef struct
+{
+  struct td_list_head list;
+  file_recovery_t file_recovery;	/* location holds the blocks used by the file */
+  uint64_t file_size;			/* size before file_check() */
+} deferred_check_t;
+
+static pthread_mutex_t deferred_mutex=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t deferred_cond_todo=PTHREAD_COND_INITIALIZER;
+static pthread_cond_t deferred_cond_done=PTHREAD_COND_INITIALIZER;
+static TD_LIST_HEAD(deferred_todo);
+static TD_LIST_HEAD(deferred_done);
+static pthread_t deferred_threads[DEFERRED_CHECK_MAX_THREADS];
+static unsigned int deferred_thread_id[DEFERRED_CHECK_MAX_THREADS];
+static void (*deferred_running[DEFERRED_CHECK_MAX_THREADS])(file_recovery_t *file_recovery);
+static unsigned int deferred_nbr_threads=0;
+static unsigned int deferred_pending=0;
+static unsigned int deferred_rejected=0;
+static int deferred_stop=0;
+static const struct ph_param *deferred_params=NULL;
+static int deferred_paranoid=1;
+
+static int deferred_check_cmp(const struct td_list_head *a, const struct td_list_head *b)
+{
+  const deferred_check_t *job_a=td_list_entry_const(a, const deferred_check_t, list);
+  const deferred_check_t *job_b=td_list_entry_const(b, const deferred_check_t, list);
+  if(job_a->file_recovery.location.start < job_b->file_recovery.location.start)
+    return -1;
+  if(job_a->file_recovery.location.start > job_b->file_recovery.location.start)
+    return 1;
+  return 0;
+}
+
+/* The file handlers keep their state in per-thread contexts, but a
+ * file_check() may be shared by several file types (file_check_tiff is
+ * used for tiff, orf, rw2...): a given file_check() is never run by two
+ * threads at the same time */
+static deferred_check_t *deferred_check_get(const unsigned int id)
+{
+  struct td_list_head *tmp;
+  td_list_for_each(tmp, &deferred_todo)
+  {
+    deferred_check_t *job=td_list_entry(tmp, deferred_check_t, list);
+    unsigned int i=deferred_nbr_threads;
+    if(job->file_recovery.file_check!=NULL)
+      for(i=0; i<deferred_nbr_threads && deferred_running[i]!=job->file_recovery.file_check; i++);
+    if(i==deferred_nbr_threads)
+    {
+      td_list_del(tmp);
+      deferred_running[id]=job->file_recovery.file_check;
+      return job;
+    }
+  }
+  return NULL;
+}
+
+static void *deferred_check_worker(void *arg)
+{
+  const unsigned int id=*(const unsigned int *)arg;
+  pthread_mutex_lock(&deferred_mutex);
+  while(1)
+  {
+    deferred_check_t *job=deferred_check_get(id);
+    if(job==NULL)
+    {
+      if(deferred_stop>0 && td_list_empty(&deferred_todo))
+	break;
+      pthread_cond_wait(&deferred_cond_todo, &deferred_mutex);
+    }
+    else
+    {
+      pthread_mutex_unlock(&deferred_mutex);
+      file_finish_check(&job->file_recovery, deferred_params, deferred_paranoid);
+      pthread_mutex_lock(&deferred_mutex);
+      deferred_running[id]=NULL;
+      if(job->file_recovery.file_size==0)
+	deferred_rejected++;
+      td_list_add_sorted(&job->list, &deferred_done, deferred_check_cmp);
+      deferred_pending--;
+      pthread_cond_broadcast(&deferred_cond_todo);
+      pthread_cond_signal(&deferred_cond_done);
+    }
+  }
+  pthread_mutex_unlock(&deferred_mutex);
+  return NULL;
+}
+
+static int deferred_check_start(const struct ph_param *params, const int paranoid)
+{
+  unsigned int nbr_threads=1;
+  if(deferred_nbr_threads>0)
+    return 0;
+#ifdef _SC_NPROCESSORS_ONLN
+  {
+    const long nbr_cpu=sysconf(_SC_NPROCESSORS_ONLN);
+    /* Keep a processor for the thread reading the disk */
+    if(nbr_cpu > DEFERRED_CHECK_MAX_THREADS)
+      nbr_threads=DEFERRED_CHECK_MAX_THREADS;
+    else if(nbr_cpu > 2)
+      nbr_threads=nbr_cpu-1;
+  }
+#endif
+  deferred_params=params;
+  deferred_paranoid=paranoid;
+  deferred_stop=0;
+  for(deferred_nbr_threads=0; deferred_nbr_threads<nbr_threads; deferred_nbr_threads++)
+  {
+    deferred_thread_id[deferred_nbr_threads]=deferred_nbr_threads;
+    deferred_running[deferred_nbr_threads]=NULL;
+    if(pthread_create(&deferred_threads[deferred_nbr_threads], NULL,
+	  deferred_check_worker, &deferred_thread_id[deferred_nbr_threads])!=0)
+      break;
+  }
+  if(deferred_nbr_threads==0)
+  {
+    log_error("Cannot create thread, files will be checked immediately\n");
+    return -1;
+  }
+  return 0;
+}
+
+/* file_finish_deferred()
+   @returns
+   0: file_check() must be done by the caller
+   1: file has been queued
+*/
+static int file_finish_deferred(file_recovery_t *file_recovery, struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space, alloc_data_t **current_search_space, uint64_t *offset)
+{
+  deferred_check_t *job;
+  if(deferred_check_start(params, options->paranoid) < 0)
+    return 0;
+  job=(deferred_check_t *)MALLOC(sizeof(*job));
+  memcpy(&job->file_recovery, file_recovery, sizeof(job->file_recovery));
+  alloc_list_init(&job->file_recovery.location);
+  job->file_recovery.loc=NULL;
+  job->file_size=file_recovery->file_size;
+  *current_search_space=file_truncate(list_search_space, file_recovery, params->disk->sector_size, params->blocksize, &job->file_recovery.location);
+  *offset=(*current_search_space)->start;
+  file_recovery->handle=NULL;
+  file_recovery->content=NULL;
+  file_recovery->hash=NULL;
+  pthread_mutex_lock(&deferred_mutex);
+  /* Limit the number of files opened */
+  while(deferred_pending >= 4*deferred_nbr_threads)
+    pthread_cond_wait(&deferred_cond_done, &deferred_mutex);
+  /* Files rejected since aren't counted when file_finish_count() checks
+   * if a new recup_dir is needed */
+  params->file_nbr-=deferred_rejected;
+  deferred_rejected=0;
+  td_list_add_tail(&job->list, &deferred_todo);
+  deferred_pending++;
+  pthread_cond_broadcast(&deferred_cond_todo);
+  pthread_mutex_unlock(&deferred_mutex);
+  file_finish_count(params);
+  return 1;
+}
+
+static void file_finish_deferred_result(deferred_check_t *job, struct ph_param *params, alloc_data_t *list_search_space, struct td_list_head **pos_search_space, alloc_data_t *list_rescan, struct td_list_head **pos_rescan)
+{
+  file_recovery_t *file_recovery=&job->file_recovery;
+  const uint64_t file_size_on_disk=(file_recovery->file_size+params->blocksize-1)/params->blocksize*params->blocksize;
+  /* Like file_error(), a rejected file is scanned again from offset_error */
+  const uint64_t offset_error_on_disk=(file_recovery->file_size==0 ?
+      file_recovery->offset_error/params->blocksize*params->blocksize : 0);
+  unsigned int i;
+  if(file_recovery->file_size==0)
+    log_info("%s\trejected\n", file_recovery->filename);
+  else
+  {
+    if(file_recovery->file_size < job->file_size)
+      log_info("%s\ttruncated to %llu bytes\n", file_recovery->filename,
+	  (long long unsigned)file_recovery->file_size);
+    file_recovery->file_stat->recovered++;
+  }
+  for(i=0; i<file_recovery->location.nbr; i++)
+  {
+    const alloc_extent_t *element=&file_recovery->location.extents[i];
+    if(offset_error_on_disk>0 && element->file_offset >= offset_error_on_disk)
+    {
+      *pos_rescan=search_space_add(list_rescan, *pos_rescan,
+	  element->start, element->end, NULL, element->data);
+    }
+    else if(offset_error_on_disk>0 && element->data>0 &&
+	element->file_offset + element->end - element->start + 1 > offset_error_on_disk)
+    {
+      const uint64_t split=element->start + offset_error_on_disk - element->file_offset;
+      *pos_search_space=search_space_add(list_search_space, *pos_search_space,
+	  element->start, split - 1,
+	  (element->start==file_recovery->location.start ? file_recovery->file_stat : NULL),
+	  element->data);
+      *pos_rescan=search_space_add(list_rescan, *pos_rescan,
+	  split, element->end, NULL, element->data);
+    }
+    else if(file_recovery->file_size==0)
+    {
+      /* File hasn't been sucessfully recovered, remember where it begins */
+      *pos_search_space=search_space_add(list_search_space, *pos_search_space,
+	  element->start, element->end,
+	  (element->start==file_recovery->location.start ? file_recovery->file_stat : NULL),
+	  element->data);
+    }
+    else if(element->file_offset >= file_size_on_disk)
+    {
+      *pos_rescan=search_space_add(list_rescan, *pos_rescan,
+	  element->start, element->end, NULL, element->data);
+    }
+    else if(element->data>0 &&
+	element->file_offset + element->end - element->start + 1 > file_size_on_disk)
+    {
+      *pos_rescan=search_space_add(list_rescan, *pos_rescan,
+	  element->start + file_size_on_disk - element->file_offset, element->end, NULL, 1);
+    }
+  }
+  if(file_recovery->file_size>0)
+  {
+    list_truncate(&file_recovery->location, file_recovery->file_size);
+#ifdef ENABLE_DFXML
+    xml_log_file_recovered(file_recovery);
+#endif
+    manifest_log_file_recovered(file_recovery);
+    index_log_file_recovered(file_recovery,
+	file_index_flags(file_recovery, params, deferred_paranoid, job->file_size));
+  }
+  alloc_list_free(&file_recovery->location);
+}
+
+void file_finish_deferred_wait(struct ph_param *params, alloc_data_t *list_search_space, alloc_data_t *list_rescan)
+{
+  struct td_list_head *pos_search_space=&list_search_space->list;
+  struct td_list_head *pos_rescan=&list_rescan->list;
+  struct td_list_head *tmp;
+  struct td_list_head *next;
+  unsigned int i;
+  if(deferred_nbr_threads==0)
+    return ;
+  pthread_mutex_lock(&deferred_mutex);
+  deferred_stop=1;
+  pthread_cond_broadcast(&deferred_cond_todo);
+  pthread_mutex_unlock(&deferred_mutex);
+  for(i=0; i<deferred_nbr_threads; i++)
+    pthread_join(deferred_threads[i], NULL);
+  deferred_nbr_threads=0;
+  params->file_nbr-=deferred_rejected;
+  deferred_rejected=0;
+  td_list_for_each_safe(tmp, next, &deferred_done)
+  {
+    deferred_check_t *job=td_list_entry(tmp, deferred_check_t, list);
+    file_finish_deferred_result(job, params, list_search_space, &pos_search_space, list_rescan, &pos_rescan);
+    td_list_del(tmp);
+    free(job);
+  }
+}
+#else
+void file_finish_deferred_wait(struct ph_param *params, alloc_data_t *list_search_space, alloc_data_t *list_rescan)
+{
+}
+#endif
+
 /** file_finish()
     @param file_recovery - 
     @param struct ph_param *params
@@ -652,6 +1144,7 @@ int file_finish(file_recovery_t *file_recovery, struct ph_param *params,
     alloc_data_t *list_search_space, alloc_data_t **current_search_space, uint64_t *offset)
 {
   int file_recovered=0;
+  const uint64_t file_size=file_recovery->file_size;
 #ifdef DEBUG_FILE_FINISH
   log_debug("file_finish start %lu (%lu-%lu)\n", (long unsigned int)((*offset)/params->blocksize),
       (unsigned long int)((*current_search_space)->start/params->blocksize),
@@ -662,6 +1155,8 @@ int file_finish(file_recovery_t *file_recovery, struct ph_param *params,
 #endif
   if(file_recovery->handle)
     file_finish_aux(file_recovery, params, 1);
+  file_content_free(file_recovery);
+  file_hash_free(file_recovery);
   if(file_recovery->file_stat!=NULL)
   {
     list_truncate(&file_recovery->location,file_recovery->file_size);
@@ -679,6 +1174,8 @@ int file_finish(file_recovery_t *file_recovery, struct ph_param *params,
 #ifdef ENABLE_DFXML
       xml_log_file_recovered(file_recovery);
 #endif
+      manifest_log_file_recovered(file_recovery);
+      index_log_file_recovered(file_recovery, file_index_flags(file_recovery, params, 1, file_size));
       update_search_space(file_recovery, list_search_space, current_search_space, offset, params->blocksize);
       file_recovered=1;			/* note that file was recovered */
     }
@@ -713,13 +1210,29 @@ int file_finish(file_recovery_t *file_recovery, struct ph_param *params,
 int file_finish2(file_recovery_t *file_recovery, struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space, alloc_data_t **current_search_space, uint64_t *offset)
 {
   int file_recovered=0;
+  const uint64_t file_size=file_recovery->file_size;
 #ifdef DEBUG_FILE_FINISH
   log_debug("file_recovery->offset_error=%llu\n", (long long unsigned)file_recovery->offset_error);
   log_debug("file_recovery->handle %s NULL\n", (file_recovery->handle!=NULL?"!=":"=="));
   info_list_search_space(list_search_space, NULL, DEFAULT_SECTOR_SIZE, 0, 1);
+#endif
+#ifdef HAVE_PTHREAD
+  if(options->deferred_check>0 && options->paranoid>0 &&
+      file_recovery->handle!=NULL && file_recovery->file_stat!=NULL &&
+      file_recovery->file_size>0 &&
+      params->status!=STATUS_EXT2_ON_SAVE_EVERYTHING &&
+      params->status!=STATUS_EXT2_OFF_SAVE_EVERYTHING &&
+      file_finish_deferred(file_recovery, params, options, list_search_space, current_search_space, offset)>0)
+  {
+    free_list_allocation(&file_recovery->location);
+    reset_file_recovery(file_recovery);
+    return 1;
+  }
 #endif
   if(file_recovery->handle)
     file_finish_aux(file_recovery, params, options->paranoid);
+  file_content_free(file_recovery);
+  file_hash_free(file_recovery);
   if(file_recovery->file_stat!=NULL)
   {
     if(file_recovery->file_size==0)
@@ -741,7 +1254,10 @@ int file_finish2(file_recovery_t *file_recovery, struct ph_param *params, const
 #ifdef ENABLE_DFXML
       xml_log_file_recovered2(list_search_space, file_recovery);
 #endif
-      *current_search_space=file_truncate(list_search_space, file_recovery, params->disk->sector_size, params->blocksize);
+      manifest_log_file_recovered(file_recovery);
+      index_log_file_recovered2(list_search_space, file_recovery,
+	  file_index_flags(file_recovery, params, options->paranoid, file_size));
+      *current_search_space=file_truncate(list_search_space, file_recovery, params->disk->sector_size, params->blocksize, NULL);
       *offset=(*current_search_space)->start;
       file_recovered=1;
     }
@@ -790,7 +1306,13 @@ void info_list_search_space(const alloc_data_t *list_search_space, const alloc_d
       (keep_corrupted_file>0?"but saved":"and rejected"));
 }
 
-static alloc_data_t *file_truncate_aux(alloc_data_t *space, alloc_data_t *file, const uint64_t file_size, const unsigned int sector_size, const unsigned int blocksize)
+static void extent_add(alloc_list_t *extents, const uint64_t start, const uint64_t end, const unsigned int data)
+{
+  if(extents!=NULL)
+    list_append_block(extents, start, end - start + 1, data);
+}
+
+static alloc_data_t *file_truncate_aux(alloc_data_t *space, alloc_data_t *file, const uint64_t file_size, const unsigned int sector_size, const unsigned int blocksize, alloc_list_t *extents)
 {
   struct td_list_head *tmp;
   struct td_list_head *next;
@@ -808,14 +1330,16 @@ static alloc_data_t *file_truncate_aux(alloc_data_t *space, alloc_data_t *file,
       {
 	size+=len;
 	log_info(" %lu-%lu", (unsigned long)(element->start/sector_size), (unsigned long)(element->end/sector_size));
+	extent_add(extents, element->start, element->end, 1);
 	td_list_del(tmp);
-	free(element);
+	pool_free(&alloc_data_pool, tmp);
       }
       else
       {
 	log_info(" %lu-%lu",
 	    (unsigned long)(element->start/sector_size),
 	    (unsigned long)((element->start + file_size_on_disk - size - 1)/sector_size));
+	extent_add(extents, element->start, element->start + file_size_on_disk - size - 1, 1);
 	element->start+=file_size_on_disk - size;
 	element->file_stat=NULL;
 	element->data=1;
@@ -825,21 +1349,22 @@ static alloc_data_t *file_truncate_aux(alloc_data_t *space, alloc_data_t *file,
     else
     {
       log_info(" (%lu-%lu)", (unsigned long)(element->start/sector_size), (unsigned long)(element->end/sector_size));
+      extent_add(extents, element->start, element->end, 0);
       td_list_del(tmp);
-      free(element);
+      pool_free(&alloc_data_pool, tmp);
     }
   }
   return space;
 }
 
-static alloc_data_t *file_truncate(alloc_data_t *space, file_recovery_t *file, const unsigned int sector_size, const unsigned int blocksize)
+static alloc_data_t *file_truncate(alloc_data_t *space, file_recovery_t *file, const unsigned int sector_size, const unsigned int blocksize, alloc_list_t *extents)
 {
   alloc_data_t *datanext;
   if(file->filename!=NULL)
     log_info("%s\t", file->filename);
   else
     log_info("?\t");
-  datanext=file_truncate_aux(space, file->loc, file->file_size, sector_size, blocksize);
+  datanext=file_truncate_aux(space, file->loc, file->file_size, sector_size, blocksize, extents);
   log_info("\n");
   return datanext;
 }
@@ -878,7 +1403,7 @@ static alloc_data_t *file_error_aux(alloc_data_t *space, alloc_data_t *file, con
 	}
 	{
 	  alloc_data_t *new_element;
-	  new_element=(alloc_data_t*)MALLOC(sizeof(*new_element));
+	  new_element=(alloc_data_t*)pool_alloc(&alloc_data_pool);
 	  memcpy(new_element, element, sizeof(*new_element));
 	  new_element->start+=file_size_on_disk - size;
 	  new_element->file_stat=NULL;
@@ -899,15 +1424,7 @@ static alloc_data_t *file_error(alloc_data_t *space, file_recovery_t *file, cons
 
 void free_search_space(alloc_data_t *list_search_space)
 {
-  struct td_list_head *search_walker = NULL;
-  struct td_list_head *search_walker_next = NULL;
-  td_list_for_each_safe(search_walker,search_walker_next,&list_search_space->list)
-  {
-    alloc_data_t *current_search_space;
-    current_search_space=td_list_entry(search_walker, alloc_data_t, list);
-    td_list_del(search_walker);
-    free(current_search_space);
-  }
+  pool_free_list(&alloc_data_pool, &list_search_space->list);
 }
 
 void set_filename(file_recovery_t *file_recovery, struct ph_param *params)
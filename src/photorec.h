@@ -34,6 +34,12 @@ struct ph_options
   unsigned int mode_ext2;
   unsigned int expert;
   unsigned int lowmem;
+  unsigned int deferred_check;
+  unsigned int verify_crc;
+  unsigned int fast_forward;
+  unsigned int index_only;
+  unsigned int hash;
+  unsigned int dedup;
   int verbose;
   file_enable_t *list_file_format;
 };
@@ -60,6 +66,8 @@ int get_prev_file_header(alloc_data_t *list_search_space, alloc_data_t **current
 int file_finish(file_recovery_t *file_recovery, struct ph_param *params, 
     alloc_data_t *list_search_space, alloc_data_t **current_search_space, uint64_t *offset);
 int file_finish2(file_recovery_t *file_recovery, struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space, alloc_data_t **current_search_space, uint64_t *offset);
+void file_finish_deferred_wait(struct ph_param *params, alloc_data_t *list_search_space, alloc_data_t *list_rescan);
+void search_space_merge(alloc_data_t *list_search_space, alloc_data_t *list_to_merge);
 void write_stats_log(const file_stat_t *file_stats);
 void write_stats_stdout(const file_stat_t *file_stats);
 void update_stats(file_stat_t *file_stats, alloc_data_t *list_search_space);
@@ -75,7 +83,16 @@ unsigned int photorec_mkdir(const char *recup_dir, const unsigned int initial_di
 void info_list_search_space(const alloc_data_t *list_search_space, const alloc_data_t *current_search_space, const unsigned int sector_size, const int keep_corrupted_file, const int verbose);
 void free_search_space(alloc_data_t *list_search_space);
 void set_filename(file_recovery_t *file_recovery, struct ph_param *params);
+size_t file_fwrite(file_recovery_t *file_recovery, const unsigned char *buffer, const unsigned int size);
+/* file_check_run()
+ * Run file_check(), on the content in memory for a file not written yet */
+void file_check_run(file_recovery_t *file_recovery);
 uint64_t set_search_start(struct ph_param *params, alloc_data_t **new_current_search_space, alloc_data_t *list_search_space);
+/* photorec_dest_filename()
+ * filename is set to name in the directory holding recup_dir.N */
+void photorec_dest_filename(char *filename, const unsigned int size, const char *recup_dir, const char *name);
+void manifest_open(const char *recup_dir, const unsigned int dir_num);
+void manifest_close(void);
 #ifdef __cplusplus
 } /* closing brace for extern "C" */
 #endif
@@ -77,10 +77,14 @@
 #include "phbs.h"
 #include "file_found.h"
 #include "dfxml.h"
+#include "preadsize.h"
+#include "phindex.h"
+#include "phdedup.h"
+#include "phcontrol.h"
+#include "hdthrottle.h"
 
 /* #define DEBUG */
 /* #define DEBUG_BF */
-#define READ_SIZE 1024*512
 #define DEFAULT_IMAGE_NAME "image_remaining.dd"
 
 extern const file_hint_t file_hint_tar;
@@ -119,8 +123,9 @@ static inline int ind_block(const unsigned char *buffer, const unsigned int bloc
 static inline void file_recovery_cpy(file_recovery_t *dst, file_recovery_t *src)
 {
   memcpy(dst, src, sizeof(*dst));
-  dst->location.list.prev=&dst->location.list;
-  dst->location.list.next=&dst->location.list;
+  dst->location.extents=NULL;
+  dst->location.nbr=0;
+  dst->location.max=0;
 }
 
 /* ==================== INLINE FUNCTIONS ========================= */
@@ -165,7 +170,7 @@ static alloc_data_t *file_add_data(alloc_data_t *data, const uint64_t offset, co
   if(data->data==content)
     return data;
   {
-    alloc_data_t *datanext=(alloc_data_t*)MALLOC(sizeof(*datanext));
+    alloc_data_t *datanext=(alloc_data_t*)pool_alloc(&alloc_data_pool);
     memcpy(datanext, data, sizeof(*datanext));
     data->end=offset-1;
     datanext->start=offset;
@@ -176,6 +181,56 @@ static alloc_data_t *file_add_data(alloc_data_t *data, const uint64_t offset, co
   }
 }
 
+/* photorec_fwrite()
+ * The writes to the recovered files are throttled here, the blocks
+ * written again by the brute force of phbf.c aren't counted twice.
+ * @returns 1 on success, 0 on error like fwrite()
+ */
+static size_t photorec_fwrite(file_recovery_t *file_recovery, const unsigned char *buffer, const unsigned int size)
+{
+  if(file_fwrite(file_recovery, buffer, size)<1)
+    return 0;
+  /* Nothing is written to recup_dir in index only mode */
+  if(!index_enabled())
+    throttle_write(size);
+  return 1;
+}
+
+/* fast_forward_size()
+ * @param const file_recovery_t *file_recovery
+ * @param const struct ph_param *params
+ * @param const alloc_data_t *current_search_space
+ * @param const uint64_t offset
+ * @param const unsigned int available - bytes in the read buffer that can be consumed
+ *
+ * @returns the number of bytes starting at offset that lie inside the
+ * validated length of the file being recovered and can be written as is.
+ * The block reaching the end of this length is left to data_check.
+ */
+static unsigned int fast_forward_size(const file_recovery_t *file_recovery, const struct ph_param *params, const alloc_data_t *current_search_space, const uint64_t offset, const unsigned int available)
+{
+  const unsigned int blocksize=params->blocksize;
+  uint64_t end=file_recovery->trusted_size;
+  uint64_t size;
+  if(file_recovery->file_stat==NULL || file_recovery->handle==NULL ||
+      file_recovery->data_crc_offset!=0 ||
+      params->status==STATUS_EXT2_ON || params->status==STATUS_EXT2_ON_SAVE_EVERYTHING)
+    return 0;
+  if(file_recovery->file_stat->file_hint->max_filesize>0 &&
+      end > file_recovery->file_stat->file_hint->max_filesize)
+    end=file_recovery->file_stat->file_hint->max_filesize;
+  if(is_fat(params->partition) && end > PHOTOREC_MAX_SIZE_32 - blocksize)
+    end=PHOTOREC_MAX_SIZE_32 - blocksize;
+  if(file_recovery->file_size + blocksize >= end)
+    return 0;
+  size=(end - 1 - file_recovery->file_size) / blocksize * blocksize;
+  if(size > current_search_space->end - offset)
+    size=(current_search_space->end - offset) / blocksize * blocksize;
+  if(size > available)
+    size=available / blocksize * blocksize;
+  return size;
+}
+
 /* photorec_aux()
  * @param struct ph_param *params
  * @param const struct ph_options *options
@@ -195,18 +250,22 @@ static int photorec_aux(struct ph_param *params, const struct ph_options *option
   unsigned char *buffer_start;
   unsigned char *buffer_olddata;
   unsigned char *buffer;
+  unsigned char *buffer_end;
   time_t start_time;
   time_t previous_time;
   int ind_stop=0;
   unsigned int buffer_size;
   const unsigned int blocksize=params->blocksize; 
-  const unsigned int read_size=(blocksize>65536?blocksize:65536);
+  unsigned int read_size;
+  read_window_t read_window;
   alloc_data_t *current_search_space;
   file_recovery_t file_recovery;
   memset(&file_recovery, 0, sizeof(file_recovery));
   reset_file_recovery(&file_recovery);
   file_recovery.blocksize=blocksize;
-  buffer_size=blocksize + READ_SIZE;
+  read_window_init(&read_window, params->disk, blocksize, params->recup_dir);
+  read_size=read_window.lookahead;
+  buffer_size=blocksize + read_window.max_size;
   buffer_start=(unsigned char *)MALLOC(buffer_size);
   buffer_olddata=buffer_start;
   buffer=buffer_olddata+blocksize;
@@ -223,11 +282,41 @@ static int photorec_aux(struct ph_param *params, const struct ph_options *option
 	(unsigned long long)((offset-params->partition->part_offset)/params->disk->sector_size),
 	(unsigned long long)((params->partition->part_size-1)/params->disk->sector_size));
   }
-  params->disk->pread(params->disk, buffer, READ_SIZE, offset);
+  read_window_pread(&read_window, params->disk, buffer, offset, 0);
+  buffer_end=buffer+read_window.size;
   while(current_search_space!=list_search_space)
   {
     int file_recovered=0;
     uint64_t old_offset=offset;
+    if(options->fast_forward>0 && file_recovery.trusted_size > 0)
+    {
+      /* Copy the payload of a validated length as a whole, the next block
+       * goes through the normal header and data checks */
+      const unsigned int size=fast_forward_size(&file_recovery, params, current_search_space,
+	  offset, buffer_end - buffer - read_size);
+      if(size > 0 && photorec_fwrite(&file_recovery, buffer, size)<1)
+      {
+	/* Let the normal path report the error */
+	if(fseek(file_recovery.handle, file_recovery.file_size, SEEK_SET)<0)
+	  log_critical("Cannot seek in file %s: %s\n", file_recovery.filename, strerror(errno));
+      }
+      else if(size > 0)
+      {
+	if(options->verbose > 1)
+	{
+	  log_verbose("Fast forward %s from sector %lu, %u bytes\n", file_recovery.filename,
+	      (unsigned long)((offset-params->partition->part_offset)/params->disk->sector_size), size);
+	}
+	file_content_append(&file_recovery, buffer, size);
+	current_search_space=file_add_data(current_search_space, offset, 1);
+	file_recovery.file_size+=size;
+	file_recovery.file_size_on_disk+=size;
+	offset+=size;
+	buffer+=size;
+	buffer_olddata=buffer-blocksize;
+	old_offset=offset;
+      }
+    }
 #ifdef DEBUG
     log_debug("sector %llu\n",
         (unsigned long long)((offset-params->partition->part_offset)/params->disk->sector_size));
@@ -270,7 +359,7 @@ static int photorec_aux(struct ph_param *params, const struct ph_options *option
 	  {
 	    const file_check_t *file_check=td_list_entry(tmp, file_check_t, list);
 	    if((file_check->length==0 || memcmp(buffer + file_check->offset, file_check->value, file_check->length)==0) &&
-		file_check->header_check(buffer, read_size, 0, &file_recovery, &file_recovery_new)!=0)
+		file_check_header(file_check, buffer, read_size, 0, &file_recovery, &file_recovery_new)!=0)
 	    {
 	      file_recovery_new.file_stat=file_check->file_stat;
 	      break;
@@ -284,6 +373,7 @@ static int photorec_aux(struct ph_param *params, const struct ph_options *option
 	  current_search_space=file_found(current_search_space, offset, file_recovery_new.file_stat);
 	  file_recovery_new.loc=current_search_space;
 	  file_recovery_new.location.start=offset;
+	  file_recovery_new.verify_crc=options->verify_crc;
           if(options->verbose > 1)
             log_trace("A known header has been found, recovery of the previous file is finished\n");
 	  {
@@ -328,7 +418,7 @@ static int photorec_aux(struct ph_param *params, const struct ph_options *option
 #if defined(__CYGWIN__) || defined(__MINGW32__)
           file_recovery.handle=fopen_with_retry(file_recovery.filename,"w+b");
 #else
-          file_recovery.handle=fopen(file_recovery.filename,"w+b");
+          file_recovery.handle=index_fopen(file_recovery.filename);
 #endif
           if(!file_recovery.handle)
           { 
@@ -361,7 +451,7 @@ static int photorec_aux(struct ph_param *params, const struct ph_options *option
       {
 	if(file_recovery.handle!=NULL)
 	{
-	  if(fwrite(buffer,blocksize,1,file_recovery.handle)<1)
+	  if(photorec_fwrite(&file_recovery, buffer, blocksize)<1)
 	  { 
 	    log_critical("Cannot write to file %s: %s\n", file_recovery.filename, strerror(errno));
 	    if(errno==EFBIG)
@@ -376,6 +466,8 @@ static int photorec_aux(struct ph_param *params, const struct ph_options *option
 	      params->offset=file_recovery.location.start;
 	    }
 	  }
+	  else
+	    file_content_append(&file_recovery, buffer, blocksize);
 	}
 	if(ind_stop==0)
 	{
@@ -441,8 +533,9 @@ static int photorec_aux(struct ph_param *params, const struct ph_options *option
     buffer+=blocksize;
     if(file_recovered==1 ||
         old_offset+blocksize!=offset ||
-        buffer+read_size>buffer_start+buffer_size)
+        buffer+read_size>buffer_end)
     {
+      const int sequential=(file_recovered!=1 && old_offset+blocksize==offset);
       if(file_recovered==1)
         memset(buffer_start,0,blocksize);
       else
@@ -455,7 +548,7 @@ static int photorec_aux(struct ph_param *params, const struct ph_options *option
 	    (unsigned long long)((offset-params->partition->part_offset)/params->disk->sector_size),
 	    (unsigned long long)((params->partition->part_size-1)/params->disk->sector_size));
       }
-      if(params->disk->pread(params->disk, buffer, READ_SIZE, offset) != READ_SIZE)
+      if(read_window_pread(&read_window, params->disk, buffer, offset, sequential) != (int)read_window.size)
       {
 #ifdef HAVE_NCURSES
 	wmove(stdscr,11,0);
@@ -464,7 +557,7 @@ static int photorec_aux(struct ph_param *params, const struct ph_options *option
 	    (unsigned long)((offset-params->partition->part_offset)/params->disk->sector_size));
 #endif
       }
-#ifdef HAVE_NCURSES
+      buffer_end=buffer+read_window.size;
       if(ind_stop==0)
       {
         time_t current_time;
@@ -472,17 +565,37 @@ static int photorec_aux(struct ph_param *params, const struct ph_options *option
         if(current_time>previous_time)
         {
           previous_time=current_time;
+#ifdef HAVE_NCURSES
           ind_stop=photorec_progressbar(stdscr, params->pass, params, offset, current_time);
+#endif
 	  if(file_recovery.file_stat!=NULL)
 	    params->offset=file_recovery.location.start;
 	  else
 	    params->offset=offset;
+	  /* Files still checked by other threads may give back some space,
+	   * the checkpoints are then delayed to the end of the pass */
+	  if(ind_stop==0)
+	    ind_stop=control_poll(params, offset, options->deferred_check==0);
         }
       }
-#endif
     }
   } /* end while(current_search_space!=list_search_space) */
   free(buffer_start);
+  read_window_save(&read_window, params->disk);
+  if(options->deferred_check>0)
+  {
+    alloc_data_t list_rescan;
+    TD_INIT_LIST_HEAD(&list_rescan.list);
+    file_finish_deferred_wait(params, list_search_space, &list_rescan);
+    if(ind_stop==0 && !td_list_empty(&list_rescan.list))
+    {
+      /* The data following the end of truncated files hasn't been read yet,
+       * rejected files are scanned again from their offset_error */
+      params->offset=(td_list_entry(list_rescan.list.next, alloc_data_t, list))->start;
+      ind_stop=photorec_aux(params, options, &list_rescan);
+    }
+    search_space_merge(list_search_space, &list_rescan);
+  }
 #ifdef HAVE_NCURSES
   photorec_info(stdscr, params->file_stats);
 #endif
@@ -631,26 +744,6 @@ static void gen_image(const char *filename, disk_t *disk, const alloc_data_t *li
 }
 
 #if 0
-static inline void list_append_block(alloc_list_t *list, const uint64_t offset, const uint64_t blocksize, const unsigned int data)
-{
-  if(!td_list_empty(&list->list))
-  {
-    alloc_list_t *prev=td_list_entry(list->list.prev, alloc_list_t, list);
-    if(prev->end+1==offset && prev->data==data)
-    {
-      prev->end=offset+blocksize-1;
-      return ;
-    }
-  }
-  {
-    alloc_list_t *new_list=(alloc_list_t *)MALLOC(sizeof(*new_list));
-    new_list->start=offset;
-    new_list->end=offset+blocksize-1;
-    new_list->data=data;
-    td_list_add_tail(&new_list->list, &list->list);
-  }
-}
-
 static void test_files_aux(file_recovery_t *file_recovery, struct ph_param *params, const uint64_t start, const uint64_t end)
 {
   uint64_t datasize=end-start+1;
@@ -667,7 +760,7 @@ static void test_files_aux(file_recovery_t *file_recovery, struct ph_param *para
       {
 	const file_check_t *file_check=td_list_entry(tmp, file_check_t, list);
 	if((file_check->length==0 || memcmp(buffer + file_check->offset, file_check->value, file_check->length)==0) &&
-	    file_check->header_check(buffer, datasize, 0, file_recovery, file_recovery)!=0)
+	    file_check_header(file_check, buffer, datasize, 0, file_recovery, file_recovery)!=0)
 	{
 	  file_recovery->file_stat=file_check->file_stat;
 	  break;
@@ -689,7 +782,7 @@ static void test_files_aux(file_recovery_t *file_recovery, struct ph_param *para
   if(file_recovery->handle==NULL)
   {
     set_filename(file_recovery, params);
-    file_recovery->handle=fopen(file_recovery->filename, "w+b");
+    file_recovery->handle=index_fopen(file_recovery->filename);
     if(file_recovery->handle==NULL)
     {
       log_critical("Cannot create file %s: %s\n", file_recovery->filename, strerror(errno));
@@ -697,7 +790,7 @@ static void test_files_aux(file_recovery_t *file_recovery, struct ph_param *para
       return;
     }
   }
-  if(fwrite(buffer, datasize, 1, file_recovery->handle)<1)
+  if(photorec_fwrite(file_recovery, buffer, datasize)<1)
   {
     log_critical("Cannot write to file %s: %s\n", file_recovery->filename, strerror(errno));
     fclose(file_recovery->handle);
@@ -705,6 +798,7 @@ static void test_files_aux(file_recovery_t *file_recovery, struct ph_param *para
     free(buffer);
     return;
   }
+  file_content_append(file_recovery, buffer, datasize);
   list_append_block(&file_recovery->location, start, datasize, 1);
   file_recovery->calculated_file_size=0;
   file_recovery->file_size+=datasize;
@@ -810,6 +904,14 @@ int photorec(struct ph_param *params, const struct ph_options *options, alloc_da
   xml_open(params->recup_dir, params->dir_num);
   xml_setup(params->disk, params->partition);
 #endif
+  if(options->index_only>0)
+    index_open(params->recup_dir, params->dir_num, params->disk);
+  file_hash_enable(options->hash || options->dedup);
+  if(options->hash>0)
+    manifest_open(params->recup_dir, params->dir_num);
+  if(options->dedup>0)
+    dedup_open(params->recup_dir);
+  control_session(list_search_space, options, carve_free_space_only);
   
   for(params->pass=0; params->status!=STATUS_QUIT; params->pass++)
   {
@@ -873,7 +975,9 @@ int photorec(struct ph_param *params, const struct ph_options *options, alloc_da
     {
       ind_stop=photorec_aux(params, options, list_search_space);
     }
-    session_save(list_search_space, params, options, carve_free_space_only);
+    if(ind_stop==0 && control_stop_requested())
+      ind_stop=1;
+    control_pass_end(params, session_save(list_search_space, params, options, carve_free_space_only));
 
     if(ind_stop==3)
     { /* no more space */
@@ -916,15 +1020,19 @@ int photorec(struct ph_param *params, const struct ph_options *options, alloc_da
       if(session_save(list_search_space, params, options, carve_free_space_only) < 0)
       {
 	/* Failed to save the session! */
+	if(control_stop_requested())
+	  params->status=STATUS_QUIT;
 #ifdef HAVE_NCURSES
-	if(ask_confirmation("PhotoRec has been unable to save its session status. Answer Y to really Quit, N to resume the recovery")!=0)
+	else if(ask_confirmation("PhotoRec has been unable to save its session status. Answer Y to really Quit, N to resume the recovery")!=0)
 	  params->status=STATUS_QUIT;
 #endif
       }
       else
       {
+	if(control_stop_requested())
+	  params->status=STATUS_QUIT;
 #ifdef HAVE_NCURSES
-	if(ask_confirmation("Answer Y to really Quit, N to resume the recovery")!=0)
+	else if(ask_confirmation("Answer Y to really Quit, N to resume the recovery")!=0)
 	  params->status=STATUS_QUIT;
 #endif
       }
@@ -1042,12 +1150,16 @@ int photorec(struct ph_param *params, const struct ph_options *options, alloc_da
   }
 #endif
   info_list_search_space(list_search_space, NULL, params->disk->sector_size, options->keep_corrupted_file, options->verbose);
+  index_log_file_rejected(list_search_space);
+  pool_log_stats(&alloc_data_pool, "Search space nodes");
   /* Free memory */
   free_search_space(list_search_space);
 #ifdef HAVE_NCURSES
   if(params->cmd_run==NULL)
     recovery_finished(params->disk, params->partition, params->file_nbr, params->recup_dir, ind_stop);
 #endif
+  control_finished(params, ind_stop);
+  control_session(NULL, NULL, 0);
   free(params->file_stats);
   params->file_stats=NULL;
   free_header_check();
@@ -1055,13 +1167,18 @@ int photorec(struct ph_param *params, const struct ph_options *options, alloc_da
   xml_shutdown();
   xml_close();
 #endif
+  index_close();
+  manifest_close();
+  /* Like photorec.ses, the store is removed once the recovery is complete */
+  dedup_close(ind_stop==0);
+  file_hash_enable(0);
   return 0;
 }
 
 #ifdef HAVE_NCURSES
 static void interface_options_photorec_ncurses(struct ph_options *options)
 {
-  unsigned int menu = 5;
+  unsigned int menu = 11;
   struct MenuItem menuOptions[]=
   {
     { 'P', NULL, "Check JPG files" },
@@ -1069,6 +1186,12 @@ static void interface_options_photorec_ncurses(struct ph_options *options)
     { 'S',NULL,"Try to skip indirect block"},
     { 'E',NULL,"Provide additional controls"},
     { 'L',NULL,"Low memory"},
+    { 'D',NULL,"Check files in background while reading the disk"},
+    { 'V',NULL,"Reject files whose embedded CRC doesn't match"},
+    { 'F',NULL,"Copy data inside a validated file length without checking it"},
+    { 'I',NULL,"List the files found in an index without writing them"},
+    { 'H',NULL,"Compute the MD5 and SHA-256 of the recovered files"},
+    { 'U',NULL,"Don't write a file identical to one already recovered"},
     { 'Q',"Quit","Return to main menu"},
     { 0, NULL, NULL }
   };
@@ -1092,8 +1215,14 @@ static void interface_options_photorec_ncurses(struct ph_options *options)
     menuOptions[2].name=options->mode_ext2?"ext2/ext3 mode: Yes":"ext2/ext3 mode : No";
     menuOptions[3].name=options->expert?"Expert mode : Yes":"Expert mode : No";
     menuOptions[4].name=options->lowmem?"Low memory: Yes":"Low memory: No";
+    menuOptions[5].name=options->deferred_check?"Deferred check: Yes":"Deferred check: No";
+    menuOptions[6].name=options->verify_crc?"Verify CRC: Yes":"Verify CRC: No";
+    menuOptions[7].name=options->fast_forward?"Fast forward: Yes":"Fast forward: No";
+    menuOptions[8].name=options->index_only?"Index only: Yes":"Index only: No";
+    menuOptions[9].name=options->hash?"Hash: Yes":"Hash: No";
+    menuOptions[10].name=options->dedup?"Skip duplicates: Yes":"Skip duplicates: No";
     aff_copy(stdscr);
-    car=wmenuSelect_ext(stdscr, 23, INTER_OPTION_Y, INTER_OPTION_X, menuOptions, 0, "PKELQ", MENU_VERT|MENU_VERT_ARROW2VALID, &menu,&real_key);
+    car=wmenuSelect_ext(stdscr, 23, INTER_OPTION_Y, INTER_OPTION_X, menuOptions, 0, "PKELDVFIHUQ", MENU_VERT|MENU_VERT_ARROW2VALID, &menu,&real_key);
     switch(car)
     {
       case 'p':
@@ -1119,6 +1248,30 @@ static void interface_options_photorec_ncurses(struct ph_options *options)
       case 'L':
 	options->lowmem=!options->lowmem;
 	break;
+      case 'd':
+      case 'D':
+	options->deferred_check=!options->deferred_check;
+	break;
+      case 'v':
+      case 'V':
+	options->verify_crc=!options->verify_crc;
+	break;
+      case 'f':
+      case 'F':
+	options->fast_forward=!options->fast_forward;
+	break;
+      case 'i':
+      case 'I':
+	options->index_only=!options->index_only;
+	break;
+      case 'h':
+      case 'H':
+	options->hash=!options->hash;
+	break;
+      case 'u':
+      case 'U':
+	options->dedup=!options->dedup;
+	break;
       case key_ESC:
       case 'q':
       case 'Q':
@@ -1182,6 +1335,42 @@ void interface_options_photorec(struct ph_options *options, char **current_cmd)
 	(*current_cmd)+=6;
 	options->lowmem=1;
       }
+      /* deferred_check */
+      else if(strncmp(*current_cmd,"deferred_check",14)==0)
+      {
+	(*current_cmd)+=14;
+	options->deferred_check=1;
+      }
+      /* verify_crc */
+      else if(strncmp(*current_cmd,"verify_crc",10)==0)
+      {
+	(*current_cmd)+=10;
+	options->verify_crc=1;
+      }
+      /* fast_forward */
+      else if(strncmp(*current_cmd,"fast_forward",12)==0)
+      {
+	(*current_cmd)+=12;
+	options->fast_forward=1;
+      }
+      /* index_only */
+      else if(strncmp(*current_cmd,"index_only",10)==0)
+      {
+	(*current_cmd)+=10;
+	options->index_only=1;
+      }
+      /* hash */
+      else if(strncmp(*current_cmd,"hash",4)==0)
+      {
+	(*current_cmd)+=4;
+	options->hash=1;
+      }
+      /* dedup */
+      else if(strncmp(*current_cmd,"dedup",5)==0)
+      {
+	(*current_cmd)+=5;
+	options->dedup=1;
+      }
       else
 	keep_asking=0;
     } while(keep_asking>0);
@@ -1195,11 +1384,17 @@ void interface_options_photorec(struct ph_options *options, char **current_cmd)
   /* write new options to log file */
   log_info("New options :\n Paranoid : %s\n", options->paranoid?"Yes":"No");
   log_info(" Brute force : %s\n", ((options->paranoid)>1?"Yes":"No"));
-  log_info(" Keep corrupted files : %s\n ext2/ext3 mode : %s\n Expert mode : %s\n Low memory : %s\n",
+  log_info(" Keep corrupted files : %s\n ext2/ext3 mode : %s\n Expert mode : %s\n Low memory : %s\n Deferred check : %s\n Verify CRC : %s\n Fast forward : %s\n Index only : %s\n Hash : %s\n Skip duplicates : %s\n",
       options->keep_corrupted_file?"Yes":"No",
       options->mode_ext2?"Yes":"No",
       options->expert?"Yes":"No",
-      options->lowmem?"Yes":"No");
+      options->lowmem?"Yes":"No",
+      options->deferred_check?"Yes":"No",
+      options->verify_crc?"Yes":"No",
+      options->fast_forward?"Yes":"No",
+      options->index_only?"Yes":"No",
+      options->hash?"Yes":"No",
+      options->dedup?"Yes":"No");
 }
 
 #ifdef HAVE_NCURSES
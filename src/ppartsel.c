@@ -236,13 +236,13 @@ void menu_photorec(struct ph_param *params, struct ph_options *options, alloc_da
 	if(mode_init_space==INIT_SPACE_EXT2_GROUP)
 	{
           alloc_data_t *new_free_space;
-          new_free_space=(alloc_data_t*)MALLOC(sizeof(*new_free_space));
+          new_free_space=(alloc_data_t*)pool_alloc(&alloc_data_pool);
           /* Temporary storage, values need to be multiplied by group size and aligned */
           new_free_space->start=groupnr;
           new_free_space->end=groupnr;
           new_free_space->file_stat=NULL;
           if(td_list_add_sorted_uniq(&new_free_space->list, &list_search_space->list, spacerange_cmp))
-	    free(new_free_space);
+	    pool_free(&alloc_data_pool, &new_free_space->list);
         }
       }
       else if(strncmp(params->cmd_run,"ext2_inode,",11)==0)
@@ -258,13 +258,13 @@ void menu_photorec(struct ph_param *params, struct ph_options *options, alloc_da
 	if(mode_init_space==INIT_SPACE_EXT2_INODE)
 	{
           alloc_data_t *new_free_space;
-          new_free_space=(alloc_data_t*)MALLOC(sizeof(*new_free_space));
+          new_free_space=(alloc_data_t*)pool_alloc(&alloc_data_pool);
           /* Temporary storage, values need to be multiplied by group size and aligned */
           new_free_space->start=inodenr;
           new_free_space->end=inodenr;
           new_free_space->file_stat=NULL;
           if(td_list_add_sorted_uniq(&new_free_space->list, &list_search_space->list, spacerange_cmp))
-	    free(new_free_space);
+	    pool_free(&alloc_data_pool, &new_free_space->list);
         }
       }
       else if(isdigit(params->cmd_run[0]))
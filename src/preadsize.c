@@ -0,0 +1,227 @@
+/*
+
+    File: preadsize.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#include <stdio.h>
+#include "types.h"
+#include "common.h"
+#include "filegen.h"
+#include "log.h"
+#include "photorec.h"
+#include "preadsize.h"
+
+#define READ_WINDOW_FILENAME	"photorec.rdw"
+/* Window used when no profile has been saved for the device */
+#define READ_WINDOW_DEFAULT	(1024*512)
+#define READ_WINDOW_MAX		(16*1024*1024)
+/* Number of reads between two estimations of the best window */
+#define READ_WINDOW_SAMPLES	16
+
+static unsigned int read_window_round(const unsigned int size, const unsigned int blocksize)
+{
+  return (size + blocksize - 1) / blocksize * blocksize;
+}
+
+static unsigned int read_window_clamp(const read_window_t *win, const unsigned int size)
+{
+  if(size < win->min_size)
+    return win->min_size;
+  if(size > win->max_size)
+    return win->max_size;
+  return size;
+}
+
+static unsigned int read_window_load(const read_window_t *win, const disk_t *disk)
+{
+  FILE *f;
+  char line[4096];
+  unsigned int size=0;
+  if(disk->device==NULL)
+    return 0;
+  f=fopen(win->filename, "r");
+  if(f==NULL)
+    return 0;
+  while(fgets(line, sizeof(line), f)!=NULL)
+  {
+    char *device;
+    const unsigned long int tmp=strtoul(line, &device, 10);
+    if(*device!=' ')
+      continue;
+    device++;
+    device[strcspn(device, "\r\n")]='\0';
+    if(strcmp(device, disk->device)==0)
+      size=tmp;
+  }
+  fclose(f);
+  return size;
+}
+
+void read_window_init(read_window_t *win, const disk_t *disk, const unsigned int blocksize, const char *recup_dir)
+{
+  const unsigned int header_end=header_check_max_offset();
+  unsigned int size;
+  win->blocksize=blocksize;
+  /* Header checks may look up to 64 KiB after the signature */
+  win->lookahead=(blocksize > 65536 ? blocksize : 65536);
+  if(win->lookahead < header_end)
+    win->lookahead=read_window_round(header_end, blocksize);
+  /* Each refill must move forward by at least lookahead bytes */
+  win->min_size=2 * win->lookahead;
+  win->max_size=read_window_round(READ_WINDOW_MAX, blocksize);
+  if(win->max_size < 4 * win->min_size)
+    win->max_size=4 * win->min_size;
+  photorec_dest_filename(win->filename, sizeof(win->filename), recup_dir, READ_WINDOW_FILENAME);
+  size=read_window_load(win, disk);
+  if(size==0)
+    size=READ_WINDOW_DEFAULT;
+  win->best_size=read_window_clamp(win, read_window_round(size, blocksize));
+  win->size=win->min_size;
+  win->nbr_samples=0;
+  win->sum_size=0;
+  win->sum_time=0;
+  win->sum_size2=0;
+  win->sum_size_time=0;
+}
+
+#ifdef HAVE_SYS_TIME_H
+/* The time to read s bytes is modeled by t = latency + s / throughput.
+ * The best window is the one where the latency costs about 1/8 of
+ * the transfer time. */
+static void read_window_update(read_window_t *win)
+{
+  const double n=win->nbr_samples;
+  const double det=n * win->sum_size2 - win->sum_size * win->sum_size;
+  double slope;
+  double latency;
+  unsigned int size;
+  if(det <= 0)
+    return ;
+  slope=(n * win->sum_size_time - win->sum_size * win->sum_time) / det;
+  latency=(win->sum_time - slope * win->sum_size) / n;
+  if(slope <= 0)
+    size=win->max_size;
+  else if(latency <= 0)
+    size=win->min_size;
+  else
+  {
+    const double target=8 * latency / slope;
+    for(size=win->min_size; size < win->max_size && size < target; size*=2);
+    size=read_window_clamp(win, size / win->blocksize * win->blocksize);
+  }
+  if(size!=win->best_size)
+    log_verbose("Read window: %u KiB (latency %.0f us, %.1f MB/s)\n",
+	size/1024, (latency > 0 ? latency : 0), (slope > 0 ? 1 / slope : 0));
+  win->best_size=size;
+  /* Keep half the weight of the previous samples */
+  win->nbr_samples/=2;
+  win->sum_size/=2;
+  win->sum_time/=2;
+  win->sum_size2/=2;
+  win->sum_size_time/=2;
+}
+#endif
+
+int read_window_pread(read_window_t *win, disk_t *disk, unsigned char *buffer, const uint64_t offset, const int sequential)
+{
+  int res;
+#ifdef HAVE_SYS_TIME_H
+  struct timeval start;
+  struct timeval end;
+#endif
+  if(sequential==0)
+    win->size=win->min_size;
+  else if(win->size < win->best_size)
+    win->size=(2 * win->size < win->best_size ? 2 * win->size : win->best_size);
+  else
+    win->size=win->best_size;
+#ifdef HAVE_SYS_TIME_H
+  gettimeofday(&start, NULL);
+#endif
+  res=disk->pread(disk, buffer, win->size, offset);
+#ifdef HAVE_SYS_TIME_H
+  gettimeofday(&end, NULL);
+  if(res==(int)win->size)
+  {
+    const double s=win->size;
+    const double t=(end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_usec - start.tv_usec);
+    win->nbr_samples++;
+    win->sum_size+=s;
+    win->sum_time+=t;
+    win->sum_size2+=s * s;
+    win->sum_size_time+=s * t;
+    if(win->nbr_samples >= READ_WINDOW_SAMPLES)
+      read_window_update(win);
+  }
+#endif
+  return res;
+}
+
+void read_window_save(const read_window_t *win, const disk_t *disk)
+{
+  FILE *f;
+  char line[4096];
+  char *other=NULL;
+  unsigned int other_size=0;
+  if(disk->device==NULL)
+    return ;
+  /* Keep the profiles of the other devices */
+  f=fopen(win->filename, "r");
+  if(f!=NULL)
+  {
+    while(fgets(line, sizeof(line), f)!=NULL)
+    {
+      const char *device=strchr(line, ' ');
+      const unsigned int len=strlen(line);
+      if(device==NULL ||
+	  (strncmp(device+1, disk->device, strlen(disk->device))==0 &&
+	   strchr("\r\n", device[1+strlen(disk->device)])!=NULL))
+	continue;
+      other=(char *)realloc(other, other_size + len + 1);
+      memcpy(other + other_size, line, len + 1);
+      other_size+=len;
+    }
+    fclose(f);
+  }
+  f=fopen(win->filename, "w");
+  if(f==NULL)
+  {
+    free(other);
+    return ;
+  }
+  if(other!=NULL)
+    fputs(other, f);
+  fprintf(f, "%u %s\n", win->best_size, disk->device);
+  fclose(f);
+  free(other);
+}
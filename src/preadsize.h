@@ -0,0 +1,57 @@
+/*
+
+    File: preadsize.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+  unsigned int blocksize;
+  unsigned int lookahead;	/* data needed after the current block by the header checks */
+  unsigned int min_size;	/* window used after a jump */
+  unsigned int max_size;
+  unsigned int best_size;	/* window used for sequential reads */
+  unsigned int size;		/* size of the last read */
+  char filename[2048];		/* profiles of the devices, next to recup_dir.N */
+  /* pread() timings, used to estimate the latency and the throughput */
+  unsigned int nbr_samples;
+  double sum_size;
+  double sum_time;
+  double sum_size2;
+  double sum_size_time;
+} read_window_t;
+
+/* Set the window sizes, best_size comes from the profile saved for this device */
+void read_window_init(read_window_t *win, const disk_t *disk, const unsigned int blocksize, const char *recup_dir);
+
+/* Read the window at offset, buffer must hold max_size bytes.
+ * After a jump (sequential==0), a small window is read, it grows
+ * up to best_size while the reads are sequential.
+ * Return the pread() result, the window size is in win->size */
+int read_window_pread(read_window_t *win, disk_t *disk, unsigned char *buffer, const uint64_t offset, const int sequential);
+
+/* Save best_size as the profile of this device */
+void read_window_save(const read_window_t *win, const disk_t *disk);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
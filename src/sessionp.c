@@ -143,7 +143,7 @@ int session_load(char **cmd_device, char **current_cmd, alloc_data_t *list_free_
     if(start <= end)
     {
       alloc_data_t *new_free_space;
-      new_free_space=(alloc_data_t*)MALLOC(sizeof(*new_free_space));
+      new_free_space=(alloc_data_t*)pool_alloc(&alloc_data_pool);
       /* Temporary storage, values need to be multiplied by sector_size */
       new_free_space->start=start;
       new_free_space->end=end;
@@ -247,6 +247,18 @@ int session_save(alloc_data_t *list_free_space, struct ph_param *params,  const
       fprintf(f_session, "expert,");
     if(options->lowmem>0)
       fprintf(f_session, "lowmem,");
+    if(options->deferred_check>0)
+      fprintf(f_session, "deferred_check,");
+    if(options->verify_crc>0)
+      fprintf(f_session, "verify_crc,");
+    if(options->fast_forward>0)
+      fprintf(f_session, "fast_forward,");
+    if(options->index_only>0)
+      fprintf(f_session, "index_only,");
+    if(options->hash>0)
+      fprintf(f_session, "hash,");
+    if(options->dedup>0)
+      fprintf(f_session, "dedup,");
     /* Save options - End */
     if(carve_free_space_only>0)
       fprintf(f_session,"freespace,");
@@ -2,7 +2,6 @@
 
     File: suspend.c
     A suspending/resuming memory manager for libjpeg
-    NOT COMPATIBLE WITH libjpeg-turbo
 
     Copyright (C) 2009 Christophe GRENIER <grenier@cgsecurity.org>
     Copyright (C) 2008 Michael Cohen <scudette@users.sourceforge.net>, part of pyflag
@@ -36,10 +35,19 @@
 #include <string.h>
 #endif
 
-// This should be large enough to handle most memory requests. On
-// linux it can be rediculously large because the system will only
-// actually allocate the memory when we write on it.
-#define POOL_SIZE 4 * 1024 * 1024
+/* All the memory of a decoder is allocated from a pool attached by the
+ * caller through cinfo->client_data, see jpeg_pool_new().
+ * The pool is kept between decoders, so the same thread doesn't ask the
+ * system for memory for each picture.
+ * A pool is made of chunks; suspend_memory() copies the used part of each
+ * chunk to its shadow, resume_memory() copies it back: the decoder
+ * continues from the state it had when suspended. */
+#define POOL_SIZE	(4 * 1024 * 1024)
+/* Chunks kept when a new decoder starts */
+#define POOL_KEEP	(4 * POOL_SIZE)
+/* libjpeg-turbo SIMD code needs 32-byte aligned buffers */
+#define POOL_ALIGN	32
+#define POOL_MAGIC	0x4a504f4cU
 
 #define AM_MEMORY_MANAGER	/* we define jvirt_Xarray_control structs */
 #ifdef HAVE_JPEGLIB_H
@@ -56,7 +64,30 @@ typedef int boolean;
 #include "log.h"
 
 #if defined(HAVE_LIBJPEG) && defined(HAVE_JPEGLIB_H)
-static void *alloc_small(j_common_ptr cinfo, int pool_id, size_t sizeofobject);
+#include "jerror.h"
+#include "suspend.h"
+
+typedef struct pool_chunk_struct pool_chunk_t;
+struct pool_chunk_struct
+{
+  pool_chunk_t *next;
+  char *base;			/* as returned by malloc() */
+  char *data;			/* aligned on POOL_ALIGN */
+  char *shadow;
+  size_t size;
+  size_t used;
+  size_t used_shadow;
+};
+
+struct jpeg_pool_struct
+{
+  unsigned int magic;
+  pool_chunk_t *chunks;
+  pool_chunk_t *current;	/* next chunks are unused */
+  pool_chunk_t *current_shadow;
+  int shadow_ok;
+  int owned;			/* freed with the decoder */
+};
 
 struct my_memory_mgr {
   struct jpeg_memory_mgr pub;	/* public fields */
@@ -66,22 +97,10 @@ struct my_memory_mgr {
   jvirt_barray_ptr virt_barray_list;
   JDIMENSION last_rowsperchunk;	/* from most recent alloc_sarray/barray */
 
-  // All memory is allocated to this pool.
-  char *pool;
-  char *shadow_pool;
-
-  // A highwater mark for pool allocations
-  long pool_size;
-
-  // This is the very end of the allocated pool.
-  long total_space_allocated;
-  long total_space_shadowed;
-
+  jpeg_pool_t *pool;
 };
 
 typedef struct my_memory_mgr *my_mem_ptr;
-#include "jerror.h"
-#include "suspend.h"
 
 #ifndef ALIGN_TYPE		/* so can override from jconfig.h */
 #define ALIGN_TYPE  double
@@ -130,35 +149,151 @@ struct jvirt_barray_control {
   jvirt_barray_ptr next;	/* link to next virtual barray control block */
 };
 
-static void *alloc_small (j_common_ptr cinfo, int pool_id, size_t sizeofobject) {
-  struct my_memory_mgr *self = (struct my_memory_mgr *)(cinfo->mem);
-  char *obj_ptr = self->pool + self->total_space_allocated;
+static pool_chunk_t *pool_chunk_new(const size_t size)
+{
+  pool_chunk_t *chunk=(pool_chunk_t *)malloc(sizeof(*chunk));
+  if(chunk==NULL)
+    return NULL;
+  chunk->base=(char *)malloc(size + POOL_ALIGN);
+  if(chunk->base==NULL)
+  {
+    free(chunk);
+    return NULL;
+  }
+  chunk->data=chunk->base + (POOL_ALIGN - ((size_t)chunk->base % POOL_ALIGN)) % POOL_ALIGN;
+  chunk->shadow=NULL;
+  chunk->size=size;
+  chunk->used=0;
+  chunk->used_shadow=0;
+  chunk->next=NULL;
+  return chunk;
+}
 
-  //  log_info("allocating %u bytes\n", sizeofobject);
+static void pool_chunk_free(pool_chunk_t *chunk)
+{
+  free(chunk->base);
+  free(chunk->shadow);
+  free(chunk);
+}
+
+jpeg_pool_t *jpeg_pool_new(void)
+{
+  jpeg_pool_t *pool=(jpeg_pool_t *)MALLOC(sizeof(*pool));
+  pool->magic=POOL_MAGIC;
+  pool->chunks=NULL;
+  pool->current=NULL;
+  pool->current_shadow=NULL;
+  pool->shadow_ok=0;
+  pool->owned=0;
+  return pool;
+}
 
-  self->total_space_allocated += sizeofobject;
-  if(self->total_space_allocated > self->pool_size)
+void jpeg_pool_free(jpeg_pool_t *pool)
+{
+  if(pool==NULL)
+    return ;
+  while(pool->chunks!=NULL)
   {
-    log_critical("suspend.c: no memory left\n");
-    return NULL;
+    pool_chunk_t *next=pool->chunks->next;
+    pool_chunk_free(pool->chunks);
+    pool->chunks=next;
+  }
+  pool->magic=0;
+  free(pool);
+}
+
+/* Forget the previous decoder, only the first chunks are kept */
+static void jpeg_pool_reset(jpeg_pool_t *pool)
+{
+  pool_chunk_t **prev=&pool->chunks;
+  size_t kept=0;
+  while(*prev!=NULL)
+  {
+    pool_chunk_t *chunk=*prev;
+    if(kept + chunk->size > POOL_KEEP && kept > 0)
+    {
+      *prev=chunk->next;
+      pool_chunk_free(chunk);
+    }
+    else
+    {
+      kept+=chunk->size;
+      chunk->used=0;
+      prev=&chunk->next;
+    }
+  }
+  pool->current=pool->chunks;
+  pool->shadow_ok=0;
+}
+
+static void *pool_alloc(jpeg_pool_t *pool, size_t size)
+{
+  pool_chunk_t *chunk;
+  void *obj_ptr;
+  size=(size + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+  for(chunk=pool->current;
+      chunk!=NULL && chunk->used + size > chunk->size;
+      chunk=chunk->next);
+  if(chunk==NULL)
+  {
+    pool_chunk_t **prev;
+    chunk=pool_chunk_new(size > POOL_SIZE ? size : POOL_SIZE);
+    if(chunk==NULL)
+      return NULL;
+    for(prev=&pool->chunks; *prev!=NULL; prev=&(*prev)->next);
+    *prev=chunk;
   }
+  pool->current=chunk;
+  obj_ptr=chunk->data + chunk->used;
+  chunk->used+=size;
+  return obj_ptr;
+}
 
+static jpeg_pool_t *cinfo_pool(j_common_ptr cinfo)
+{
+  jpeg_pool_t *pool=(jpeg_pool_t *)cinfo->client_data;
+  if(pool==NULL || pool->magic!=POOL_MAGIC)
+    return NULL;
+  return pool;
+}
+
+static void *alloc_small (j_common_ptr cinfo, int pool_id, size_t sizeofobject) {
+  struct my_memory_mgr *self = (struct my_memory_mgr *)(cinfo->mem);
+  void *obj_ptr=pool_alloc(self->pool, sizeofobject);
+  (void)pool_id;
+  if(obj_ptr==NULL)
+    ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
   return obj_ptr;
 }
 
 METHODDEF(JSAMPARRAY) alloc_sarray (j_common_ptr cinfo, int pool_id, 
 				    JDIMENSION samplesperrow, JDIMENSION numrows) {
+  my_mem_ptr mem = (my_mem_ptr) cinfo->mem;
+  /* libjpeg-turbo may access the samples up to the alignment */
+  const size_t row_size=((size_t)samplesperrow * SIZEOF(JSAMPLE) + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
   JSAMPARRAY result;
   JDIMENSION i;
   result = (JSAMPARRAY) alloc_small(cinfo, pool_id, (size_t) (numrows * SIZEOF(JSAMPROW)));
-  
   for(i=0; i<numrows; i++) {
-    result[i] = (JSAMPROW) alloc_small(cinfo, pool_id, 
-				       (size_t) ((size_t) samplesperrow * SIZEOF(JSAMPLE)));
+    result[i] = (JSAMPROW) alloc_small(cinfo, pool_id, row_size);
   }
+  mem->last_rowsperchunk = numrows;
   return result;
 }
 
+METHODDEF(JBLOCKARRAY) alloc_barray (j_common_ptr cinfo, int pool_id,
+				     JDIMENSION blocksperrow, JDIMENSION numrows) {
+  my_mem_ptr mem = (my_mem_ptr) cinfo->mem;
+  JBLOCKARRAY result;
+  JDIMENSION i;
+  result = (JBLOCKARRAY) alloc_small(cinfo, pool_id, (size_t) (numrows * SIZEOF(JBLOCKROW)));
+  for(i=0; i<numrows; i++) {
+    result[i] = (JBLOCKROW) alloc_small(cinfo, pool_id,
+					(size_t) blocksperrow * SIZEOF(JBLOCK));
+  }
+  mem->last_rowsperchunk = numrows;
+  return result;
+}
 
 METHODDEF(jvirt_sarray_ptr) request_virt_sarray (j_common_ptr cinfo, int pool_id, boolean pre_zero,
 						 JDIMENSION samplesperrow, JDIMENSION numrows,
@@ -177,48 +312,43 @@ METHODDEF(jvirt_sarray_ptr) request_virt_sarray (j_common_ptr cinfo, int pool_id
   result->next = mem->virt_sarray_list;
   mem->virt_sarray_list = result;  
   return result;
-};
+}
+
+METHODDEF(jvirt_barray_ptr) request_virt_barray (j_common_ptr cinfo, int pool_id, boolean pre_zero,
+						 JDIMENSION blocksperrow, JDIMENSION numrows,
+						 JDIMENSION maxaccess) {
+  my_mem_ptr mem = (my_mem_ptr) cinfo->mem;
+  jvirt_barray_ptr result;
+
+  result = (jvirt_barray_ptr) alloc_small(cinfo, pool_id,
+					  SIZEOF(struct jvirt_barray_control));
+  result->mem_buffer = NULL;
+  result->rows_in_array = numrows;
+  result->blocksperrow = blocksperrow;
+  result->maxaccess = maxaccess;
+  result->pre_zero = pre_zero;
+  result->b_s_open = FALSE;
+  result->next = mem->virt_barray_list;
+  mem->virt_barray_list = result;
+  return result;
+}
 
+/* The whole virtual arrays are kept in memory, there is no backing store */
 METHODDEF(void) realize_virt_arrays (j_common_ptr cinfo) {
   my_mem_ptr mem = (my_mem_ptr) cinfo->mem;
-  long space_per_minheight, maximum_space, avail_mem;
-  long minheights, max_minheights;
   jvirt_sarray_ptr sptr;
   jvirt_barray_ptr bptr;
   
-  space_per_minheight = 0;
-  maximum_space = 0;
-  for (sptr = mem->virt_sarray_list; sptr != NULL; sptr = sptr->next) {
-    if (sptr->mem_buffer == NULL) { /* if not realized yet */
-      space_per_minheight += (long) sptr->maxaccess *
-	(long) sptr->samplesperrow * SIZEOF(JSAMPLE);
-      maximum_space += (long) sptr->rows_in_array *
-	(long) sptr->samplesperrow * SIZEOF(JSAMPLE);
-    }
-  }
-  for (bptr = mem->virt_barray_list; bptr != NULL; bptr = bptr->next) {
-    if (bptr->mem_buffer == NULL) { /* if not realized yet */
-      space_per_minheight += (long) bptr->maxaccess *
-	(long) bptr->blocksperrow * SIZEOF(JBLOCK);
-      maximum_space += (long) bptr->rows_in_array *
-	(long) bptr->blocksperrow * SIZEOF(JBLOCK);
-    }
-  }
-  
-  if (space_per_minheight <= 0)
-    return;			/* no unrealized arrays, no work */
-  
-  /* Determine amount of memory to actually use */
-  avail_mem = maximum_space;
-  max_minheights = 1000000000L;
-  
-  /* Allocate the in-memory buffers and initialize backing store as needed. */
   for (sptr = mem->virt_sarray_list; sptr != NULL; sptr = sptr->next) {
     if (sptr->mem_buffer == NULL) { /* if not realized yet */
-      minheights = ((long) sptr->rows_in_array - 1L) / sptr->maxaccess + 1L;
       sptr->rows_in_mem = sptr->rows_in_array;
       sptr->mem_buffer = alloc_sarray(cinfo, JPOOL_IMAGE,
 				      sptr->samplesperrow, sptr->rows_in_mem);
+      if (sptr->pre_zero) {
+	JDIMENSION i;
+	for (i = 0; i < sptr->rows_in_mem; i++)
+	  memset(sptr->mem_buffer[i], 0, (size_t) sptr->samplesperrow * SIZEOF(JSAMPLE));
+      }
       sptr->rowsperchunk = mem->last_rowsperchunk;
       sptr->cur_start_row = 0;
       sptr->first_undef_row = 0;
@@ -228,10 +358,15 @@ METHODDEF(void) realize_virt_arrays (j_common_ptr cinfo) {
   
   for (bptr = mem->virt_barray_list; bptr != NULL; bptr = bptr->next) {
     if (bptr->mem_buffer == NULL) { /* if not realized yet */
-      minheights = ((long) bptr->rows_in_array - 1L) / bptr->maxaccess + 1L;
       bptr->rows_in_mem = bptr->rows_in_array;
-      bptr->mem_buffer = (JBLOCKARRAY)alloc_sarray(cinfo, JPOOL_IMAGE,
+      bptr->mem_buffer = alloc_barray(cinfo, JPOOL_IMAGE,
 				      bptr->blocksperrow, bptr->rows_in_mem);
+      /* progressive decoding needs zeroed coefficients */
+      if (bptr->pre_zero) {
+	JDIMENSION i;
+	for (i = 0; i < bptr->rows_in_mem; i++)
+	  memset(bptr->mem_buffer[i], 0, (size_t) bptr->blocksperrow * SIZEOF(JBLOCK));
+      }
       bptr->rowsperchunk = mem->last_rowsperchunk;
       bptr->cur_start_row = 0;
       bptr->first_undef_row = 0;
@@ -243,78 +378,113 @@ METHODDEF(void) realize_virt_arrays (j_common_ptr cinfo) {
 METHODDEF(JSAMPARRAY) access_virt_sarray (j_common_ptr cinfo, jvirt_sarray_ptr ptr,
 					  JDIMENSION start_row, JDIMENSION num_rows,
 					  boolean writable) {  
+  (void)cinfo;
+  (void)num_rows;
+  if (writable)
+    ptr->dirty = TRUE;
+  return ptr->mem_buffer + (start_row - ptr->cur_start_row);
+}
+
+METHODDEF(JBLOCKARRAY) access_virt_barray (j_common_ptr cinfo, jvirt_barray_ptr ptr,
+					   JDIMENSION start_row, JDIMENSION num_rows,
+					   boolean writable) {
+  (void)cinfo;
+  (void)num_rows;
   if (writable)
     ptr->dirty = TRUE;
   return ptr->mem_buffer + (start_row - ptr->cur_start_row);
 }
 
 METHODDEF(void) free_pool (j_common_ptr cinfo, int pool_id) {
-  struct my_memory_mgr *self = (struct my_memory_mgr *)(cinfo->mem);
-  //  log_info("Freeing pool\n");
-  //  self->total_space_allocated = 0;
+  /* Memory is reused when the next decoder starts */
+  (void)cinfo;
+  (void)pool_id;
 }
 
 METHODDEF(void) self_destruct (j_common_ptr cinfo) {
   struct my_memory_mgr *self = (struct my_memory_mgr *)(cinfo->mem);
-  //log_info("Destroying pool\n");
-  //free(self->pool);
-  //free(self->shadow_pool);
+  if(self->pool->owned)
+    jpeg_pool_free(self->pool);
+  cinfo->mem = NULL;
 }
 
 void suspend_memory(j_common_ptr cinfo) {
-  struct my_memory_mgr *self = (struct my_memory_mgr *)(cinfo->mem);
-  
-//  log_info("Suspending at sector %u\n", sector);
-  memcpy(self->shadow_pool, self->pool, self->total_space_allocated);
-  self->total_space_shadowed = self->total_space_allocated;
-};
+  jpeg_pool_t *pool=cinfo_pool(cinfo);
+  pool_chunk_t *chunk;
+  if(pool==NULL || cinfo->mem==NULL || cinfo->mem->self_destruct!=self_destruct)
+    return ;
+  pool->shadow_ok=0;
+  for(chunk=pool->chunks; chunk!=NULL; chunk=chunk->next)
+  {
+    if(chunk->shadow==NULL && chunk->used > 0)
+    {
+      chunk->shadow=(char *)malloc(chunk->size);
+      if(chunk->shadow==NULL)
+	return ;
+    }
+    if(chunk->used > 0)
+      memcpy(chunk->shadow, chunk->data, chunk->used);
+    chunk->used_shadow=chunk->used;
+  }
+  pool->current_shadow=pool->current;
+  pool->shadow_ok=1;
+}
 
+/* resume_memory()
+ * cinfo must have been restored to its value when suspend_memory() was called
+ * @returns 0 on success, -1 if there is nothing to resume from */
 int resume_memory(j_common_ptr cinfo)
 {
-  struct my_memory_mgr *self = (struct my_memory_mgr *)(cinfo->mem);
-//  log_info("Resuming from sector %u (copying %lu bytes)\n", self->sector, self->total_space_shadowed);
-  memcpy(self->pool, self->shadow_pool, self->total_space_shadowed);
-  self->total_space_allocated = self->total_space_shadowed;
+  jpeg_pool_t *pool=cinfo_pool(cinfo);
+  pool_chunk_t *chunk;
+  if(pool==NULL || pool->shadow_ok==0)
+    return -1;
+  for(chunk=pool->chunks; chunk!=NULL; chunk=chunk->next)
+  {
+    if(chunk->used_shadow > 0)
+      memcpy(chunk->data, chunk->shadow, chunk->used_shadow);
+    chunk->used=chunk->used_shadow;
+  }
+  pool->current=pool->current_shadow;
   return 0;
-};
+}
 
 GLOBAL(void) jinit_memory_mgr (j_common_ptr cinfo);
 GLOBAL(void) jinit_memory_mgr (j_common_ptr cinfo)
 {
-  static my_mem_ptr mem=NULL;
-  long max_to_use;
-  size_t test_mac;
+  jpeg_pool_t *pool=cinfo_pool(cinfo);
+  my_mem_ptr mem;
   
   cinfo->mem = NULL;
   if ((SIZEOF(ALIGN_TYPE) & (SIZEOF(ALIGN_TYPE)-1)) != 0)
     ERREXIT(cinfo, JERR_BAD_ALIGN_TYPE);
-  test_mac = (size_t) MAX_ALLOC_CHUNK;
-  if ((long) test_mac != MAX_ALLOC_CHUNK ||
-      (MAX_ALLOC_CHUNK % SIZEOF(ALIGN_TYPE)) != 0)
-    ERREXIT(cinfo, JERR_BAD_ALLOC_CHUNK);
-
-  max_to_use = 0;
+  if(pool==NULL)
+  {
+    /* The decoder isn't one of ours, it gets its own pool */
+    pool=jpeg_pool_new();
+    pool->owned=1;
+  }
+  jpeg_pool_reset(pool);
+  mem = (my_mem_ptr)pool_alloc(pool, sizeof(struct my_memory_mgr));
   if(mem == NULL)
-    mem = (struct my_memory_mgr *)MALLOC(sizeof(struct my_memory_mgr));
-
-  // Prepare our memory pools:
-  if(mem->pool == NULL)
-    mem->pool = (char *)MALLOC(POOL_SIZE);
-  if(mem->shadow_pool == NULL)
-    mem->shadow_pool = (char *)MALLOC(POOL_SIZE);
-  mem->pool_size = POOL_SIZE;
+  {
+    if(pool->owned)
+      jpeg_pool_free(pool);
+    ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
+  }
+  mem->pool = pool;
 
   /* OK, fill in the method pointers */
   mem->pub.alloc_small = alloc_small;
   mem->pub.alloc_large = alloc_small;
   mem->pub.alloc_sarray = alloc_sarray;
-  mem->pub.alloc_barray = alloc_sarray;
+  mem->pub.alloc_barray = alloc_barray;
 
   mem->pub.request_virt_sarray = request_virt_sarray;
-  mem->pub.request_virt_barray = request_virt_sarray;
+  mem->pub.request_virt_barray = request_virt_barray;
   mem->pub.realize_virt_arrays = realize_virt_arrays;
   mem->pub.access_virt_sarray = access_virt_sarray;
-  mem->pub.access_virt_barray = access_virt_sarray;
+  mem->pub.access_virt_barray = access_virt_barray;
   mem->pub.free_pool = free_pool;
   mem->pub.self_destruct = self_destruct;
 
@@ -322,10 +492,10 @@ GLOBAL(void) jinit_memory_mgr (j_common_ptr cinfo)
   mem->pub.max_alloc_chunk = MAX_ALLOC_CHUNK;
   
   /* Initialize working state */
-  mem->pub.max_memory_to_use = max_to_use;
+  mem->pub.max_memory_to_use = 0;
   mem->virt_sarray_list = NULL;
   mem->virt_barray_list = NULL;
-  mem->total_space_allocated = SIZEOF(struct my_memory_mgr);
+  mem->last_rowsperchunk = 0;
 
   /* Declare ourselves open for business */
   cinfo->mem = & mem->pub;
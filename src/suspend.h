@@ -1,2 +1,40 @@
+/*
+
+    File: suspend.h
+
+    Copyright (C) 2012 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct jpeg_pool_struct jpeg_pool_t;
+
+/* jpeg_pool_new()
+ * Memory of the decoders created with cinfo->client_data pointing to this
+ * pool is allocated from it. It's reused by the next decoder, a pool must
+ * only be used by one decoder at a time. */
+jpeg_pool_t *jpeg_pool_new(void);
+void jpeg_pool_free(jpeg_pool_t *pool);
+
 void suspend_memory(j_common_ptr cinfo);
 int resume_memory(j_common_ptr cinfo);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
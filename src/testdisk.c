@@ -56,6 +56,7 @@
 #include "rfs_dir.h"
 #include "ntfs_dir.h"
 #include "hdcache.h"
+#include "hdthrottle.h"
 #include "ewf.h"
 #include "log.h"
 #include "hdaccess.h"
@@ -74,10 +75,9 @@ static void sighup_hdlr(int sig);
 static void sighup_hdlr(int sig)
 {
   if(sig == SIGINT)
-    log_critical("SIGINT detected! TestDisk has been killed.\n");
+    log_emergency_flush("SIGINT detected! TestDisk has been killed.\n");
   else
-    log_critical("SIGHUP detected! TestDisk has been killed.\n");
-  log_flush();
+    log_emergency_flush("SIGHUP detected! TestDisk has been killed.\n");
   action.sa_handler=SIG_DFL;
   sigaction(sig,&action,NULL);
   kill(0, sig);
@@ -158,6 +158,14 @@ int main( int argc, char **argv )
       create_backup=1;
     else if((strcmp(argv[i],"/direct")==0) || (strcmp(argv[i],"-direct")==0))
       testdisk_mode|=TESTDISK_O_DIRECT;
+    else if(((strcmp(argv[i],"/throttle")==0) || (strcmp(argv[i],"-throttle")==0)) && (i+1<argc))
+    {
+      if(throttle_set(argv[++i])<0)
+      {
+	printf("\nInvalid throttle parameters %s\n", argv[i]);
+	help=1;
+      }
+    }
     else if((strcmp(argv[i],"/help")==0) || (strcmp(argv[i],"-help")==0) || (strcmp(argv[i],"--help")==0) ||
       (strcmp(argv[i],"/h")==0) || (strcmp(argv[i],"-h")==0) ||
       (strcmp(argv[i],"/?")==0) || (strcmp(argv[i],"-?")==0))
@@ -225,13 +233,15 @@ int main( int argc, char **argv )
   if(help!=0)
   {
     printf("\n" \
-	"Usage: testdisk [/log] [/debug] [file.dd|file.e01|device]\n"\
+	"Usage: testdisk [/log] [/debug] [/throttle limits] [file.dd|file.e01|device]\n"\
 	"       testdisk /list  [/log]   [file.dd|file.e01|device]\n" \
 	"       testdisk /version\n" \
 	"\n" \
 	"/log          : create a testdisk.log file\n" \
 	"/debug        : add debug information\n" \
 	"/list         : display current partitions\n" \
+	"/throttle     : limit the disk reads and writes, ie\n" \
+	"                read=50M,read_burst=8M,read_iops=200,write=1M,adaptive\n" \
 	"\n" \
 	"TestDisk checks and recovers lost partitions\n" \
 	"It works with :\n" \
@@ -260,7 +270,7 @@ int main( int argc, char **argv )
       list_disk=hd_parse(list_disk, verbose, testdisk_mode);
     /* Activate the cache */
     for(element_disk=list_disk;element_disk!=NULL;element_disk=element_disk->next)
-      element_disk->disk=new_diskcache(element_disk->disk,testdisk_mode);
+      element_disk->disk=new_diskcache(new_diskthrottle(element_disk->disk),testdisk_mode);
     if(safe==0)
       hd_update_all_geometry(list_disk, verbose);
     for(element_disk=list_disk;element_disk!=NULL;element_disk=element_disk->next)
@@ -386,7 +396,7 @@ int main( int argc, char **argv )
     list_disk=hd_parse(list_disk, verbose, testdisk_mode);
   /* Activate the cache */
   for(element_disk=list_disk;element_disk!=NULL;element_disk=element_disk->next)
-    element_disk->disk=new_diskcache(element_disk->disk,testdisk_mode);
+    element_disk->disk=new_diskcache(new_diskthrottle(element_disk->disk),testdisk_mode);
 #ifdef HAVE_NCURSES
   wmove(stdscr,6,0);
   for(element_disk=list_disk;element_disk!=NULL;element_disk=element_disk->next)